@@ -0,0 +1,22 @@
+#pragma once
+
+#include <time.h>
+
+// The benchmarks are programs of their own linked with everything but main.c (make bench),
+// they print what they measured and never fail
+
+// Seconds on a monotonic clock, only the differences mean anything
+static inline double bench_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+// Runs the statement until at least min_time seconds have passed, returns the seconds per run
+#define BENCH_RUN(min_time, stmt) ({ \
+    size_t _runs = 0; \
+    const double _start = bench_now(); \
+    double _elapsed; \
+    do { stmt; _runs++; } while ((_elapsed = bench_now()-_start) < (min_time)); \
+    _elapsed/_runs; \
+})
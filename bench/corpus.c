@@ -0,0 +1,61 @@
+// Writes a .jps script of random func, graph, var and calc commands to stdout,
+// the input of the lexer benchmark : corpus [number of commands] > corpus.jps
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CORPUS_MAXDEPTH 6 // of the generated expressions, the lines stay under the console's limit
+
+// The same corpus every time, it doesn't depend on the libc rand()
+static unsigned long long state = 0x5EEDULL;
+
+static unsigned next(unsigned n) {
+    state = state*6364136223846793005ULL + 1442695040888963407ULL;
+    return (unsigned)(state >> 33) % n;
+}
+
+static const char* const funcs[] = {"sin", "cos", "tan", "exp", "log", "sqrt", "abs"};
+static const char* const opers[] = {" + ", " - ", "*", "/", "^", " mod "};
+static const char* const names[] = {"x", "a", "b", "pi", "e", "k1", "rate"};
+
+static void expression(unsigned depth) {
+    const unsigned kind = depth >= CORPUS_MAXDEPTH ? next(2) : next(6);
+
+    switch (kind) {
+        case 0 : printf("%u.%u", next(100), next(1000)); break;
+        case 1 : printf("%s", names[next(sizeof(names)/sizeof(*names))]); break;
+        case 2 : case 3 :
+            expression(depth+1);
+            printf("%s", opers[next(sizeof(opers)/sizeof(*opers))]);
+            expression(depth+1);
+        break;
+        case 4 :
+            printf("%s(", funcs[next(sizeof(funcs)/sizeof(*funcs))]);
+            expression(depth+1);
+            printf(")");
+        break;
+        default :
+            printf(next(2) ? "(" : "-(");
+            expression(depth+1);
+            printf(")");
+        break;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const unsigned count = argc > 1 ? (unsigned)atoi(argv[1]) : 10000;
+
+    for (unsigned i = 0; i < count; i++) {
+        switch (next(4)) {
+            case 0 : printf("func f%u = ", i); break;
+            case 1 : printf("graph g%u = ", i); break;
+            case 2 : printf("var v%u = ", i); break;
+            default : printf("calc "); break;
+        }
+
+        expression(next(3));
+        printf("\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,80 @@
+// The cost of graphing in double-double (deep zoom) against plain doubles, in ns per sample
+
+#include "bench.h"
+#include "ddouble.h"
+#include "parser.h"
+#include "compiler.h" // formula_free
+#include "objects.h"
+#include "console.h" // settings
+
+#include <stdio.h>
+
+#define DD_MINTIME 0.5
+#define DD_WIDTH 1e-13 // of the zoomed in camera around x = 1, doubles can't tell the pixels apart there
+
+static const char* const expressions[] = {
+    "x^3-2*x+1",
+    "sin(x)*x^2+exp(x)/3",
+    "sqrt(x)+log(x)*cos(3*x)",
+};
+
+// the samples of a zoomed in graph that land on distinct y values
+static size_t distinct(const double* ys, size_t n) {
+    size_t count = 1;
+    for (size_t i = 1; i < n; i++) count += ys[i] != ys[i-1];
+    return count;
+}
+
+int main() {
+    static double xs[SET_MAXLENGTH], ys[SET_MAXLENGTH];
+    static ddouble xs_dd[SET_MAXLENGTH], ys_dd[SET_MAXLENGTH];
+    const size_t n = SET_MAXLENGTH;
+
+    objects_init();
+
+    for (size_t i = 0; i < n; i++) {
+        xs[i] = 1 + (double)i/n;
+        xs_dd[i] = (ddouble){xs[i], 0.0};
+    }
+
+    printf("dd : %lu samples, ns per sample\n", n);
+    printf("    %-26s %8s %8s %14s %8s\n", "expression", "jit", "double", "double-double", "ratio");
+
+    for (size_t e = 0; e < sizeof(expressions)/sizeof(*expressions); e++) {
+        formula_s formula = lex(expressions[e]);
+
+        settings.jit = 1;
+        compute_batch(&formula, xs, ys, n);
+        const double jit = BENCH_RUN(DD_MINTIME, compute_batch(&formula, xs, ys, n));
+
+        settings.jit = 0;
+        object_generation++; // recompiled without the JIT
+        compute_batch(&formula, xs, ys, n);
+        const double plain = BENCH_RUN(DD_MINTIME, compute_batch(&formula, xs, ys, n));
+
+        const double deep = BENCH_RUN(DD_MINTIME, compute_batch_dd(&formula, xs_dd, ys_dd, n));
+
+        printf("    %-26s %8.1f %8.1f %14.1f %7.0fx\n", expressions[e], jit/n*1e9, plain/n*1e9, deep/n*1e9, deep/plain);
+        settings.jit = 1;
+        object_generation++;
+        formula_free(&formula);
+    }
+
+    // what the time buys, the staircase doubles draw at that zoom
+    formula_s formula = lex(expressions[0]);
+    for (size_t i = 0; i < n; i++) {
+        xs_dd[i] = dd_add_d((ddouble){1.0, 0.0}, i*(DD_WIDTH/n));
+        xs[i] = xs_dd[i].hi;
+    }
+    compute_batch(&formula, xs, ys, n);
+    compute_batch_dd(&formula, xs_dd, ys_dd, n);
+    for (size_t i = 0; i < n; i++) ys[i] = ys_dd[i].hi;
+    const size_t deep = distinct(ys, n);
+    compute_batch(&formula, xs, ys, n);
+    printf("    %s over a width of %g around 1 : %lu distinct y in double, %lu in double-double\n",
+        expressions[0], DD_WIDTH, distinct(ys, n), deep);
+    formula_free(&formula);
+
+    objects_destroy();
+    return 0;
+}
@@ -0,0 +1,64 @@
+// Lexes every formula of a .jps script over and over, the lexer's throughput : lex [script]
+
+#include "bench.h"
+#include "parser.h"
+#include "compiler.h" // formula_free
+#include "objects.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LEX_MINTIME 1.0
+
+int main(int argc, char* argv[]) {
+    FILE* file = fopen(argc > 1 ? argv[1] : "./bin/bench/corpus.jps", "r");
+    if (file == NULL) {
+        printf("the script can't be opened\n");
+        return 1;
+    }
+
+    // the formulas are whatever follows the '=' of the definitions, or the command name of calc
+    char** formulas = NULL;
+    size_t numformulas = 0, bytes = 0;
+    char line[1024];
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        const char* formula = strchr(line, '=');
+        if (formula != NULL) formula++;
+        else if (strncmp(line, "calc ", 5) == 0) formula = line+5;
+        else continue;
+
+        formulas = realloc(formulas, (numformulas+1)*sizeof(char*));
+        formulas[numformulas++] = strdup(formula);
+        bytes += strlen(formula);
+    }
+    fclose(file);
+
+    objects_init();
+
+    size_t tokens = 0, failed = 0;
+    for (size_t i = 0; i < numformulas; i++) {
+        formula_s formula = lex(formulas[i]);
+        if (formula.toks == NULL) failed++;
+        tokens += formula.numtoks;
+        formula_free(&formula);
+    }
+
+    const double time = BENCH_RUN(LEX_MINTIME,
+        for (size_t i = 0; i < numformulas; i++) {
+            formula_s formula = lex(formulas[i]);
+            formula_free(&formula);
+        }
+    );
+
+    printf("lex : %lu formulas (%lu bytes, %lu tokens, %lu rejected)\n", numformulas, bytes, tokens, failed);
+    printf("    %.0f formulas/s, %.1f MB/s, %.1f ns per token\n", numformulas/time, bytes/time*1e-6, time/tokens*1e9);
+
+    for (size_t i = 0; i < numformulas; i++) free(formulas[i]);
+    free(formulas);
+    objects_destroy();
+    return 0;
+}
@@ -0,0 +1,58 @@
+// A Fourier series graphed the way the renderer does every frame, with the camera panning so nothing is reused
+
+#include "bench.h"
+#include "parser.h"
+#include "compiler.h" // formula_free
+#include "plot.h"
+#include "objects.h"
+#include "renderer.h" // cam, renderer_mutex
+#include "console.h" // settings
+
+#include <stdio.h>
+#include <math.h>
+#include <pthread.h>
+
+#define SERIES_FRAMES 200
+#define SERIES_FORMULA "sum(k,1,200,sin((2k-1)x)/(2k-1))" // the square wave, pi/4 on (0, pi)
+
+static double frame_time() {
+    const double start = bench_now();
+    for (unsigned i = 0; i < SERIES_FRAMES; i++) {
+        cam.x += cam.w/SERIES_FRAMES;
+
+        pthread_mutex_lock(&renderer_mutex);
+        graph_all(cam.x, cam.x+cam.w, SET_MAXLENGTH);
+        pthread_mutex_unlock(&renderer_mutex);
+    }
+    return (bench_now()-start)/SERIES_FRAMES;
+}
+
+int main() {
+    objects_init();
+    cam = (rectf){-2*M_PI, -2, 4*M_PI, 4};
+
+    if (ERROR_FAIL(graph_add("square", lex(SERIES_FORMULA), 0, (SDL_Color){0, 0, 0, 255}))) {
+        printf("the series can't be graphed\n");
+        return 1;
+    }
+
+    double y;
+    formula_s formula = lex(SERIES_FORMULA);
+    compute(&y, &formula, &(double){M_PI/2});
+    formula_free(&formula);
+
+    printf("series : %s over %lu samples, %g at pi/2 (pi/4 is %g)\n", SERIES_FORMULA, SET_MAXLENGTH, y, M_PI/4);
+
+    for (int kahan = 1; kahan >= 0; kahan--) {
+        settings.kahan = kahan;
+        const double time = frame_time();
+
+        size_t computed, culled, stepped, deep, reused;
+        graph_stats(&computed, &culled, &stepped, &deep, &reused);
+        printf("    %-12s %6.2f ms per frame, %5.0f fps (%lu samples computed)\n",
+            kahan ? "compensated" : "plain", time*1e3, 1/time, computed);
+    }
+
+    objects_destroy();
+    return 0;
+}
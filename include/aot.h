@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+
+typedef struct formula_s formula_s;
+#include "objects.h" // formula_s
+#include "error.h"
+
+// Formulas compiled ahead of time by gcc into a shared library (the 'compile' command),
+// the library exports a batch kernel taking x and the variables the formula reads as its arguments
+
+#define AOT_MAXVARS 8 // distinct variables a compiled formula can read
+
+typedef struct aot_kernel {
+    void* library; // the dlopen handle
+    void (*batch)(const double* in, double* out, size_t n); // in[k*n+i] is the argument k of the lane i
+    unsigned long long hash; // of the generated source, it names the cached library and the library keeps it too
+
+    // the arguments after x
+    const double* vars[AOT_MAXVARS];
+    size_t numvars;
+} aot_kernel;
+
+// Generates the C source of the (prepared) formula, the user functions are already inlined and
+// the built ins map to libm, fails for formulas calling plugins, returns a malloc'd string
+error_t aot_source(const formula_s* formula, char** source, unsigned long long* hash);
+
+// Loads the library built from the source of the formula and hot swaps compute_batch to it,
+// fails for a library built from any other source
+error_t aot_load(formula_s* formula, const char* path);
+
+// Called after every recompilation of the formula, the kernel stays only if it still computes the same thing
+void aot_rebind(formula_s* formula);
+
+// Computes ys[i] = f(xs[i]) with the compiled kernel
+void aot_batch(const formula_s* formula, const double* xs, double* ys, size_t n);
+
+void aot_free(formula_s* formula);
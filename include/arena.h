@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+
+typedef struct arena_chunk arena_chunk;
+
+// A simple bump allocator, the chunks are never moved or freed until arena_destroy
+// so everything allocated stays valid until it's released with arena_restore
+typedef struct arena_s {
+    arena_chunk* first;
+    arena_chunk* curr;
+
+    size_t allocations; // number of chunks malloc'd so far
+} arena_s;
+
+typedef struct arena_mark {
+    arena_chunk* chunk;
+    size_t used;
+} arena_mark;
+
+void* arena_alloc(arena_s* arena, size_t size);
+
+// Saves the current position so everything allocated after it can be released at once
+arena_mark arena_save(const arena_s* arena);
+void arena_restore(arena_s* arena, arena_mark mark);
+
+void arena_destroy(arena_s* arena);
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stddef.h>
+
+#define ARRAY_MAXLENGTH 100000000LU
+
+// A reference counted array of numbers, the array objects, the data sets and the computed arrays
+// share them instead of copying, the numbers never change once the array has been filled,
+// so every holder can read them without a lock
+typedef struct array_s {
+    double* data;
+    size_t length;
+    _Atomic unsigned refs;
+} array_s;
+
+// A new array with a single reference, the numbers are left for the caller to fill,
+// NULL (with the error thrown) if it's too long or there's not enough memory
+array_s* array_create(size_t length);
+
+// count numbers evenly spaced from from to to (both included)
+array_s* array_linspace(double from, double to, size_t count);
+
+array_s* array_retain(array_s* array);
+
+// Drops a reference, the last one frees the array (NULL is fine)
+void array_release(array_s* array);
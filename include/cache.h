@@ -0,0 +1,17 @@
+#pragma once
+
+#include "objects.h" // formula_s
+
+// The formulas of the expressions the console computes (calc, var, modif ...) are kept around,
+// keyed by their normalized text, so an expression seen before isn't lexed again.
+// The compiled code is tied to the object generation like any other formula,
+// when a name can point somewhere else, formula_prepare recompiles it from the cached tokens
+
+// Returns the formula for the expression, NULL if it can't be lexed (the error is thrown),
+// it is owned by the cache and only valid until the next call
+formula_s* cache_formula(const char* str);
+
+// Lookups that found the expression, the ones of them that needed a recompilation, and the rest
+void cache_stats(size_t* hits, size_t* recompiled, size_t* misses, size_t* entries);
+
+void cache_destroy();
@@ -0,0 +1,97 @@
+#pragma once
+
+typedef struct instr instr;
+typedef struct poly_s poly_s;
+typedef struct series_s series_s;
+#include "objects.h" // formula_s
+
+#define POLY_MAXDEGREE 24
+#define SERIES_MAXTERMS 1000000 // a sum or a product with more terms than this fails
+#define COMPILE_MAXNESTING 64 // functions inlining functions ... this deep
+
+// A polynomial with constant coefficients, coeffs[k] multiplies x^k
+typedef struct poly_s {
+    unsigned degree;
+    double coeffs[POLY_MAXDEGREE+1];
+} poly_s;
+
+// A sum or a product over the whole k from one bound to the other, the code of the term
+// follows the OC_SERIES instruction and is run once for every k
+typedef struct series_s {
+    double k; // the index, the OC_VAR instructions of the term point here
+    size_t len; // the instructions of the term
+    _Bool product;
+    char name[NAME_MAXLEN]; // the index name, only for printing
+} series_s;
+
+// A single bytecode instruction, all names are already resolved here
+typedef struct instr {
+    enum {
+        OC_NUM, OC_X, OC_VAR, OC_ADD, OC_SUB, OC_MULT, OC_DIV, OC_MOD, OC_POW, OC_NEG, OC_CFUNC, OC_FUNC,
+        OC_POWI, // integer power, the exponent is stored in num
+        OC_CALL, // a plugin function taking call->arity arguments from the stack
+        OC_POLY, // the polynomial poly of the stack top, found by the optimizer
+        OC_I, // the imaginary unit, only the complex evaluator knows it, it's NaN everywhere else
+        OC_CMP, // a comparison, 1 if it holds and 0 if it doesn't, the CMP_ kind is stored in num
+        OC_SELECT, // if(cond, a, b), takes three values from the stack, both branches are always computed
+        OC_SERIES, // sum or prod, takes the two bounds from the stack, the code of the term comes right after it
+        OC_RAND, // rand() or randn(), a new draw every time it's computed, the RAND_ kind is stored in num
+        OC_ARRAY, // the element of an array, only compute_array knows which one, every other evaluator fails
+        OC_ARG // only used inside the optimizer, joins the arguments of OC_CALL, OC_SELECT and OC_SERIES
+    } op;
+
+    unsigned flags; // IF_ flags
+
+    union {
+        double num; // OC_NUM, OC_POWI, OC_CMP, OC_RAND
+        const double* val; // OC_VAR
+        formula_s* func; // OC_FUNC
+        const cfunc_s* call; // OC_CFUNC, OC_CALL
+        const poly_s* poly; // OC_POLY, owned by the formula
+        series_s* series; // OC_SERIES, owned by the formula
+        array_s* const* array; // OC_ARRAY, the handle of the object
+    };
+} instr;
+
+#define IF_PURE 1 // the function has no side effects, it can be folded when the argument is constant
+#define IF_THREADSAFE 2 // the function can be called from several threads at once
+
+// the kinds of OC_CMP, in the order of the lexer operators
+enum {CMP_LT, CMP_LE, CMP_GT, CMP_GE, CMP_EQ, CMP_NE};
+
+// the kinds of OC_RAND, uniform from [0, 1) and standard normal
+enum {RAND_UNIFORM, RAND_NORMAL};
+
+// Compiles the RPN tokens into bytecode,
+// if bind_x is set, 'x' is the formula argument and not an object
+error_t formula_compile(formula_s* formula, _Bool bind_x);
+
+// Recompiles the formula only if the bytecode is outdated (the objects or the local names changed)
+error_t formula_prepare(formula_s* formula, _Bool bind_x);
+
+// A rough cost of the instruction per value, in additions
+unsigned instr_cost(const instr* in);
+
+// Inlines user functions, folds constants, reduces small integer powers to multiplications
+// and removes identities (like *1 or +0), fails if an inlined function doesn't compile
+error_t formula_optimize(formula_s* formula);
+
+// x^n using only multiplications
+double powi(double x, int n);
+
+// The scalar OC_CMP and OC_SELECT, a NaN operand (or condition) gives NaN,
+// so the undefined parts of a formula stay undefined
+double compare(int kind, double a, double b);
+double choose(double cond, double a, double b);
+
+// Horner's scheme, Estrin's for the high degrees (it doesn't wait for one multiplication after another)
+double poly_eval(const poly_s* poly, double x);
+
+// Frees the polynomials the OC_POLY instructions of the formula point to
+void formula_free_polys(formula_s* formula);
+
+// Frees the loops the OC_SERIES instructions of the formula point to
+void formula_free_series(formula_s* formula);
+
+// Frees the tokens and the bytecode
+void formula_free(formula_s* formula);
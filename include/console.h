@@ -25,6 +25,15 @@ typedef struct {
     SDL_Color col_grid;
     SDL_Color col_text;
 
+    _Bool jit; // compile formulas to native code when possible
+    _Bool adaptive; // place the graph samples by the shape of the curve, not uniformly
+    _Bool stepping; // compute the sines, exponentials and polynomials of uniform samples incrementally
+    _Bool fastmath; // the vectorized functions trade accuracy (about 1e-7 relative) for speed
+    _Bool kahan; // the sums carry the rounding errors of their terms along (compensated summation)
+    enum {
+        CP_OFF, CP_RE, CP_IM, CP_ABS
+    } complex_part; // the part of the complex values graphs show, off graphs them in real numbers
+
     double grid_size;
     double cam_movespeed;
     double cam_scalespeed;
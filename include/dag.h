@@ -0,0 +1,24 @@
+#pragma once
+
+#include "objects.h" // set_s
+#include "error.h"
+
+// All graph formulas are interned into one hash-consed expression DAG,
+// an identical subexpression is evaluated only once per x and shared by every set using it
+
+// Interns the formula of the set (sets set->dag_root)
+error_t dag_add(set_s* set);
+
+// Releases the nodes only used by this set
+void dag_remove(set_s* set);
+
+// Decides whether evaluating the shared DAG is cheaper than evaluating every set on its own
+_Bool dag_worth();
+
+// Computes the coordinates of every function set on a uniform grid
+void dag_graph(double start, double end, unsigned numsteps);
+
+// The number of live nodes and the number of them used more than once
+void dag_stats(size_t* nodes, size_t* shared);
+
+void dag_destroy();
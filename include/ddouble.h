@@ -0,0 +1,94 @@
+#pragma once
+
+typedef struct ddouble ddouble;
+#include "objects.h" // formula_s
+#include "error.h"
+
+#include <math.h> // fma
+
+// A double-double number, the unevaluated sum hi + lo with |lo| <= ulp(hi)/2,
+// about 106 bits of mantissa out of plain hardware doubles (the error free transformations
+// of Knuth and Dekker), many times faster than arbitrary precision libraries.
+// It is used for graphing when the camera is so small that doubles can't tell the pixels apart
+typedef struct ddouble {
+    double hi, lo;
+} ddouble;
+
+#define DD_EPS 4.93038065763132e-32 // 2^-104
+
+// a+b exactly, s is the rounded sum and e the rounding error
+static inline ddouble two_sum(double a, double b) {
+    const double s = a+b, bb = s-a;
+    return (ddouble){s, (a-(s-bb)) + (b-bb)};
+}
+
+// the same, but only if |a| >= |b|
+static inline ddouble quick_two_sum(double a, double b) {
+    const double s = a+b;
+    return (ddouble){s, b-(s-a)};
+}
+
+// a*b exactly, without a fused multiply-add the factors are split into 26 bit halves
+static inline ddouble two_prod(double a, double b) {
+    const double p = a*b;
+#ifdef FP_FAST_FMA
+    return (ddouble){p, fma(a, b, -p)};
+#else
+    const double ta = 134217729.0*a, ah = ta-(ta-a), al = a-ah; // 2^27+1
+    const double tb = 134217729.0*b, bh = tb-(tb-b), bl = b-bh;
+    return (ddouble){p, ((ah*bh-p) + ah*bl + al*bh) + al*bl};
+#endif
+}
+
+static inline ddouble dd_add(ddouble a, ddouble b) {
+    ddouble s = two_sum(a.hi, b.hi), t = two_sum(a.lo, b.lo);
+    s = quick_two_sum(s.hi, s.lo + t.hi);
+    return quick_two_sum(s.hi, s.lo + t.lo);
+}
+
+static inline ddouble dd_add_d(ddouble a, double b) {
+    const ddouble s = two_sum(a.hi, b);
+    return quick_two_sum(s.hi, s.lo + a.lo);
+}
+
+static inline ddouble dd_neg(ddouble a) { return (ddouble){-a.hi, -a.lo}; }
+static inline ddouble dd_sub(ddouble a, ddouble b) { return dd_add(a, dd_neg(b)); }
+
+static inline ddouble dd_mul(ddouble a, ddouble b) {
+    const ddouble p = two_prod(a.hi, b.hi);
+    return quick_two_sum(p.hi, p.lo + (a.hi*b.lo + a.lo*b.hi));
+}
+
+static inline ddouble dd_mul_d(ddouble a, double b) {
+    const ddouble p = two_prod(a.hi, b);
+    return quick_two_sum(p.hi, p.lo + a.lo*b);
+}
+
+// long division, every quotient digit corrects the remainder of the previous one
+static inline ddouble dd_div(ddouble a, ddouble b) {
+    const double q1 = a.hi/b.hi;
+    ddouble r = dd_sub(a, dd_mul_d(b, q1));
+    const double q2 = r.hi/b.hi;
+    r = dd_sub(r, dd_mul_d(b, q2));
+
+    return dd_add_d(quick_two_sum(q1, q2), r.hi/b.hi);
+}
+
+// The functions give what the double versions do for the special arguments (NaN, infinities, poles),
+// the ones too big for the range reduction are just computed in double.
+// The arithmetic turns infinite results into NaN, such points aren't drawn anyway
+ddouble dd_sqrt(ddouble a);
+ddouble dd_exp(ddouble a);
+ddouble dd_log(ddouble a);
+ddouble dd_sin(ddouble a);
+ddouble dd_cos(ddouble a);
+ddouble dd_tan(ddouble a);
+ddouble dd_abs(ddouble a);
+ddouble dd_sgn(ddouble a);
+ddouble dd_pow(ddouble a, ddouble b);
+ddouble dd_powi(ddouble a, int n);
+ddouble dd_fmod(ddouble a, ddouble b);
+
+// Computes the formula in double-double for every x in xs (xs and ys can be the same array),
+// the functions without a double-double version (plugins) only get the double precision
+error_t compute_batch_dd(formula_s* formula, const ddouble* xs, ddouble* ys, size_t n);
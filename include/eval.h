@@ -0,0 +1,72 @@
+#pragma once
+
+#include "arena.h"
+#include "compiler.h" // COMPILE_MAXNESTING
+
+#define EVAL_ERRORLEN 100
+#define FRAME_MAXBINDINGS 16LU
+
+typedef struct stepper_s stepper_s;
+
+// A name bound for a while by 'calc ... for'
+typedef struct binding_s {
+    char name[NAME_MAXLEN];
+    double val;
+    array_s* array; // NULL if the name is a number
+} binding_s;
+
+// The local names of a context, they shadow the objects of the same name while the formulas are compiled,
+// the objects themselves are never touched. The code reads the values through OC_VAR (or OC_ARRAY)
+// like it reads the variables, so binding the same names to other values doesn't recompile anything
+typedef struct frame_s {
+    binding_s bindings[FRAME_MAXBINDINGS];
+    size_t numbindings;
+    size_t numnames; // the names in bindings the shape stands for, numbindings or more
+    unsigned shape; // changes with the names, the code compiled against other names is recompiled
+} frame_s;
+
+// A function object compiled for a single context (see eval_ctx.functions)
+typedef struct function_copy {
+    const formula_s* shared; // the formula of the object
+    formula_s* copy; // owned by the context
+} function_copy;
+
+// Everything compiling and computing a formula changes besides the formula itself, so several threads
+// can do it at once. Every thread starts with a context of its own, a worker can be given another one,
+// its error is still there once the worker is done
+typedef struct eval_ctx {
+    char error[EVAL_ERRORLEN]; // the last error thrown (see error_catch)
+    arena_s scratch; // the stacks of the evaluators
+    frame_s frame;
+
+    // the formulas being compiled right now (inlining compiles the called functions),
+    // a function showing up twice calls itself and can't ever be computed
+    const formula_s* compiling[COMPILE_MAXNESTING];
+    size_t numcompiling;
+
+    const snapshot_s* objects; // the names are resolved here and not in the live objects, NULL if they aren't
+    stepper_s* stepper; // the plan of the graph being stepped, NULL until the context steps one
+
+    // with a snapshot, the function objects other threads may be running aren't recompiled,
+    // the ones which don't fit the local names of the context are compiled again in a copy
+    function_copy* functions;
+    size_t numfunctions;
+} eval_ctx;
+
+// The context of the calling thread, its own one is destroyed when the thread ends
+eval_ctx* eval_current();
+
+// Makes ctx the context of the calling thread, NULL gives the thread its own one back
+void eval_bind(eval_ctx* ctx);
+
+// A context for a worker, with the local names of parent (can be NULL) resolving against the snapshot,
+// the code compiled in parent runs in it as it is
+void eval_init(eval_ctx* ctx, const eval_ctx* parent, const snapshot_s* objects);
+void eval_destroy(eval_ctx* ctx);
+
+// Binds the name in the frame of the current context, the later bindings shadow the earlier ones,
+// the frame takes over the array reference (it's released if the name can't be bound)
+error_t frame_bind(const char* name, double val, array_s* array);
+
+// Unbinds all the names of the current context, the arrays are released
+void frame_clear();
@@ -0,0 +1,58 @@
+#pragma once
+
+// The JaPlot plugin interface, version 2
+// This header is all a plugin needs, it doesn't depend on anything else from JaPlot
+//
+// Old plugins just export 'double name(double)' functions, those still work with 'plug name < plugin'.
+// A version 2 plugin exports japlot_plugin_register instead, which adds any number of functions :
+//
+//     static double hypot2(const double* args) { return sqrt(args[0]*args[0] + args[1]*args[1]); }
+//
+//     static void hypot2_batch(const double* in, double* out, size_t n) {
+//         for (size_t i = 0; i < n; i++) out[i] = sqrt(in[i]*in[i] + in[n+i]*in[n+i]);
+//     }
+//
+//     int japlot_plugin_register(jp_host* host) {
+//         jp_function f = {"hypot", 2, JP_PURE | JP_THREADSAFE, hypot2, hypot2_batch};
+//         host->add(host, &f);
+//         return JAPLOT_PLUGIN_ABI;
+//     }
+
+#include <stddef.h>
+
+#define JAPLOT_PLUGIN_ABI 2
+#define JP_MAXARITY 8
+
+// function flags
+#define JP_PURE 1 // the same arguments always give the same result, no side effects (calls can be folded or merged)
+#define JP_THREADSAFE 2 // the function can be called from several threads at once
+
+typedef struct jp_function {
+    const char* name; // copied by JaPlot, the same rules as for other object names apply
+    unsigned arity; // the number of arguments (1 to JP_MAXARITY)
+    unsigned flags; // JP_ flags
+
+    // At least one of the entry points has to be set
+
+    // Computes the function for args[0] ... args[arity-1]
+    double (*scalar)(const double* args);
+
+    // Computes the function for n argument tuples at once,
+    // in[k*n+i] is the argument k of the tuple i, the result goes to out[i] (out never overlaps in)
+    void (*batch)(const double* in, double* out, size_t n);
+
+    // Optional, the partial derivatives at args, grad[k] is the derivative by args[k]
+    // (used for the exact derivatives, they are approximated by differences without it)
+    void (*gradient)(const double* args, double* grad);
+} jp_function;
+
+typedef struct jp_host {
+    unsigned abi; // the version JaPlot implements (JAPLOT_PLUGIN_ABI)
+
+    // Adds a function to JaPlot, returns 0 if it was refused (bad name, arity, no entry point ...)
+    int (*add)(struct jp_host* host, const jp_function* func);
+} jp_host;
+
+// The symbol JaPlot looks for, it has to return the JAPLOT_PLUGIN_ABI the plugin was built with
+#define JAPLOT_PLUGIN_REGISTER "japlot_plugin_register"
+typedef int (*jp_register_fn)(jp_host* host);
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stddef.h>
+
+typedef struct formula_s formula_s;
+#include "objects.h" // formula_s
+
+// A natively compiled formula, it computes ys[i] = f(xs[i]) for i < n
+typedef void (*jit_fn)(const double* xs, double* ys, size_t n);
+
+// Translates the (already compiled) bytecode into x86-64 SSE2 machine code,
+// returns NULL if the platform or the formula isn't supported (the interpreter is used then)
+jit_fn jit_compile(const formula_s* formula, size_t* size);
+
+void jit_free(jit_fn fn, size_t size);
@@ -10,6 +10,14 @@ typedef struct formula_s formula_s;
 typedef struct set_s set_s;
 #include "plot.h" // pointf
 
+typedef struct instr instr;
+typedef struct poly_s poly_s;
+typedef struct series_s series_s;
+typedef struct interval interval;
+typedef struct ddouble ddouble;
+typedef struct array_s array_s;
+
+#include "japlot_plugin.h" // jp_function flags
 #include "SDL.h" // color
 
 #define SET_MAXLENGTH 2048LU
@@ -18,15 +26,46 @@ typedef struct set_s set_s;
 typedef struct formula_s {
     token* toks;
     size_t numtoks;
+    size_t depth; // the maximum height of the number stack, found by lex
+
+    // compiled bytecode, (re)built lazily by formula_prepare
+    instr* code;
+    size_t numcode;
+    unsigned generation; // the object_generation the code was compiled against
+    unsigned frame; // the shape of the local names it was compiled against (see frame_s)
+    size_t framesize;
+    _Bool bound_x;
+    size_t removed; // instructions removed by the optimizer
+    size_t inlined; // user function calls spliced into the code
+
+    poly_s** polys; // the coefficients of the OC_POLY instructions
+    size_t numpolys;
+
+    series_s** series; // the index cells and the lengths of the OC_SERIES instructions
+    size_t numseries;
+
+    void* jit; // natively compiled code (jit_fn), NULL if the JIT is off or unsupported
+    size_t jitsize;
+    _Bool vectormath; // calls functions the batch evaluator has vectorized (see vmath.h)
+    _Bool uses_i; // uses i, its real value is NaN (see compute_complex)
+    _Bool uses_arrays; // reads arrays, it's only computed element-wise (see compute_array)
+
+    void* native; // the kernel gcc compiled (aot_kernel), NULL if the formula wasn't compiled ahead of time
 } formula_s;
 
 typedef struct set_s {
     struct set_s *next, *prev; // this is actually a linked list node
 
-    pointf *coords;
+    pointf *coords; // the computed points of a graph
+    array_s *xs, *ys; // the columns of a data set, shared with the arrays they come from
     size_t length;
 
     formula_s formula;
+    _Bool derivative; // the set shows the derivative of the formula
+    int dag_root; // the node of the shared DAG computing this set, -1 if none
+    _Bool dirty; // something the formula depends on changed since the coordinates were computed
+    _Bool deep; // the coordinates are relative to the camera, graphed in double-double (see graph_all)
+    _Bool domain; // drawn as the domain coloring of the formula over the complex plane instead of a curve
 
     _Bool shown;
     SDL_Color col_point, col_line;
@@ -37,28 +76,61 @@ typedef struct set_s {
     } plot_type;
 } set_s;
 
+// A built in or plugin function
+typedef struct cfunc_s {
+    double (*func)(double); // the plain single argument entry point (built ins and old plugins)
+    double (*scalar)(const double* args); // JP_ABI 2 entry points, NULL if not available
+    void (*batch)(const double* in, double* out, size_t n);
+
+    // the derivatives, if they are not known, they get approximated
+    double (*deriv)(double); // of func
+    void (*gradient)(const double* args, double* grad); // JP_ABI 2
+
+    interval (*range)(interval); // the image of a range under func, unbounded if not known
+    ddouble (*precise)(ddouble); // func in double-double (deep zoom), NULL if not known, func is used then
+    void (*cbatch)(double* re, double* im, size_t n); // func of complex numbers in place, NULL if it's only known for real ones
+    const char* cname; // what calls func in generated C code, NULL for plugins
+
+    unsigned arity;
+    unsigned flags; // JP_PURE, JP_THREADSAFE
+} cfunc_s;
+
+typedef struct dependency dependency;
+
+#define OT_NUMTYPES 6
+
 // A generic object
 typedef struct object {
 
     enum {
-        OT_CONSTANT = 0, OT_VARIABLE, OT_FUNCTION, OT_CFUNC, OT_SET
+        OT_CONSTANT = 0, OT_VARIABLE, OT_FUNCTION, OT_CFUNC, OT_SET, OT_ARRAY
     } type;
 
     _Bool hidden;
+    char name[NAME_MAXLEN]; // the key in the trie, kept for the dependency lookups
+
+    // the names the formula refers to (functions and sets only), each of them lists this object as a user
+    dependency** uses;
+    size_t numuses;
+    unsigned mark; // visited by the current dependency walk
 
     union {
         void* data; // GENERIC ACCESS
 
-        double (*cfunc)(double); // OT_CFUNC
+        cfunc_s* cfunc; // OT_CFUNC
         double* val; //OT_CONSTANT, OT_VARIABLE
         formula_s* func; // OT_FUNCTION
         set_s* set; //OT_SET
+        array_s** array; // OT_ARRAY, the code reads through it, so modif can swap the array
     };
 
 } object;
 
 extern set_s* set_first; // linked list for easy iterations
 
+// Changes every time a resolved name could point somewhere else (remove, rename, hide)
+extern unsigned object_generation;
+
 void objects_init();
 void objects_destroy();
 
@@ -67,12 +139,28 @@ void objects_destroy();
 error_t object_remove(const char* name);
 error_t object_rename(const char* name, const char* newname);
 error_t object_hide(const char* name, _Bool val);
+
+// Marks every set depending on the object (directly or through functions) as dirty
+void object_changed(const char* name);
+
+// Finds the sets depending on the object (directly or through functions), returns how many there are
+size_t object_graphs(const char* name, object** sets, size_t max);
+
+// Replaces the formula of a function, the old one is freed
+void function_replace(object* obj, formula_s formula);
 error_t objects_dump(ds_vector** arr); 
 
-error_t graph_add(const char* name, formula_s formula, SDL_Color col);
-error_t plot_add(const char* name, pointf* coords, size_t length, SDL_Color col);
+error_t graph_add(const char* name, formula_s formula, _Bool derivative, SDL_Color col);
+// The set takes over both references, they are released if it can't be added
+error_t plot_add(const char* name, array_s* xs, array_s* ys, SDL_Color col);
 
 error_t object_add(const char* name, int type, void* copy);
 error_t object_get(const char* name, object** obj);
 
+// The objects as they are right now, a context resolving the names here can compile and compute on any thread
+// while the objects don't change (the objects themselves aren't copied), NULL if it fails
+typedef struct snapshot_s snapshot_s;
+snapshot_s* objects_snapshot();
+void snapshot_free(snapshot_s* snapshot);
+
 const char* obj_type_str(int type);
@@ -1,20 +1,29 @@
 #pragma once
 
 typedef struct token token;
-#include "objects.h" // formula_s
+typedef struct instr instr;
+typedef struct cfunc_s cfunc_s;
+typedef struct interval interval;
+typedef struct array_s array_s;
 
-#define NAME_MAXLEN 12LU
+#define NAME_MAXLEN 12LU // before objects.h, the objects keep their names too
+#include "objects.h" // formula_s
 
 typedef struct token {
     enum {
-        TT_OPERATOR, TT_NUMBER, TT_VARIABLE, TT_FUNCTION, TT_UNKNOWN
+        TT_OPERATOR, TT_NUMBER, TT_VARIABLE, TT_FUNCTION, TT_UNKNOWN,
+        TT_BIND, // the term of a sum or a product starts here, the index name is bound until the sum ends
+        TT_INDEX // the index of an enclosing sum or product
     } type; 
 
+    unsigned args; // TT_FUNCTION, the arguments written between its brackets
+
     union {
         double num; // TT_NUMBER
-        char name[NAME_MAXLEN]; // TT_FUNCTION or TT_CONST
+        char name[NAME_MAXLEN]; // TT_FUNCTION, TT_VARIABLE, TT_BIND or TT_INDEX
         enum {
-            OP_ADD = 0, OP_SUB, OP_MULT, OP_DIV, OP_MOD, OP_POW, OP_OBRACK, OP_CBRACK, OP_NEG, OP_FUNC
+            OP_ADD = 0, OP_SUB, OP_MULT, OP_DIV, OP_MOD, OP_POW, OP_OBRACK, OP_CBRACK, OP_NEG, OP_FUNC, OP_COMMA,
+            OP_LT, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NE // the comparisons bind the loosest, "x+1 < 2" compares x+1
         } oper; // TT_OPERATOR
     };
 } token;
@@ -22,8 +31,61 @@ typedef struct token {
 // Converts to reverse polish notation (the variables are replaced here)
 formula_s lex(const char* str);
 
-// Computes reverse polish notation
-int compute(double* result, const formula_s tokens, const double* x);
+// Computes the formula, compiling it first if needed
+// x can be NULL, 'x' is then looked up as a regular object
+int compute(double* result, formula_s* formula, const double* x);
+
+// Computes the formula for every x in xs, the results are stored in ys (xs and ys can be the same array)
+#define BATCH_LANES 256LU
+error_t compute_batch(formula_s* formula, const double* xs, double* ys, size_t n);
+
+// Computes the formula n times without an argument ('x' is an object like in compute(..., NULL)),
+// the values only differ by the random draws, so it's always interpreted a block at a time
+error_t compute_draws(formula_s* formula, double* ys, size_t n);
+
+// Computes the formula element by element over the arrays it reads (all of them equally long) into a new array,
+// 'x' is an object like in compute(..., NULL), a formula which is just an array shares it instead of copying
+error_t compute_array(formula_s* formula, array_s** result);
+
+// Applies a single instruction over m lanes (dst = a op b, unary operations only use b),
+// dst can overlap the operands
+error_t batch_instr(const instr* in, double* dst, const double* a, const double* b, const double* xs, size_t m);
+
+// dst = if(c, a, b) lane by lane as masks, without branching, dst can be the same array as any of them
+void batch_select(double* dst, const double* c, const double* a, const double* b, size_t m);
+
+// The whole indices first .. last a sum or a product with the bounds lo[i] .. hi[i] runs over in any lane,
+// first > last if there are none, the lanes with NaN bounds are left out, fails past SERIES_MAXTERMS
+error_t series_terms(const double* lo, const double* hi, size_t m, double* first, double* last);
+
+// Computes f(x) and f'(x) in one pass (forward mode differentiation with dual numbers),
+// the derivatives go to dys, xs and ys can be the same array
+error_t compute_batch_dual(formula_s* formula, const double* xs, double* ys, double* dys, size_t n);
+error_t compute_dual(double* result, double* deriv, formula_s* formula, double x);
+
+// Computes the formula of complex numbers, the real and imaginary parts of the arguments and the results
+// are in separate arrays (the outputs can be the same arrays as the inputs), 'i' is only known here,
+// the functions which only have a real version give NaN off the real axis
+error_t compute_batch_complex(formula_s* formula, const double* xre, const double* xim, double* yre, double* yim, size_t n);
+error_t compute_complex(double* re, double* im, formula_s* formula, const double* x);
+
+// A range of values, lo > hi means an empty one (undefined everywhere)
+typedef struct interval {
+    double lo, hi;
+    _Bool gap; // the function may be undefined or infinite somewhere in the range
+} interval;
+
+// Computes guaranteed bounds of the formula for every x in the range (interval arithmetic),
+// the bounds can be wider than the real ones, but never narrower
+error_t compute_interval(interval* result, formula_s* formula, interval x);
+
+// Calls a plugin function through whichever entry point it has,
+// call_batch reads the argument k of the lane i from in[k*m+i]
+double call_scalar(const cfunc_s* f, const double* args);
+void call_batch(const cfunc_s* f, const double* in, double* out, size_t m);
+
+// The number of heap allocations the evaluation (and compilation) has made so far
+extern _Atomic unsigned long eval_allocations;
 
 // Checks validity of a given formula
-error_t validate(const formula_s tokens);
+error_t validate(formula_s* formula);
@@ -16,4 +16,14 @@ typedef struct pointi {
 int pointf_compare(const pointf* p1, const pointf* p2);
 
 void graph(double start, double end, unsigned numsteps, set_s* dst);
+
+// Graphs all function sets, sharing the common subexpressions when it pays off.
+// When the camera is too small for doubles to tell its pixels apart, the sets are computed
+// in double-double over the camera instead (start and end are then ignored).
+// A set with the domain coloring on is computed over the complex plane of the camera instead of a curve
+void graph_all(double start, double end, unsigned numsteps);
 void plot(GPU_Target* target, set_s* s);
+
+// The samples graph_all computed last time (stepped of them incrementally, deep of them in double-double),
+// the ones it skipped as off the screen and the sets it didn't have to compute again because nothing they depend on changed
+void graph_stats(size_t* computed, size_t* culled, size_t* stepped, size_t* deep, size_t* reused);
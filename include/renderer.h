@@ -3,8 +3,11 @@
 //#include "plot.h" // points
 #include <pthread.h> // mutex
 
-#define WORLD2CAM(p) (((pointi){(p.x-cam.x)/(cam.w/(double)settings.WIDTH), (p.y-cam.y)/(cam.h/(double)settings.HEIGHT)}))
-#define WORLD2CAMCART(p) (((pointi){(p.x-cam.x)/(cam.w/(double)settings.WIDTH), (-p.y-cam.y)/(cam.h/(double)settings.HEIGHT)})) // CARThesian
+// the low parts of the camera position only matter when zoomed in very deep, then p-cam is (nearly) exact
+#define WORLD2CAM(p) (((pointi){((p.x-cam.x)-cam_lo.x)/(cam.w/(double)settings.WIDTH), ((p.y-cam.y)-cam_lo.y)/(cam.h/(double)settings.HEIGHT)}))
+#define WORLD2CAMCART(p) (((pointi){((p.x-cam.x)-cam_lo.x)/(cam.w/(double)settings.WIDTH), ((-p.y-cam.y)-cam_lo.y)/(cam.h/(double)settings.HEIGHT)})) // CARThesian
+// p is already relative to the camera, x from its left edge and y from its top edge upwards (see graph_all)
+#define WORLD2CAMCART_DEEP(p) (((pointi){p.x/(cam.w/(double)settings.WIDTH), -p.y/(cam.h/(double)settings.HEIGHT)}))
 #define CAM2WORLD(p) (((pointf){(p.x*(cam.w/(double)settings.WIDTH)+cam.x), p.y*(cam.h/(double)settings.HEIGHT)+cam.y})
 
 #define COLDARKER1(col) ((SDL_Color){col.r*0.8, col.g*0.8, col.b*0.8, col.a})
@@ -14,7 +17,12 @@
 
 typedef struct rectf { double x,y,w,h; } rectf;
 extern rectf cam;
+extern rectf cam_lo; // x and y make the camera position double-double with cam, w and h are unused
 extern pthread_mutex_t renderer_mutex;
+extern unsigned long frame_allocations; // evaluator heap allocations during the last frame
+
+// Moves the camera in double-double, so it can still move when a step is below the precision of its position
+void cam_move(double dx, double dy);
 
 int window_init();
 int window_destroy();
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stddef.h>
+
+// The random numbers of rand() and randn(), xoshiro256+ running RNG_LANES independent streams side by side,
+// the loop over the lanes is plain integer arithmetic the compiler vectorizes.
+// Every thread has a generator of its own, started from the seed ("set seed") and a stream number,
+// the same seed and stream always give the same draws
+
+#define RNG_LANES 4
+
+// Restarts the generator of the calling thread, the state is hashed from both numbers,
+// so the streams of one seed are unrelated to each other
+void rng_seed(unsigned long long seed, unsigned long long stream);
+
+// Every thread starts over from the seed with its next draw, each one on a stream of its own
+void rng_reseed(unsigned long long seed);
+
+// n uniform draws from [0, 1)
+void rng_uniform(double* out, size_t n);
+
+// n standard normal draws (Box-Muller over the vectorized log, sqrt, sin and cos)
+void rng_normal(double* out, size_t n);
+
+// 64 random bits, the seed of a whole batch of streams
+unsigned long long rng_bits();
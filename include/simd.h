@@ -0,0 +1,131 @@
+#pragma once
+
+// A tiny abstraction over the vector instruction sets, the widest one
+// enabled at compile time gets picked (build with -march=native for AVX)
+
+#if defined(__AVX__)
+    #include <immintrin.h>
+
+    #define SIMD_LANES 4
+    typedef __m256d simd_d;
+
+    #define SIMD_LOAD(p)     _mm256_loadu_pd(p)
+    #define SIMD_STORE(p, v) _mm256_storeu_pd(p, v)
+    #define SIMD_SET1(a)     _mm256_set1_pd(a)
+    #define SIMD_ADD(a, b)   _mm256_add_pd(a, b)
+    #define SIMD_SUB(a, b)   _mm256_sub_pd(a, b)
+    #define SIMD_MUL(a, b)   _mm256_mul_pd(a, b)
+    #define SIMD_DIV(a, b)   _mm256_div_pd(a, b)
+    #define SIMD_NEG(a)      _mm256_xor_pd(a, _mm256_set1_pd(-0.0))
+    #define SIMD_SQRT(a)     _mm256_sqrt_pd(a)
+
+    // bitwise, on the IEEE representation
+    #define SIMD_AND(a, b)   _mm256_and_pd(a, b)
+    #define SIMD_OR(a, b)    _mm256_or_pd(a, b)
+    #define SIMD_ANDNOT(a, b) _mm256_andnot_pd(a, b)
+
+    // comparisons give masks of all ones or zeros, NaN compares false (only unequal to everything)
+    #define SIMD_LT(a, b)    _mm256_cmp_pd(a, b, _CMP_LT_OQ)
+    #define SIMD_LE(a, b)    _mm256_cmp_pd(a, b, _CMP_LE_OQ)
+    #define SIMD_EQ(a, b)    _mm256_cmp_pd(a, b, _CMP_EQ_OQ)
+    #define SIMD_NEQ(a, b)   _mm256_cmp_pd(a, b, _CMP_NEQ_UQ)
+    #define SIMD_UNORD(a, b) _mm256_cmp_pd(a, b, _CMP_UNORD_Q)
+    #define SIMD_BLEND(mask, a, b) _mm256_blendv_pd(b, a, mask)
+    #ifdef __AVX2__
+        #define SIMD_SHL52(a) _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_castpd_si256(a), 52))
+        #define SIMD_SHR52(a) _mm256_castsi256_pd(_mm256_srli_epi64(_mm256_castpd_si256(a), 52))
+    #else
+        // AVX alone has no 256 bit integer shifts, the halves are shifted separately
+        #define SIMD_SHIFT_HALVES(a, shift) _mm256_insertf128_pd(_mm256_castpd128_pd256( \
+            _mm_castsi128_pd(shift(_mm_castpd_si128(_mm256_castpd256_pd128(a)), 52))), \
+            _mm_castsi128_pd(shift(_mm_castpd_si128(_mm256_extractf128_pd(a, 1)), 52)), 1)
+        #define SIMD_SHL52(a) SIMD_SHIFT_HALVES(a, _mm_slli_epi64)
+        #define SIMD_SHR52(a) SIMD_SHIFT_HALVES(a, _mm_srli_epi64)
+    #endif
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+
+    #define SIMD_LANES 2
+    typedef __m128d simd_d;
+
+    #define SIMD_LOAD(p)     _mm_loadu_pd(p)
+    #define SIMD_STORE(p, v) _mm_storeu_pd(p, v)
+    #define SIMD_SET1(a)     _mm_set1_pd(a)
+    #define SIMD_ADD(a, b)   _mm_add_pd(a, b)
+    #define SIMD_SUB(a, b)   _mm_sub_pd(a, b)
+    #define SIMD_MUL(a, b)   _mm_mul_pd(a, b)
+    #define SIMD_DIV(a, b)   _mm_div_pd(a, b)
+    #define SIMD_NEG(a)      _mm_xor_pd(a, _mm_set1_pd(-0.0))
+    #define SIMD_SQRT(a)     _mm_sqrt_pd(a)
+
+    // bitwise, on the IEEE representation
+    #define SIMD_AND(a, b)   _mm_and_pd(a, b)
+    #define SIMD_OR(a, b)    _mm_or_pd(a, b)
+    #define SIMD_ANDNOT(a, b) _mm_andnot_pd(a, b)
+
+    // comparisons give masks of all ones or zeros, NaN compares false (only unequal to everything)
+    #define SIMD_LT(a, b)    _mm_cmplt_pd(a, b)
+    #define SIMD_LE(a, b)    _mm_cmple_pd(a, b)
+    #define SIMD_EQ(a, b)    _mm_cmpeq_pd(a, b)
+    #define SIMD_NEQ(a, b)   _mm_cmpneq_pd(a, b)
+    #define SIMD_UNORD(a, b) _mm_cmpunord_pd(a, b)
+    #define SIMD_BLEND(mask, a, b) _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b)) // SSE4.1 would have blendv
+    #define SIMD_SHL52(a)    _mm_castsi128_pd(_mm_slli_epi64(_mm_castpd_si128(a), 52))
+    #define SIMD_SHR52(a)    _mm_castsi128_pd(_mm_srli_epi64(_mm_castpd_si128(a), 52))
+#else
+    // scalar fallback, the compiler can still vectorize this on its own
+    #define SIMD_LANES 1
+    typedef double simd_d;
+
+    #define SIMD_LOAD(p)     (*(p))
+    #define SIMD_STORE(p, v) (*(p) = (v))
+    #define SIMD_SET1(a)     (a)
+    #define SIMD_ADD(a, b)   ((a)+(b))
+    #define SIMD_SUB(a, b)   ((a)-(b))
+    #define SIMD_MUL(a, b)   ((a)*(b))
+    #define SIMD_DIV(a, b)   ((a)/(b))
+    #define SIMD_NEG(a)      (-(a))
+    #define SIMD_SQRT(a)     sqrt(a)
+
+    #include <math.h>
+    #include <string.h>
+
+    // bitwise, on the IEEE representation
+    static inline double simd_bits(double a, double b, int op) {
+        unsigned long long x, y;
+        memcpy(&x, &a, sizeof(x));
+        memcpy(&y, &b, sizeof(y));
+
+        switch (op) {
+            case 0 : x &= y; break;
+            case 1 : x |= y; break;
+            case 2 : x <<= 52; break;
+            case 3 : x >>= 52; break;
+            default : x = ~x & y; break;
+        }
+
+        memcpy(&a, &x, sizeof(a));
+        return a;
+    }
+
+    static inline double simd_mask(int cond) {
+        const unsigned long long x = cond ? ~0ULL : 0ULL;
+        double a;
+        memcpy(&a, &x, sizeof(a));
+        return a;
+    }
+
+    #define SIMD_AND(a, b)   simd_bits(a, b, 0)
+    #define SIMD_OR(a, b)    simd_bits(a, b, 1)
+    #define SIMD_ANDNOT(a, b) simd_bits(a, b, 4)
+    #define SIMD_SHL52(a)    simd_bits(a, 0.0, 2)
+    #define SIMD_SHR52(a)    simd_bits(a, 0.0, 3)
+
+    // comparisons give masks of all ones or zeros, NaN compares false (only unequal to everything)
+    #define SIMD_LT(a, b)    simd_mask((a) < (b))
+    #define SIMD_LE(a, b)    simd_mask((a) <= (b))
+    #define SIMD_EQ(a, b)    simd_mask((a) == (b))
+    #define SIMD_NEQ(a, b)   simd_mask((a) != (b))
+    #define SIMD_UNORD(a, b) simd_mask(isnan(a) || isnan(b))
+    #define SIMD_BLEND(mask, a, b) SIMD_OR(SIMD_AND(mask, a), SIMD_ANDNOT(mask, b))
+#endif
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "objects.h" // formula_s
+#include "error.h"
+
+// Samples on a uniform grid (x = start + i*step) can be computed incrementally,
+// the sines and cosines of a + b*x by rotating, c^(a + b*x) by scaling and the polynomials
+// of a + b*x by forward differences, the rest of the formula is evaluated as usual.
+// Every STEP_ANCHOR samples the recurrences are anchored again by a full evaluation,
+// so their errors never pile up
+
+#define STEP_ANCHOR 32
+
+// The plan of the graph being stepped, every evaluation context has its own (see eval_ctx)
+typedef struct stepper_s stepper_s;
+void stepper_free(stepper_s* plan);
+
+// Plans the incremental evaluation of the formula on the grid,
+// fails if the formula has nothing worth stepping (it is then computed the usual way)
+error_t stepper_plan(formula_s* formula, double start, double step);
+
+// Computes the samples first ... first+n-1 of the planned grid, xs are their x values
+error_t stepper_batch(const double* xs, double* ys, size_t first, size_t n);
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+
+// Vectorized elementary functions for the batch evaluator, built on simd.h.
+// "set mathmode" picks the accuracy (settings.fastmath) :
+//     exact - within about 1 ulp of libm (pow is left to libm)
+//     fast - about 1e-7 relative error, shorter polynomials and pow as exp(y*log(x)) (about |y*log(x)| times worse)
+// The arguments the polynomials don't cover (huge, infinite, NaN, nonpositive for log ...)
+// still go to libm, so the special cases behave exactly the same in both modes.
+// out can be the same array as in (the cfunc_s batch entry points of the built in functions)
+
+void vm_sin(const double* in, double* out, size_t n);
+void vm_cos(const double* in, double* out, size_t n);
+void vm_tan(const double* in, double* out, size_t n);
+void vm_exp(const double* in, double* out, size_t n);
+void vm_log(const double* in, double* out, size_t n);
+void vm_sqrt(const double* in, double* out, size_t n);
+void vm_abs(const double* in, double* out, size_t n);
+
+// dst = a^b, dst can be the same array as a or b
+void vm_pow(double* dst, const double* a, const double* b, size_t n);
+
+// The complex versions, re and im are the parts of the arguments (split arrays), replaced by the results,
+// log and sqrt are the principal branches (cut along the negative real axis)
+void vm_cexp(double* re, double* im, size_t n);
+void vm_clog(double* re, double* im, size_t n);
+void vm_csqrt(double* re, double* im, size_t n);
+void vm_csin(double* re, double* im, size_t n);
+void vm_ccos(double* re, double* im, size_t n);
+void vm_ctan(double* re, double* im, size_t n);
+void vm_cabs(double* re, double* im, size_t n);
+void vm_csgn(double* re, double* im, size_t n);
@@ -0,0 +1,303 @@
+#include "aot.h"
+#include "compiler.h"
+#include "parser.h" // BATCH_LANES, eval_allocations
+#include "console.h" // console colors
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <dlfcn.h>
+
+#define AOT_SYMBOL "japlot_kernel"
+#define AOT_HASH_SYMBOL "japlot_kernel_hash"
+
+// The functions the generated code can't get from libm
+static const char prelude[] =
+    "// Generated by JaPlot (the compile command), the batch kernel of a single formula\n"
+    "#include <math.h>\n"
+    "#include <stddef.h>\n\n"
+    "static double jp_sgn(double x) { return x > 0.0 ? 1.0 : x < 0.0 ? -1.0 : 0.0; }\n\n"
+    "// the same exponentiation by squaring as the interpreter, the exponent is always a constant\n"
+    "static inline double jp_powi(double x, int n) {\n"
+    "    unsigned k = n < 0 ? -(unsigned)n : (unsigned)n;\n"
+    "    double res = 1.0;\n"
+    "    while (k) {\n"
+    "        if (k & 1) res *= x;\n"
+    "        x *= x;\n"
+    "        k >>= 1;\n"
+    "    }\n"
+    "    return n < 0 ? 1.0/res : res;\n"
+    "}\n\n"
+    "// a NaN operand (or condition) gives NaN, the ternaries are left for gcc to turn into blends\n"
+    "static inline double jp_cmp(int holds, double a, double b) { return isnan(a) || isnan(b) ? NAN : holds; }\n"
+    "static inline double jp_if(double c, double a, double b) { return isnan(c) ? NAN : c != 0.0 ? a : b; }\n\n";
+
+typedef struct textbuf {
+    char* str;
+    size_t len, cap;
+} textbuf;
+
+static void append(textbuf* buf, const char* fmt, ...) {
+    va_list args;
+
+    for (;;) {
+        va_start(args, fmt);
+        int n = vsnprintf(buf->str+buf->len, buf->cap-buf->len, fmt, args);
+        va_end(args);
+
+        if (buf->len+n < buf->cap) {
+            buf->len += n;
+            return;
+        }
+
+        buf->cap = buf->cap*2 > buf->len+n+1 ? buf->cap*2 : buf->len+n+1;
+        buf->str = realloc(buf->str, buf->cap);
+    }
+}
+
+// hex floats are exact, the compiled code sees the very same constants as the interpreter
+static void append_num(textbuf* buf, double num) {
+    if (isnan(num)) append(buf, "NAN");
+    else if (isinf(num)) append(buf, num > 0 ? "INFINITY" : "-INFINITY");
+    else append(buf, "%a", num);
+}
+
+// the variables become the arguments after x, in the order the code reads them first
+static int var_index(const double** vars, size_t* numvars, const double* val) {
+    for (size_t i = 0; i < *numvars; i++)
+        if (vars[i] == val) return i;
+
+    if (*numvars == AOT_MAXVARS) return -1;
+
+    vars[*numvars] = val;
+    return (*numvars)++;
+}
+
+static const char* c_operator(int op) {
+    switch (op) {
+        case OC_ADD : return "+";
+        case OC_SUB : return "-";
+        case OC_MULT: return "*";
+        default : return "/";
+    }
+}
+
+// indexed by the CMP_ kinds
+static const char* const c_compare[] = {"<", "<=", ">", ">=", "==", "!="};
+
+// Every instruction becomes a constant, gcc does the register allocation
+static error_t generate(const formula_s* formula, textbuf* buf, const double** vars, size_t* numvars) {
+    int* stack = malloc(formula->numcode*sizeof(int));
+    size_t height = 0;
+    *numvars = 0;
+
+    for (size_t i = 0; i < formula->numcode; i++) {
+        const instr* in = &formula->code[i];
+        const int a = height >= 2 ? stack[height-2] : -1, b = height >= 1 ? stack[height-1] : -1;
+
+        append(buf, "        const double t%lu = ", i);
+
+        switch (in->op) {
+            case OC_NUM : append_num(buf, in->num); height++; break;
+            case OC_X : append(buf, "in[i]"); height++; break;
+            case OC_I : append_num(buf, NAN); height++; break;
+            case OC_VAR : {
+                int k = var_index(vars, numvars, in->val);
+                if (k < 0) {
+                    error_throw_val("the formula reads more than %ld variables", AOT_MAXVARS);
+                    goto fail;
+                }
+
+                append(buf, "in[%d*n+i]", k+1);
+                height++;
+            } break;
+
+            case OC_ADD : case OC_SUB : case OC_MULT : case OC_DIV :
+                append(buf, "t%d %s t%d", a, c_operator(in->op), b);
+                height--;
+            break;
+            case OC_MOD : append(buf, "fmod(t%d, t%d)", a, b); height--; break;
+            case OC_POW : append(buf, "pow(t%d, t%d)", a, b); height--; break;
+            case OC_NEG : append(buf, "-t%d", b); break;
+            case OC_CMP : append(buf, "jp_cmp(t%d %s t%d, t%d, t%d)", a, c_compare[(int)in->num], b, a, b); height--; break;
+            case OC_SELECT :
+                append(buf, "jp_if(t%d, t%d, t%d)", stack[height-3], a, b);
+                height -= 2;
+            break;
+            case OC_POWI: append(buf, "jp_powi(t%d, %d)", b, (int)in->num); break;
+            case OC_POLY:
+                // Horner's scheme written out, ((c_n*t + c_n-1)*t + ...)
+                for (unsigned k = 0; k < in->poly->degree; k++) append(buf, "(");
+                append_num(buf, in->poly->coeffs[in->poly->degree]);
+                for (unsigned k = in->poly->degree; k-- > 0; ) {
+                    append(buf, "*t%d + ", b);
+                    append_num(buf, in->poly->coeffs[k]);
+                    append(buf, ")");
+                }
+            break;
+
+            case OC_CFUNC :
+                if (in->call->cname == NULL) {
+                    error_throw("plugin functions can't be compiled");
+                    goto fail;
+                }
+
+                append(buf, "%s(t%d)", in->call->cname, b);
+            break;
+            case OC_CALL :
+                error_throw("plugin functions can't be compiled");
+                goto fail;
+            case OC_FUNC :
+                error_throw("a user function couldn't be inlined");
+                goto fail;
+            case OC_SERIES :
+                error_throw("sums and products can't be compiled");
+                goto fail;
+            case OC_RAND :
+                error_throw("random numbers can't be compiled");
+                goto fail;
+            case OC_ARRAY :
+                error_throw("arrays can't be compiled");
+                goto fail;
+            default :
+                error_throw("unknown instruction");
+                goto fail;
+        }
+
+        append(buf, ";\n");
+        stack[height-1] = i;
+    }
+
+    append(buf, "        out[i] = t%d;\n", stack[0]);
+
+    free(stack);
+    return ERROR_CODE_OK;
+
+    fail :
+    free(stack);
+    return ERROR_CODE_FAIL;
+}
+
+static error_t source(const formula_s* formula, textbuf* buf, unsigned long long* hash, const double** vars, size_t* numvars) {
+    if (formula->code == NULL) {
+        error_throw("the formula isn't compiled");
+        return ERROR_CODE_FAIL;
+    }
+
+    textbuf body = {malloc(1024), 0, 1024};
+    if (ERROR_FAIL(generate(formula, &body, vars, numvars))) {
+        free(body.str);
+        return ERROR_CODE_FAIL;
+    }
+
+    buf->len = 0;
+    append(buf, "%s", prelude);
+    append(buf, "const unsigned japlot_kernel_arity = %lu;\n\n", *numvars+1);
+    append(buf, "// in[k*n+i] is the argument k of the lane i, x is the argument 0\n");
+    append(buf, "void "AOT_SYMBOL"(const double* restrict in, double* restrict out, size_t n) {\n");
+    append(buf, "    for (size_t i = 0; i < n; i++) {\n%s    }\n}\n", body.str);
+    free(body.str);
+
+    // FNV-1a, 64 bits so that the cached libraries practically never collide
+    unsigned long long h = 14695981039346656037ULL;
+    for (size_t i = 0; i < buf->len; i++) {
+        h ^= (unsigned char)buf->str[i];
+        h *= 1099511628211ULL;
+    }
+
+    // the library carries the hash of the source it was built from, a stale one is never taken for the formula
+    append(buf, "\nconst unsigned long long "AOT_HASH_SYMBOL" = 0x%016llxULL;\n", h);
+
+    *hash = h;
+    return ERROR_CODE_OK;
+}
+
+error_t aot_source(const formula_s* formula, char** str, unsigned long long* hash) {
+    textbuf buf = {malloc(4096), 0, 4096};
+    const double* vars[AOT_MAXVARS];
+    size_t numvars;
+
+    if (ERROR_FAIL(source(formula, &buf, hash, vars, &numvars))) {
+        free(buf.str);
+        return ERROR_CODE_FAIL;
+    }
+
+    *str = buf.str;
+    return ERROR_CODE_OK;
+}
+
+error_t aot_load(formula_s* formula, const char* path) {
+    aot_kernel kernel = {0};
+
+    textbuf buf = {malloc(4096), 0, 4096};
+    error_t retval = source(formula, &buf, &kernel.hash, kernel.vars, &kernel.numvars);
+    free(buf.str);
+
+    if (ERROR_FAIL(retval))
+        return ERROR_CODE_FAIL;
+
+    kernel.library = dlopen(path, RTLD_NOW);
+    if (kernel.library == NULL) {
+        error_throw_str("the compiled library "ANSI_COLOR_YELLOW"'%s'"ANSI_COLOR_RESET" couldn't be loaded", path);
+        return ERROR_CODE_FAIL;
+    }
+
+    kernel.batch = (void (*)(const double*, double*, size_t))dlsym(kernel.library, AOT_SYMBOL);
+    const unsigned* arity = dlsym(kernel.library, "japlot_kernel_arity");
+    const unsigned long long* hash = dlsym(kernel.library, AOT_HASH_SYMBOL);
+
+    if (kernel.batch == NULL || arity == NULL || *arity != kernel.numvars+1 || hash == NULL || *hash != kernel.hash) {
+        dlclose(kernel.library);
+        error_throw_str("the compiled library "ANSI_COLOR_YELLOW"'%s'"ANSI_COLOR_RESET" doesn't match the formula", path);
+        return ERROR_CODE_FAIL;
+    }
+
+    aot_free(formula);
+
+    formula->native = malloc(sizeof(aot_kernel));
+    memcpy(formula->native, &kernel, sizeof(aot_kernel));
+    eval_allocations++;
+
+    return ERROR_CODE_OK;
+}
+
+void aot_rebind(formula_s* formula) {
+    aot_kernel* kernel = formula->native;
+    if (kernel == NULL) return;
+
+    // the variables could have moved, but the same source means the same computation
+    textbuf buf = {malloc(4096), 0, 4096};
+    unsigned long long hash;
+    if (ERROR_FAIL(source(formula, &buf, &hash, kernel->vars, &kernel->numvars)) || hash != kernel->hash)
+        aot_free(formula);
+
+    free(buf.str);
+}
+
+void aot_batch(const formula_s* formula, const double* xs, double* ys, size_t n) {
+    const aot_kernel* kernel = formula->native;
+    double in[(AOT_MAXVARS+1)*BATCH_LANES];
+
+    for (size_t done = 0; done < n; done += BATCH_LANES) {
+        size_t m = n-done < BATCH_LANES ? n-done : BATCH_LANES;
+
+        // xs and ys can be the same array, the kernel wants them apart
+        memcpy(in, xs+done, m*sizeof(double));
+        for (size_t k = 0; k < kernel->numvars; k++)
+            for (size_t i = 0; i < m; i++)
+                in[(k+1)*m+i] = *kernel->vars[k];
+
+        kernel->batch(in, ys+done, m);
+    }
+}
+
+void aot_free(formula_s* formula) {
+    aot_kernel* kernel = formula->native;
+    if (kernel == NULL) return;
+
+    dlclose(kernel->library);
+    free(kernel);
+    formula->native = NULL;
+}
@@ -0,0 +1,84 @@
+#include "arena.h"
+
+#include <stdlib.h>
+
+#define ARENA_ALIGN 32LU // enough for AVX loads
+#define ARENA_CHUNK_MINSIZE (64LU*1024LU)
+
+typedef struct arena_chunk {
+    struct arena_chunk* next;
+    size_t cap, used;
+    _Alignas(ARENA_ALIGN) unsigned char data[];
+} arena_chunk;
+
+static arena_chunk* chunk_create(arena_s* arena, size_t size) {
+    size_t cap = size < ARENA_CHUNK_MINSIZE ? ARENA_CHUNK_MINSIZE : size;
+
+    arena_chunk* chunk = aligned_alloc(ARENA_ALIGN, (sizeof(arena_chunk)+cap+ARENA_ALIGN-1) & ~(ARENA_ALIGN-1));
+    if (chunk == NULL) return NULL;
+
+    chunk->next = NULL;
+    chunk->cap = cap;
+    chunk->used = 0;
+
+    arena->allocations++;
+    return chunk;
+}
+
+void* arena_alloc(arena_s* arena, size_t size) {
+    size = (size+ARENA_ALIGN-1) & ~(ARENA_ALIGN-1);
+
+    if (arena->curr == NULL) {
+        if (arena->first == NULL && (arena->first = chunk_create(arena, size)) == NULL)
+            return NULL;
+
+        arena->curr = arena->first;
+        arena->curr->used = 0;
+    }
+
+    // try the current chunk first, then the ones left over from the previous use
+    while (arena->curr->used+size > arena->curr->cap) {
+        arena_chunk* next = arena->curr->next;
+
+        if (next != NULL && next->cap < size) {
+            // too small to ever be useful for this size, replace it
+            arena->curr->next = next->next;
+            free(next);
+            next = NULL;
+        }
+
+        if (next == NULL) {
+            if ((next = chunk_create(arena, size > arena->curr->cap*2 ? size : arena->curr->cap*2)) == NULL)
+                return NULL;
+
+            next->next = arena->curr->next;
+            arena->curr->next = next;
+        }
+
+        arena->curr = next;
+        arena->curr->used = 0;
+    }
+
+    void* ptr = arena->curr->data + arena->curr->used;
+    arena->curr->used += size;
+    return ptr;
+}
+
+arena_mark arena_save(const arena_s* arena) {
+    return (arena_mark){arena->curr, arena->curr ? arena->curr->used : 0};
+}
+
+void arena_restore(arena_s* arena, arena_mark mark) {
+    arena->curr = mark.chunk;
+    if (arena->curr != NULL)
+        arena->curr->used = mark.used;
+}
+
+void arena_destroy(arena_s* arena) {
+    for (arena_chunk* chunk = arena->first, *next; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
+
+    arena->first = arena->curr = NULL;
+}
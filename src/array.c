@@ -0,0 +1,50 @@
+#include "array.h"
+#include "error.h"
+
+#include <stdlib.h>
+
+array_s* array_create(size_t length) {
+    if (length > ARRAY_MAXLENGTH) {
+        error_throw_val("the maximum length of an array is %lu", ARRAY_MAXLENGTH);
+        return NULL;
+    }
+
+    array_s* array = malloc(sizeof(array_s));
+    double* data = malloc((length ? length : 1)*sizeof(double));
+
+    if (array == NULL || data == NULL) {
+        free(array);
+        free(data);
+        error_throw("not enough memory for the array");
+        return NULL;
+    }
+
+    array->data = data;
+    array->length = length;
+    array->refs = 1;
+    return array;
+}
+
+array_s* array_linspace(double from, double to, size_t count) {
+    array_s* array = array_create(count);
+    if (array == NULL) return NULL;
+
+    // from the nearer end, so both of them come out exact
+    const double step = count > 1 ? (to-from)/(count-1) : 0.0;
+    for (size_t i = 0; i < count; i++)
+        array->data[i] = i < count/2 ? from + i*step : to - (count-1-i)*step;
+
+    return array;
+}
+
+array_s* array_retain(array_s* array) {
+    array->refs++;
+    return array;
+}
+
+void array_release(array_s* array) {
+    if (array == NULL || --array->refs != 0) return;
+
+    free(array->data);
+    free(array);
+}
@@ -0,0 +1,113 @@
+#include "cache.h"
+#include "compiler.h" // formula_free
+#include "parser.h" // lex
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h> // isspace
+
+#define CACHE_SLOTS 256 // direct mapped, an expression hashing to a taken slot replaces the old one
+
+typedef struct cache_entry {
+    char* text; // normalized, NULL if the slot is empty
+    unsigned hash;
+    formula_s formula;
+} cache_entry;
+
+static cache_entry slots[CACHE_SLOTS];
+static size_t hits = 0, recompiled = 0, misses = 0, entries = 0;
+
+// the normalized text of the expression being looked up
+static char* normbuf = NULL;
+static size_t normcap = 0;
+
+// these are always tokens of their own, spaces next to them don't matter
+static _Bool is_operator(char c) {
+    return c != '\0' && strchr("+-*/^(),", c) != NULL;
+}
+
+// Strips the spaces the lexer ignores, the ones separating two tokens become a single space
+static unsigned normalize(const char* str) {
+    size_t len = strlen(str);
+    if (len+1 > normcap) {
+        free(normbuf);
+        normcap = len+1 > 2*normcap ? len+1 : 2*normcap;
+        normbuf = malloc(normcap);
+    }
+
+    char* out = normbuf;
+    while (isspace((unsigned char)*str)) str++;
+
+    while (*str != '\0') {
+        if (!isspace((unsigned char)*str)) {
+            *out++ = *str++;
+            continue;
+        }
+
+        while (isspace((unsigned char)*str)) str++;
+        if (*str != '\0' && !is_operator(*str) && !is_operator(out[-1])) *out++ = ' ';
+    }
+
+    *out = '\0';
+
+    // FNV-1a
+    unsigned hash = 2166136261u;
+    for (const char* c = normbuf; *c; c++) {
+        hash ^= (unsigned char)*c;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+formula_s* cache_formula(const char* str) {
+    if (str == NULL) {
+        error_throw("no input specified");
+        return NULL;
+    }
+
+    const unsigned hash = normalize(str);
+    cache_entry* e = &slots[hash % CACHE_SLOTS];
+
+    if (e->text != NULL && e->hash == hash && strcmp(e->text, normbuf) == 0) {
+        hits++;
+        if (e->formula.code != NULL && e->formula.generation != object_generation) recompiled++;
+
+        return &e->formula;
+    }
+
+    misses++;
+
+    formula_s formula = lex(normbuf);
+    if (formula.toks == NULL) return NULL;
+
+    if (e->text != NULL) {
+        formula_free(&e->formula);
+        free(e->text);
+    } else
+        entries++;
+
+    *e = (cache_entry){strdup(normbuf), hash, formula};
+    return &e->formula;
+}
+
+void cache_stats(size_t* h, size_t* r, size_t* m, size_t* n) {
+    *h = hits;
+    *r = recompiled;
+    *m = misses;
+    *n = entries;
+}
+
+void cache_destroy() {
+    for (size_t i = 0; i < CACHE_SLOTS; i++)
+        if (slots[i].text != NULL) {
+            formula_free(&slots[i].formula);
+            free(slots[i].text);
+            slots[i].text = NULL;
+        }
+
+    free(normbuf);
+    normbuf = NULL;
+    normcap = 0;
+    entries = 0;
+}
@@ -0,0 +1,385 @@
+#include "compiler.h"
+#include "parser.h" // eval_allocations
+#include "console.h" // settings
+#include "jit.h"
+#include "aot.h"
+#include "eval.h" // frame_s, the formulas being compiled
+#include "error.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#define COMPILE_MAXSERIES 16 // sums inside of sums ... this deep (the lexer has the same limit)
+
+// the bytecode equivalents of the lexer operators (defined in parser.h)
+static const int opcodes[] = {OC_ADD, OC_SUB, OC_MULT, OC_DIV, OC_MOD, OC_POW, -1, -1, OC_NEG, -1, -1,
+                              OC_CMP, OC_CMP, OC_CMP, OC_CMP, OC_CMP, OC_CMP};
+
+// the code is up to date and was compiled against the local names of the current context
+static _Bool formula_ready(const formula_s* formula, _Bool bind_x) {
+    // without any local names, the shape doesn't matter
+    const frame_s* frame = &eval_current()->frame;
+    const _Bool same_frame = formula->framesize == frame->numbindings && (frame->numbindings == 0 || formula->frame == frame->shape);
+
+    return formula->code != NULL && formula->generation == object_generation && formula->bound_x == bind_x && same_frame;
+}
+
+// The function object the code of the current context calls, a context with a snapshot runs next to other threads
+// which may be running the same function, so it compiles a copy of its own if the shared code doesn't fit its names
+static formula_s* context_function(formula_s* func) {
+    eval_ctx* ctx = eval_current();
+    if (ctx->objects == NULL || formula_ready(func, 1))
+        return func;
+
+    // one copy per function, a recursive call then finds the copy being compiled
+    for (size_t i = 0; i < ctx->numfunctions; i++)
+        if (ctx->functions[i].shared == func) return ctx->functions[i].copy;
+
+    formula_s* copy = calloc(1, sizeof(formula_s));
+    copy->toks = malloc(func->numtoks*sizeof(token));
+    memcpy(copy->toks, func->toks, func->numtoks*sizeof(token));
+    copy->numtoks = func->numtoks;
+    copy->depth = func->depth;
+
+    ctx->functions = realloc(ctx->functions, (ctx->numfunctions+1)*sizeof(function_copy));
+    ctx->functions[ctx->numfunctions++] = (function_copy){func, copy};
+    eval_allocations += 3;
+
+    return copy;
+}
+
+// Looks up the object behind a name token, this is the only place where the trie gets touched
+static error_t resolve(instr* in, const token* tok, _Bool bind_x) {
+
+    if (bind_x && tok->type == TT_VARIABLE && strcmp(tok->name, "x") == 0) {
+        in->op = OC_X;
+        return ERROR_CODE_OK;
+    }
+
+    // a reserved name like x, but it doesn't depend on the argument
+    if (tok->type == TT_VARIABLE && strcmp(tok->name, "i") == 0) {
+        in->op = OC_I;
+        return ERROR_CODE_OK;
+    }
+
+    // the local names shadow the objects, the latest binding first
+    frame_s* frame = &eval_current()->frame;
+    if (tok->type == TT_VARIABLE)
+        for (size_t k = frame->numbindings; k-- > 0; ) {
+            binding_s* binding = &frame->bindings[k];
+            if (strcmp(binding->name, tok->name) != 0) continue;
+
+            if (binding->array != NULL) {
+                in->op = OC_ARRAY;
+                in->array = &binding->array;
+            } else {
+                in->op = OC_VAR;
+                in->val = &binding->val;
+            }
+
+            return ERROR_CODE_OK;
+        }
+
+    // so are the sums and the products, the lexer has already checked the index
+    if (tok->type == TT_FUNCTION && (strcmp(tok->name, "sum") == 0 || strcmp(tok->name, "prod") == 0)) {
+        in->op = OC_SERIES;
+        return ERROR_CODE_OK;
+    }
+
+    // the conditional is built in, the optimizer and every evaluator treat it on its own
+    if (tok->type == TT_FUNCTION && strcmp(tok->name, "if") == 0) {
+        in->op = OC_SELECT;
+        return ERROR_CODE_OK;
+    }
+
+    // the random draws have no argument, every evaluation of the instruction is a new draw
+    if (tok->type == TT_FUNCTION && (strcmp(tok->name, "rand") == 0 || strcmp(tok->name, "randn") == 0)) {
+        in->op = OC_RAND;
+        in->num = strcmp(tok->name, "rand") == 0 ? RAND_UNIFORM : RAND_NORMAL;
+        return ERROR_CODE_OK;
+    }
+
+    object* obj;
+    if (ERROR_FAIL(object_get(tok->name, &obj)))
+        return ERROR_CODE_FAIL;
+
+    switch (tok->type) {
+        case TT_VARIABLE :
+            // the arrays are read element by element, the handle stays valid when modif replaces the array
+            if (obj->type == OT_ARRAY) {
+                in->op = OC_ARRAY;
+                in->array = obj->array;
+                break;
+            }
+
+            if (obj->type != OT_VARIABLE && obj->type != OT_CONSTANT) {
+                error_throw_str("%s is not a variable", tok->name);
+                return ERROR_CODE_FAIL;
+            }
+
+            // constants can never change, so they are just numbers from now on
+            if (obj->type == OT_CONSTANT) {
+                in->op = OC_NUM;
+                in->num = *obj->val;
+            } else {
+                in->op = OC_VAR;
+                in->val = obj->val;
+            }
+        break;
+        case TT_FUNCTION :
+            if (obj->type == OT_CFUNC) {
+                in->flags = (obj->cfunc->flags & JP_PURE ? IF_PURE : 0) | (obj->cfunc->flags & JP_THREADSAFE ? IF_THREADSAFE : 0);
+
+                // the plain functions are called directly, the rest goes through the plugin entry points
+                in->op = obj->cfunc->func != NULL ? OC_CFUNC : OC_CALL;
+                in->call = obj->cfunc;
+            } else if (obj->type == OT_FUNCTION) {
+                in->op = OC_FUNC;
+                in->func = context_function(obj->func);
+            } else {
+                error_throw_str("%s is not a function", tok->name);
+                return ERROR_CODE_FAIL;
+            }
+        break;
+        default :
+            error_throw("unknown type token");
+            return ERROR_CODE_FAIL;
+        break;
+    }
+
+    return ERROR_CODE_OK;
+}
+
+static error_t compile(formula_s* formula, _Bool bind_x);
+
+// The loops are owned by the formula, the optimizer hands them over to the optimized code
+static series_s* add_series(formula_s* formula, const char* name) {
+    series_s* series = calloc(1, sizeof(series_s));
+    memcpy(series->name, name, NAME_MAXLEN);
+
+    formula->series = realloc(formula->series, (formula->numseries+1)*sizeof(series_s*));
+    formula->series[formula->numseries++] = series;
+    eval_allocations += 2;
+
+    return series;
+}
+
+error_t formula_compile(formula_s* formula, _Bool bind_x) {
+    eval_ctx* ctx = eval_current();
+
+    for (size_t i = 0; i < ctx->numcompiling; i++)
+        if (ctx->compiling[i] == formula) {
+            error_throw("recursive function call");
+            return ERROR_CODE_FAIL;
+        }
+
+    if (ctx->numcompiling == COMPILE_MAXNESTING) {
+        error_throw("functions nested too deep");
+        return ERROR_CODE_FAIL;
+    }
+
+    ctx->compiling[ctx->numcompiling++] = formula;
+    error_t retval = compile(formula, bind_x);
+    ctx->numcompiling--;
+
+    return retval;
+}
+
+static error_t compile(formula_s* formula, _Bool bind_x) {
+    if (formula->toks == NULL) {
+        error_throw("invalid formula");
+        return ERROR_CODE_FAIL;
+    }
+
+    free(formula->code);
+    formula->code = NULL;
+    formula->numcode = 0;
+    formula_free_polys(formula);
+    formula_free_series(formula);
+
+    jit_free(formula->jit, formula->jitsize);
+    formula->jit = NULL;
+
+    instr* code = malloc((formula->numtoks+1)*sizeof(instr));
+    eval_allocations++;
+
+    // The stack height is tracked here, so the evaluation doesn't have to check anything
+    size_t height = 0, numcode = 0;
+
+    // the sums whose term is being compiled, with the stack height below their bounds
+    size_t open[COMPILE_MAXSERIES], heights[COMPILE_MAXSERIES], numopen = 0;
+
+    for (size_t i = 0; i < formula->numtoks; i++) {
+        const token* tok = &formula->toks[i];
+        instr* in = &code[numcode++];
+        in->flags = 0;
+
+        switch (tok->type) {
+            case TT_NUMBER :
+                in->op = OC_NUM;
+                in->num = tok->num;
+                height++;
+            break;
+            case TT_OPERATOR : {
+                size_t operands = tok->oper == OP_NEG ? 1 : 2;
+                if (height < operands) {
+                    error_throw("insufficent operand count");
+                    goto fail;
+                }
+
+                if (opcodes[tok->oper] < 0) {
+                    error_throw("unknown operator");
+                    goto fail;
+                }
+
+                in->op = opcodes[tok->oper];
+                if (in->op == OC_CMP) in->num = tok->oper-OP_LT;
+                height -= operands-1;
+            } break;
+            case TT_VARIABLE :
+                if (ERROR_FAIL(resolve(in, tok, bind_x)))
+                    goto fail;
+                height++;
+            break;
+            case TT_BIND :
+                // the loop instruction goes between the bounds and the term, its length is known at the end of the term
+                if (height < 2 || numopen == COMPILE_MAXSERIES) {
+                    error_throw_str("%s can't be bound here", tok->name);
+                    goto fail;
+                }
+
+                in->op = OC_SERIES;
+                in->series = add_series(formula, tok->name);
+                height -= 2;
+
+                heights[numopen] = height;
+                open[numopen++] = numcode-1;
+            break;
+            case TT_INDEX : {
+                size_t k = numopen;
+                while (k-- > 0 && strcmp(code[open[k]].series->name, tok->name) != 0);
+
+                if (k == (size_t)-1) {
+                    error_throw_str("%s is outside of its sum", tok->name);
+                    goto fail;
+                }
+
+                in->op = OC_VAR;
+                in->val = &code[open[k]].series->k;
+                height++;
+            } break;
+            case TT_FUNCTION : {
+                if (ERROR_FAIL(resolve(in, tok, bind_x)))
+                    goto fail;
+
+                // the end of the term, the sum itself is the OC_SERIES before it
+                if (in->op == OC_SERIES) {
+                    if (numopen == 0 || height != heights[numopen-1]+1) {
+                        error_throw_str("%s(index, from, to, term) expected", tok->name);
+                        goto fail;
+                    }
+
+                    series_s* series = code[open[--numopen]].series;
+                    series->product = strcmp(tok->name, "prod") == 0;
+                    series->len = numcode-1 - open[numopen]-1;
+                    numcode--;
+                    break;
+                }
+
+                // the stack height alone would let the arguments of neighbouring calls mix, "sin(1,2)+hypot(x)"
+                size_t arity = in->op == OC_CALL ? in->call->arity : in->op == OC_SELECT ? 3 : in->op == OC_RAND ? 0 : 1;
+                if (tok->args != arity) {
+                    error_throw_str(tok->args < arity ? "not enough arguments for %s" : "too many arguments for %s", tok->name);
+                    goto fail;
+                }
+
+                if (height < arity) {
+                    error_throw_str("not enough arguments for %s", tok->name);
+                    goto fail;
+                }
+
+                height = height+1 - arity; // the draws take nothing and leave a value
+            } break;
+            default :
+                error_throw("unknown type token");
+                goto fail;
+            break;
+        }
+    }
+
+    if (numopen > 0) {
+        error_throw_str("%s isn't summed up", code[open[numopen-1]].series->name);
+        goto fail;
+    }
+
+    if (height != 1) {
+        error_throw(height > 1 ? "insufficent operator count" : "insufficent operand count");
+        goto fail;
+    }
+
+    formula->code = code;
+    formula->numcode = numcode;
+
+    if (ERROR_FAIL(formula_optimize(formula))) {
+        free(formula->code);
+        formula->code = NULL;
+        formula->numcode = 0;
+        return ERROR_CODE_FAIL;
+    }
+
+    formula->generation = object_generation;
+    formula->frame = eval_current()->frame.shape;
+    formula->framesize = eval_current()->frame.numbindings;
+    formula->bound_x = bind_x;
+
+    formula->vectormath = formula->uses_i = formula->uses_arrays = 0;
+    for (size_t i = 0; i < formula->numcode; i++) {
+        const instr* in = &formula->code[i];
+        formula->vectormath |= in->op == OC_POW || (in->op == OC_CFUNC && in->call->batch != NULL);
+        formula->uses_i |= in->op == OC_I || (in->op == OC_FUNC && in->func->uses_i);
+        formula->uses_arrays |= in->op == OC_ARRAY || (in->op == OC_FUNC && in->func->uses_arrays);
+    }
+
+    if (settings.jit)
+        formula->jit = jit_compile(formula, &formula->jitsize);
+
+    aot_rebind(formula);
+
+    return ERROR_CODE_OK;
+
+    fail :
+    free(code);
+    formula_free_series(formula);
+    return ERROR_CODE_FAIL;
+}
+
+error_t formula_prepare(formula_s* formula, _Bool bind_x) {
+    if (formula_ready(formula, bind_x))
+        return ERROR_CODE_OK;
+
+    return formula_compile(formula, bind_x);
+}
+
+// calls are an order of magnitude more expensive than arithmetic
+unsigned instr_cost(const instr* in) {
+    switch (in->op) {
+        case OC_CFUNC : case OC_FUNC : case OC_CALL : case OC_POW : case OC_MOD : return 16;
+        case OC_POWI : case OC_SELECT : case OC_SERIES : return 2; // the terms of a sum count on their own
+        case OC_POLY : return 2*in->poly->degree;
+        default : return 1;
+    }
+}
+
+void formula_free(formula_s* formula) {
+    free(formula->toks);
+    free(formula->code);
+    formula_free_polys(formula);
+    formula_free_series(formula);
+    jit_free(formula->jit, formula->jitsize);
+    aot_free(formula);
+
+    formula->toks = NULL;
+    formula->code = NULL;
+    formula->jit = NULL;
+    formula->numtoks = formula->numcode = 0;
+}
@@ -2,9 +2,17 @@
 #include "dash/vector.h"
 
 #include "parser.h" // lex
+#include "compiler.h" // formula_free
+#include "dag.h" // dag_stats
+#include "cache.h" // cache_formula
+#include "aot.h" // aot_source
+#include "plot.h" // graph_stats
 #include "error.h" // error_catch
 #include "console.h" // settings
 #include "objects.h" // var_add etc.
+#include "rng.h" // set seed
+#include "array.h" // array objects and data sets
+#include "eval.h" // the contexts of the Monte Carlo workers
 
 #include "renderer.h" // accessing the camera
 
@@ -13,14 +21,28 @@
 
 #include <stdlib.h> //random (random colors)
 #include <time.h>
+#include <math.h> // fabs, isfinite
+#include <float.h> // DBL_MIN
 
 #include <ctype.h> // isspace
 
 #include <dlfcn.h> // dynamic loading (plugins)
+#ifdef _WIN32
+    #include <direct.h> // _mkdir
+    #include <process.h> // getpid
+#else
+    #include <sys/stat.h> // mkdir, the owner of the compiled graphs' folder
+    #include <unistd.h> // getuid, getpid
+#endif
+#include <pthread.h> // the console thread and the Monte Carlo workers
+#include "japlot_plugin.h"
 
 //static const char* whitespace = " \t\n\v\f\r";
 
 settings_s settings = {
+    .jit = 1,
+    .stepping = 1,
+    .kahan = 1,
     .grid_size = 1.0,
     .cam_movespeed = 0.10,
     .cam_scalespeed = 1.05,
@@ -132,8 +154,9 @@ static error_t safe_lex(const char* func, formula_s *formula, _Bool should_valid
         return ERROR_CODE_FAIL;
     }
 
-    if (should_validate && ERROR_FAIL(validate(*formula))) {
+    if (should_validate && ERROR_FAIL(validate(formula))) {
         ERROR_MSG("verifying");
+        formula_free(formula);
         return ERROR_CODE_FAIL;
     }
 
@@ -143,8 +166,9 @@ static error_t safe_lex(const char* func, formula_s *formula, _Bool should_valid
 static error_t safe_compute(const char* func, double* result) {
     ASSERT(func, "missing function definition");
 
-    formula_s formula = lex(func);
-    if (formula.toks == NULL) { 
+    // scripts compute the same expressions over and over, the cache only lexes them once
+    formula_s* formula = cache_formula(func);
+    if (formula == NULL) { 
         ERROR_MSG("lexing");
         return ERROR_CODE_FAIL;
     }
@@ -152,12 +176,9 @@ static error_t safe_compute(const char* func, double* result) {
     double val;
     if (ERROR_FAIL(compute(&val, formula, NULL))) {
         ERROR_MSG("computing");
-
-        free(formula.toks);
         return ERROR_CODE_FAIL;
     }
 
-    free(formula.toks);
     *result = val;
     return ERROR_CODE_OK;
 }
@@ -194,17 +215,132 @@ static error_t safe_getobj(object** dst, const char* name) {
     return ERROR_CODE_OK;
 }
 
+// Splits "name(a,b,c)" in buf into the arguments, returns how many there are,
+// 0 if the whole expression isn't a call of name
+static size_t call_args(const char* str, const char* name, char* buf, char** args, size_t max) {
+    const size_t len = strlen(name), end = strlen(str);
+    if (strncmp(str, name, len) != 0 || str[len] != '(' || str[end-1] != ')' || end >= COMMAND_MAXLEN) return 0;
+
+    strcpy(buf, str+len+1);
+    buf[end-len-2] = '\0';
+
+    size_t numargs = 0;
+    int depth = 0;
+    args[numargs++] = buf;
+
+    for (char* c = buf; *c; c++) {
+        if (*c == '(') depth++;
+        else if (*c == ')' && --depth < 0) return 0; // "name(a)+f(b)" ends with a bracket too
+        else if (*c == ',' && depth == 0) {
+            if (numargs == max) return max+1;
+            *c = '\0';
+            args[numargs++] = c+1;
+        }
+    }
+
+    return numargs;
+}
+
+// The expressions making arrays, linspace(from, to, count), column(set, 1 or 2) and the formulas reading arrays
+// (computed element-wise), result is NULL if the expression is just a number
+static error_t safe_array(const char* func, array_s** result) {
+    ASSERT(func, "missing function definition");
+    *result = NULL;
+
+    char buf[COMMAND_MAXLEN];
+    char* args[3];
+    size_t numargs;
+
+    if ((numargs = call_args(func, "linspace", buf, args, 3)) != 0) {
+        ASSERT(numargs == 3, "linspace(from, to, count) expected");
+
+        double from, to, count;
+        if (ERROR_FAIL(safe_compute(args[0], &from)) || ERROR_FAIL(safe_compute(args[1], &to)) || ERROR_FAIL(safe_compute(args[2], &count)))
+            return ERROR_CODE_FAIL;
+
+        ASSERT(count >= 1.0 && count == floor(count), "the count has to be a whole positive number");
+        ASSERT(count <= ARRAY_MAXLENGTH, "too many numbers for an array");
+
+        if ((*result = array_linspace(from, to, (size_t)count)) == NULL) {
+            ERROR_MSG("creating an array");
+            return ERROR_CODE_FAIL;
+        }
+
+        return ERROR_CODE_OK;
+    }
+
+    if ((numargs = call_args(func, "column", buf, args, 2)) != 0) {
+        ASSERT(numargs == 2, "column(set, 1 or 2) expected");
+
+        object* obj;
+        if (ERROR_FAIL(safe_getobj(&obj, args[0])))
+            return ERROR_CODE_FAIL;
+
+        double col;
+        if (ERROR_FAIL(safe_compute(args[1], &col)))
+            return ERROR_CODE_FAIL;
+
+        ASSERT(obj->type == OT_SET && obj->set->xs != NULL, "only the plotted data sets have columns");
+        ASSERT(col == 1.0 || col == 2.0, "the columns are 1 (x) and 2 (y)");
+
+        // the set keeps its own reference, nothing gets copied
+        *result = array_retain(col == 1.0 ? obj->set->xs : obj->set->ys);
+        return ERROR_CODE_OK;
+    }
+
+    formula_s* formula = cache_formula(func);
+    if (formula == NULL) {
+        ERROR_MSG("lexing");
+        return ERROR_CODE_FAIL;
+    }
+
+    // the formula is only known to read arrays once it's compiled
+    if (ERROR_FAIL(formula_prepare(formula, 0))) {
+        ERROR_MSG("computing");
+        return ERROR_CODE_FAIL;
+    }
+
+    if (formula->uses_arrays && ERROR_FAIL(compute_array(formula, result))) {
+        ERROR_MSG("computing");
+        return ERROR_CODE_FAIL;
+    }
+
+    return ERROR_CODE_OK;
+}
+
 static error_t add_var(_Bool isconst) {
     const char* var_name = nextarg(NULL);
 
     ASSERT(var_name, "missing variable name");
 
     ASSERT(strcmp(var_name, "x") != 0, "'x' is a reserved keyword and cannot be used"); 
+    ASSERT(strcmp(var_name, "i") != 0, "'i' is the imaginary unit and cannot be used");
 
     REQUIRE_ARG("=");
 
+    const char* expr = nextarg(NULL);
+
+    array_s* array;
+    if (ERROR_FAIL(safe_array(expr, &array)))
+        return ERROR_CODE_FAIL;
+
+    // the object holds the reference the expression made
+    if (array != NULL) {
+        if (isconst)
+            error_throw("arrays never change, add them with 'var'");
+
+        if (isconst || ERROR_FAIL(object_add(var_name, OT_ARRAY, &array))) {
+            ERROR_MSG("adding an array");
+            array_release(array);
+            return ERROR_CODE_FAIL;
+        }
+
+        printf(ANSI_COLOR_GREEN "Array "ANSI_COLOR_YELLOW"'%s'"ANSI_COLOR_GREEN" (%lu values) added\n" ANSI_COLOR_RESET, var_name, array->length);
+        return ERROR_CODE_OK;
+    }
+
     double result;
-    if(ERROR_FAIL(safe_compute(nextarg(NULL), &result)))
+    if(ERROR_FAIL(safe_compute(expr, &result)))
         return ERROR_CODE_FAIL;
 
     if (ERROR_FAIL(object_add(var_name, isconst ? OT_CONSTANT : OT_VARIABLE, &result))) {
@@ -284,6 +420,35 @@ static error_t csfn_line() {
     return ERROR_CODE_OK;
 }
 
+static error_t csfn_domain() {
+    object* obj;
+    const char* name;
+    if (ERROR_FAIL(getset(&obj, &name)))
+        return ERROR_CODE_FAIL;
+
+    ASSERT(obj->set->plot_type == PT_FUNCTION, "only graphs have a domain coloring");
+
+    const char* arg = nextarg(NULL);
+    ASSERT(arg && (strcmp(arg, "on") == 0 || strcmp(arg, "off") == 0), "'on' or 'off' expected");
+    const _Bool on = strcmp(arg, "on") == 0;
+
+    // the coloring covers the whole screen, only one set has it
+    for (set_s* s = set_first; s != NULL; s = s->next)
+        if (s->domain && s != obj->set) {
+            s->domain = 0;
+            s->dirty = 1;
+            dag_add(s);
+        }
+
+    obj->set->domain = on;
+    obj->set->dirty = 1;
+    if (on) dag_remove(obj->set);
+    else dag_add(obj->set);
+
+    printf(ANSI_COLOR_GREEN "The domain coloring of "ANSI_COLOR_YELLOW"'%s'"ANSI_COLOR_GREEN" turned %s\n" ANSI_COLOR_RESET, name, arg);
+    return ERROR_CODE_OK;
+}
+
 static error_t csfn_mod() {
     const char* obj_name = nextarg(NULL);
     ASSERT(obj_name, "no object specified");
@@ -302,6 +467,8 @@ static error_t csfn_mod() {
             if (ERROR_FAIL(safe_compute(arg, obj->val)))
                 return ERROR_CODE_FAIL;
 
+            object_changed(obj_name);
+
             printf(ANSI_COLOR_GREEN "Variable " ANSI_COLOR_YELLOW "'%s'" ANSI_COLOR_GREEN " (%.2lf) modified\n" ANSI_COLOR_RESET, obj_name, *obj->val);
         break;
         case OT_CONSTANT :
@@ -309,12 +476,28 @@ static error_t csfn_mod() {
             ERROR_MSG("modifying");
             return ERROR_CODE_FAIL;
         break;
-        case OT_FUNCTION :
-            if (ERROR_FAIL(safe_lex(arg, obj->func, 0)))
+        case OT_FUNCTION : {
+            formula_s formula;
+            if (ERROR_FAIL(safe_lex(arg, &formula, 0)))
                 return ERROR_CODE_FAIL;
 
+            function_replace(obj, formula);
+
             printf(ANSI_COLOR_GREEN "Function " ANSI_COLOR_YELLOW "'%s'" ANSI_COLOR_GREEN " modified\n" ANSI_COLOR_RESET, obj_name);
-        break;
+        } break;
+        case OT_ARRAY : {
+            array_s* array;
+            if (ERROR_FAIL(safe_array(arg, &array)))
+                return ERROR_CODE_FAIL;
+
+            ASSERT(array != NULL, "an array expected");
+
+            // the formulas read through the handle, the old array lives on while the data sets still share it
+            array_release(*obj->array);
+            *obj->array = array;
+
+            printf(ANSI_COLOR_GREEN "Array " ANSI_COLOR_YELLOW "'%s'" ANSI_COLOR_GREEN " (%lu values) modified\n" ANSI_COLOR_RESET, obj_name, array->length);
+        } break;
         default :
             error_throw("invalid object type");
             ERROR_MSG("modifying");
@@ -325,17 +508,206 @@ static error_t csfn_mod() {
     return ERROR_CODE_OK;
 }
 
+#define ROOT_MAXITER 64
+
+// format : root [expression] near [initial guess]
+static error_t csfn_root() {
+    const char* form = nextarg(NULL);
+    ASSERT(form, "Missing expression");
+
+    REQUIRE_ARG("near");
+
+    double x;
+    if (ERROR_FAIL(safe_compute(nextarg(NULL), &x)))
+        return ERROR_CODE_FAIL;
+
+    formula_s formula;
+    if (ERROR_FAIL(safe_lex(form, &formula, 0)))
+        return ERROR_CODE_FAIL;
+
+    // Newton's method, the derivative comes out of the same evaluation as the value
+    for (unsigned iter = 1; iter <= ROOT_MAXITER; iter++) {
+        double f, df;
+        if (ERROR_FAIL(compute_dual(&f, &df, &formula, x))) {
+            ERROR_MSG("computing");
+            formula_free(&formula);
+            return ERROR_CODE_FAIL;
+        }
+
+        double step = f/df;
+        if (f != 0.0 && (df == 0.0 || !isfinite(step))) break;
+
+        x -= step;
+        if (f == 0.0 || fabs(step) <= 1e-15*fabs(x)) {
+            printf(ANSI_COLOR_GREEN "Root : "ANSI_COLOR_YELLOW"%.15g"ANSI_COLOR_GREEN" (%u iterations)\n" ANSI_COLOR_RESET, x, iter);
+            formula_free(&formula);
+            return ERROR_CODE_OK;
+        }
+    }
+
+    formula_free(&formula);
+    printf(ANSI_COLOR_RED "No root found" ANSI_COLOR_RESET " : the iteration didn't converge, try another guess\n");
+    return ERROR_CODE_FAIL;
+}
+
+#define BOUNDS_DEPTH 48 // the gaps are located to 2^-48 of the range
+#define BOUNDS_MAXPIECES 512 // the pieces looked into per level
+#define BOUNDS_MAXGAPS 8 // shown
+
+typedef struct gap_s {
+    double lo, hi;
+    _Bool empty; // contains a piece undefined everywhere (not only poles and edges)
+} gap_s;
+
+static int gap_compare(const void* a, const void* b) {
+    const double la = ((const gap_s*)a)->lo, lb = ((const gap_s*)b)->lo;
+    return la < lb ? -1 : la > lb;
+}
+
+// Narrows down where the formula may be undefined or infinite by splitting the range,
+// the pieces the interval arithmetic proves to be fine are dropped.
+// It goes level by level, so a formula that can't be resolved (a plugin without interval rules)
+// still gets an even answer. Returns the number of gaps (touching pieces are merged), 0 on an error
+static size_t find_gaps(formula_s* formula, double lo, double hi, gap_s* gaps, size_t maxgaps, _Bool* incomplete) {
+    gap_s level[BOUNDS_MAXPIECES], next[BOUNDS_MAXPIECES]; // 12 kB each, nothing is shared between the calls
+    size_t numlevel = 1, numgaps = 0;
+    level[0] = (gap_s){lo, hi, 0};
+
+    for (unsigned depth = 0; numlevel > 0; depth++) {
+        size_t numnext = 0;
+
+        for (size_t i = 0; i < numlevel; i++) {
+            interval y;
+            if (ERROR_FAIL(compute_interval(&y, formula, (interval){level[i].lo, level[i].hi, 0})))
+                return 0;
+
+            if (!y.gap) continue;
+
+            const _Bool empty = y.lo > y.hi;
+            if (!empty && depth < BOUNDS_DEPTH && numnext+2 <= BOUNDS_MAXPIECES) {
+                const double mid = level[i].lo + (level[i].hi-level[i].lo)/2;
+                next[numnext++] = (gap_s){level[i].lo, mid, 0};
+                next[numnext++] = (gap_s){mid, level[i].hi, 0};
+                continue;
+            }
+
+            if (!empty && depth < BOUNDS_DEPTH) *incomplete = 1;
+
+            if (numgaps == maxgaps) {
+                // make room by merging the touching ones
+                qsort(gaps, numgaps, sizeof(gap_s), gap_compare);
+                size_t k = 0;
+                for (size_t g = 1; g < numgaps; g++)
+                    if (gaps[g].lo <= gaps[k].hi) {
+                        gaps[k].hi = fmax(gaps[k].hi, gaps[g].hi);
+                        gaps[k].empty |= gaps[g].empty;
+                    } else
+                        gaps[++k] = gaps[g];
+                numgaps = k+1;
+
+                if (numgaps == maxgaps) {
+                    *incomplete = 1;
+                    continue;
+                }
+            }
+
+            gaps[numgaps++] = (gap_s){level[i].lo, level[i].hi, empty};
+        }
+
+        memcpy(level, next, numnext*sizeof(gap_s));
+        numlevel = numnext;
+    }
+
+    qsort(gaps, numgaps, sizeof(gap_s), gap_compare);
+    size_t k = 0;
+    for (size_t g = 1; g < numgaps; g++)
+        if (gaps[g].lo <= gaps[k].hi) {
+            gaps[k].hi = fmax(gaps[k].hi, gaps[g].hi);
+            gaps[k].empty |= gaps[g].empty;
+        } else
+            gaps[++k] = gaps[g];
+
+    return numgaps > 0 ? k+1 : 0;
+}
+
+// format : bounds [expression] from [a] to [b]
+static error_t csfn_bounds() {
+    const char* form = nextarg(NULL);
+    ASSERT(form, "Missing expression");
+
+    double lo, hi;
+    REQUIRE_ARG("from");
+    if (ERROR_FAIL(safe_compute(nextarg(NULL), &lo)))
+        return ERROR_CODE_FAIL;
+
+    REQUIRE_ARG("to");
+    if (ERROR_FAIL(safe_compute(nextarg(NULL), &hi)))
+        return ERROR_CODE_FAIL;
+
+    ASSERT(lo <= hi, "the range is empty");
+
+    formula_s formula;
+    if (ERROR_FAIL(safe_lex(form, &formula, 0)))
+        return ERROR_CODE_FAIL;
+
+    interval y;
+    if (ERROR_FAIL(compute_interval(&y, &formula, (interval){lo, hi, 0}))) {
+        ERROR_MSG("computing");
+        formula_free(&formula);
+        return ERROR_CODE_FAIL;
+    }
+
+    // the ulp the rounding adds to an exact 0 is just noise here
+    if (fabs(y.lo) < DBL_MIN) y.lo = 0.0;
+    if (fabs(y.hi) < DBL_MIN) y.hi = 0.0;
+
+    if (y.lo > y.hi)
+        printf(ANSI_COLOR_GREEN "Undefined everywhere in [%g, %g]\n" ANSI_COLOR_RESET, lo, hi);
+    else
+        printf(ANSI_COLOR_GREEN "Bounds : "ANSI_COLOR_YELLOW"[%.15g, %.15g]"ANSI_COLOR_GREEN" for x in [%g, %g]\n" ANSI_COLOR_RESET, y.lo, y.hi, lo, hi);
+
+    if (y.gap && y.lo <= y.hi) {
+        gap_s gaps[BOUNDS_MAXPIECES];
+        _Bool incomplete = 0;
+        size_t numgaps = find_gaps(&formula, lo, hi, gaps, BOUNDS_MAXPIECES, &incomplete);
+
+        for (size_t i = 0; i < numgaps && i < BOUNDS_MAXGAPS; i++) {
+            if (gaps[i].hi-gaps[i].lo <= 4*ldexp(hi-lo, -BOUNDS_DEPTH))
+                printf(ANSI_COLOR_YELLOW "Pole or domain edge near x = %.15g\n" ANSI_COLOR_RESET, gaps[i].lo + (gaps[i].hi-gaps[i].lo)/2);
+            else
+                printf(ANSI_COLOR_YELLOW "%s for x in [%g, %g]\n" ANSI_COLOR_RESET, gaps[i].empty ? "Undefined" : "Possibly undefined", gaps[i].lo, gaps[i].hi);
+        }
+
+        if (numgaps > BOUNDS_MAXGAPS) printf("... and %lu more\n", numgaps-BOUNDS_MAXGAPS);
+        if (incomplete) printf("Some of the gaps couldn't be narrowed down\n");
+    }
+
+    formula_free(&formula);
+    return ERROR_CODE_OK;
+}
+
 static error_t csfn_graph() {
     const char *args[2] = {nextarg(NULL), nextarg(NULL)};
     const char *form;
     char namebuf[NAME_MAXLEN];
+    _Bool derivative = 0;
 
     if (args[1] != NULL && strcmp(args[1], "=") == 0) {
         form = nextarg(NULL);   
         strcpy(namebuf, args[0]);
+
+        if (form != NULL && strcmp(form, "d/dx") == 0) {
+            derivative = 1;
+            form = nextarg(NULL);
+        }
     } else {
         form = args[0];
 
+        if (form != NULL && strcmp(form, "d/dx") == 0) {
+            derivative = 1;
+            form = args[1];
+        }
+
         static unsigned gnum = 0;
 
         // Generate a new name until it is not already taken
@@ -353,10 +725,10 @@ static error_t csfn_graph() {
 
     SDL_Color color = *nextcolor();
 
-    if (ERROR_FAIL(graph_add(namebuf, formula, color))) {
+    if (ERROR_FAIL(graph_add(namebuf, formula, derivative, color))) {
         ERROR_MSG("adding a set");  
     
-        free(formula.toks);
+        formula_free(&formula);
         return ERROR_CODE_FAIL;
     }
 
@@ -364,23 +736,64 @@ static error_t csfn_graph() {
     return ERROR_CODE_OK;   
 }   
 
+// Generates a new name until it is not already taken
+static void plot_name(char* namebuf) {
+    static unsigned pnum = 0;
+
+    do
+        sprintf(namebuf, "p%u", pnum++);
+    while (!ERROR_FAIL(object_get(namebuf, NULL)));
+}
+
+// 'plot [name =] xs , ys', the set shares the arrays, nothing gets copied
+static error_t plot_arrays(const char* name, const char* xexpr, const char* yexpr) {
+    array_s *xs = NULL, *ys = NULL;
+    if (ERROR_FAIL(safe_array(xexpr, &xs)) || ERROR_FAIL(safe_array(yexpr, &ys)))
+        goto fail;
+
+    if (xs == NULL || ys == NULL || xs->length != ys->length) {
+        error_throw(xs == NULL || ys == NULL ? "both coordinates have to be arrays" : "the arrays have different lengths");
+        ERROR_MSG("plotting");
+        goto fail;
+    }
+
+    // the set takes over both references
+    if (ERROR_FAIL(plot_add(name, xs, ys, *nextcolor()))) {
+        ERROR_MSG("adding a set");
+        return ERROR_CODE_FAIL;
+    }
+
+    printf(ANSI_COLOR_GREEN "Set "ANSI_COLOR_YELLOW"'%s'"ANSI_COLOR_GREEN" (%lu points) added\n" ANSI_COLOR_RESET, name, xs->length);
+    return ERROR_CODE_OK;
+
+    fail :
+    array_release(xs);
+    array_release(ys);
+    return ERROR_CODE_FAIL;
+}
+
 static error_t csfn_plot() {
     const char *args[2] = {nextarg(NULL), nextarg(NULL)};
     const char *filename;
     char namebuf[NAME_MAXLEN];
 
+    if (args[1] != NULL && strcmp(args[1], "=") == 0) {
+        const char* xexpr = nextarg(NULL);
+        REQUIRE_ARG(",");
+        return plot_arrays(args[0], xexpr, nextarg(NULL));
+    }
+
+    if (args[1] != NULL && strcmp(args[1], ",") == 0) {
+        plot_name(namebuf);
+        return plot_arrays(namebuf, args[0], nextarg(NULL));
+    }
+
     if (args[1] != NULL && strcmp(args[1], "<") == 0) {
         filename = nextarg(NULL);   
         strcpy(namebuf, args[0]);
     } else {
         filename = args[0];
-
-        static unsigned pnum = 0;
-
-        // Generate a new name until it is not already taken
-        do
-            sprintf(namebuf, "p%u", pnum++);
-        while (!ERROR_FAIL(object_get(namebuf, NULL)));
+        plot_name(namebuf);
     }
 
     ASSERT(namebuf[0], "Missing plot name");
@@ -400,24 +813,238 @@ static error_t csfn_plot() {
     if (!feof(file))
         printf(ANSI_COLOR_RED"Only a portion of the points has been plotted (the limit is %lu points)\n", SET_MAXLENGTH);
 
+    fclose(file);
+
     // sort the points based on their x value
     qsort(coords, lastp-coords, sizeof(pointf), (int (*)(const void*, const void*))pointf_compare);
 
+    // the set keeps the columns, so they can be arrays too (see column)
+    array_s *xs = array_create(lastp-coords), *ys = array_create(lastp-coords);
+    if (xs == NULL || ys == NULL) {
+        ERROR_MSG("loading the points");
+        array_release(xs);
+        array_release(ys);
+        free(coords);
+        return ERROR_CODE_FAIL;
+    }
+
+    for (size_t i = 0; i < xs->length; i++) {
+        xs->data[i] = coords[i].x;
+        ys->data[i] = coords[i].y;
+    }
+    free(coords);
+
     SDL_Color color = *nextcolor();
 
-    if (ERROR_FAIL(plot_add(namebuf, coords, lastp-coords, color))) {
+    if (ERROR_FAIL(plot_add(namebuf, xs, ys, color))) {
         ERROR_MSG("adding a set");  
-        fclose(file);
         return ERROR_CODE_FAIL;
     }
 
-    fclose(file);
-
     printf(ANSI_COLOR_GREEN "Set "ANSI_COLOR_YELLOW"'%s'"ANSI_COLOR_GREEN" added\n" ANSI_COLOR_RESET, namebuf);
 
     return ERROR_CODE_OK;
 }
 
+// = = = = MONTE CARLO = = = =
+// 'calc mc' splits the draws into chunks, the chunk k always draws from the stream k of the seed
+// and its statistics are combined in order, so the result only depends on the seed, not on the threads
+
+#define MC_MAXTHREADS 64
+#define MC_MAXCHUNKS 65536LU // more draws make the chunks bigger
+#define MC_MINCHUNK (4*BATCH_LANES)
+#define MC_BLOCK SET_MAXLENGTH // the values computed at once by a worker
+#define MC_MAXDRAWS 1e12
+
+typedef struct mc_stats {
+    double count, mean, m2; // the defined values, their mean and the sum of their squared deviations
+} mc_stats;
+
+typedef struct mc_job {
+    unsigned long long seed;
+    size_t draws, chunk, numchunks;
+    _Atomic size_t next; // the first chunk nobody has taken yet
+    _Atomic _Bool failed;
+    mc_stats* chunks;
+} mc_job;
+
+typedef struct mc_worker {
+    mc_job* job;
+    formula_s formula; // the sums write their index while running, so every worker has a copy of its own
+    eval_ctx ctx; // the error, the stacks and the local names (of the console) of the worker
+    pthread_t thread;
+} mc_worker;
+
+// Chan's update, adding up the statistics of two parts
+static mc_stats mc_combine(mc_stats a, mc_stats b) {
+    const double count = a.count + b.count;
+    if (count == 0.0) return a;
+
+    const double delta = b.mean - a.mean;
+    return (mc_stats){count, a.mean + delta*b.count/count, a.m2 + b.m2 + delta*delta*a.count*b.count/count};
+}
+
+// two passes over the values, the undefined ones are left out
+static mc_stats mc_block(const double* ys, size_t n) {
+    mc_stats res = {0.0, 0.0, 0.0};
+    for (size_t i = 0; i < n; i++)
+        if (!isnan(ys[i])) {
+            res.count++;
+            res.mean += ys[i];
+        }
+
+    if (res.count == 0.0) return res;
+    res.mean /= res.count;
+
+    for (size_t i = 0; i < n; i++)
+        if (!isnan(ys[i])) res.m2 += (ys[i]-res.mean)*(ys[i]-res.mean);
+
+    return res;
+}
+
+static void* mc_run(void* arg) {
+    mc_worker* worker = arg;
+    mc_job* job = worker->job;
+    double* ys = malloc(MC_BLOCK*sizeof(double));
+
+    // the console can run a worker too, it gets its own context back afterwards
+    eval_ctx* own = eval_current();
+    eval_bind(&worker->ctx);
+
+    size_t k;
+    while (!job->failed && (k = job->next++) < job->numchunks) {
+        const size_t first = k*job->chunk, last = first+job->chunk < job->draws ? first+job->chunk : job->draws;
+        mc_stats stats = {0.0, 0.0, 0.0};
+        rng_seed(job->seed, k);
+
+        for (size_t done = first; done < last; done += MC_BLOCK) {
+            const size_t n = last-done < MC_BLOCK ? last-done : MC_BLOCK;
+            if (ERROR_FAIL(compute_draws(&worker->formula, ys, n))) {
+                job->failed = 1;
+                break;
+            }
+
+            stats = mc_combine(stats, mc_block(ys, n));
+        }
+
+        job->chunks[k] = stats;
+    }
+
+    eval_bind(own);
+    free(ys);
+    return NULL;
+}
+
+// The workers can share the code only if every function it calls can run on several threads at once,
+// the formula's own sums are copied for every worker, the ones of a called function would be shared
+static _Bool mc_threadsafe(const formula_s* formula, _Bool copied, unsigned depth) {
+    if (depth > 16) return 0;
+
+    for (const instr* in = formula->code; in < formula->code+formula->numcode; in++)
+        switch (in->op) {
+            case OC_CFUNC : case OC_CALL :
+                if (!(in->flags & IF_THREADSAFE)) return 0;
+            break;
+            case OC_FUNC :
+                if (!mc_threadsafe(in->func, 0, depth+1)) return 0;
+            break;
+            case OC_SERIES :
+                if (!copied) return 0;
+            break;
+            default : break;
+        }
+
+    return 1;
+}
+
+// Computes the expression for the given number of draws on all the cores, the statistics of the defined values
+static error_t monte_carlo(const char* func, double draws, mc_stats* result, size_t* numthreads) {
+    if (!(draws >= 1.0 && draws <= MC_MAXDRAWS) || draws != floor(draws)) {
+        error_throw("the number of draws has to be a whole number from 1 to 10^12");
+        return ERROR_CODE_FAIL;
+    }
+
+    mc_job job = {.seed = rng_bits(), .draws = (size_t)draws};
+    job.chunk = (job.draws+MC_MAXCHUNKS-1)/MC_MAXCHUNKS;
+    if (job.chunk < MC_MINCHUNK) job.chunk = MC_MINCHUNK;
+    job.numchunks = (job.draws+job.chunk-1)/job.chunk;
+
+    // every worker compiles its copy here, before anything runs, the workers only see a snapshot of the objects
+    mc_worker workers[MC_MAXTHREADS];
+    size_t count = SDL_GetCPUCount() > 0 ? (size_t)SDL_GetCPUCount() : 1;
+    if (count > MC_MAXTHREADS) count = MC_MAXTHREADS;
+    if (count > job.numchunks) count = job.numchunks;
+
+    error_t retval = ERROR_CODE_OK;
+    size_t numworkers = 0;
+    for (; numworkers < count; numworkers++) {
+        mc_worker* worker = &workers[numworkers];
+        worker->job = &job;
+        worker->formula = lex(func);
+
+        if (worker->formula.toks == NULL || ERROR_FAIL(formula_prepare(&worker->formula, 0))) {
+            formula_free(&worker->formula);
+            retval = ERROR_CODE_FAIL;
+            break;
+        }
+
+        if (worker->formula.uses_i) {
+            error_throw("the draws have to be real numbers");
+            formula_free(&worker->formula);
+            retval = ERROR_CODE_FAIL;
+            break;
+        }
+
+        // a single worker then
+        if (numworkers == 0 && !mc_threadsafe(&worker->formula, 1, 0)) count = 1;
+    }
+
+    snapshot_s* snapshot = ERROR_FAIL(retval) ? NULL : objects_snapshot();
+    if (snapshot == NULL) {
+        while (numworkers-- > 0) formula_free(&workers[numworkers].formula);
+        return ERROR_CODE_FAIL;
+    }
+
+    // the code reads the local names of the console, the workers get the same ones so it isn't recompiled
+    for (size_t k = 0; k < numworkers; k++)
+        eval_init(&workers[k].ctx, eval_current(), snapshot);
+
+    job.chunks = malloc(job.numchunks*sizeof(mc_stats));
+
+    size_t started = 0;
+    for (; started < numworkers; started++)
+        if (pthread_create(&workers[started].thread, NULL, mc_run, &workers[started]) != 0) break;
+
+    // no thread at all, the console does the work itself
+    if (started == 0) mc_run(&workers[0]);
+
+    for (size_t k = 0; k < started; k++)
+        pthread_join(workers[k].thread, NULL);
+
+    *result = (mc_stats){0.0, 0.0, 0.0};
+    for (size_t k = 0; k < job.numchunks && !job.failed; k++)
+        *result = mc_combine(*result, job.chunks[k]);
+
+    // the error of the first worker which failed goes to the console
+    for (size_t k = 0; k < numworkers; k++) {
+        if (job.failed && !ERROR_FAIL(retval) && workers[k].ctx.error[0] != '\0') {
+            error_throw_str("%s", workers[k].ctx.error);
+            retval = ERROR_CODE_FAIL;
+        }
+
+        formula_free(&workers[k].formula);
+        eval_destroy(&workers[k].ctx);
+    }
+
+    snapshot_free(snapshot);
+    free(job.chunks);
+
+    *numthreads = started > 0 ? started : 1;
+    return job.failed ? ERROR_CODE_FAIL : ERROR_CODE_OK;
+}
+
+#define CALC_MAXSHOWN 8 // the values printed from either end of an array, a file gets all of them
+
 static error_t csfn_compute() {
     const char* arg = nextarg(NULL);
     const char* func;
@@ -438,24 +1065,42 @@ static error_t csfn_compute() {
     double range_end = 0;
     double range_step = 0;
 
-    // saving the variables so we know which ones to delete
-    ds_vector* var_names = NULL;
+    // 'calc mc 1e6 rand()^2', the number of draws is only computed once the variables after 'for' exist
+    const char* draws_arg = NULL;
+    if (func && strcmp(func, "mc") == 0) {
+        draws_arg = nextarg(NULL);
+        func = nextarg(NULL);
+        ASSERT_EX(draws_arg && func, "'calc mc [draws] [expression]' expected");
+    }
+
+    // the names after 'for' are local, they shadow the objects without touching them
     const char* for_kw = nextarg(NULL);
     if (for_kw && strcmp(for_kw, "for") == 0) {
 
-        var_names = vector_create((int (*)(void*))object_remove); 
-
         while ((arg = nextarg(NULL)) != NULL) {
             const char* name = arg;
 
             REQUIRE_ARG_EX("=");
 
+            const char* expr = nextarg(NULL);
+
+            // the arrays are bound like the numbers
+            array_s* array;
+            if (ERROR_FAIL(safe_array(expr, &array)))
+                goto exit;
+
             double val;
-            if (ERROR_FAIL(safe_compute(nextarg(NULL), &val)))
+            if (array == NULL && ERROR_FAIL(safe_compute(expr, &val)))
                 goto exit;
 
+            if (array != NULL) {
+                if (ERROR_FAIL(frame_bind(name, 0.0, array))) {
+                    ERROR_MSG("binding an array");
+                    goto exit;
+                }
+
             // with x you can do range stuff (x = 0 .. 1 + 0.1)
-            if (strcmp(name, "x") == 0 && (arg = nextarg(NULL)) != NULL && strcmp(arg, "..") == 0) {
+            } else if (strcmp(name, "x") == 0 && (arg = nextarg(NULL)) != NULL && strcmp(arg, "..") == 0) {
                 is_ranged = 1;
 
                 range_start = val;
@@ -472,12 +1117,9 @@ static error_t csfn_compute() {
                 if (ERROR_FAIL(safe_compute(args[0], &range_end)) |
                     ERROR_FAIL(safe_compute(args[1], &range_step)))
                     goto exit;
-            } else {
-                if (ERROR_FAIL(object_add(name, OT_VARIABLE, &val))) {
-                    ERROR_MSG("adding a variable");
-                    goto exit;
-                }
-                vector_append(var_names, (void*)name);
+            } else if (ERROR_FAIL(frame_bind(name, val, NULL))) {
+                ERROR_MSG("binding a variable");
+                goto exit;
             }
 
             if ((arg = nextarg(NULL)) == NULL) break;
@@ -485,21 +1127,89 @@ static error_t csfn_compute() {
         }   
     }
 
-    if (!is_ranged) {
-        double result;
-        if (ERROR_FAIL(safe_compute(func, &result)))
+    // an array is printed (or written to the file) whole
+    array_s* array = NULL;
+    if (draws_arg == NULL && !is_ranged && ERROR_FAIL(safe_array(func, &array)))
+        goto exit;
+
+    if (draws_arg != NULL) {
+        ASSERT_EX(!is_ranged, "the draws can't go over a range");
+
+        double draws;
+        if (ERROR_FAIL(safe_compute(draws_arg, &draws)))
             goto exit;
 
+        mc_stats stats;
+        size_t numthreads;
+        if (ERROR_FAIL(monte_carlo(func, draws, &stats, &numthreads))) {
+            ERROR_MSG("computing");
+            goto exit;
+        }
+
+        // the standard error of the mean, from the sample variance
+        const double error = stats.count > 1.0 ? sqrt(stats.m2/(stats.count-1.0)/stats.count) : NAN;
         if (out == stdout)
-            fprintf(out, ANSI_COLOR_GREEN "%.2lf\n" ANSI_COLOR_RESET, result);
+            fprintf(out, ANSI_COLOR_GREEN "%g +- %g\n" ANSI_COLOR_RESET, stats.count > 0.0 ? stats.mean : NAN, error);
         else
-            fprintf(out, "%lf\n", result);
+            fprintf(out, "%lf %lf\n", stats.count > 0.0 ? stats.mean : NAN, error);
+
+        printf(ANSI_COLOR_GREEN "%.0lf draws on %lu thread%s", draws, numthreads, numthreads > 1 ? "s" : "");
+        if (stats.count < draws) printf(", %.0lf of them undefined", draws-stats.count);
+        printf("\n" ANSI_COLOR_RESET);
+    } else if (array != NULL) {
+        for (size_t i = 0; i < array->length; i++) {
+            if (out != stdout)
+                fprintf(out, "%lf\n", array->data[i]);
+            else if (i < CALC_MAXSHOWN || i+CALC_MAXSHOWN >= array->length)
+                fprintf(out, ANSI_COLOR_YELLOW"["ANSI_COLOR_GREEN"%lu, %.2lf"ANSI_COLOR_YELLOW"]\n"ANSI_COLOR_RESET, i, array->data[i]);
+            else if (i == CALC_MAXSHOWN)
+                fprintf(out, ANSI_COLOR_YELLOW"...\n"ANSI_COLOR_RESET);
+        }
+
+        printf(ANSI_COLOR_GREEN "%lu total values calculated\n"ANSI_COLOR_RESET, array->length);
+        array_release(array);
+    } else if (!is_ranged) {
+        ASSERT_EX(func, "missing function definition");
+
+        formula_s* formula = cache_formula(func);
+        if (formula == NULL) {
+            ERROR_MSG("lexing");
+            goto exit;
+        }
+
+        // the formula is only known to use i once it's compiled
+        if (ERROR_FAIL(formula_prepare(formula, 0))) {
+            ERROR_MSG("computing");
+            goto exit;
+        }
+
+        double re, im = 0.0;
+        error_t retval = formula->uses_i || settings.complex_part != CP_OFF ? compute_complex(&re, &im, formula, NULL) : compute(&re, formula, NULL);
+        if (ERROR_FAIL(retval)) {
+            ERROR_MSG("computing");
+            goto exit;
+        }
+
+        if (im != 0.0 && !isnan(im)) {
+            if (out == stdout)
+                fprintf(out, ANSI_COLOR_GREEN "%.2lf %c %.2lfi\n" ANSI_COLOR_RESET, re, im < 0.0 ? '-' : '+', fabs(im));
+            else
+                fprintf(out, "%lf %c %lfi\n", re, im < 0.0 ? '-' : '+', fabs(im));
+        } else if (out == stdout)
+            fprintf(out, ANSI_COLOR_GREEN "%.2lf\n" ANSI_COLOR_RESET, re);
+        else
+            fprintf(out, "%lf\n", re);
 
     } else {
-        formula_s formula;
-        if (ERROR_FAIL(safe_lex(func, &formula, 1)))
+        // a broken formula fails in compute_batch, no need to validate it first
+        formula_s* formula = cache_formula(func);
+        if (formula == NULL) {
+            ERROR_MSG("lexing");
             goto exit;
-        
+        }
+
+        double xs[SET_MAXLENGTH], ys[SET_MAXLENGTH];
+
         size_t i = 0;
         for (double x = range_start; x <= range_end+range_step/2; x += range_step, i++) {
             if (i == SET_MAXLENGTH) {
@@ -508,22 +1218,42 @@ static error_t csfn_compute() {
                 goto exit;
             }
 
-            double val;
-            compute(&val, formula, &x);
+            xs[i] = x;
+        }
 
-            if (out == stdout)
-                fprintf(out, ANSI_COLOR_YELLOW"["ANSI_COLOR_GREEN"%.2lf, %.2lf"ANSI_COLOR_YELLOW"]\n"ANSI_COLOR_RESET, x, val);
+        if (ERROR_FAIL(formula_prepare(formula, 1))) {
+            ERROR_MSG("computing");
+            goto exit;
+        }
+
+        static double ims[SET_MAXLENGTH];
+        const _Bool complex_values = formula->uses_i || settings.complex_part != CP_OFF;
+        memset(ims, 0, i*sizeof(double));
+
+        error_t retval = complex_values ? compute_batch_complex(formula, xs, ims, ys, ims, i) : compute_batch(formula, xs, ys, i);
+        if (ERROR_FAIL(retval)) {
+            ERROR_MSG("computing");
+            goto exit;
+        }
+
+        for (size_t j = 0; j < i; j++) {
+            const _Bool imaginary = ims[j] != 0.0 && !isnan(ims[j]);
+
+            if (out == stdout && imaginary)
+                fprintf(out, ANSI_COLOR_YELLOW"["ANSI_COLOR_GREEN"%.2lf, %.2lf %c %.2lfi"ANSI_COLOR_YELLOW"]\n"ANSI_COLOR_RESET, xs[j], ys[j], ims[j] < 0.0 ? '-' : '+', fabs(ims[j]));
+            else if (out == stdout)
+                fprintf(out, ANSI_COLOR_YELLOW"["ANSI_COLOR_GREEN"%.2lf, %.2lf"ANSI_COLOR_YELLOW"]\n"ANSI_COLOR_RESET, xs[j], ys[j]);
+            else if (imaginary)
+                fprintf(out, "%lf %lf %lf\n", xs[j], ys[j], ims[j]);
             else
-                fprintf(out, "%lf %lf\n", x, val);
-                
+                fprintf(out, "%lf %lf\n", xs[j], ys[j]);
         }
 
         printf(ANSI_COLOR_GREEN "%lu total values calculated\n"ANSI_COLOR_RESET, i);
-        free(formula.toks);
     }
 
     if (out != stdout) fclose(out);
-    vector_destroy(var_names);
+    frame_clear();
 
     return ERROR_CODE_OK;
 
@@ -531,24 +1261,25 @@ static error_t csfn_compute() {
     exit :
 
     if (out != stdout) fclose(out);
-    vector_destroy(var_names);
+    frame_clear();
 
     return ERROR_CODE_FAIL;
 }
 
 static int csfn_remove() {
     const char* name = nextarg(NULL);
-
-    // Properly unplug if the object happens to be a plugin function
-    void* plugin;
-    if ((plugin = trie_remove(trie_plugins, name, trie_encode)) != NULL)
-        dlclose(plugin);
+    ASSERT(name, "object name not specified");
 
     if (ERROR_FAIL(object_remove(name))) {
         ERROR_MSG("removing an object");
         return ERROR_CODE_FAIL;
     }
 
+    // Properly unplug if the object happens to be a plugin function (only once nothing uses it)
+    void* plugin;
+    if ((plugin = trie_remove(trie_plugins, name, trie_encode)) != NULL)
+        dlclose(plugin);
+
     printf(ANSI_COLOR_GREEN "Object "ANSI_COLOR_YELLOW"'%s'"ANSI_COLOR_GREEN" removed\n" ANSI_COLOR_RESET, name);
     return ERROR_CODE_OK;
 }
@@ -558,6 +1289,10 @@ static int csfn_addfunc() {
     ASSERT(func_name, "function name not specified");
 
     ASSERT(strcmp(func_name, "x") != 0, "'x' is a reserved keyword and could interfere with the grapher");  
+    ASSERT(strcmp(func_name, "i") != 0, "'i' is the imaginary unit and cannot be used");
+    ASSERT(strcmp(func_name, "if") != 0, "'if' is the built in conditional and cannot be used");
+    ASSERT(strcmp(func_name, "sum") != 0 && strcmp(func_name, "prod") != 0, "'sum' and 'prod' are built in and cannot be used");
+    ASSERT(strcmp(func_name, "rand") != 0 && strcmp(func_name, "randn") != 0, "'rand' and 'randn' are built in and cannot be used");
 
     REQUIRE_ARG("=");
 
@@ -616,6 +1351,7 @@ static error_t csfn_show() {
 static error_t csfn_center() {
     cam.x = -cam.w/2;
     cam.y = -cam.h/2;
+    cam_lo.x = cam_lo.y = 0.0;
 
     return ERROR_CODE_OK;
 }
@@ -643,8 +1379,10 @@ static error_t csfn_cam() {
         if (ERROR_FAIL(safe_atof(&newpos.x, x))) return ERROR_CODE_FAIL;
         if (ERROR_FAIL(safe_atof(&newpos.y, y))) return ERROR_CODE_FAIL;
 
-        cam.x = newpos.x-cam.w/2;
-        cam.y = (-newpos.y)-cam.h/2;
+        cam.x = newpos.x;
+        cam.y = -newpos.y;
+        cam_lo.x = cam_lo.y = 0.0;
+        cam_move(-cam.w/2, -cam.h/2);
 
         printf(ANSI_COLOR_GREEN "Camera anchored to "ANSI_COLOR_YELLOW"[%.2lf, %.2lf]\n" ANSI_COLOR_RESET, newpos.x, newpos.y);
     } else if (strcmp(action, "scale") == 0) {
@@ -659,13 +1397,12 @@ static error_t csfn_cam() {
 
         ASSERT(newsize.x > 0 && newsize.y > 0, "positive scale size expected");
 
-        cam.x -= (newsize.x-cam.w)/2;
-        cam.y -= (newsize.y-cam.h)/2;
+        cam_move(-(newsize.x-cam.w)/2, -(newsize.y-cam.h)/2);
     
         cam.w = newsize.x;
         cam.h = newsize.y;
 
-        printf(ANSI_COLOR_GREEN "Camera scaled to "ANSI_COLOR_YELLOW"[%.2lf, %.2lf]\n" ANSI_COLOR_RESET, cam.w, cam.h);
+        printf(ANSI_COLOR_GREEN "Camera scaled to "ANSI_COLOR_YELLOW"[%lg, %lg]\n" ANSI_COLOR_RESET, cam.w, cam.h);
     } else {
         printf(ANSI_COLOR_RED "Invalid camera action name : "ANSI_COLOR_YELLOW"'%s'\n"ANSI_COLOR_RESET, action);
         return ERROR_CODE_FAIL;
@@ -691,7 +1428,68 @@ static error_t csfn_set() {
         ASSERT(arg, "Value not specified");
         
         settings.grid_size = atof(arg);
-    }   
+    } else if (strcmp(option, "jit") == 0) {
+        const char* arg = nextarg(NULL);
+        ASSERT(arg && (strcmp(arg, "on") == 0 || strcmp(arg, "off") == 0), "'on' or 'off' expected");
+
+        settings.jit = strcmp(arg, "on") == 0;
+        object_generation++; // recompile everything
+
+        printf(ANSI_COLOR_GREEN "JIT compilation turned %s\n" ANSI_COLOR_RESET, arg);
+    } else if (strcmp(option, "sampling") == 0) {
+        const char* arg = nextarg(NULL);
+        ASSERT(arg && (strcmp(arg, "uniform") == 0 || strcmp(arg, "adaptive") == 0), "'uniform' or 'adaptive' expected");
+
+        settings.adaptive = strcmp(arg, "adaptive") == 0;
+
+        printf(ANSI_COLOR_GREEN "Graphs are sampled %s\n" ANSI_COLOR_RESET, settings.adaptive ? "adaptively" : "uniformly");
+    } else if (strcmp(option, "stepping") == 0) {
+        const char* arg = nextarg(NULL);
+        ASSERT(arg && (strcmp(arg, "on") == 0 || strcmp(arg, "off") == 0), "'on' or 'off' expected");
+
+        settings.stepping = strcmp(arg, "on") == 0;
+
+        printf(ANSI_COLOR_GREEN "Incremental sampling turned %s\n" ANSI_COLOR_RESET, arg);
+    } else if (strcmp(option, "mathmode") == 0) {
+        const char* arg = nextarg(NULL);
+        ASSERT(arg && (strcmp(arg, "exact") == 0 || strcmp(arg, "fast") == 0), "'exact' or 'fast' expected");
+
+        settings.fastmath = strcmp(arg, "fast") == 0;
+
+        printf(ANSI_COLOR_GREEN "The vectorized math is %s\n" ANSI_COLOR_RESET, settings.fastmath ? "fast (about 1e-7 relative error)" : "exact (about 1 ulp)");
+    } else if (strcmp(option, "summation") == 0) {
+        const char* arg = nextarg(NULL);
+        ASSERT(arg && (strcmp(arg, "plain") == 0 || strcmp(arg, "compensated") == 0), "'plain' or 'compensated' expected");
+
+        settings.kahan = strcmp(arg, "compensated") == 0;
+
+        printf(ANSI_COLOR_GREEN "The sums are %s\n" ANSI_COLOR_RESET, settings.kahan ? "compensated (Kahan)" : "plain");
+    } else if (strcmp(option, "seed") == 0) {
+        double seed;
+        if (ERROR_FAIL(safe_compute(nextarg(NULL), &seed)))
+            return ERROR_CODE_FAIL;
+        ASSERT(seed >= 0.0 && seed < 0x1p64 && seed == floor(seed), "a whole number from 0 to 2^64 expected");
+
+        rng_reseed((unsigned long long)seed);
+
+        printf(ANSI_COLOR_GREEN "The random numbers start over from the seed %llu\n" ANSI_COLOR_RESET, (unsigned long long)seed);
+    } else if (strcmp(option, "complex") == 0) {
+        const char* arg = nextarg(NULL);
+        const char* parts[] = {"off", "re", "im", "abs"};
+
+        int part = -1;
+        for (int i = 0; arg && i < 4; i++)
+            if (strcmp(arg, parts[i]) == 0) part = i;
+        ASSERT(part >= 0, "'off', 're', 'im' or 'abs' expected");
+
+        settings.complex_part = part;
+
+        if (part == CP_OFF) printf(ANSI_COLOR_GREEN "Graphs are computed in real numbers\n" ANSI_COLOR_RESET);
+        else printf(ANSI_COLOR_GREEN "Graphs show the %s of their complex values\n" ANSI_COLOR_RESET, part == CP_RE ? "real part" : part == CP_IM ? "imaginary part" : "modulus");
+    } else {
+        printf(ANSI_COLOR_RED "Unknown option : "ANSI_COLOR_YELLOW"'%s'\n"ANSI_COLOR_RESET, option);
+        return ERROR_CODE_FAIL;
+    }
 
     return ERROR_CODE_OK;   
 }
@@ -701,13 +1499,39 @@ static error_t csfn_set() {
 #else
     #define PLUGIN_EXTENSION ".so"
 #endif
-// format : plug from ~/jpplugins/plugin.so myFunc
+// The functions a version 2 plugin registers are queued here first,
+// they get added only once the plugin confirms its ABI version
+#define PLUGIN_MAXFUNCS 25
+typedef struct plug_host {
+    jp_host host; // has to be the first member, the plugin only sees this part
+    jp_function funcs[PLUGIN_MAXFUNCS];
+    size_t numfuncs;
+} plug_host;
+
+static int plug_queue(jp_host* host, const jp_function* func) {
+    plug_host* plug = (plug_host*)host;
+
+    if (func == NULL || func->name == NULL || plug->numfuncs == PLUGIN_MAXFUNCS)
+        return 0;
+
+    if (func->arity < 1 || func->arity > JP_MAXARITY || (func->scalar == NULL && func->batch == NULL)) {
+        printf(ANSI_COLOR_RED "Plugin function "ANSI_COLOR_YELLOW"'%s'"ANSI_COLOR_RED" refused" ANSI_COLOR_RESET " : bad arity or no entry point\n", func->name);
+        return 0;
+    }
+
+    plug->funcs[plug->numfuncs++] = *func;
+    return 1;
+}
+
+// format : plug myFunc < ~/jpplugins/plugin.so
+//          plug < ~/jpplugins/plugin.so (all the functions of a version 2 plugin)
 static error_t csfn_plug() {
 
     const char* cfunc_name = nextarg(NULL);
     ASSERT(cfunc_name, "Missing function name");
 
-	REQUIRE_ARG("<");
+    if (strcmp(cfunc_name, "<") == 0) cfunc_name = NULL;
+    else REQUIRE_ARG("<");
 
     char plugin_path_buf[COMMAND_MAXLEN] = {0};
     char* plugin_path = nextarg(NULL);
@@ -719,27 +1543,115 @@ static error_t csfn_plug() {
     if (!dot || dot[1] == '\\' || dot[1] == '/')
         strcat(plugin_path, PLUGIN_EXTENSION);
 
-    // Load the function from the plugin
     void* dlhandle = dlopen(plugin_path, RTLD_LAZY);
     ASSERT(dlhandle, "plugin not found");
 
-    void* cfunc = dlsym(dlhandle, cfunc_name);
-    if (cfunc == NULL) {
-		error_throw("Plugin function not found");
-		ERROR_MSG("plugging");
+    jp_register_fn reg = (jp_register_fn)dlsym(dlhandle, JAPLOT_PLUGIN_REGISTER);
+
+    // An old plugin, the function is just a symbol
+    if (reg == NULL) {
+        if (cfunc_name == NULL) {
+            error_throw("the plugin doesn't register its functions, name the function");
+            ERROR_MSG("plugging");
+            dlclose(dlhandle);
+            return ERROR_CODE_FAIL;
+        }
+
+        cfunc_s cfunc = {.func = dlsym(dlhandle, cfunc_name), .arity = 1};
+        if (cfunc.func == NULL) {
+            error_throw("Plugin function not found");
+            ERROR_MSG("plugging");
+            dlclose(dlhandle);
+            return ERROR_CODE_FAIL;
+        }
+
+        if (ERROR_FAIL(object_add(cfunc_name, OT_CFUNC, &cfunc))) {
+            ERROR_MSG("plugging");
+            dlclose(dlhandle);
+            return ERROR_CODE_FAIL;
+        }
+
+        trie_add(trie_plugins, cfunc_name, trie_encode, dlhandle);
+
+        printf(ANSI_COLOR_GREEN "Function "ANSI_COLOR_YELLOW"'%s'"ANSI_COLOR_GREEN" from the plugin "ANSI_COLOR_YELLOW"'%s'"ANSI_COLOR_GREEN" added\n" ANSI_COLOR_RESET, cfunc_name, plugin_path);
+        return ERROR_CODE_OK;
+    }
+
+    plug_host plug = {.host = {JAPLOT_PLUGIN_ABI, plug_queue}};
+    int abi = reg(&plug.host);
+    if (abi != JAPLOT_PLUGIN_ABI) {
+        error_throw_val("the plugin was built for the plugin ABI version %ld", abi);
+        ERROR_MSG("plugging");
         dlclose(dlhandle);
         return ERROR_CODE_FAIL;
     }
 
-    if (ERROR_FAIL(object_add(cfunc_name, OT_CFUNC, cfunc))) {
-        ERROR_MSG("plugging");
+    size_t added = 0;
+    for (size_t i = 0; i < plug.numfuncs; i++) {
+        const jp_function* func = &plug.funcs[i];
+        if (cfunc_name != NULL && strcmp(cfunc_name, func->name) != 0) continue;
+
+        cfunc_s cfunc = {
+            .scalar = func->scalar,
+            .batch = func->batch,
+            .gradient = func->gradient,
+            .arity = func->arity,
+            .flags = func->flags & (JP_PURE | JP_THREADSAFE)
+        };
+
+        if (ERROR_FAIL(object_add(func->name, OT_CFUNC, &cfunc))) {
+            ERROR_MSG("plugging");
+            continue;
+        }
+
+        // every function holds its own reference to the library, removing one doesn't unload the rest
+        trie_add(trie_plugins, func->name, trie_encode, added == 0 ? dlhandle : dlopen(plugin_path, RTLD_LAZY));
+        added++;
+
+        printf(ANSI_COLOR_GREEN "Function "ANSI_COLOR_YELLOW"'%s'"ANSI_COLOR_GREEN" from the plugin "ANSI_COLOR_YELLOW"'%s'"ANSI_COLOR_GREEN" added\n" ANSI_COLOR_RESET, func->name, plugin_path);
+    }
+
+    if (added == 0) {
         dlclose(dlhandle);
+        error_throw("Plugin function not found");
+        ERROR_MSG("plugging");
         return ERROR_CODE_FAIL;
     }
 
-    trie_add(trie_plugins, cfunc_name, trie_encode, dlhandle);
+    return ERROR_CODE_OK;
+}
+
+// Builds a plugin from a single source file with gcc, prints the compiler output if it fails
+#define BUILD_MAXPATH 512 // of the sources and the libraries gcc_build takes
+
+static error_t gcc_build(const char* source, const char* plugin, const char* flags) {
+    char shell_command[BUILD_MAXPATH*6+80+1], object_path[BUILD_MAXPATH+2], log_path[BUILD_MAXPATH+4];
+    //gcc [flags] [source] -c -fPIC -o [plugin].o && gcc [plugin].o -shared -o [plugin]
+    // the temporary files sit next to the plugin, nothing is left in (or read from) the current folder
+
+    sprintf(object_path, "%s.o", plugin);
+    sprintf(log_path, "%s.log", plugin);
+    sprintf(shell_command, "gcc %s \"%s\" -c -fPIC -o \"%s\" 2> \"%s\" && gcc \"%s\" -shared -o \"%s\" 2> \"%s\"",
+            flags, source, object_path, log_path, object_path, plugin, log_path);
+
+    system(shell_command);
+    remove(object_path);
+
+    FILE* log = fopen(log_path, "r");
+    ASSERT(log, "gcc didn't run");
+
+    if (fseek(log, 0, SEEK_END), ftell(log) != 0) {
+        fseek(log, 0, SEEK_SET);
 
-    printf(ANSI_COLOR_GREEN "Function "ANSI_COLOR_YELLOW"'%s'"ANSI_COLOR_GREEN" from the plugin "ANSI_COLOR_YELLOW"'%s'"ANSI_COLOR_GREEN" added\n" ANSI_COLOR_RESET, cfunc_name, plugin_path);
+        printf(ANSI_COLOR_RED "Plugin compilation failed" ANSI_COLOR_RESET " : \n");
+        for (int c; (c = fgetc(log)) != EOF; ) putchar(c);
+
+        fclose(log);
+        remove(log_path);
+        return ERROR_CODE_FAIL;
+    }
+    fclose(log);
+    remove(log_path);
 
     return ERROR_CODE_OK;
 }
@@ -751,29 +1663,160 @@ static error_t csfn_gccmakeplug() {
     const char* plugin_name = path_to_name(file_name);
     ASSERT(*plugin_name, "file not specified");
 
-    char shell_command[COMMAND_MAXLEN*2+74+1];
-    //gcc [file_name] -c -fPIC -o tmp.o && gcc tmp.o -shared -o [plugin_name].dll/so
+    char source[COMMAND_MAXLEN+2+1], plugin[COMMAND_MAXLEN+2+sizeof(PLUGIN_EXTENSION)];
+    sprintf(source, "%s.c", file_name);
+    sprintf(plugin, "./%s%s", plugin_name, PLUGIN_EXTENSION);
 
-    sprintf(shell_command, "gcc %s.c -c -fPIC -o ./tmp.o 2> ./tmp && gcc tmp.o -shared -o ./%s%s 2> ./tmp", file_name, plugin_name, PLUGIN_EXTENSION);
+    if (ERROR_FAIL(gcc_build(source, plugin, "")))
+        return ERROR_CODE_FAIL;
 
-    system(shell_command);
-    remove("./tmp.o");
+    printf(ANSI_COLOR_GREEN "Plugin "ANSI_COLOR_YELLOW"'%s'"ANSI_COLOR_GREEN" compiled\n" ANSI_COLOR_RESET, plugin_name);
+    return ERROR_CODE_OK;
+}
 
-    FILE* log = fopen("./tmp", "r");
-    if (fseek(log, 0, SEEK_END), ftell(log) != 0) {
-        fseek(log, 0, SEEK_SET);
+#define AOT_FLAGS "-O3 -march=native -ffp-contract=off" // no fused multiply-adds, the kernel rounds like the interpreter
 
-        printf(ANSI_COLOR_RED "Plugin compilation failed" ANSI_COLOR_RESET " : \n");
-        while (!feof(log)) putchar(fgetc(log));
+// The compiled graphs are cached in a folder only the user can write to ($XDG_CACHE_HOME/japlot, ~/.cache/japlot
+// or %LOCALAPPDATA%\japlot), whatever lies there gets loaded and run, so it can't come from anybody else
+static error_t aot_cachedir(char* dir, size_t size) {
+    int len;
+
+#ifdef _WIN32
+    const char* base = getenv("LOCALAPPDATA");
+    ASSERT(base, "no folder for the compiled graphs (LOCALAPPDATA isn't set)");
+
+    len = snprintf(dir, size, "%s\\japlot", base);
+    ASSERT(len > 0 && (size_t)len < size, "the path of the compiled graphs is too long");
+    _mkdir(dir);
+#else
+    const char* base = getenv("XDG_CACHE_HOME");
+
+    if (base != NULL && *base == '/')
+        len = snprintf(dir, size, "%s/japlot", base);
+    else {
+        const char* home = getenv("HOME");
+        ASSERT(home && *home == '/', "no folder for the compiled graphs (HOME isn't set)");
+
+        len = snprintf(dir, size, "%s/.cache", home);
+        if (len > 0 && (size_t)len < size) mkdir(dir, 0700);
+        len = snprintf(dir, size, "%s/.cache/japlot", home);
+    }
+
+    ASSERT(len > 0 && (size_t)len < size, "the path of the compiled graphs is too long");
+    mkdir(dir, 0700);
+
+    // a folder somebody else owns (or could write to) is refused, it could hold anything
+    struct stat st;
+    ASSERT(lstat(dir, &st) == 0 && S_ISDIR(st.st_mode), "cannot create the folder of the compiled graphs");
+    ASSERT(st.st_uid == getuid() && (st.st_mode & 077) == 0, "the folder of the compiled graphs isn't private to the user");
+#endif
+
+    return ERROR_CODE_OK;
+}
+
+// Compiles the graph with gcc, the library is cached by the hash of the generated source
+static error_t compile_set(object* obj) {
+    set_s* set = obj->set;
+    ASSERT(!set->derivative, "derivative graphs are computed with dual numbers, they can't be compiled");
+
+    char* source;
+    unsigned long long hash;
+    if (ERROR_FAIL(formula_prepare(&set->formula, 1)) || ERROR_FAIL(aot_source(&set->formula, &source, &hash))) {
+        ERROR_MSG("generating the code");
         return ERROR_CODE_FAIL;
     }
-    fclose(log);
-    remove("./tmp");
 
-    printf(ANSI_COLOR_GREEN "Plugin "ANSI_COLOR_YELLOW"'%s'"ANSI_COLOR_GREEN" compiled\n" ANSI_COLOR_RESET, plugin_name);
+    // the file names add at most 64 characters to the folder
+    char dir[BUILD_MAXPATH-64], source_path[BUILD_MAXPATH], temp_path[BUILD_MAXPATH], plugin_path[BUILD_MAXPATH];
+    if (ERROR_FAIL(aot_cachedir(dir, sizeof(dir)))) {
+        free(source);
+        return ERROR_CODE_FAIL;
+    }
+
+    sprintf(source_path, "%s/jpaot_%016llx.%d.c", dir, hash, (int)getpid());
+    sprintf(temp_path, "%s/jpaot_%016llx.%d.tmp", dir, hash, (int)getpid());
+    sprintf(plugin_path, "%s/jpaot_%016llx%s", dir, hash, PLUGIN_EXTENSION);
+
+    // the same formula was already compiled, maybe even in another session,
+    // a library built from another source (a stale one) is thrown away and built again
+    _Bool cached = 0;
+    FILE* plugin = fopen(plugin_path, "r");
+    if (plugin != NULL) {
+        fclose(plugin);
+
+        cached = !ERROR_FAIL(aot_load(&set->formula, plugin_path));
+        if (!cached) remove(plugin_path);
+    }
+
+    if (!cached) {
+        FILE* file = fopen(source_path, "w");
+        if (file == NULL) free(source);
+        ASSERT(file, "cannot write the generated source");
+
+        fputs(source, file);
+        fclose(file);
+
+        error_t retval = gcc_build(source_path, temp_path, AOT_FLAGS);
+        remove(source_path);
+
+        if (ERROR_FAIL(retval)) {
+            free(source);
+            return ERROR_CODE_FAIL;
+        }
+
+        // the library only gets its name once it's complete, a half written one is never loaded
+        const _Bool stored = rename(temp_path, plugin_path) == 0;
+        if (!stored) {
+            remove(temp_path);
+            free(source);
+        }
+        ASSERT(stored, "cannot store the compiled library");
+
+        if (ERROR_FAIL(aot_load(&set->formula, plugin_path))) {
+            free(source);
+            ERROR_MSG("loading the compiled graph");
+            return ERROR_CODE_FAIL;
+        }
+    }
+
+    free(source);
+
+    // the DAG doesn't take compiled sets
+    dag_remove(set);
+    set->dirty = 1;
+
+    printf(ANSI_COLOR_GREEN "Graph "ANSI_COLOR_YELLOW"'%s'"ANSI_COLOR_GREEN" compiled%s\n" ANSI_COLOR_RESET, obj->name, cached ? " (cached)" : "");
     return ERROR_CODE_OK;
 }
 
+static error_t csfn_compile() {
+    const char* name = nextarg(NULL);
+    ASSERT(name, "object name not specified");
+
+    object* obj;
+    if (ERROR_FAIL(safe_getobj(&obj, name)))
+        return ERROR_CODE_FAIL;
+
+    if (obj->type == OT_SET) {
+        ASSERT(obj->set->plot_type == PT_FUNCTION, "data sets have nothing to compile");
+        return compile_set(obj);
+    }
+
+    ASSERT(obj->type == OT_FUNCTION, "only functions and graphs can be compiled");
+
+    // functions get inlined, so it's the graphs using them which get compiled
+    object* sets[64];
+    size_t numsets = object_graphs(name, sets, sizeof(sets)/sizeof(*sets));
+    ASSERT(numsets > 0, "no graph uses the function");
+
+    error_t retval = ERROR_CODE_OK;
+    for (size_t i = 0; i < numsets; i++)
+        if (sets[i]->set->plot_type == PT_FUNCTION && !sets[i]->set->derivative && ERROR_FAIL(compile_set(sets[i])))
+            retval = ERROR_CODE_FAIL;
+
+    return retval;
+}
+
 static void print_name(ds_trie_dump* dump) {
     if (dump == NULL) {
         printf("%-*s", NAME_MAXLEN, "");
@@ -787,6 +1830,9 @@ static void print_name(ds_trie_dump* dump) {
     printf("%-*s"ANSI_COLOR_RESET, NAME_MAXLEN, dump->name);
 }
 
+// indexed by the CMP_ kinds (the same order as the lexer operators)
+static const char* const comparisons[] = {"<", "<=", ">", ">=", "==", "!="};
+
 static void print_formula(formula_s formula) {
     static const char* opers = "+-*/%^()-";
 
@@ -797,22 +1843,111 @@ static void print_formula(formula_s formula) {
                 printf("%.2lf ", formula.toks[tok].num);    
             break;
             case TT_OPERATOR :
-                printf("%c ", opers[formula.toks[tok].oper]);   
+                if (formula.toks[tok].oper >= OP_LT) printf("%s ", comparisons[formula.toks[tok].oper-OP_LT]);
+                else printf("%c ", opers[formula.toks[tok].oper]);
             break;
             case TT_VARIABLE :
             case TT_FUNCTION :
+            case TT_INDEX :
                 printf("%s ", formula.toks[tok].name);  
             break;
+            case TT_BIND :
+                printf("%s= ", formula.toks[tok].name);
+            break;
         }
     }
     printf(ANSI_COLOR_RESET);
 }
 
+// Finds the name of a resolved object (the bytecode only has pointers)
+static const char* resolved_name(ds_vector** objs, int type, const void* data) {
+    for (size_t i = 0; i < vector_length(objs[type]); i++) {
+        ds_trie_dump* dump = vector_get(objs[type], i);
+        if (((object*)dump->data)->data == data)
+            return dump->name;
+    }
+
+    return "?";
+}
+
+// Prints the optimized bytecode of the formula
+static void print_code(formula_s* formula, ds_vector** objs) {
+    static const char* opers = "   +-*/%^-"; // indexed by the opcodes
+
+    if (ERROR_FAIL(formula_prepare(formula, 1))) {
+        printf(ANSI_COLOR_RED "(%s)" ANSI_COLOR_RESET, error_catch());
+        return;
+    }
+
+    printf(ANSI_COLOR_CYAN);
+    for (const instr* in = formula->code; in < formula->code+formula->numcode; in++) {
+        switch (in->op) {
+            case OC_NUM :
+                printf("%.2lf ", in->num);
+            break;
+            case OC_X :
+                printf("x ");
+            break;
+            case OC_I :
+                printf("i ");
+            break;
+            case OC_VAR : {
+                // the index of a sum isn't an object
+                const char* name = resolved_name(objs, OT_VARIABLE, in->val);
+                for (size_t k = 0; k < formula->numseries; k++)
+                    if (in->val == &formula->series[k]->k) name = formula->series[k]->name;
+
+                printf("%s ", name);
+            } break;
+            case OC_CFUNC :
+            case OC_CALL :
+                printf("%s ", resolved_name(objs, OT_CFUNC, in->call));
+            break;
+            case OC_FUNC :
+                printf("%s ", resolved_name(objs, OT_FUNCTION, in->func));
+            break;
+            case OC_POWI :
+                printf("^%d ", (int)in->num);
+            break;
+            case OC_POLY :
+                printf("poly%u ", in->poly->degree);
+            break;
+            case OC_CMP :
+                printf("%s ", comparisons[(int)in->num]);
+            break;
+            case OC_SELECT :
+                printf("if ");
+            break;
+            case OC_SERIES :
+                // the term follows
+                printf("%s %s= ", in->series->product ? "prod" : "sum", in->series->name);
+            break;
+            case OC_RAND :
+                printf("%s ", (int)in->num == RAND_NORMAL ? "randn" : "rand");
+            break;
+            case OC_ARRAY :
+                printf("%s[] ", resolved_name(objs, OT_ARRAY, in->array));
+            break;
+            default :
+                printf("%c ", opers[in->op]);
+            break;
+        }
+    }
+
+    if (formula->inlined > 0)
+        printf(ANSI_COLOR_DYELLOW "(%lu inlined) ", formula->inlined);
+    if (formula->removed > 0)
+        printf(ANSI_COLOR_DYELLOW "(%lu removed) ", formula->removed);
+    if (formula->native != NULL)
+        printf(ANSI_COLOR_DYELLOW "(compiled)");
+    printf(ANSI_COLOR_RESET);
+}
+
 static error_t csfn_list() {
     const char* arg = nextarg(NULL);
 
     // Dump objects from the trie by type
-    ds_vector *objs[5];
+    ds_vector *objs[OT_NUMTYPES];
     if (ERROR_FAIL(objects_dump(objs))) {
         ERROR_MSG("dumping");
         return ERROR_CODE_FAIL;
@@ -826,19 +1961,20 @@ static error_t csfn_list() {
         printf("%-*s", NAME_MAXLEN, "Functions");
         printf("%-*s", NAME_MAXLEN, "CFuncs");
         printf("%-*s", NAME_MAXLEN, "Sets");
+        printf("%-*s", NAME_MAXLEN, "Arrays");
 
         // and figure out the longest vector of them
         size_t longest = 0;
-        for (size_t i = 0; i < 5; i++) {
+        for (size_t i = 0; i < OT_NUMTYPES; i++) {
             if (vector_length(objs[i]) > longest)
                 longest = vector_length(objs[i]);
         }
 
         printf("%s", ANSI_COLOR_YELLOW);
-        for (size_t col = 0; col < longest*5; col++) {
-            if (col%5 == 0) putchar('\n');
+        for (size_t col = 0; col < longest*OT_NUMTYPES; col++) {
+            if (col%OT_NUMTYPES == 0) putchar('\n');
 
-            ds_trie_dump* dump_obj = vector_get(objs[col%5], col/5);
+            ds_trie_dump* dump_obj = vector_get(objs[col%OT_NUMTYPES], col/OT_NUMTYPES);
             print_name(dump_obj);
         }
         printf("%s", ANSI_COLOR_RESET);
@@ -851,6 +1987,8 @@ static error_t csfn_list() {
             print_name(dump_obj);
             
             print_formula(*((object*)dump_obj->data)->func);
+            printf("=> ");
+            print_code(((object*)dump_obj->data)->func, objs);
             putchar('\n');
         }
     } else if (strcmp(arg, "cfuncs") == 0) {
@@ -859,7 +1997,10 @@ static error_t csfn_list() {
         for (size_t i = 0; i < vector_length(objs[OT_CFUNC]); i++) {
             ds_trie_dump* dump_obj = vector_get(objs[OT_CFUNC], i);
             print_name(dump_obj);
-            putchar('\n');
+
+            const cfunc_s* cfunc = ((object*)dump_obj->data)->cfunc;
+            printf(ANSI_COLOR_CYAN "%u arg%s%s%s%s\n" ANSI_COLOR_RESET, cfunc->arity, cfunc->arity > 1 ? "s" : "",
+                cfunc->flags & JP_PURE ? ", pure" : "", cfunc->flags & JP_THREADSAFE ? ", thread-safe" : "", cfunc->batch ? ", batched" : "");
         }
     } else if (strcmp(arg, "sets") == 0) {
         printf(ANSI_COLOR_GREEN);
@@ -875,7 +2016,13 @@ static error_t csfn_list() {
             set_s* set = ((object*)dump_obj->data)->set;
             
             printf(ANSI_COLOR_BLUE"[%3u %3u %3u] ", set->col_line.r, set->col_line.g, set->col_line.b);
+            if (set->derivative) printf(ANSI_COLOR_MAGENTA "d/dx ");
             print_formula(set->formula);
+            if (set->plot_type == PT_FUNCTION) {
+                printf("=> ");
+                print_code(&set->formula, objs);
+            } else
+                printf("%lu points", set->length);
             
             putchar('\n');
         }
@@ -888,6 +2035,20 @@ static error_t csfn_list() {
             print_name(dump_obj);
             printf(ANSI_COLOR_BLUE"%.2lf", *((object*)dump_obj->data)->val);
 
+            putchar('\n');
+        }
+    } else if (strcmp(arg, "arrays") == 0) {
+        printf(ANSI_COLOR_GREEN"%-*s\n", NAME_MAXLEN, "Arrays");
+
+        for (size_t i = 0; i < vector_length(objs[OT_ARRAY]); i++) {
+            ds_trie_dump* dump_obj = vector_get(objs[OT_ARRAY], i);
+            print_name(dump_obj);
+
+            const array_s* array = *((object*)dump_obj->data)->array;
+            printf(ANSI_COLOR_BLUE"%lu values", array->length);
+            if (array->length > 0) printf(" [%.2lf .. %.2lf]", array->data[0], array->data[array->length-1]);
+            if (array->refs > 1) printf(ANSI_COLOR_DYELLOW" (shared)");
+
             putchar('\n');
         }
     } else if (strcmp(arg, "consts") == 0) {
@@ -904,7 +2065,7 @@ static error_t csfn_list() {
         printf(ANSI_COLOR_RED"Invalid argument"ANSI_COLOR_RESET);
     }
 
-    for (size_t i = 0; i < 5; i++)
+    for (size_t i = 0; i < OT_NUMTYPES; i++)
         vector_destroy(objs[i]);
 
     printf(ANSI_COLOR_RESET);
@@ -912,6 +2073,24 @@ static error_t csfn_list() {
     return ERROR_CODE_OK;
 }
 
+static error_t csfn_stats() {
+    printf(ANSI_COLOR_GREEN "Evaluator heap allocations : "ANSI_COLOR_YELLOW"%lu"ANSI_COLOR_GREEN" total, "ANSI_COLOR_YELLOW"%lu"ANSI_COLOR_GREEN" in the last frame\n" ANSI_COLOR_RESET, (unsigned long)eval_allocations, frame_allocations);
+
+    size_t nodes, shared;
+    dag_stats(&nodes, &shared);
+    printf(ANSI_COLOR_GREEN "Graph DAG : "ANSI_COLOR_YELLOW"%lu"ANSI_COLOR_GREEN" nodes, "ANSI_COLOR_YELLOW"%lu"ANSI_COLOR_GREEN" shared (%s)\n" ANSI_COLOR_RESET, nodes, shared, dag_worth() ? "in use" : "not worth it");
+
+    size_t computed, culled, stepped, deep, reused;
+    graph_stats(&computed, &culled, &stepped, &deep, &reused);
+    size_t hits, recompiled, misses, entries;
+    cache_stats(&hits, &recompiled, &misses, &entries);
+    printf(ANSI_COLOR_GREEN "Formula cache : "ANSI_COLOR_YELLOW"%lu"ANSI_COLOR_GREEN" hits ("ANSI_COLOR_YELLOW"%lu"ANSI_COLOR_GREEN" recompiled), "ANSI_COLOR_YELLOW"%lu"ANSI_COLOR_GREEN" misses, "ANSI_COLOR_YELLOW"%lu"ANSI_COLOR_GREEN" expressions cached\n" ANSI_COLOR_RESET, hits, recompiled, misses, entries);
+
+    printf(ANSI_COLOR_GREEN "Graph samples : "ANSI_COLOR_YELLOW"%lu"ANSI_COLOR_GREEN" computed ("ANSI_COLOR_YELLOW"%lu"ANSI_COLOR_GREEN" stepped, "ANSI_COLOR_YELLOW"%lu"ANSI_COLOR_GREEN" double-double), "ANSI_COLOR_YELLOW"%lu"ANSI_COLOR_GREEN" culled off screen, "ANSI_COLOR_YELLOW"%lu"ANSI_COLOR_GREEN" sets reused in the last frame\n" ANSI_COLOR_RESET, computed, stepped, deep, culled, reused);
+
+    return ERROR_CODE_OK;
+}
+
 static error_t csfn_help() {
 	const char* command_name = nextarg(NULL);
 
@@ -944,14 +2123,18 @@ void* console_start(void* arg) {
     trie_add(trie_commands, "echo", trie_encode, csfn_echo);
     trie_add(trie_commands, "help", trie_encode, csfn_help);
     trie_add(trie_commands, "set", trie_encode, csfn_set);
+    trie_add(trie_commands, "stats", trie_encode, csfn_stats);
 
     trie_add(trie_commands, "calc", trie_encode, csfn_compute);
     trie_add(trie_commands, "graph", trie_encode, csfn_graph);
+    trie_add(trie_commands, "root", trie_encode, csfn_root);
+    trie_add(trie_commands, "bounds", trie_encode, csfn_bounds);
     trie_add(trie_commands, "plot", trie_encode, csfn_plot);
 
     trie_add(trie_commands, "modif", trie_encode, csfn_mod);
     trie_add(trie_commands, "color", trie_encode, csfn_color);
     trie_add(trie_commands, "line", trie_encode, csfn_line);
+    trie_add(trie_commands, "domain", trie_encode, csfn_domain);
 
     trie_add(trie_commands, "func", trie_encode, csfn_addfunc);
     trie_add(trie_commands, "var", trie_encode, csfn_addvar);
@@ -962,6 +2145,7 @@ void* console_start(void* arg) {
 
     trie_add(trie_commands, "plug", trie_encode, csfn_plug);
     trie_add(trie_commands, "gccmakeplug", trie_encode, csfn_gccmakeplug);
+    trie_add(trie_commands, "compile", trie_encode, csfn_compile);
 
     trie_add(trie_commands, "hide", trie_encode, csfn_hide);
     trie_add(trie_commands, "show", trie_encode, csfn_show);
@@ -1001,10 +2185,11 @@ void console_cleanup() {
 
     trie_commands = trie_colors = trie_plugins = NULL;
 
+    cache_destroy();
+
 }
 
 // = = = = THE CONSOLE PARSER = = = = 
-#include <pthread.h>
 
 // arguments are the sigquit from main, a boolean used to terminate and a mutex so rendering doesn't interfere
 static void console(volatile _Atomic _Bool* sigquit) {
@@ -0,0 +1,345 @@
+#include "dag.h"
+#include "compiler.h"
+#include "parser.h" // batch_instr
+#include "plot.h" // graph
+#include "console.h" // settings
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+typedef struct dag_node {
+    instr in;
+    int left, right; // children, -1 if not used (unary operations only use right)
+
+    unsigned refs; // parents + sets using the node, 0 means the slot is free
+    unsigned hash;
+    int next; // next node in the hash bucket (or in the free list)
+    unsigned mark; // for the topological sort
+} dag_node;
+
+// The DAG is a part of the sets and not of an evaluation context (eval.h), so none of this is per thread,
+// only the renderer and the console commands get here, both with the renderer mutex locked
+static dag_node* nodes = NULL;
+static size_t numnodes = 0, capnodes = 0, livenodes = 0;
+static int freelist = -1;
+
+static int* buckets = NULL;
+static size_t numbuckets = 0;
+
+// the evaluation order, children always come before their parents
+static int* order = NULL;
+static size_t numorder = 0;
+static unsigned epoch = 0;
+static _Bool dirty = 1;
+
+// BATCH_LANES values for every node
+static double* vals = NULL;
+static size_t capvals = 0;
+
+static unsigned generation = 0;
+static _Bool built = 0;
+
+// ------- INTERNING ---------
+
+// only these instructions have an operand, the union is garbage for the rest
+static _Bool has_operand(const instr* in) {
+    switch (in->op) {
+        case OC_NUM : case OC_VAR : case OC_POWI : case OC_CFUNC : case OC_FUNC : case OC_CALL : case OC_POLY : case OC_CMP : return 1;
+        default : return 0;
+    }
+}
+
+static unsigned hash_instr(const instr* in, int left, int right) {
+    unsigned long long bits = 0;
+    if (has_operand(in)) memcpy(&bits, &in->num, sizeof(bits)); // covers the whole union
+
+    // FNV-1a over everything that makes two nodes different
+    unsigned long long parts[] = {in->op, in->flags, bits, (unsigned)left, (unsigned)right};
+    unsigned long long h = 14695981039346656037ULL;
+    for (size_t i = 0; i < sizeof(parts)/sizeof(*parts); i++) {
+        h ^= parts[i];
+        h *= 1099511628211ULL;
+    }
+
+    return (unsigned)(h ^ (h >> 32));
+}
+
+static _Bool same_instr(const instr* a, const instr* b) {
+    return a->op == b->op && a->flags == b->flags && (!has_operand(a) || memcmp(&a->num, &b->num, sizeof(a->num)) == 0);
+}
+
+static void rehash() {
+    free(buckets);
+    numbuckets = numbuckets ? numbuckets*2 : 256;
+    buckets = malloc(numbuckets*sizeof(int));
+    eval_allocations++;
+
+    for (size_t i = 0; i < numbuckets; i++) buckets[i] = -1;
+
+    for (size_t i = 0; i < numnodes; i++)
+        if (nodes[i].refs > 0) {
+            size_t b = nodes[i].hash & (numbuckets-1);
+            nodes[i].next = buckets[b];
+            buckets[b] = i;
+        }
+}
+
+static void release(int n) {
+    if (n < 0 || --nodes[n].refs > 0) return;
+
+    // unlink from its bucket
+    int* link = &buckets[nodes[n].hash & (numbuckets-1)];
+    while (*link != n) link = &nodes[*link].next;
+    *link = nodes[n].next;
+
+    release(nodes[n].left);
+    release(nodes[n].right);
+
+    nodes[n].next = freelist;
+    freelist = n;
+    livenodes--;
+    dirty = 1;
+}
+
+// Returns the node for (in, left, right) with one more reference,
+// the references the caller held to left and right are handed over to it
+static int intern(const instr* in, int left, int right) {
+    unsigned hash = hash_instr(in, left, right);
+
+    if (numbuckets > 0)
+        for (int n = buckets[hash & (numbuckets-1)]; n >= 0; n = nodes[n].next)
+            if (nodes[n].hash == hash && nodes[n].left == left && nodes[n].right == right && same_instr(&nodes[n].in, in)) {
+                nodes[n].refs++;
+
+                // the existing node already references its children
+                release(left);
+                release(right);
+                return n;
+            }
+
+    int n;
+    if (freelist >= 0) {
+        n = freelist;
+        freelist = nodes[n].next;
+    } else {
+        if (numnodes == capnodes) {
+            capnodes = capnodes ? capnodes*2 : 64;
+            nodes = realloc(nodes, capnodes*sizeof(dag_node));
+            eval_allocations++;
+        }
+        n = numnodes++;
+    }
+
+    nodes[n] = (dag_node){*in, left, right, 1, hash, -1, 0};
+    livenodes++;
+    dirty = 1;
+
+    if (livenodes*2 > numbuckets)
+        rehash();
+    else {
+        size_t b = hash & (numbuckets-1);
+        nodes[n].next = buckets[b];
+        buckets[b] = n;
+    }
+
+    return n;
+}
+
+error_t dag_add(set_s* set) {
+    set->dag_root = -1;
+
+    // derivatives are computed with dual numbers and compiled sets have their own kernel, graph does that,
+    // the domain colorings are no curves at all
+    if (set->derivative || set->domain || set->formula.native != NULL) return ERROR_CODE_FAIL;
+
+    if (ERROR_FAIL(formula_prepare(&set->formula, 1)) || set->formula.numcode == 0)
+        return ERROR_CODE_FAIL;
+
+    // the bytecode is replayed with node indices instead of values
+    int* stack = malloc(set->formula.depth*sizeof(int));
+    size_t height = 0;
+
+    for (const instr* in = set->formula.code; in < set->formula.code+set->formula.numcode; in++) {
+        int left = -1, right = -1;
+
+        switch (in->op) {
+            case OC_NUM : case OC_X : case OC_VAR : case OC_I :
+            break;
+            case OC_NEG : case OC_POWI : case OC_CFUNC : case OC_FUNC : case OC_POLY :
+                right = stack[--height];
+            break;
+            case OC_CALL :
+                if (in->call->arity == 1) {
+                    right = stack[--height];
+                    break;
+                }
+            // fallthrough
+            case OC_SELECT : case OC_SERIES : case OC_RAND : case OC_ARRAY :
+                // the nodes are binary and they don't loop, and two draws are never the same node,
+                // such a set is graphed on its own (and fails there, if it reads an array)
+                while (height > 0) release(stack[--height]);
+                free(stack);
+                return ERROR_CODE_FAIL;
+            default :
+                right = stack[--height];
+                left = stack[--height];
+            break;
+        }
+
+        stack[height++] = intern(in, left, right);
+    }
+
+    set->dag_root = stack[0];
+    free(stack);
+
+    return ERROR_CODE_OK;
+}
+
+void dag_remove(set_s* set) {
+    release(set->dag_root);
+    set->dag_root = -1;
+}
+
+void dag_destroy() {
+    free(nodes);
+    free(buckets);
+    free(order);
+    free(vals);
+
+    nodes = NULL; order = NULL; buckets = NULL; vals = NULL;
+    numnodes = capnodes = livenodes = numbuckets = numorder = capvals = 0;
+    freelist = -1;
+    built = 0;
+    dirty = 1;
+}
+
+// The resolved pointers are only valid for one object generation, after that everything is rebuilt
+static void dag_update() {
+    if (built && generation == object_generation) return;
+
+    for (set_s* s = set_first; s != NULL; s = s->next)
+        s->dag_root = -1;
+
+    numnodes = livenodes = 0;
+    freelist = -1;
+    for (size_t i = 0; i < numbuckets; i++) buckets[i] = -1;
+
+    generation = object_generation;
+    built = 1;
+    dirty = 1;
+
+    for (set_s* s = set_first; s != NULL; s = s->next)
+        if (s->plot_type == PT_FUNCTION)
+            dag_add(s); // fails (and leaves dag_root -1) for the sets graph has to handle
+}
+
+// ------- EVALUATION ---------
+
+static void visit(int n) {
+    if (n < 0 || nodes[n].mark == epoch) return;
+    nodes[n].mark = epoch;
+
+    visit(nodes[n].left);
+    visit(nodes[n].right);
+
+    order[numorder++] = n;
+}
+
+static void sort() {
+    if (!dirty) return;
+
+    free(order);
+    order = malloc((numnodes+1)*sizeof(int));
+    eval_allocations++;
+
+    numorder = 0;
+    epoch++;
+    for (set_s* s = set_first; s != NULL; s = s->next)
+        visit(s->dag_root);
+
+    dirty = 0;
+}
+
+_Bool dag_worth() {
+    dag_update();
+
+    unsigned long dag_cost = 0, sets_cost = 0;
+    _Bool jit = 0;
+
+    for (size_t i = 0; i < numnodes; i++)
+        if (nodes[i].refs > 0) dag_cost += instr_cost(&nodes[i].in);
+
+    for (set_s* s = set_first; s != NULL; s = s->next) {
+        if (s->dag_root < 0) continue;
+
+        for (size_t i = 0; i < s->formula.numcode; i++)
+            sets_cost += instr_cost(&s->formula.code[i]);
+
+        jit |= s->formula.jit != NULL;
+    }
+
+    // the DAG is always interpreted, so it has to save more when the sets would run natively
+    return jit ? dag_cost*2 < sets_cost : dag_cost < sets_cost;
+}
+
+void dag_graph(double start, double end, unsigned numsteps) {
+    if (numsteps < 2) return;
+    if (numsteps > SET_MAXLENGTH) numsteps = SET_MAXLENGTH;
+
+    dag_update();
+    sort();
+
+    if (capvals < numnodes) {
+        free(vals);
+        capvals = capnodes;
+        vals = malloc(capvals*BATCH_LANES*sizeof(double));
+        eval_allocations++;
+    }
+
+    double xs[SET_MAXLENGTH];
+
+    // not accumulated, the same x values as graph() gives the sets outside of the DAG
+    double step = (end-start)/(numsteps-1);
+    for (size_t i = 0; i < numsteps; i++)
+        xs[i] = start + i*step;
+
+    for (size_t done = 0; done < numsteps; done += BATCH_LANES) {
+        size_t m = numsteps-done < BATCH_LANES ? numsteps-done : BATCH_LANES;
+
+        for (size_t k = 0; k < numorder; k++) {
+            const dag_node* nd = &nodes[order[k]];
+            double* dst = vals + order[k]*BATCH_LANES;
+
+            if (ERROR_FAIL(batch_instr(&nd->in, dst,
+                nd->left >= 0 ? vals + nd->left*BATCH_LANES : NULL,
+                nd->right >= 0 ? vals + nd->right*BATCH_LANES : NULL, xs+done, m)))
+                for (size_t j = 0; j < m; j++) dst[j] = NAN;
+        }
+
+        for (set_s* s = set_first; s != NULL; s = s->next)
+            if (s->dag_root >= 0)
+                for (size_t j = 0; j < m; j++)
+                    s->coords[done+j] = (pointf){xs[done+j], vals[s->dag_root*BATCH_LANES+j]};
+    }
+
+    for (set_s* s = set_first; s != NULL; s = s->next) {
+        if (s->plot_type != PT_FUNCTION || s->domain) continue;
+
+        // the formula is broken right now, graph handles that
+        if (s->dag_root < 0) graph(start, end, numsteps, s);
+        else {
+            s->length = numsteps;
+            s->deep = 0;
+        }
+    }
+}
+
+void dag_stats(size_t* live, size_t* shared) {
+    dag_update();
+
+    *live = livenodes;
+    *shared = 0;
+    for (size_t i = 0; i < numnodes; i++)
+        if (nodes[i].refs > 1) (*shared)++;
+}
@@ -0,0 +1,269 @@
+#include "ddouble.h"
+#include "compiler.h" // instr
+#include "parser.h" // call_scalar
+#include "rng.h"
+
+#include <math.h>
+#include <float.h> // DBL_MIN
+
+#define DD_MAXDEPTH 64 // the number stack of compute_batch_dd lives on the C stack
+#define DD_TRIG_MAX 1e15 // the multiples of pi/2 are reduced exactly only below this
+
+static const ddouble dd_one = {1.0, 0.0};
+static const ddouble dd_pi2 = {1.570796326794896558e+00, 6.123233995736766036e-17};
+static const ddouble dd_ln2 = {6.931471805599452862e-01, 2.319046813846299558e-17};
+
+static ddouble dd_div_d(ddouble a, double b) {
+    const double q1 = a.hi/b;
+    const ddouble p = two_prod(q1, b);
+    ddouble r = two_sum(a.hi, -p.hi);
+    r.lo += a.lo - p.lo;
+
+    return quick_two_sum(q1, (r.hi + r.lo)/b);
+}
+
+static ddouble dd_floor(ddouble a) {
+    const double hi = floor(a.hi);
+
+    // hi is already a whole number, the digits after the point are all in lo
+    if (hi == a.hi) return quick_two_sum(hi, floor(a.lo));
+    return (ddouble){hi, 0.0};
+}
+
+ddouble dd_sqrt(ddouble a) {
+    if (!(a.hi > 0.0) || isinf(a.hi)) return (ddouble){sqrt(a.hi), 0.0};
+
+    // one Newton step from the double square root, done with its reciprocal (Karp's trick)
+    const double inv = 1.0/sqrt(a.hi), ax = a.hi*inv;
+    const ddouble err = dd_sub(a, two_prod(ax, ax));
+    return dd_add_d((ddouble){ax, 0.0}, err.hi*inv*0.5);
+}
+
+ddouble dd_exp(ddouble a) {
+    if (!(fabs(a.hi) < 708.0)) return (ddouble){exp(a.hi), 0.0};
+
+    // a = k*ln2 + 512*r with |r| < 0.0007, e^a = 2^k * (e^r)^512
+    const double k = nearbyint(a.hi/dd_ln2.hi);
+    ddouble r = dd_sub(a, dd_mul_d(dd_ln2, k));
+    r = (ddouble){r.hi/512.0, r.lo/512.0};
+
+    // e^r - 1, the series runs until the terms fall below the last digit
+    ddouble term = r, sum = r;
+    for (unsigned n = 2; fabs(term.hi) > DD_EPS*fabs(sum.hi); n++) {
+        term = dd_div_d(dd_mul(term, r), n);
+        sum = dd_add(sum, term);
+    }
+
+    // squaring nine times, (1+s)^2 - 1 = 2s + s^2 keeps the small digits of s
+    for (int i = 0; i < 9; i++)
+        sum = dd_add(dd_mul_d(sum, 2.0), dd_mul(sum, sum));
+
+    sum = dd_add(sum, dd_one);
+    return (ddouble){ldexp(sum.hi, (int)k), ldexp(sum.lo, (int)k)};
+}
+
+ddouble dd_log(ddouble a) {
+    if (!(a.hi >= DBL_MIN) || isinf(a.hi)) return (ddouble){log(a.hi), 0.0};
+
+    // one Newton step for e^x = a from the double logarithm doubles the correct digits
+    const ddouble x = {log(a.hi), 0.0};
+    return dd_sub(dd_add(x, dd_mul(a, dd_exp(dd_neg(x)))), dd_one);
+}
+
+// sin (or cos) of |r| <= pi/4, the Taylor series until the terms fall below the last digit
+static ddouble trig_kernel(ddouble r, _Bool cosine) {
+    const ddouble r2 = dd_mul(r, r);
+    ddouble term = cosine ? dd_one : r, sum = term;
+
+    for (unsigned n = cosine ? 1 : 2; fabs(term.hi) > DD_EPS*fabs(sum.hi); n += 2) {
+        term = dd_div_d(dd_mul(term, r2), -(double)n*(n+1));
+        sum = dd_add(sum, term);
+    }
+
+    return sum;
+}
+
+// sin(a + quarter*pi/2), the argument is reduced by pi/2, the quadrant picks the kernel and the sign
+static ddouble trig(ddouble a, int quarter) {
+    const double k = nearbyint(a.hi/dd_pi2.hi);
+    const ddouble r = dd_sub(a, dd_mul_d(dd_pi2, k));
+    const int q = (int)(((long long)k + quarter) & 3);
+
+    const ddouble res = trig_kernel(r, q & 1);
+    return q & 2 ? dd_neg(res) : res;
+}
+
+ddouble dd_sin(ddouble a) {
+    if (!(fabs(a.hi) < DD_TRIG_MAX)) return (ddouble){sin(a.hi), 0.0};
+    return trig(a, 0);
+}
+
+ddouble dd_cos(ddouble a) {
+    if (!(fabs(a.hi) < DD_TRIG_MAX)) return (ddouble){cos(a.hi), 0.0};
+    return trig(a, 1);
+}
+
+ddouble dd_tan(ddouble a) {
+    if (!(fabs(a.hi) < DD_TRIG_MAX)) return (ddouble){tan(a.hi), 0.0};
+    return dd_div(trig(a, 0), trig(a, 1));
+}
+
+ddouble dd_abs(ddouble a) {
+    return a.hi < 0.0 ? dd_neg(a) : a;
+}
+
+ddouble dd_sgn(ddouble a) {
+    return (ddouble){a.hi > 0.0 ? 1.0 : a.hi < 0.0 ? -1.0 : 0.0, 0.0};
+}
+
+ddouble dd_powi(ddouble a, int n) {
+    ddouble res = dd_one, sq = a;
+
+    // squaring and multiplying by the bits of the exponent
+    for (unsigned e = n < 0 ? -(unsigned)n : (unsigned)n; e != 0; e >>= 1) {
+        if (e & 1) res = dd_mul(res, sq);
+        if (e > 1) sq = dd_mul(sq, sq);
+    }
+
+    return n < 0 ? dd_div(dd_one, res) : res;
+}
+
+ddouble dd_pow(ddouble a, ddouble b) {
+    // whole exponents work for negative bases too
+    if (b.lo == 0.0 && b.hi == trunc(b.hi) && fabs(b.hi) <= 1024.0)
+        return dd_powi(a, (int)b.hi);
+
+    if (!(a.hi > 0.0) || !isfinite(a.hi) || !isfinite(b.hi))
+        return (ddouble){pow(a.hi, b.hi), 0.0};
+
+    return dd_exp(dd_mul(b, dd_log(a)));
+}
+
+ddouble dd_fmod(ddouble a, ddouble b) {
+    const ddouble q = dd_div(a, b);
+    const ddouble n = q.hi < 0.0 ? dd_neg(dd_floor(dd_neg(q))) : dd_floor(q); // truncated, like fmod
+
+    return dd_sub(a, dd_mul(b, n));
+}
+
+static error_t dd_run(const instr* code, size_t numcode, ddouble x, ddouble* stack);
+
+// The bounds are the top two values, the terms are added up in double-double, the result replaces the bounds
+static error_t dd_series(const instr* in, ddouble x, ddouble* top) {
+    series_s* series = in->series;
+    const double lo = top[0].hi, hi = top[1].hi;
+
+    double first, last;
+    if (ERROR_FAIL(series_terms(&lo, &hi, 1, &first, &last)))
+        return ERROR_CODE_FAIL;
+
+    ddouble acc = {series->product ? 1.0 : 0.0, 0.0};
+    for (double k = first; k <= last; k++) {
+        series->k = k;
+        if (ERROR_FAIL(dd_run(in+1, series->len, x, top)))
+            return ERROR_CODE_FAIL;
+
+        acc = series->product ? dd_mul(acc, *top) : dd_add(acc, *top);
+    }
+
+    *top = isnan(lo) || isnan(hi) ? (ddouble){NAN, 0.0} : acc;
+    return ERROR_CODE_OK;
+}
+
+// The bytecode is run one x at a time, the double-double arithmetic outweighs the dispatch by far,
+// the result is left in stack[0]
+static error_t dd_run(const instr* code, size_t numcode, ddouble x, ddouble* stack) {
+    ddouble* top = stack; // the first free slot
+
+    for (const instr* in = code; in < code+numcode; in++) {
+        ddouble *a = top-2, *b = top-1;
+
+        switch (in->op) {
+            case OC_NUM : *top++ = (ddouble){in->num, 0.0}; break;
+            case OC_X   : *top++ = x; break;
+            case OC_VAR : *top++ = (ddouble){*in->val, 0.0}; break;
+            case OC_I   : *top++ = (ddouble){NAN, 0.0}; break;
+            case OC_RAND: {
+                double r;
+                if ((int)in->num == RAND_NORMAL) rng_normal(&r, 1);
+                else rng_uniform(&r, 1);
+                *top++ = (ddouble){r, 0.0};
+            } break;
+            case OC_ARRAY :
+                error_throw("arrays are only computed element-wise");
+                return ERROR_CODE_FAIL;
+
+            case OC_ADD : *a = dd_add(*a, *b); top--; break;
+            case OC_SUB : *a = dd_sub(*a, *b); top--; break;
+            case OC_MULT: *a = dd_mul(*a, *b); top--; break;
+            case OC_DIV : *a = dd_div(*a, *b); top--; break;
+            case OC_MOD : *a = dd_fmod(*a, *b); top--; break;
+            case OC_POW : *a = dd_pow(*a, *b); top--; break;
+            case OC_NEG : *b = dd_neg(*b); break;
+            case OC_POWI: *b = dd_powi(*b, (int)in->num); break;
+            case OC_CMP : {
+                // the low parts only matter if the high parts are equal
+                const _Bool same = a->hi == b->hi;
+                *a = (ddouble){compare((int)in->num, same ? a->lo : a->hi, same ? b->lo : b->hi), 0.0};
+                top--;
+            } break;
+            case OC_SELECT :
+                top -= 2;
+                top[-1] = isnan(top[-1].hi) ? (ddouble){NAN, 0.0} : top[-1].hi != 0.0 ? top[0] : top[1];
+            break;
+
+            case OC_POLY : {
+                const double* c = in->poly->coeffs;
+                ddouble res = {c[in->poly->degree], 0.0};
+
+                for (unsigned k = in->poly->degree; k-- > 0; )
+                    res = dd_add_d(dd_mul(res, *b), c[k]);
+                *b = res;
+            } break;
+
+            case OC_CFUNC :
+                *b = in->call->precise != NULL ? in->call->precise(*b) : (ddouble){in->call->func(b->hi), 0.0};
+            break;
+            case OC_FUNC :
+                if (ERROR_FAIL(compute_batch_dd(in->func, b, b, 1)))
+                    return ERROR_CODE_FAIL;
+            break;
+            case OC_CALL : {
+                double args[JP_MAXARITY];
+                top -= in->call->arity;
+                for (size_t k = 0; k < in->call->arity; k++) args[k] = top[k].hi;
+
+                *top++ = (ddouble){call_scalar(in->call, args), 0.0};
+            } break;
+            case OC_SERIES :
+                if (ERROR_FAIL(dd_series(in, x, a)))
+                    return ERROR_CODE_FAIL;
+                in += in->series->len;
+                top--;
+            break;
+            case OC_ARG : break;
+        }
+    }
+
+    return ERROR_CODE_OK;
+}
+
+error_t compute_batch_dd(formula_s* formula, const ddouble* xs, ddouble* ys, size_t n) {
+    if (ERROR_FAIL(formula_prepare(formula, 1)))
+        return ERROR_CODE_FAIL;
+
+    if (formula->depth > DD_MAXDEPTH) {
+        error_throw("Formula too deep for double-double evaluation");
+        return ERROR_CODE_FAIL;
+    }
+
+    ddouble stack[DD_MAXDEPTH];
+    for (size_t i = 0; i < n; i++) {
+        if (ERROR_FAIL(dd_run(formula->code, formula->numcode, xs[i], stack)))
+            return ERROR_CODE_FAIL;
+
+        ys[i] = stack[0];
+    }
+
+    return ERROR_CODE_OK;
+}
@@ -1,20 +1,21 @@
 #include "error.h"
+#include "eval.h"
 
 // --------- ERROR THROWING/CATCHIN' STUFF-----------
-static char error[100];
+// every evaluation context keeps its own error, the threads don't overwrite each other's
 
 void error_throw(const char* msg) {
-    snprintf(error, 100, msg);
+    snprintf(eval_current()->error, EVAL_ERRORLEN, msg);
 }
 
 void error_throw_str(const char* msg, const char* str) {
-    snprintf(error, 100, msg, str);
+    snprintf(eval_current()->error, EVAL_ERRORLEN, msg, str);
 }
 
 void error_throw_val(const char* msg, const long val) {
-    snprintf(error, 100, msg, val);
+    snprintf(eval_current()->error, EVAL_ERRORLEN, msg, val);
 }
 
 const char* error_catch() {
-    return error;   
+    return eval_current()->error;   
 }
@@ -0,0 +1,117 @@
+#include "eval.h"
+#include "array.h"
+#include "stepper.h" // stepper_free
+#include "error.h"
+
+#include <string.h>
+#include <ctype.h> // isalnum
+#include <pthread.h> // the destructor of the thread's own context
+
+static _Thread_local eval_ctx own;
+static _Thread_local eval_ctx* bound = NULL;
+
+// _Thread_local has no destructors, the key only frees the thread's own context when the thread ends
+static pthread_key_t own_key;
+static pthread_once_t own_once = PTHREAD_ONCE_INIT;
+static _Thread_local _Bool own_registered = 0;
+
+static _Atomic unsigned frame_shapes = 0;
+
+static void own_destroy(void* ctx) {
+    eval_destroy(ctx);
+}
+
+static void own_key_create() {
+    pthread_key_create(&own_key, own_destroy);
+}
+
+eval_ctx* eval_current() {
+    if (bound != NULL) return bound;
+
+    if (!own_registered) {
+        pthread_once(&own_once, own_key_create);
+        pthread_setspecific(own_key, &own);
+        own_registered = 1;
+    }
+
+    return &own;
+}
+
+void eval_bind(eval_ctx* ctx) {
+    bound = ctx;
+}
+
+void eval_init(eval_ctx* ctx, const eval_ctx* parent, const snapshot_s* objects) {
+    memset(ctx, 0, sizeof(eval_ctx));
+    ctx->objects = objects;
+
+    // the same shape too, so nothing gets recompiled
+    if (parent != NULL) {
+        ctx->frame = parent->frame;
+
+        for (size_t k = 0; k < ctx->frame.numbindings; k++)
+            if (ctx->frame.bindings[k].array != NULL) array_retain(ctx->frame.bindings[k].array);
+    }
+}
+
+static void frame_release(frame_s* frame) {
+    while (frame->numbindings > 0) {
+        binding_s* binding = &frame->bindings[--frame->numbindings];
+        array_release(binding->array);
+        binding->array = NULL;
+    }
+}
+
+void eval_destroy(eval_ctx* ctx) {
+    frame_release(&ctx->frame);
+    arena_destroy(&ctx->scratch);
+
+    stepper_free(ctx->stepper);
+    ctx->stepper = NULL;
+
+    for (size_t i = 0; i < ctx->numfunctions; i++) {
+        formula_free(ctx->functions[i].copy);
+        free(ctx->functions[i].copy);
+    }
+    free(ctx->functions);
+    ctx->functions = NULL;
+    ctx->numfunctions = 0;
+}
+
+error_t frame_bind(const char* name, double val, array_s* array) {
+    frame_s* frame = &eval_current()->frame;
+
+    if (frame->numbindings == FRAME_MAXBINDINGS) {
+        array_release(array);
+        error_throw_val("at most %lu names can be bound", FRAME_MAXBINDINGS);
+        return ERROR_CODE_FAIL;
+    }
+
+    _Bool valid = strlen(name)+1 <= NAME_MAXLEN && isalpha(*name) && strcmp(name, "i") != 0;
+    for (const char* c = name; *c; c++) valid &= isalnum(*c) || *c == '_';
+
+    if (!valid) {
+        array_release(array);
+        error_throw_str("'%s' can't be bound", name);
+        return ERROR_CODE_FAIL;
+    }
+
+    binding_s* binding = &frame->bindings[frame->numbindings];
+
+    // the same names as last time keep the shape, the code compiled against them stays valid
+    if (frame->numbindings >= frame->numnames || strcmp(binding->name, name) != 0) {
+        strcpy(binding->name, name);
+        frame->numnames = frame->numbindings+1;
+        frame->shape = ++frame_shapes;
+    }
+
+    binding->val = val;
+    binding->array = array;
+    frame->numbindings++;
+
+    return ERROR_CODE_OK;
+}
+
+void frame_clear() {
+    frame_release(&eval_current()->frame);
+}
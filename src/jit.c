@@ -0,0 +1,343 @@
+#include "jit.h"
+#include "compiler.h"
+#include "parser.h" // compute
+
+#include <string.h>
+#include <math.h>
+
+// Only the System V calling convention is implemented (Linux, macOS, BSD ...),
+// everywhere else jit_compile just refuses and the interpreter takes over
+#if defined(__x86_64__) && !defined(_WIN32)
+
+#include <sys/mman.h>
+
+// The stack slot k of the bytecode lives in the register xmm<k>,
+// the last two registers are temporaries
+#define JIT_MAXDEPTH 14
+#define XMM_TMP1 14
+#define XMM_TMP2 15
+
+// the spill area for the slots that have to survive a function call
+#define FRAME_SIZE (((JIT_MAXDEPTH*8)+15) & ~15)
+
+// SSE2 opcodes (all of them prefixed with F2 0F)
+#define SSE_LOAD  0x10
+#define SSE_STORE 0x11
+#define SSE_ADD   0x58
+#define SSE_MUL   0x59
+#define SSE_SUB   0x5C
+#define SSE_DIV   0x5E
+
+// registers holding the state of the loop (all callee saved)
+#define REG_RBX 3 // xs
+#define REG_R12 12 // ys
+#define REG_R14 14 // i
+
+// the spills and the reloads of a call take 10 bytes per slot at most
+#define JIT_SPILLBYTES 10
+
+typedef struct codebuf {
+    unsigned char* code;
+    size_t len, cap;
+    _Bool overflow; // the code didn't fit, nothing more is written and the interpreter takes over
+} codebuf;
+
+static void emit(codebuf* buf, size_t n, const unsigned char* bytes) {
+    if (buf->overflow || buf->len+n > buf->cap) {
+        buf->overflow = 1;
+        return;
+    }
+
+    memcpy(buf->code+buf->len, bytes, n);
+    buf->len += n;
+}
+
+#define EMIT(buf, ...) emit(buf, sizeof((unsigned char[]){__VA_ARGS__}), (unsigned char[]){__VA_ARGS__})
+
+static void emit_u32(codebuf* buf, unsigned v) {
+    unsigned char bytes[4];
+    memcpy(bytes, &v, 4);
+    emit(buf, 4, bytes);
+}
+
+static void emit_u64(codebuf* buf, unsigned long long v) {
+    unsigned char bytes[8];
+    memcpy(bytes, &v, 8);
+    emit(buf, 8, bytes);
+}
+
+static void emit_rex(codebuf* buf, int w, int r, int x, int b) {
+    unsigned char rex = 0x40 | (w << 3) | ((r >> 3) << 2) | ((x >> 3) << 1) | (b >> 3);
+    if (rex != 0x40) EMIT(buf, rex);
+}
+
+// op xmm<reg>, xmm<rm>
+static void sse_rr(codebuf* buf, int op, int reg, int rm) {
+    EMIT(buf, 0xF2);
+    emit_rex(buf, 0, reg, 0, rm);
+    EMIT(buf, 0x0F, op, 0xC0 | (reg&7) << 3 | (rm&7));
+}
+
+// op xmm<reg>, [rsp+disp]
+static void sse_rsp(codebuf* buf, int op, int reg, unsigned disp) {
+    EMIT(buf, 0xF2);
+    emit_rex(buf, 0, reg, 0, 0);
+    EMIT(buf, 0x0F, op, 0x84 | (reg&7) << 3, 0x24);
+    emit_u32(buf, disp);
+}
+
+// op xmm<reg>, [base+index*8]
+static void sse_sib(codebuf* buf, int op, int reg, int base, int index) {
+    EMIT(buf, 0xF2);
+    emit_rex(buf, 0, reg, index, base);
+    EMIT(buf, 0x0F, op, 0x04 | (reg&7) << 3, 0xC0 | (index&7) << 3 | (base&7));
+}
+
+// movsd xmm<reg>, [rax]
+static void sse_load_rax(codebuf* buf, int reg) {
+    EMIT(buf, 0xF2);
+    emit_rex(buf, 0, reg, 0, 0);
+    EMIT(buf, 0x0F, SSE_LOAD, (reg&7) << 3);
+}
+
+// mov rax, imm64
+static void mov_rax(codebuf* buf, unsigned long long imm) {
+    EMIT(buf, 0x48, 0xB8);
+    emit_u64(buf, imm);
+}
+
+static void load_const(codebuf* buf, int reg, double val) {
+    unsigned long long bits;
+    memcpy(&bits, &val, 8);
+
+    mov_rax(buf, bits);
+
+    // movq xmm<reg>, rax
+    EMIT(buf, 0x66);
+    emit_rex(buf, 1, reg, 0, 0);
+    EMIT(buf, 0x0F, 0x6E, 0xC0 | (reg&7) << 3);
+}
+
+static void negate(codebuf* buf, int reg) {
+    // movq rax, xmm<reg> / btc rax, 63 / movq xmm<reg>, rax
+    EMIT(buf, 0x66);
+    emit_rex(buf, 1, reg, 0, 0);
+    EMIT(buf, 0x0F, 0x7E, 0xC0 | (reg&7) << 3);
+
+    EMIT(buf, 0x48, 0x0F, 0xBA, 0xF8, 0x3F);
+
+    EMIT(buf, 0x66);
+    emit_rex(buf, 1, reg, 0, 0);
+    EMIT(buf, 0x0F, 0x6E, 0xC0 | (reg&7) << 3);
+}
+
+// the same exponentiation by squaring as powi(), unrolled for the known exponent
+static void emit_powi(codebuf* buf, int reg, int n) {
+    unsigned k = n < 0 ? -(unsigned)n : (unsigned)n;
+
+    if (k == 0) {
+        load_const(buf, reg, 1.0);
+        return;
+    }
+
+    _Bool first = 1;
+    sse_rr(buf, SSE_LOAD, XMM_TMP2, reg); // the base
+    while (k) {
+        if (k & 1) {
+            if (first) sse_rr(buf, SSE_LOAD, XMM_TMP1, XMM_TMP2);
+            else sse_rr(buf, SSE_MUL, XMM_TMP1, XMM_TMP2);
+            first = 0;
+        }
+
+        k >>= 1;
+        if (k) sse_rr(buf, SSE_MUL, XMM_TMP2, XMM_TMP2);
+    }
+
+    if (n < 0) {
+        load_const(buf, reg, 1.0);
+        sse_rr(buf, SSE_DIV, reg, XMM_TMP1);
+    } else
+        sse_rr(buf, SSE_LOAD, reg, XMM_TMP1);
+}
+
+// Horner's scheme, the argument is kept in the second temporary
+static void emit_poly(codebuf* buf, int reg, const poly_s* poly) {
+    sse_rr(buf, SSE_LOAD, XMM_TMP2, reg);
+    load_const(buf, reg, poly->coeffs[poly->degree]);
+
+    for (unsigned k = poly->degree; k-- > 0; ) {
+        sse_rr(buf, SSE_MUL, reg, XMM_TMP2);
+        load_const(buf, XMM_TMP1, poly->coeffs[k]);
+        sse_rr(buf, SSE_ADD, reg, XMM_TMP1);
+    }
+}
+
+// Every xmm register is caller saved, so the slots below the arguments
+// have to be spilled before a call and reloaded afterwards
+static void emit_spill(codebuf* buf, int live) {
+    for (int i = 0; i < live; i++)
+        sse_rsp(buf, SSE_STORE, i, i*8);
+}
+
+static void emit_reload(codebuf* buf, int live) {
+    for (int i = 0; i < live; i++)
+        sse_rsp(buf, SSE_LOAD, i, i*8);
+}
+
+// Calls fn(xmm<args[0]>, xmm<args[1]> ...) and puts the result into xmm<args[0]>
+static void emit_call(codebuf* buf, const void* fn, int first, int numargs) {
+    emit_spill(buf, first);
+
+    // the arguments are consecutive and first >= 0, so this can't overwrite anything still needed
+    for (int i = 0; i < numargs; i++)
+        if (first+i != i) sse_rr(buf, SSE_LOAD, i, first+i);
+
+    mov_rax(buf, (unsigned long long)fn);
+    EMIT(buf, 0xFF, 0xD0); // call rax
+
+    if (first != 0) sse_rr(buf, SSE_LOAD, first, 0);
+    emit_reload(buf, first);
+}
+
+// user functions are still interpreted, errors just produce NaN
+static double jit_func(formula_s* func, double x) {
+    double result;
+    if (ERROR_FAIL(compute(&result, func, &x)))
+        return NAN;
+
+    return result;
+}
+
+// the comparisons are calls like the rest of the functions, the NaN handling stays in one place
+#define JIT_CMP(name, kind) static double name(double a, double b) { return compare(kind, a, b); }
+JIT_CMP(jit_lt, CMP_LT)
+JIT_CMP(jit_le, CMP_LE)
+JIT_CMP(jit_gt, CMP_GT)
+JIT_CMP(jit_ge, CMP_GE)
+JIT_CMP(jit_eq, CMP_EQ)
+JIT_CMP(jit_ne, CMP_NE)
+
+// indexed by the CMP_ kinds
+static double (*const jit_cmp[])(double, double) = {jit_lt, jit_le, jit_gt, jit_ge, jit_eq, jit_ne};
+
+jit_fn jit_compile(const formula_s* formula, size_t* size) {
+    if (formula->code == NULL || formula->depth > JIT_MAXDEPTH)
+        return NULL;
+
+    // every instruction fits into 64 bytes besides the spills and the reloads around a call (one of each
+    // for every slot below it), a polynomial takes 32 more for every coefficient and an integer power
+    // 10 for every bit of the exponent, emit checks the bounds anyway and leaves the rest to the interpreter
+    size_t cap = formula->numcode*(64 + 2*JIT_SPILLBYTES*formula->depth) + 256;
+    for (size_t i = 0; i < formula->numcode; i++)
+        if (formula->code[i].op == OC_POLY) cap += formula->code[i].poly->degree*32;
+        else if (formula->code[i].op == OC_POWI) cap += 10*32;
+    cap = (cap+4095) & ~4095LU;
+    codebuf buf = {mmap(NULL, cap, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0), 0, cap, 0};
+    if (buf.code == MAP_FAILED)
+        return NULL;
+
+    eval_allocations++;
+
+    // prologue
+    EMIT(&buf, 0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57); // push rbx, r12, r13, r14, r15
+    EMIT(&buf, 0x48, 0x89, 0xFB); // mov rbx, rdi
+    EMIT(&buf, 0x49, 0x89, 0xF4); // mov r12, rsi
+    EMIT(&buf, 0x49, 0x89, 0xD5); // mov r13, rdx
+    EMIT(&buf, 0x45, 0x31, 0xF6); // xor r14d, r14d
+    EMIT(&buf, 0x48, 0x81, 0xEC); emit_u32(&buf, FRAME_SIZE); // sub rsp, FRAME_SIZE
+
+    EMIT(&buf, 0x4D, 0x85, 0xED); // test r13, r13
+    EMIT(&buf, 0x0F, 0x84); // jz end
+    size_t jz_end = buf.len;
+    emit_u32(&buf, 0);
+
+    size_t loop = buf.len;
+
+    int top = 0; // the number of slots in use
+    for (const instr* in = formula->code; in < formula->code+formula->numcode; in++) {
+        const int a = top-2, b = top-1;
+
+        switch (in->op) {
+            case OC_NUM : load_const(&buf, top++, in->num); break;
+            case OC_I   : load_const(&buf, top++, NAN); break;
+            case OC_X   : sse_sib(&buf, SSE_LOAD, top++, REG_RBX, REG_R14); break;
+            case OC_VAR :
+                // variables are read through the pointer, so 'modif' doesn't need a recompilation
+                mov_rax(&buf, (unsigned long long)in->val);
+                sse_load_rax(&buf, top++);
+            break;
+
+            case OC_ADD : sse_rr(&buf, SSE_ADD, a, b); top--; break;
+            case OC_SUB : sse_rr(&buf, SSE_SUB, a, b); top--; break;
+            case OC_MULT: sse_rr(&buf, SSE_MUL, a, b); top--; break;
+            case OC_DIV : sse_rr(&buf, SSE_DIV, a, b); top--; break;
+            case OC_NEG : negate(&buf, b); break;
+            case OC_POWI: emit_powi(&buf, b, (int)in->num); break;
+            case OC_POLY: emit_poly(&buf, b, in->poly); break;
+
+            case OC_MOD :
+            case OC_POW :
+                emit_call(&buf, in->op == OC_POW ? (const void*)pow : (const void*)fmod, a, 2);
+                top--;
+            break;
+
+            case OC_CMP : emit_call(&buf, (const void*)jit_cmp[(int)in->num], a, 2); top--; break;
+            case OC_SELECT : emit_call(&buf, (const void*)choose, top-3, 3); top -= 2; break;
+
+            case OC_CFUNC : emit_call(&buf, in->call->func, b, 1); break;
+            case OC_FUNC  :
+                EMIT(&buf, 0x48, 0xBF); emit_u64(&buf, (unsigned long long)in->func); // mov rdi, func
+                emit_call(&buf, jit_func, b, 1);
+            break;
+
+            // plugin functions want whole blocks of values, the batch interpreter does that,
+            // it runs the terms of the sums over whole blocks too and fills the random draws a block at a time
+            case OC_CALL : case OC_SERIES : case OC_RAND : case OC_ARRAY :
+            default :
+                munmap(buf.code, cap);
+                return NULL;
+            break;
+        }
+    }
+
+    sse_sib(&buf, SSE_STORE, 0, REG_R12, REG_R14); // ys[i] = xmm0
+
+    EMIT(&buf, 0x49, 0xFF, 0xC6); // inc r14
+    EMIT(&buf, 0x4D, 0x39, 0xEE); // cmp r14, r13
+    EMIT(&buf, 0x0F, 0x82); emit_u32(&buf, loop-(buf.len+4)); // jb loop
+
+    unsigned rel = buf.len-(jz_end+4);
+    if (!buf.overflow) memcpy(buf.code+jz_end, &rel, 4);
+
+    // epilogue
+    EMIT(&buf, 0x48, 0x81, 0xC4); emit_u32(&buf, FRAME_SIZE); // add rsp, FRAME_SIZE
+    EMIT(&buf, 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B); // pop r15, r14, r13, r12, rbx
+    EMIT(&buf, 0xC3); // ret
+
+    if (buf.overflow || mprotect(buf.code, cap, PROT_READ | PROT_EXEC) != 0) {
+        munmap(buf.code, cap);
+        return NULL;
+    }
+
+    *size = cap;
+    return (jit_fn)buf.code;
+}
+
+void jit_free(jit_fn fn, size_t size) {
+    if (fn != NULL) munmap((void*)fn, size);
+}
+
+#else
+
+jit_fn jit_compile(const formula_s* formula, size_t* size) {
+    (void)formula;
+    (void)size;
+    return NULL;
+}
+
+void jit_free(jit_fn fn, size_t size) {
+    (void)fn;
+    (void)size;
+}
+
+#endif
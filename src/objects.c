@@ -8,12 +8,21 @@
 #include "SDL.h" // Color etc.
 #include "error.h"
 #include "console.h" // console colors
+#include "compiler.h" // formula_free
+#include "dag.h"
+#include "vmath.h" // the batch entry points
+#include "ddouble.h" // the double-double ones
+#include "array.h"
+#include "eval.h" // the snapshot of the current context
 
 static ds_trie* trie_objects;
+static ds_trie* trie_dependencies;
 set_s* set_first = NULL;
 static set_s* set_last = NULL;
 
-static unsigned instances[5], limits[5] = {50, 50, 25, 25, 8};
+unsigned object_generation = 0;
+
+static unsigned instances[OT_NUMTYPES], limits[OT_NUMTYPES] = {50, 50, 25, 25, 8, 25};
 
 // ---------INITIALIZATION STUFF ------------
 
@@ -22,21 +31,90 @@ static error_t generic_free(object* obj);
 
 static double sgn(double x) { return (x > 0.0 ? 1.0 : x < 0.0 ? -1.0 : 0.0); }
 
+// the derivatives of the built in functions
+static double dsin(double x) { return cos(x); }
+static double dcos(double x) { return -sin(x); }
+static double dtan(double x) { return 1.0 + tan(x)*tan(x); }
+static double dlog(double x) { return 1.0/x; }
+static double dsqrt(double x) { return 0.5/sqrt(x); }
+static double dsgn(double x) { (void)x; return 0.0; }
+
+// the images of ranges (for the interval arithmetic), the rounding is handled by the caller
+static _Bool has_phase(interval x, double phase) { // phase + 2k*PI is in the range (with some slack)
+    const double slack = 1e-9*(1.0 + fabs(x.lo) + fabs(x.hi));
+    return phase + 2*M_PI*ceil((x.lo - slack - phase)/(2*M_PI)) <= x.hi + slack;
+}
+
+static interval range_wave(interval x, double (*f)(double), double top, double bottom) {
+    if (!(x.hi - x.lo < 2*M_PI)) return (interval){-1.0, 1.0, x.gap}; // a whole period (or infinite/NaN)
+
+    interval y = {fmin(f(x.lo), f(x.hi)), fmax(f(x.lo), f(x.hi)), x.gap};
+    if (has_phase(x, top)) y.hi = 1.0;
+    if (has_phase(x, bottom)) y.lo = -1.0;
+    return y;
+}
+
+static interval range_sin(interval x) { return range_wave(x, sin, M_PI/2, -M_PI/2); }
+static interval range_cos(interval x) { return range_wave(x, cos, 0.0, M_PI); }
+
+// tan is increasing between two poles
+static interval range_tan(interval x) {
+    if (!(x.hi - x.lo < M_PI) || floor(x.lo/M_PI + 0.5) != floor(x.hi/M_PI + 0.5)) return (interval){-INFINITY, INFINITY, 1};
+    return (interval){tan(x.lo), tan(x.hi), x.gap};
+}
+
+static interval range_exp(interval x) { return (interval){exp(x.lo), exp(x.hi), x.gap}; }
+
+static interval range_log(interval x) {
+    if (x.hi < 0.0) return (interval){INFINITY, -INFINITY, 1};
+    return (interval){x.lo > 0.0 ? log(x.lo) : -INFINITY, log(x.hi), x.gap || x.lo <= 0.0};
+}
+
+static interval range_sqrt(interval x) {
+    if (x.hi < 0.0) return (interval){INFINITY, -INFINITY, 1};
+    return (interval){x.lo > 0.0 ? sqrt(x.lo) : 0.0, sqrt(x.hi), x.gap || x.lo < 0.0};
+}
+
+static interval range_abs(interval x) {
+    if (x.lo >= 0.0) return x;
+    if (x.hi <= 0.0) return (interval){-x.hi, -x.lo, x.gap};
+    return (interval){0.0, fmax(-x.lo, x.hi), x.gap};
+}
+
+static interval range_sgn(interval x) { return (interval){sgn(x.lo), sgn(x.hi), x.gap}; }
+
+// the built in functions are all pure, so the optimizer can fold them
+static void builtin_add(const char* name, const char* cname, double (*func)(double), void (*batch)(const double*, double*, size_t),
+    double (*deriv)(double), interval (*range)(interval), ddouble (*precise)(ddouble), void (*cbatch)(double*, double*, size_t)) {
+    object_add(name, OT_CFUNC, &(cfunc_s){.func = func, .batch = batch, .deriv = deriv, .range = range, .precise = precise, .cbatch = cbatch, .cname = cname, .arity = 1, .flags = JP_PURE | JP_THREADSAFE});
+}
+
 void objects_init() {
     trie_objects = trie_create();   
-
-    object_add("sin", OT_CFUNC, sin);   
-    object_add("cos", OT_CFUNC, cos);   
-    object_add("sqrt", OT_CFUNC, sqrt); 
-    object_add("abs", OT_CFUNC, fabs);
-    object_add("sgn", OT_CFUNC, sgn);
+    trie_dependencies = trie_create();
+
+    builtin_add("sin", "sin", sin, vm_sin, dsin, range_sin, dd_sin, vm_csin);
+    builtin_add("cos", "cos", cos, vm_cos, dcos, range_cos, dd_cos, vm_ccos);
+    builtin_add("tan", "tan", tan, vm_tan, dtan, range_tan, dd_tan, vm_ctan);
+    builtin_add("exp", "exp", exp, vm_exp, exp, range_exp, dd_exp, vm_cexp);
+    builtin_add("log", "log", log, vm_log, dlog, range_log, dd_log, vm_clog);
+    builtin_add("sqrt", "sqrt", sqrt, vm_sqrt, dsqrt, range_sqrt, dd_sqrt, vm_csqrt);
+    builtin_add("abs", "fabs", fabs, vm_abs, sgn, range_abs, dd_abs, vm_cabs);
+    builtin_add("sgn", "jp_sgn", sgn, NULL, dsgn, range_sgn, dd_sgn, vm_csgn);
     object_add("PI", OT_CONSTANT, &(double){M_PI});
     object_add("e", OT_CONSTANT, &(double){M_E});
 }
 
+static void dependency_free(dependency* dep);
+
 void objects_destroy() {
     trie_destroy(trie_objects, (void (*)(void*))generic_free);
     trie_objects = NULL;
+
+    trie_destroy(trie_dependencies, (void (*)(void*))dependency_free);
+    trie_dependencies = NULL;
+
+    dag_destroy();
 }
 
 // Variable/Function/Set adding & removing procedures
@@ -90,6 +168,133 @@ static error_t checkname(const char* name) {
         
 }   
 
+// ---------- DEPENDENCIES -------------------
+
+// The users of a name, the object with the name doesn't have to exist (yet),
+// a graph can refer to a function which is only going to be added later
+typedef struct dependency {
+    object** users;
+    size_t numusers, capusers;
+} dependency;
+
+static void dependency_free(dependency* dep) {
+    free(dep->users);
+    free(dep);
+}
+
+static formula_s* object_formula(object* obj) {
+    switch (obj->type) {
+        case OT_FUNCTION : return obj->func;
+        case OT_SET : return &obj->set->formula;
+        default : return NULL;
+    }
+}
+
+static _Bool uses_name(const object* obj, const dependency* dep) {
+    for (size_t i = 0; i < obj->numuses; i++)
+        if (obj->uses[i] == dep) return 1;
+
+    return 0;
+}
+
+// Registers obj as a user of every name its formula refers to
+static void dependencies_add(object* obj) {
+    const formula_s* formula = object_formula(obj);
+    if (formula == NULL || formula->toks == NULL) return;
+
+    obj->uses = malloc(formula->numtoks*sizeof(dependency*));
+
+    for (size_t i = 0; i < formula->numtoks; i++) {
+        const token* tok = &formula->toks[i];
+        if (tok->type != TT_VARIABLE && tok->type != TT_FUNCTION) continue;
+
+        dependency* dep = trie_find(trie_dependencies, tok->name, trie_encode);
+        if (dep == NULL) {
+            dep = calloc(1, sizeof(dependency));
+            trie_add(trie_dependencies, tok->name, trie_encode, dep);
+        } else if (uses_name(obj, dep))
+            continue;
+
+        if (dep->numusers == dep->capusers) {
+            dep->capusers = dep->capusers ? dep->capusers*2 : 4;
+            dep->users = realloc(dep->users, dep->capusers*sizeof(object*));
+        }
+
+        dep->users[dep->numusers++] = obj;
+        obj->uses[obj->numuses++] = dep;
+    }
+}
+
+static void dependencies_remove(object* obj) {
+    for (size_t i = 0; i < obj->numuses; i++) {
+        dependency* dep = obj->uses[i];
+
+        for (size_t j = 0; j < dep->numusers; j++)
+            if (dep->users[j] == obj) {
+                dep->users[j] = dep->users[--dep->numusers];
+                break;
+            }
+    }
+
+    free(obj->uses);
+    obj->uses = NULL;
+    obj->numuses = 0;
+}
+
+// Some other object than obj itself using the name, NULL if there is none
+static object* first_user(const char* name, const object* obj) {
+    dependency* dep = trie_find(trie_dependencies, name, trie_encode);
+    if (dep == NULL) return NULL;
+
+    for (size_t i = 0; i < dep->numusers; i++)
+        if (dep->users[i] != obj) return dep->users[i];
+
+    return NULL;
+}
+
+static unsigned walk = 0;
+
+// Collects the sets using the name directly or through functions (at most max of them)
+static void find_graphs(const char* name, object** sets, size_t* numsets, size_t max) {
+    dependency* dep = trie_find(trie_dependencies, name, trie_encode);
+    if (dep == NULL) return;
+
+    for (size_t i = 0; i < dep->numusers; i++) {
+        object* user = dep->users[i];
+        if (user->mark == walk) continue; // functions can refer to each other
+        user->mark = walk;
+
+        if (user->type != OT_SET) find_graphs(user->name, sets, numsets, max);
+        else if (*numsets < max) sets[(*numsets)++] = user;
+    }
+}
+
+size_t object_graphs(const char* name, object** sets, size_t max) {
+    size_t numsets = 0;
+
+    walk++;
+    find_graphs(name, sets, &numsets, max);
+    return numsets;
+}
+
+void object_changed(const char* name) {
+    object* sets[64]; // more than there can be
+    size_t numsets = object_graphs(name, sets, sizeof(sets)/sizeof(*sets));
+
+    for (size_t i = 0; i < numsets; i++)
+        sets[i]->set->dirty = 1;
+}
+
+void function_replace(object* obj, formula_s formula) {
+    dependencies_remove(obj);
+    formula_free(obj->func);
+    *obj->func = formula;
+    dependencies_add(obj);
+
+    // the function is inlined into its callers, they have to be recompiled
+    object_generation++;
+}
+
 // Add a generic object to the trie structure
 error_t object_add(const char* name, int type, void* data) {
 
@@ -100,9 +305,9 @@ error_t object_add(const char* name, int type, void* data) {
 
     if (ERROR_FAIL(checkname(name))) return ERROR_CODE_FAIL;
 
-    object* obj = malloc(sizeof(object));
+    object* obj = calloc(1, sizeof(object));
     obj->type = type;
-    obj->hidden = 0;
+    strcpy(obj->name, name);
 
     // This is copying from pointer to stack variable so you dont have to free if checkname fails
     size_t size;
@@ -110,8 +315,9 @@ error_t object_add(const char* name, int type, void* data) {
         case OT_VARIABLE :
         case OT_CONSTANT : size = sizeof(double);    break;
         case OT_FUNCTION : size = sizeof(formula_s); break;
-        case    OT_CFUNC : size = 0;                 break;
+        case    OT_CFUNC : size = sizeof(cfunc_s);   break;
         case      OT_SET : size = sizeof(set_s);       break;
+        case    OT_ARRAY : size = sizeof(array_s*);    break;
 
         default : 
             free(obj);
@@ -120,12 +326,14 @@ error_t object_add(const char* name, int type, void* data) {
         break;
     }
 
-    if (type != OT_CFUNC) {
-        obj->data = malloc(size);
-        memcpy(obj->data, data, size);
-    } else obj->cfunc = data;
+    obj->data = malloc(size);
+    memcpy(obj->data, data, size);
 
     trie_add(trie_objects, name, trie_encode, obj);
+    dependencies_add(obj);
+
+    // the graphs which couldn't be computed without it can be now
+    object_changed(name);
 
     // add to the linked list of sets
     if (type == OT_SET) {
@@ -161,12 +369,12 @@ static error_t generic_free(object* obj) {
             free(obj->val);
         break;
         case OT_FUNCTION : 
-            free(obj->func->toks); 
+            formula_free(obj->func);
 
             free(obj->func);
         break;
         case OT_CFUNC :
-
+            free(obj->cfunc);
         break;
         case OT_SET : 
     
@@ -181,11 +389,18 @@ static error_t generic_free(object* obj) {
             if (obj->set->next == NULL)
                 set_last = obj->set->prev;
 
+            dag_remove(obj->set);
             free(obj->set->coords);
-            free(obj->set->formula.toks);
+            array_release(obj->set->xs);
+            array_release(obj->set->ys);
+            formula_free(&obj->set->formula);
 
             free(obj->set);
         break;
+        case OT_ARRAY :
+            array_release(*obj->array);
+            free(obj->array);
+        break;
         default :
             error_throw("invalid object type");
             return ERROR_CODE_FAIL;
@@ -193,53 +408,43 @@ static error_t generic_free(object* obj) {
     }
 
     instances[obj->type]--;
+    free(obj->uses);
     free(obj);
 
     return ERROR_CODE_OK; 
     
 }
 
-static bool formula_contains(formula_s formula, const char* name) {
-    if (formula.toks == NULL) return 0;
+// Refuses if some other object refers to the name, it would break otherwise
+static error_t check_unused(const char* name, const object* obj) {
+    const object* user = first_user(name, obj);
+    if (user == NULL) return ERROR_CODE_OK;
 
-    for (size_t tok = 0; tok < formula.numtoks; tok++)
-        if (formula.toks[tok].type == TT_VARIABLE ||
-            formula.toks[tok].type == TT_FUNCTION)
-            if (strcmp(formula.toks[tok].name, name) == 0) {
-                return 1;
-            }
+    if (user->type == OT_SET)
+        error_throw_str("Object is used in the graph "ANSI_COLOR_YELLOW"'%s'"ANSI_COLOR_RESET, user->name);
+    else
+        error_throw_str("Object is used in the function "ANSI_COLOR_YELLOW"'%s'"ANSI_COLOR_RESET, user->name);
 
-    return 0;
+    return ERROR_CODE_FAIL;
 }
 
 // generic remove
 error_t object_remove(const char* name) {
-
-    // First, check if any set or function uses the variable/constant/function so we don't mess things up
-    ds_vector* dumps[5];
-    objects_dump(dumps); 
-
-    // Check the graphs first
-    for (size_t i = 0; i < vector_length(dumps[OT_SET]); i++) {
-        ds_trie_dump* dump = (ds_trie_dump*)vector_get(dumps[OT_SET], i);
-        formula_s formula = ((object*)dump->data)->set->formula;
-
-        if (formula_contains(formula, name))    {
-            error_throw_str("Object is used in the graph "ANSI_COLOR_YELLOW"'%s'"ANSI_COLOR_RESET, dump->name );
-            return ERROR_CODE_FAIL;
-        }
+    object* obj = trie_find(trie_objects, name, trie_encode);
+    if (obj == NULL) {
+        error_throw_str("object " ANSI_COLOR_YELLOW "'%s'" ANSI_COLOR_RESET " not found", name);
+        return ERROR_CODE_FAIL;
     }
 
-    /*for (size_t i = 0; i < vector_length(dumps[OT_FUNCTION]); i++) {
-        ds_trie_dump* dump = (ds_trie_dump*)vector_get(dumps[OT_FUNCTION], i);
-        formula_s formula = *((object*)dump->data)->func;
+    // check if any set or function uses the object so we don't mess things up
+    if (ERROR_FAIL(check_unused(name, obj)))
+        return ERROR_CODE_FAIL;
 
-        if (formula_contains(formula, name))    {
-            error_throw_str("Object is used in the function "ANSI_COLOR_YELLOW"'%s'"ANSI_COLOR_RESET, dump->name );
-            return ERROR_CODE_FAIL;
-        }
-    }*/
+    dependencies_remove(obj);
 
+    // the compiled code of the cached expressions may point into the object, it's recompiled,
+    // nothing compiled refers to a set (check_unused), the DAG only releases its nodes then
+    if (obj->type != OT_SET) object_generation++;
     return generic_free(trie_remove(trie_objects, name, trie_encode));  
 }
 
@@ -248,13 +453,20 @@ error_t object_rename(const char* name, const char* newname) {
     if (ERROR_FAIL(checkname(newname)))
         return ERROR_CODE_FAIL;
 
-    object* obj = trie_remove(trie_objects, name, trie_encode);
+    object* obj = trie_find(trie_objects, name, trie_encode);
     if (obj == NULL){
         error_throw("invalid object");
         return ERROR_CODE_FAIL;
     }
 
+    // the users would still refer to the old name
+    if (ERROR_FAIL(check_unused(name, obj)))
+        return ERROR_CODE_FAIL;
+
+    trie_remove(trie_objects, name, trie_encode);
     trie_add(trie_objects, newname, trie_encode, obj);  
+    strcpy(obj->name, newname);
+    object_generation++;
 
     return ERROR_CODE_OK;
 }
@@ -272,6 +484,7 @@ error_t object_hide(const char* name, _Bool val) {
     }
     
     obj->hidden = val;  
+    object_generation++;
 
     if (obj->type == OT_SET)
         obj->set->shown = !val;
@@ -286,7 +499,7 @@ error_t objects_dump(ds_vector** arr) {
         return ERROR_CODE_FAIL;
     }
 
-    for (size_t i = 0; i < 5; i++) 
+    for (size_t i = 0; i < OT_NUMTYPES; i++) 
         arr[i] = vector_create(vec->destroy_element);
 
     for (size_t i = 0; i < vector_length(vec); i++) {
@@ -307,8 +520,63 @@ error_t objects_dump(ds_vector** arr) {
     return ERROR_CODE_OK;
 }
 
+typedef struct snapshot_entry {
+    char name[NAME_MAXLEN];
+    object* obj;
+} snapshot_entry;
+
+typedef struct snapshot_s {
+    size_t length;
+    snapshot_entry entries[]; // sorted by the name
+} snapshot_s;
+
+static int snapshot_compare(const void* a, const void* b) {
+    return strcmp(((const snapshot_entry*)a)->name, ((const snapshot_entry*)b)->name);
+}
+
+// bsearch hands over the name itself as the key
+static int snapshot_find(const void* name, const void* entry) {
+    return strcmp(name, ((const snapshot_entry*)entry)->name);
+}
+
+snapshot_s* objects_snapshot() {
+    ds_vector* vec = trie_dump(trie_objects, trie_decode);
+    if (vec == NULL) {
+        error_throw("dump error");
+        return NULL;
+    }
+
+    const size_t length = vector_length(vec);
+    snapshot_s* snapshot = malloc(sizeof(snapshot_s) + length*sizeof(snapshot_entry));
+    snapshot->length = length;
+
+    for (size_t i = 0; i < length; i++) {
+        ds_trie_dump* obj_dump = vector_get(vec, i);
+        strncpy(snapshot->entries[i].name, obj_dump->name, NAME_MAXLEN-1);
+        snapshot->entries[i].name[NAME_MAXLEN-1] = '\0';
+        snapshot->entries[i].obj = obj_dump->data;
+    }
+
+    vector_destroy(vec);
+
+    // the trie order isn't necessarily strcmp's
+    qsort(snapshot->entries, length, sizeof(snapshot_entry), snapshot_compare);
+    return snapshot;
+}
+
+void snapshot_free(snapshot_s* snapshot) {
+    free(snapshot);
+}
+
 error_t object_get(const char* name, object** obj) {
-    object* tmpobj = trie_find(trie_objects, name, trie_encode);
+    // a context with a snapshot doesn't touch the trie, other threads can go on reading it at the same time
+    const snapshot_s* snapshot = eval_current()->objects;
+    object* tmpobj;
+
+    if (snapshot != NULL) {
+        const snapshot_entry* entry = bsearch(name, snapshot->entries, snapshot->length, sizeof(snapshot_entry), snapshot_find);
+        tmpobj = entry != NULL ? entry->obj : NULL;
+    } else tmpobj = trie_find(trie_objects, name, trie_encode);
 
     if (tmpobj == NULL) {
         error_throw_str("object " ANSI_COLOR_YELLOW "'%s'" ANSI_COLOR_RESET " not found", name);
@@ -327,7 +595,7 @@ error_t object_get(const char* name, object** obj) {
 }
 
 // ---------- SET HANDELING -------------------
-error_t graph_add(const char* name, formula_s formula, SDL_Color col) {
+error_t graph_add(const char* name, formula_s formula, _Bool derivative, SDL_Color col) {
 
     set_s s = {
         .plot_type = PT_FUNCTION,
@@ -336,24 +604,38 @@ error_t graph_add(const char* name, formula_s formula, SDL_Color col) {
         .length = 0,
 
         .formula = formula,
+        .derivative = derivative,
+        .dag_root = -1,
+        .dirty = 1,
         .linewidth = 2,
         .shown = 1,
         .col_line = col
     };
 
     error_t retval = object_add(name, OT_SET, &s);
-    if (ERROR_FAIL(retval)) free(s.coords);
+    if (ERROR_FAIL(retval)) {
+        free(s.coords);
+        return retval;
+    }
+
+    // share the subexpressions with the other graphs
+    object* obj;
+    if (!ERROR_FAIL(object_get(name, &obj)))
+        dag_add(obj->set);
 
     return retval;
 }
 
-error_t plot_add(const char* name, pointf* coords, size_t length, SDL_Color col) {
+error_t plot_add(const char* name, array_s* xs, array_s* ys, SDL_Color col) {
 
     set_s s = {
         .plot_type = PT_LINEAR,
 
-        .coords = coords,
-        .length = length,
+        .xs = xs,
+        .ys = ys,
+        .length = xs->length < ys->length ? xs->length : ys->length,
+        .dag_root = -1,
+        .dirty = 1,
 
         .linewidth = 2,
         .shown = 1,
@@ -361,12 +643,15 @@ error_t plot_add(const char* name, pointf* coords, size_t length, SDL_Color col)
     };
 
     error_t retval = object_add(name, OT_SET, &s);
-    if (ERROR_FAIL(retval)) free(s.coords);
+    if (ERROR_FAIL(retval)) {
+        array_release(xs);
+        array_release(ys);
+    }
 
     return retval;
 }
 
 const char* obj_type_str(int type) {
-    static const char *names[5] = {"constant", "variable", "function", "plugin function", "set"};
+    static const char *names[OT_NUMTYPES] = {"constant", "variable", "function", "plugin function", "set", "array"};
     return names[type];
 }
@@ -0,0 +1,627 @@
+#include "compiler.h"
+#include "parser.h" // eval_allocations, call_scalar
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// The optimizer turns the bytecode back into a tree, inlines the user functions,
+// simplifies it bottom up and writes it out again
+
+#define POWI_MAX 16 // the highest exponent that still gets turned into multiplications
+
+#define INLINE_MAXNODES 4096 // inlining stops once the formula has this many instructions
+#define INLINE_MAXCOPY 16 // how many instructions copying an argument for every 'x' may add
+
+#define POLY_MINSAVED 3 // a polynomial replaces code at least this much longer than its degree
+#define ESTRIN_MINDEGREE 8 // Horner's scheme waits for every multiplication, from here on that is slower
+
+typedef struct node {
+    instr in;
+    int left, right; // -1 if not used, unary operations only use right
+    int repl; // the simplified replacement, -2 until simplify visited the node
+} node;
+
+// The index cells of the sums being built, the term of a copied sum uses the cell of the copy
+typedef struct remap {
+    const double* from;
+    const double* to;
+    const struct remap* next;
+} remap;
+
+// Inlined arguments are shared by every 'x' of the function body, so this is a DAG until emit
+typedef struct tree {
+    node* nodes;
+    size_t numnodes, cap;
+    size_t inlined;
+
+    // the coefficients of the OC_POLY nodes, handed over to the formula in the end
+    poly_s** polys;
+    size_t numpolys, cappolys;
+
+    // the same for the loops of the OC_SERIES nodes
+    series_s** series;
+    size_t numseries, capseries;
+    const remap* remaps;
+} tree;
+
+double powi(double x, int n) {
+    unsigned k = n < 0 ? -(unsigned)n : (unsigned)n;
+    double res = 1.0;
+
+    // exponentiation by squaring
+    while (k) {
+        if (k & 1) res *= x;
+        x *= x;
+        k >>= 1;
+    }
+
+    return n < 0 ? 1.0/res : res;
+}
+
+double compare(int kind, double a, double b) {
+    if (isnan(a) || isnan(b)) return NAN;
+
+    switch (kind) {
+        case CMP_LT : return a < b;
+        case CMP_LE : return a <= b;
+        case CMP_GT : return a > b;
+        case CMP_GE : return a >= b;
+        case CMP_EQ : return a == b;
+        default : return a != b;
+    }
+}
+
+double choose(double cond, double a, double b) {
+    if (isnan(cond)) return NAN;
+    return cond != 0.0 ? a : b;
+}
+
+double poly_eval(const poly_s* poly, double x) {
+    const double* c = poly->coeffs;
+    unsigned len = poly->degree+1;
+
+    if (poly->degree < ESTRIN_MINDEGREE) {
+        double res = c[poly->degree];
+        for (unsigned k = poly->degree; k-- > 0; )
+            res = res*x + c[k];
+
+        return res;
+    }
+
+    // pairs of coefficients c0 + c1*x first, then pairs of the pairs with x^2, x^4 ...
+    double tmp[POLY_MAXDEGREE+1];
+    for (unsigned k = 0; k < len; k += 2)
+        tmp[k/2] = k+1 < len ? c[k] + c[k+1]*x : c[k];
+
+    for (double p = x*x; len = (len+1)/2, len > 1; p *= p)
+        for (unsigned k = 0; k < len; k += 2)
+            tmp[k/2] = k+1 < len ? tmp[k] + tmp[k+1]*p : tmp[k];
+
+    return tmp[0];
+}
+
+void formula_free_polys(formula_s* formula) {
+    for (size_t i = 0; i < formula->numpolys; i++)
+        free(formula->polys[i]);
+
+    free(formula->polys);
+    formula->polys = NULL;
+    formula->numpolys = 0;
+}
+
+void formula_free_series(formula_s* formula) {
+    for (size_t i = 0; i < formula->numseries; i++)
+        free(formula->series[i]);
+
+    free(formula->series);
+    formula->series = NULL;
+    formula->numseries = 0;
+}
+
+static _Bool isnum(const node* nodes, int n, double val) {
+    return nodes[n].in.op == OC_NUM && nodes[n].in.num == val;
+}
+
+static _Bool isconst(const node* nodes, int n) {
+    return n < 0 || nodes[n].in.op == OC_NUM;
+}
+
+// Computes an operation on constant operands exactly the way the evaluator would
+static double fold_value(const instr* in, double left, double right) {
+    switch (in->op) {
+        case OC_ADD : return left + right;
+        case OC_SUB : return left - right;
+        case OC_MULT: return left * right;
+        case OC_DIV : return left / right;
+        case OC_MOD : return fmod(left, right);
+        case OC_POW : return pow(left, right);
+        case OC_NEG : return -right;
+        case OC_POWI: return powi(right, (int)in->num);
+        case OC_CFUNC : return in->call->func(right);
+        case OC_POLY : return poly_eval(in->poly, right);
+        case OC_CMP : return compare((int)in->num, left, right);
+        default : return NAN; // never happens, checked by the caller
+    }
+}
+
+static _Bool foldable(const instr* in) {
+    switch (in->op) {
+        case OC_NUM :
+        case OC_X :
+        case OC_VAR :
+        case OC_I : // not a real number, folding would turn it into NaN
+        case OC_FUNC :
+        case OC_CALL : // folded separately, it has more arguments
+        case OC_SELECT :
+        case OC_SERIES :
+        case OC_RAND :
+        case OC_ARRAY : // a different number for every element
+        case OC_ARG :
+            return 0;
+        case OC_CFUNC :
+            return in->flags & IF_PURE;
+        default :
+            return 1;
+    }
+}
+
+// Collects the values of an argument list, fails if any of them isn't constant
+static _Bool const_args(const node* nodes, int n, double* args, size_t* numargs) {
+    if (nodes[n].in.op == OC_ARG)
+        return const_args(nodes, nodes[n].left, args, numargs) && const_args(nodes, nodes[n].right, args, numargs);
+
+    if (nodes[n].in.op != OC_NUM) return 0;
+
+    args[(*numargs)++] = nodes[n].in.num;
+    return 1;
+}
+
+static int simplify(node* nodes, int n);
+static _Bool copyable(const node* nodes, int n);
+
+static int simplify_node(node* nodes, int n) {
+    node* nd = &nodes[n];
+
+    if (nd->left >= 0) nd->left = simplify(nodes, nd->left);
+    if (nd->right >= 0) nd->right = simplify(nodes, nd->right);
+
+    const int l = nd->left, r = nd->right;
+
+    // a pure plugin function with constant arguments is called just once, right now
+    double args[JP_MAXARITY];
+    size_t numargs = 0;
+    if (nd->in.op == OC_CALL && (nd->in.flags & IF_PURE) && const_args(nodes, r, args, &numargs)) {
+        nd->in.num = call_scalar(nd->in.call, args);
+        nd->in.op = OC_NUM;
+        nd->in.flags = 0;
+        nd->left = nd->right = -1;
+        return n;
+    }
+
+    // constant folding, a NaN out of numbers (like sqrt(-4)) is left for the evaluator, it can be a complex number
+    if (foldable(&nd->in) && isconst(nodes, l) && isconst(nodes, r)) {
+        const double left = l >= 0 ? nodes[l].in.num : 0.0, right = nodes[r].in.num;
+        const double val = fold_value(&nd->in, left, right);
+
+        if (!isnan(val) || isnan(left) || isnan(right)) {
+            nd->in.num = val;
+            nd->in.op = OC_NUM;
+            nd->in.flags = 0;
+            nd->left = nd->right = -1;
+            return n;
+        }
+    }
+
+    switch (nd->in.op) {
+        case OC_POW :
+            // strength reduction, small integer powers are just a few multiplications
+            if (nodes[r].in.op == OC_NUM && nodes[r].in.num == floor(nodes[r].in.num) && fabs(nodes[r].in.num) <= POWI_MAX) {
+                if (nodes[r].in.num == 1.0) return l;
+
+                nd->in.op = OC_POWI;
+                nd->in.num = nodes[r].in.num;
+                nd->right = l;
+                nd->left = -1;
+            }
+        break;
+        case OC_MULT :
+            if (isnum(nodes, r, 1.0)) return l;
+            if (isnum(nodes, l, 1.0)) return r;
+        break;
+        case OC_DIV :
+            if (isnum(nodes, r, 1.0)) return l;
+        break;
+        case OC_ADD :
+            if (isnum(nodes, r, 0.0)) return l;
+            if (isnum(nodes, l, 0.0)) return r;
+        break;
+        case OC_SUB :
+            if (isnum(nodes, r, 0.0)) return l;
+            if (isnum(nodes, l, 0.0)) {
+                nd->in.op = OC_NEG;
+                nd->left = -1;
+            }
+        break;
+        case OC_NEG :
+            if (nodes[r].in.op == OC_NEG) return nodes[r].right;
+        break;
+        case OC_SELECT : {
+            // a constant condition picks the branch, the other one goes if it has no side effects
+            const int args = nodes[r].left, cond = nodes[args].left;
+            if (nodes[cond].in.op == OC_NUM && !isnan(nodes[cond].in.num)) {
+                const _Bool taken = nodes[cond].in.num != 0.0;
+                if (copyable(nodes, taken ? nodes[r].right : nodes[args].right))
+                    return taken ? nodes[args].right : nodes[r].right;
+            }
+        } break;
+        default : break;
+    }
+
+    return n;
+}
+
+// Simplifies the subtree and returns the node that replaces it
+static int simplify(node* nodes, int n) {
+    node* nd = &nodes[n];
+    if (nd->repl != -2) return nd->repl; // a shared argument, already done
+
+    nd->repl = simplify_node(nodes, n);
+    return nd->repl;
+}
+
+// The number of values the subtree leaves on the stack, only argument lists leave more than one
+static size_t width(const node* nodes, int n) {
+    if (nodes[n].in.op != OC_ARG) return 1;
+    return width(nodes, nodes[n].left) + width(nodes, nodes[n].right);
+}
+
+// Writes the tree back as bytecode and returns the stack depth it needs
+static size_t emit(const node* nodes, int n, instr* code, size_t* numcode) {
+    size_t depth = 1;
+
+    // the bounds, the loop and then the term, which is computed where the bounds were
+    if (nodes[n].in.op == OC_SERIES) {
+        depth = emit(nodes, nodes[n].left, code, numcode);
+
+        const size_t loop = (*numcode)++;
+        code[loop] = nodes[n].in;
+
+        size_t tdepth = emit(nodes, nodes[n].right, code, numcode);
+        code[loop].series->len = *numcode-loop-1;
+
+        return tdepth > depth ? tdepth : depth;
+    }
+
+    if (nodes[n].left >= 0) {
+        depth = emit(nodes, nodes[n].left, code, numcode);
+
+        size_t rdepth = width(nodes, nodes[n].left)+emit(nodes, nodes[n].right, code, numcode);
+        if (rdepth > depth) depth = rdepth;
+    } else if (nodes[n].right >= 0)
+        depth = emit(nodes, nodes[n].right, code, numcode);
+
+    // the arguments just stay on the stack for the call
+    if (nodes[n].in.op != OC_ARG)
+        code[(*numcode)++] = nodes[n].in;
+
+    return depth;
+}
+
+static int add_node(tree* t, const instr* in, int left, int right) {
+    if (t->numnodes == t->cap) {
+        t->cap *= 2;
+        t->nodes = realloc(t->nodes, t->cap*sizeof(node));
+        eval_allocations++;
+    }
+
+    t->nodes[t->numnodes] = (node){*in, left, right, -2};
+    return t->numnodes++;
+}
+
+// The number of instructions emit writes for the subtree (shared nodes count every time)
+static size_t tree_size(const node* nodes, int n) {
+    if (n < 0) return 0;
+    return (nodes[n].in.op != OC_ARG) + tree_size(nodes, nodes[n].left) + tree_size(nodes, nodes[n].right);
+}
+
+// Side effects have to happen exactly once, so such arguments can't be copied or dropped
+static _Bool copyable(const node* nodes, int n) {
+    if (n < 0) return 1;
+
+    const instr* in = &nodes[n].in;
+    if (in->op == OC_FUNC || in->op == OC_RAND || ((in->op == OC_CFUNC || in->op == OC_CALL) && !(in->flags & IF_PURE)))
+        return 0;
+
+    return copyable(nodes, nodes[n].left) && copyable(nodes, nodes[n].right);
+}
+
+static const poly_s* tree_poly(tree* t, const poly_s* poly) {
+    if (t->numpolys == t->cappolys) {
+        t->cappolys = t->cappolys ? t->cappolys*2 : 4;
+        t->polys = realloc(t->polys, t->cappolys*sizeof(poly_s*));
+        eval_allocations++;
+    }
+
+    poly_s* copy = malloc(sizeof(poly_s));
+    memcpy(copy, poly, sizeof(poly_s));
+    eval_allocations++;
+
+    return t->polys[t->numpolys++] = copy;
+}
+
+static series_s* tree_series(tree* t, const series_s* series) {
+    if (t->numseries == t->capseries) {
+        t->capseries = t->capseries ? t->capseries*2 : 4;
+        t->series = realloc(t->series, t->capseries*sizeof(series_s*));
+        eval_allocations++;
+    }
+
+    series_s* copy = malloc(sizeof(series_s));
+    memcpy(copy, series, sizeof(series_s));
+    eval_allocations++;
+
+    return t->series[t->numseries++] = copy;
+}
+
+static error_t build(tree* t, const instr* code, size_t numcode, int arg, int* root);
+
+// Splices the body of a user function in place of the call with 'x' substituted by the argument,
+// result is -1 if the call is better left alone
+static error_t inline_call(tree* t, formula_s* func, int arg, int* result) {
+    *result = -1;
+
+    if (ERROR_FAIL(formula_prepare(func, 1)))
+        return ERROR_CODE_FAIL;
+
+    if (t->numnodes+func->numcode > INLINE_MAXNODES)
+        return ERROR_CODE_OK;
+
+    size_t uses = 0;
+    _Bool series = 0;
+    for (size_t i = 0; i < func->numcode; i++) {
+        if (func->code[i].op == OC_X) uses++;
+        series |= func->code[i].op == OC_SERIES;
+    }
+
+    // the argument would be computed again for every term of a sum
+    if (series && (tree_size(t->nodes, arg) > 1 || !copyable(t->nodes, arg)))
+        return ERROR_CODE_OK;
+
+    // every additional 'x' evaluates the argument once more
+    if (uses != 1 && (!copyable(t->nodes, arg) || (uses > 1 && tree_size(t->nodes, arg)*(uses-1) > INLINE_MAXCOPY)))
+        return ERROR_CODE_OK;
+
+    if (ERROR_FAIL(build(t, func->code, func->numcode, arg, result)))
+        return ERROR_CODE_FAIL;
+
+    t->inlined++;
+    return ERROR_CODE_OK;
+}
+
+// Rebuilds the tree of the bytecode, 'x' is replaced by the node arg if it's not -1
+static error_t build(tree* t, const instr* code, size_t numcode, int arg, int* root) {
+    int* stack = malloc(numcode*sizeof(int));
+    size_t height = 0;
+    eval_allocations++;
+
+    // the compiler already made sure the operand counts add up
+    for (size_t i = 0; i < numcode; i++) {
+        int left = -1, right = -1;
+
+        switch (code[i].op) {
+            case OC_NUM : case OC_I : case OC_RAND : case OC_ARRAY :
+            break;
+            case OC_VAR : {
+                // the index of a copied sum
+                const remap* r = t->remaps;
+                while (r != NULL && r->from != code[i].val) r = r->next;
+
+                if (r != NULL) {
+                    stack[height++] = add_node(t, &(instr){.op = OC_VAR, .val = r->to}, -1, -1);
+                    continue;
+                }
+            } break;
+            case OC_SERIES : {
+                // the term is a tree of its own, the sums of inlined functions are copied like their polynomials
+                series_s* copy = tree_series(t, code[i].series);
+                const size_t len = code[i].series->len;
+
+                remap r = {&code[i].series->k, &copy->k, t->remaps};
+                t->remaps = &r;
+                int term;
+                error_t retval = build(t, code+i+1, len, arg, &term);
+                t->remaps = r.next;
+
+                if (ERROR_FAIL(retval)) {
+                    free(stack);
+                    return ERROR_CODE_FAIL;
+                }
+
+                height -= 2;
+                left = add_node(t, &(instr){.op = OC_ARG}, stack[height], stack[height+1]);
+                stack[height++] = add_node(t, &(instr){.op = OC_SERIES, .series = copy}, left, term);
+                i += len;
+            } continue;
+            case OC_X :
+                if (arg >= 0) {
+                    stack[height++] = arg;
+                    continue;
+                }
+            break;
+            case OC_FUNC : {
+                right = stack[--height];
+
+                int body;
+                if (ERROR_FAIL(inline_call(t, code[i].func, right, &body))) {
+                    free(stack);
+                    return ERROR_CODE_FAIL;
+                }
+
+                if (body >= 0) {
+                    stack[height++] = body;
+                    continue;
+                }
+            } break;
+            case OC_NEG : case OC_POWI : case OC_CFUNC :
+                right = stack[--height];
+            break;
+            case OC_POLY :
+                // an inlined function, its polynomials belong to it
+                right = stack[--height];
+                stack[height++] = add_node(t, &(instr){.op = OC_POLY, .poly = tree_poly(t, code[i].poly)}, -1, right);
+            continue;
+            case OC_CALL : case OC_SELECT : {
+                // the arguments become a chain of OC_ARG nodes, so the tree stays binary
+                const size_t arity = code[i].op == OC_CALL ? code[i].call->arity : 3;
+                height -= arity;
+                right = stack[height];
+                for (size_t k = 1; k < arity; k++)
+                    right = add_node(t, &(instr){.op = OC_ARG}, right, stack[height+k]);
+            } break;
+            default :
+                right = stack[--height];
+                left = stack[--height];
+            break;
+        }
+
+        stack[height++] = add_node(t, &code[i], left, right);
+    }
+
+    *root = stack[0];
+    free(stack);
+
+    return ERROR_CODE_OK;
+}
+
+// ------- POLYNOMIALS ---------
+
+static _Bool monomial(const poly_s* p) {
+    unsigned terms = 0;
+    for (unsigned k = 0; k <= p->degree; k++)
+        terms += p->coeffs[k] != 0.0;
+
+    return terms <= 1;
+}
+
+static void poly_const(poly_s* p, double c, unsigned degree) {
+    memset(p, 0, sizeof(poly_s));
+    p->degree = degree;
+    p->coeffs[degree] = c;
+}
+
+// The polynomial in x the subtree computes, fails if it isn't one or the degree is too high.
+// Only products with a monomial get expanded, (x-1)^8 written as a sum would lose all precision around 1
+static _Bool as_poly(const node* nodes, int n, poly_s* p) {
+    const node* nd = &nodes[n];
+    poly_s l, r;
+
+    switch (nd->in.op) {
+        case OC_NUM : poly_const(p, nd->in.num, 0); return 1;
+        case OC_X : poly_const(p, 1.0, 1); return 1;
+        case OC_NEG :
+            if (!as_poly(nodes, nd->right, p)) return 0;
+
+            for (unsigned k = 0; k <= p->degree; k++) p->coeffs[k] = -p->coeffs[k];
+            return 1;
+        case OC_ADD : case OC_SUB :
+            if (!as_poly(nodes, nd->left, &l) || !as_poly(nodes, nd->right, &r)) return 0;
+
+            // the coefficients past the degree are zeros
+            poly_const(p, 0.0, l.degree > r.degree ? l.degree : r.degree);
+            for (unsigned k = 0; k <= p->degree; k++)
+                p->coeffs[k] = nd->in.op == OC_ADD ? l.coeffs[k] + r.coeffs[k] : l.coeffs[k] - r.coeffs[k];
+
+            while (p->degree > 0 && p->coeffs[p->degree] == 0.0) p->degree--;
+            return 1;
+        case OC_MULT :
+            if (!as_poly(nodes, nd->left, &l) || !as_poly(nodes, nd->right, &r)) return 0;
+            if ((!monomial(&l) && !monomial(&r)) || l.degree+r.degree > POLY_MAXDEGREE) return 0;
+
+            poly_const(p, 0.0, l.degree+r.degree);
+            for (unsigned i = 0; i <= l.degree; i++)
+                for (unsigned j = 0; j <= r.degree; j++)
+                    if (l.coeffs[i] != 0.0 && r.coeffs[j] != 0.0) p->coeffs[i+j] += l.coeffs[i]*r.coeffs[j];
+            return 1;
+        case OC_DIV :
+            if (nodes[nd->right].in.op != OC_NUM || !as_poly(nodes, nd->left, p)) return 0;
+
+            for (unsigned k = 0; k <= p->degree; k++) p->coeffs[k] /= nodes[nd->right].in.num;
+            return 1;
+        case OC_POWI : case OC_POW : {
+            // big integer powers stay OC_POW
+            const double e = nd->in.op == OC_POWI ? nd->in.num : nodes[nd->right].in.op == OC_NUM ? nodes[nd->right].in.num : -1.0;
+            if (!(e >= 0.0 && e <= POLY_MAXDEGREE && e == floor(e))) return 0;
+
+            if (!as_poly(nodes, nd->in.op == OC_POWI ? nd->right : nd->left, &l) || !monomial(&l) || l.degree*e > POLY_MAXDEGREE) return 0;
+
+            poly_const(p, powi(l.coeffs[l.degree], (int)e), l.degree*(unsigned)e);
+            return 1;
+        }
+        default : return 0;
+    }
+}
+
+// Replaces the biggest polynomial subtrees in x by single OC_POLY instructions,
+// x is usually the only thing that isn't constant, so rational functions become two of them
+static int specialize(tree* t, int n) {
+    if (n < 0 || t->nodes[n].in.op == OC_NUM || t->nodes[n].in.op == OC_POLY) return n;
+
+    poly_s p;
+    if (as_poly(t->nodes, n, &p) && p.degree >= 2 && tree_size(t->nodes, n) > p.degree+POLY_MINSAVED) {
+        int x = add_node(t, &(instr){.op = OC_X}, -1, -1);
+        return add_node(t, &(instr){.op = OC_POLY, .poly = tree_poly(t, &p)}, -1, x);
+    }
+
+    // add_node can move the nodes
+    int left = specialize(t, t->nodes[n].left);
+    int right = specialize(t, t->nodes[n].right);
+    t->nodes[n].left = left;
+    t->nodes[n].right = right;
+
+    return n;
+}
+
+error_t formula_optimize(formula_s* formula) {
+    formula->removed = formula->inlined = 0;
+    if (formula->code == NULL || formula->numcode == 0) return ERROR_CODE_OK;
+
+    tree t = {malloc(formula->numcode*2*sizeof(node)), 0, formula->numcode*2, 0};
+    eval_allocations++;
+
+    int root;
+    if (ERROR_FAIL(build(&t, formula->code, formula->numcode, -1, &root))) {
+        formula_free_polys(&(formula_s){.polys = t.polys, .numpolys = t.numpolys});
+        formula_free_series(&(formula_s){.series = t.series, .numseries = t.numseries});
+        free(t.nodes);
+        return ERROR_CODE_FAIL;
+    }
+
+    size_t before = tree_size(t.nodes, root);
+    root = simplify(t.nodes, root);
+    root = specialize(&t, root);
+
+    // inlining can make the code longer than it was
+    instr* code = malloc(tree_size(t.nodes, root)*sizeof(instr));
+    eval_allocations++;
+
+    size_t numcode = 0;
+    formula->depth = emit(t.nodes, root, code, &numcode);
+
+    free(formula->code);
+    formula->code = code;
+    formula->numcode = numcode;
+    formula->removed = before-numcode;
+    formula->inlined = t.inlined;
+
+    formula_free_polys(formula);
+    formula->polys = t.polys;
+    formula->numpolys = t.numpolys;
+
+    formula_free_series(formula);
+    formula->series = t.series;
+    formula->numseries = t.numseries;
+
+    free(t.nodes);
+    return ERROR_CODE_OK;
+}
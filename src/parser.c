@@ -1,298 +1,1750 @@
 #include "parser.h"
+#include "compiler.h"
 #include "error.h"
+#include "simd.h"
+#include "eval.h" // the scratch arena
+#include "jit.h"
+#include "aot.h"
+#include "vmath.h"
+#include "rng.h"
+#include "array.h"
+#include "console.h" // settings
 
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
 #include <ctype.h>
+#include <limits.h>
+#include <float.h>
 
 #define STACK_POP(ts) (*(--(ts).stacktop))
 #define STACK_PUSH(ts, val) (*((ts).stacktop++)) = val
 #define STACK_PEEK(ts) ((ts).stacktop-1)
 #define STACK_HEIGHT(ts) ((ts).stacktop - (ts).stackbot)
-#define STACK_ALLOC(ts, length, type) (ts).stackbot = malloc(length*sizeof(type)); (ts).stacktop = (ts).stackbot
-#define STACK_FREE(ts) free((ts).stackbot)
+#define STACK_SCRATCH(ts, length, type) (ts).stackbot = scratch_alloc(length*sizeof(type)); (ts).stacktop = (ts).stackbot
 
-#define ISNUMBER(c) (isdigit(c) || c == '.')
-#define ISSIGN(c) (!isalnum(c) && c != '.')
-
-static const int precedence[] = {0,0,1,1,1,2,-1,-1, 0}; // the precedence of the enumeration operators (defined in header)
-
-typedef struct tokenstack {
-    token* stackbot;
-    token* stacktop;
-} tokenstack;
+static const int precedence[] = {1,1,2,2,2,3,-1,-1, 1, -1, -1, 0,0,0,0,0,0}; // the precedence of the enumeration operators (defined in header)
 
 typedef struct numberstack {
     double* stackbot;
     double* stacktop;
 } numberstack;
 
-//This is just for convenience
-static void token_set_operator(token* tok, int oper) {
-    tok->type = TT_OPERATOR;
-    tok->oper = oper;
+// Every evaluation context has its own scratch arena, after the first few calls
+// the chunks are big enough and the evaluation doesn't touch the heap at all
+_Atomic unsigned long eval_allocations = 0;
+
+static void* scratch_alloc(size_t size) {
+    arena_s* scratch = &eval_current()->scratch;
+    size_t before = scratch->allocations;
+    void* ptr = arena_alloc(scratch, size);
+
+    // the atomic add isn't free, and it's almost never needed
+    if (scratch->allocations != before) eval_allocations += scratch->allocations-before;
+
+    return ptr;
+}
+
+static inline arena_mark scratch_save() {
+    return arena_save(&eval_current()->scratch);
+}
+
+static inline void scratch_restore(arena_mark mark) {
+    arena_restore(&eval_current()->scratch, mark);
 }
 
-// Converts to reverse polish notation using the shunting yard algorithm
+// ---------- LEXER -------------------
+// The string is tokenized and converted to reverse polish notation in one pass (the shunting yard algorithm),
+// both stacks live on the scratch arena, only the finished formula is copied to the heap
 // https://en.wikipedia.org/wiki/Shunting-yard_algorithm
+
+#define PRECEDENCE_FUNC 4 // functions bind tighter than any operator
+#define NUMBER_MAXLEN 64
+#define LEX_MAXINDICES 16 // sums inside of sums ... this deep
+
+typedef struct shunting {
+    token *out, *outtop;
+    token *opers, *operstop;
+    size_t height, depth; // the height of the number stack when the output is evaluated, and its maximum
+} shunting;
+
+// A sum or a product the lexer is inside of, its index is only bound in the term (the fourth argument)
+typedef struct lex_index {
+    char name[NAME_MAXLEN];
+    int depth; // of the bracket of the sum
+    int commas; // the ones after the index, the term starts after the second one
+} lex_index;
+
+static token token_operator(int oper) {
+    return (token){.type = TT_OPERATOR, .oper = oper};
+}
+
+static _Bool is_oper(const token* tok, int oper) {
+    return tok->type == TT_OPERATOR && tok->oper == oper;
+}
+
+static int stack_precedence(const token* tok) {
+    return tok->type == TT_FUNCTION ? PRECEDENCE_FUNC : precedence[tok->oper];
+}
+
+static void shunt_output(shunting* s, token tok) {
+    if (tok.type == TT_NUMBER || tok.type == TT_VARIABLE || tok.type == TT_INDEX)
+        s->height++;
+    else if (tok.type == TT_OPERATOR && tok.oper != OP_NEG && s->height > 0)
+        s->height--;
+    else if (tok.type == TT_BIND) // the bounds are taken off, the term is computed in their place
+        s->height = s->height > 2 ? s->height-2 : 0;
+
+    if (s->height > s->depth) s->depth = s->height;
+    *s->outtop++ = tok;
+}
+
+// pops the operators down to (not including) the innermost opening bracket
+static void shunt_bracket(shunting* s) {
+    while (s->operstop > s->opers && !is_oper(s->operstop-1, OP_OBRACK))
+        shunt_output(s, *--s->operstop);
+}
+
+static void shunt(shunting* s, token tok) {
+    if (tok.type == TT_NUMBER || tok.type == TT_VARIABLE || tok.type == TT_INDEX) {
+        shunt_output(s, tok);
+        return;
+    }
+
+    const int prec = tok.type == TT_FUNCTION ? PRECEDENCE_FUNC : precedence[tok.oper];
+
+    switch (tok.type == TT_FUNCTION ? OP_FUNC : tok.oper) {
+        case OP_CBRACK :
+            shunt_bracket(s);
+            if (s->operstop > s->opers) s->operstop--; // the opening bracket itself
+        return;
+        case OP_COMMA : shunt_bracket(s); return; // finish the previous argument, the bracket stays for the next one
+
+        // neither of these pops anything, the negation is a prefix, so it can't finish an operation
+        case OP_OBRACK : case OP_NEG : break;
+
+        default :
+            while (s->operstop > s->opers && prec <= stack_precedence(s->operstop-1))
+                shunt_output(s, *--s->operstop);
+        break;
+    }
+
+    *s->operstop++ = tok;
+}
+
+// Reads one token starting at *str, a name is left TT_UNKNOWN, the next token decides what it is
+static error_t next_token(const char** str, const token* prev, token* tok) {
+    const char* c = *str;
+
+    switch (*c) {
+        case '+' : *tok = token_operator(OP_ADD); break;
+        case '*' : *tok = token_operator(OP_MULT); break;
+        case '/' : *tok = token_operator(OP_DIV); break;
+        case '^' : *tok = token_operator(OP_POW); break;
+        case '(' : *tok = token_operator(OP_OBRACK); break;
+        case ')' : *tok = token_operator(OP_CBRACK); break;
+        case ',' : *tok = token_operator(OP_COMMA); break; // separates function arguments
+
+        // the minus operator or the negation sign, everything but a value or a closing bracket before it means negation
+        case '-' : *tok = token_operator(prev->type == TT_OPERATOR && prev->oper != OP_CBRACK ? OP_NEG : OP_SUB); break;
+
+        // the comparisons, the longer ones take two characters
+        case '<' : case '>' :
+            if (c[1] == '=') {
+                *tok = token_operator(*c == '<' ? OP_LE : OP_GE);
+                *str = c+2;
+                return ERROR_CODE_OK;
+            }
+
+            *tok = token_operator(*c == '<' ? OP_LT : OP_GT);
+        break;
+        case '=' : case '!' :
+            if (c[1] != '=') {
+                error_throw_str("'%s=' expected", *c == '=' ? "=" : "!");
+                return ERROR_CODE_FAIL;
+            }
+
+            *tok = token_operator(*c == '=' ? OP_EQ : OP_NE);
+            *str = c+2;
+        return ERROR_CODE_OK;
+
+        default : {
+            const char* end = c;
+            size_t len;
+
+            if (isdigit((unsigned char)*c) || *c == '.') {
+                while (isdigit((unsigned char)*end) || *end == '.') end++;
+
+                // an exponent only counts with its digits, "2e" is still 2*e
+                const char* exp = end;
+                if (*exp == 'e' || *exp == 'E') exp++;
+                if (exp != end && (*exp == '+' || *exp == '-')) exp++;
+                if (exp != end && isdigit((unsigned char)*exp))
+                    for (end = exp; isdigit((unsigned char)*end); end++);
+
+                char buf[NUMBER_MAXLEN];
+                if ((len = end-c) >= NUMBER_MAXLEN) {
+                    error_throw("number too long");
+                    return ERROR_CODE_FAIL;
+                }
+
+                memcpy(buf, c, len);
+                buf[len] = '\0';
+
+                *tok = (token){.type = TT_NUMBER, .num = strtod(buf, NULL)};
+                *str = end;
+                return ERROR_CODE_OK;
+            }
+
+            if (isalpha((unsigned char)*c))
+                while (isalnum((unsigned char)*end) || *end == '_') end++;
+            else // any other signs stay together, they can only be an unknown name
+                while (*end != '\0' && !isalnum((unsigned char)*end) && !isspace((unsigned char)*end) && !strchr(".+-*/^(),<>=!", *end)) end++;
+
+            if ((len = end-c) >= NAME_MAXLEN) {
+                error_throw_str("name too long : '%.11s...'", c);
+                return ERROR_CODE_FAIL;
+            }
+
+            if (len == 3 && memcmp(c, "mod", 3) == 0)
+                *tok = token_operator(OP_MOD);
+            else {
+                *tok = (token){.type = TT_UNKNOWN};
+                memcpy(tok->name, c, len);
+                tok->name[len] = '\0';
+            }
+
+            *str = end;
+        } return ERROR_CODE_OK;
+    }
+
+    *str = c+1;
+    return ERROR_CODE_OK;
+}
+
+static _Bool is_series(const token* tok) {
+    return tok->type == TT_FUNCTION && (strcmp(tok->name, "sum") == 0 || strcmp(tok->name, "prod") == 0);
+}
+
+// Reads the index name and the comma after it, right after the bracket of a sum or a product
+static error_t next_index(const char** str, const char* func, lex_index* index) {
+    token name, comma = {0};
+
+    while (isspace((unsigned char)**str)) (*str)++;
+    if (ERROR_FAIL(next_token(str, &(token){.type = TT_OPERATOR, .oper = OP_OBRACK}, &name)))
+        return ERROR_CODE_FAIL;
+
+    while (isspace((unsigned char)**str)) (*str)++;
+    if (name.type == TT_UNKNOWN && **str != '\0' && ERROR_FAIL(next_token(str, &name, &comma)))
+        return ERROR_CODE_FAIL;
+
+    if (name.type != TT_UNKNOWN || !isalpha((unsigned char)name.name[0]) || !is_oper(&comma, OP_COMMA)) {
+        error_throw_str("%s(index, from, to, term) expected", func);
+        return ERROR_CODE_FAIL;
+    }
+
+    // both already mean something in every formula
+    if (strcmp(name.name, "x") == 0 || strcmp(name.name, "i") == 0) {
+        error_throw_str("%s can't be an index", name.name);
+        return ERROR_CODE_FAIL;
+    }
+
+    memcpy(index->name, name.name, NAME_MAXLEN);
+    return ERROR_CODE_OK;
+}
+
+// A name is the index of the innermost sum whose term it is in, or a variable
+static int name_type(const token* tok, const lex_index* indices, size_t numindices) {
+    for (size_t k = numindices; k-- > 0; )
+        if (indices[k].commas >= 2 && strcmp(indices[k].name, tok->name) == 0)
+            return TT_INDEX;
+
+    return TT_VARIABLE;
+}
+
 formula_s lex(const char* str) {
-    if (str == NULL || strlen(str) == 0) {
+    if (str == NULL || *str == '\0') {
         error_throw("no input specified");
         return (formula_s){NULL, 0};
     }
 
-    // first, tokenize the string
-    /*
-    0. return the token list if the current character is '\0'
-    1. skip all the following spaces
-    2. Determine the token type base on its first character
-    3. Add characters to the buffer until there is a character
-       that does not correspond the current token type
-    4. parse the current token and put it into the token list
-    5. goto step 0
-    */
+    arena_mark mark = scratch_save();
 
-    size_t numtoks = 0; // numtoks - total number of tokens, numopers - number of operators (!isnumber)
-    token* tokens = NULL;
+    // every character is at most one token, and at most one multiplication is squeezed in before each
+    const size_t len = strlen(str);
+    shunting s = {0};
+    s.out = s.outtop = scratch_alloc(2*len*sizeof(token));
+    s.opers = s.operstop = scratch_alloc(len*sizeof(token));
 
+    token prev = token_operator(OP_OBRACK); // the start behaves like an opening bracket
     int depth = 0;
 
+    // the commas of every open bracket, a call knows how many arguments it got once its bracket closes
+    unsigned* commas = scratch_alloc((len+1)*sizeof(unsigned));
+    commas[0] = 0;
+
+    lex_index indices[LEX_MAXINDICES];
+    size_t numindices = 0;
+
     while (1) {
-            while (isblank(*str)) str++; // skip all the following spaces
-            if (*str == '\0') break;
+        while (isspace((unsigned char)*str)) str++;
+        if (*str == '\0') break;
+
+        token tok;
+        if (ERROR_FAIL(next_token(&str, &prev, &tok))) {
+            scratch_restore(mark);
+            return (formula_s){NULL, 0};
+        }
+
+        if (is_oper(&tok, OP_OBRACK)) commas[++depth] = 0;
+        else if (is_oper(&tok, OP_COMMA)) commas[depth]++;
+        else if (is_oper(&tok, OP_CBRACK) && --depth < 0) break;
+
+        // This decides if a keyword is a function or a variable
+        // e.g. in "cos 2" "cos" is a function, that is not the case in "cos + 2"
+        if (prev.type == TT_UNKNOWN) {
+            prev.type = is_oper(&tok, OP_OBRACK) ? TT_FUNCTION : name_type(&prev, indices, numindices);
+            shunt(&s, prev);
+        }
+
+        // This allow sytactic sugar like 2x instead of 2*x or (k+1)x (it just squeezes the * in between)
+        if ((prev.type == TT_NUMBER || is_oper(&prev, OP_CBRACK)) && (tok.type == TT_UNKNOWN || is_oper(&tok, OP_OBRACK)))
+            shunt(&s, token_operator(OP_MULT));
+
+        if (tok.type != TT_UNKNOWN) shunt(&s, tok);
 
-            char currstr[NAME_MAXLEN];
-            char* currchar = &currstr[0];
-            _Bool isnumber = ISNUMBER(*str); // Determine the token type base on its first character
-        _Bool isletter = isalpha(*str);
+        // the bracket of a call is gone, its function is on the top of the stack now
+        if (is_oper(&tok, OP_CBRACK) && s.operstop > s.opers && s.operstop[-1].type == TT_FUNCTION)
+            s.operstop[-1].args = is_oper(&prev, OP_OBRACK) ? 0 : commas[depth+1]+1;
 
-            // Add characters to the buffer until there is a character that does not match the current token type, whitespace character or EOS
-            while ((isnumber ? ISNUMBER(*str) : isletter ? (isalnum(*str) || *str == '_') : (!ISNUMBER(*str) && !isalpha(*str)))
-                && *str != '\0' && !isspace(*str)) {
+        // the bounds of a sum are finished, its index is bound from here on
+        if (is_oper(&tok, OP_COMMA) && numindices > 0 && indices[numindices-1].depth == depth
+            && ++indices[numindices-1].commas == 2) {
+            token bind = {.type = TT_BIND};
+            memcpy(bind.name, indices[numindices-1].name, NAME_MAXLEN);
+            shunt_output(&s, bind);
+        }
+
+        while (numindices > 0 && depth < indices[numindices-1].depth) numindices--;
 
-                    *(currchar++) = *(str++);
+        // the index comes right after the bracket, "sum(k, 1, 10, k^2)"
+        if (is_series(&prev) && is_oper(&tok, OP_OBRACK)) {
+            if (numindices == LEX_MAXINDICES) {
+                error_throw("sums nested too deep");
+                scratch_restore(mark);
+                return (formula_s){NULL, 0};
+            }
 
-                    // brackets are an exception where two operators can be next to each other, e.g. *(())
-                    if (*(str) == '(' || *(str-1) == '(' || *(str-1) == ')') break;
+            if (ERROR_FAIL(next_index(&str, prev.name, &indices[numindices]))) {
+                scratch_restore(mark);
+                return (formula_s){NULL, 0};
             }
 
-            *currchar = '\0';
-            if (strlen(currstr) == 0) break;
-
-        if  (currstr[0] == '(') depth++;
-        else if (currstr[0] == ')') depth--;
-
-            // create the token
-            tokens = realloc(tokens, (++numtoks)*sizeof(token));
-        token *currtok = &tokens[numtoks-1], 
-              *prevtok = numtoks > 1 ? &tokens[numtoks-2] : NULL;
-
-        // parse the current token
-
-            if (isnumber) {
-            currtok->type = TT_NUMBER;
-            currtok->num = atof(currstr);
-            } 
-        else if (strcmp(currstr, "+") == 0) token_set_operator(currtok, OP_ADD);
-        else if (strcmp(currstr, "-") == 0) {
-            // decide if it is the minus operator or the negation sign
-            if (prevtok == NULL || (prevtok->type == TT_OPERATOR && prevtok->oper == OP_OBRACK))
-                token_set_operator(currtok, OP_NEG);
-            else 
-                token_set_operator(currtok, OP_SUB);
+            indices[numindices].depth = depth;
+            indices[numindices++].commas = 0;
+            tok = token_operator(OP_COMMA);
         }
-        else if (strcmp(currstr, "*") == 0) token_set_operator(currtok, OP_MULT);
-        else if (strcmp(currstr, "/") == 0) token_set_operator(currtok, OP_DIV);
-        else if (strcmp(currstr, "^") == 0) token_set_operator(currtok, OP_POW);
-        else if (strcmp(currstr, "(") == 0) token_set_operator(currtok, OP_OBRACK);
-        else if (strcmp(currstr, ")") == 0) token_set_operator(currtok, OP_CBRACK);
-        else if (strcmp(currstr, "mod") == 0) token_set_operator(currtok, OP_MOD);
+
+        prev = tok;
+    }
+
+    if (prev.type == TT_UNKNOWN) {
+        prev.type = name_type(&prev, indices, numindices);
+        shunt(&s, prev);
+    }
+
+    if (depth != 0) {
+        error_throw("bracket error");
+        scratch_restore(mark);
+        return (formula_s){NULL, 0};
+    }
+
+    // pop off the whole stack before finishing
+    while (s.operstop > s.opers)
+        shunt_output(&s, *--s.operstop);
+
+    formula_s result = {NULL, s.outtop-s.out};
+    result.depth = s.depth;
+
+    if (result.numtoks == 0) error_throw("empty expression");
+    else if ((result.toks = malloc(result.numtoks*sizeof(token))) != NULL)
+        memcpy(result.toks, s.out, result.numtoks*sizeof(token));
+
+    scratch_restore(mark);
+    return result;
+}
+
+double call_scalar(const cfunc_s* f, const double* args) {
+    if (f->scalar != NULL) return f->scalar(args);
+    if (f->func != NULL) return f->func(args[0]);
+
+    // a batch of one, every argument column is just one value long
+    double result;
+    f->batch(args, &result, 1);
+    return result;
+}
+
+void call_batch(const cfunc_s* f, const double* in, double* out, size_t m) {
+    if (f->batch == NULL) {
+        double args[JP_MAXARITY];
+        for (size_t i = 0; i < m; i++) {
+            for (size_t k = 0; k < f->arity; k++) args[k] = in[k*m+i];
+            out[i] = call_scalar(f, args);
+        }
+
+        return;
+    }
+
+    // the plugins are promised that the output doesn't overlap the input
+    if (out >= in && out < in+f->arity*m) {
+        arena_mark mark = scratch_save();
+        double* tmp = scratch_alloc(m*sizeof(double));
+
+        f->batch(in, tmp, m);
+        memcpy(out, tmp, m*sizeof(double));
+
+        scratch_restore(mark);
+    } else
+        f->batch(in, out, m);
+}
+
+error_t series_terms(const double* lo, const double* hi, size_t m, double* first, double* last) {
+    *first = INFINITY;
+    *last = -INFINITY;
+
+    for (size_t i = 0; i < m; i++) {
+        const double from = ceil(lo[i]), to = floor(hi[i]);
+        if (!(from <= to)) continue; // empty or NaN
+
+        if (from < *first) *first = from;
+        if (to > *last) *last = to;
+    }
+
+    if (*first <= *last && !(*last-*first < SERIES_MAXTERMS)) {
+        error_throw("too many terms in a sum");
+        return ERROR_CODE_FAIL;
+    }
+
+    return ERROR_CODE_OK;
+}
+
+// The lost low bits of the sum are carried along (Kahan), without them the error grows with the number of terms
+static inline double kahan_add(double sum, double term, double* comp) {
+    const double y = term - *comp, t = sum + y;
+    *comp = (t - sum) - y;
+    return t;
+}
+
+// rand() and randn(), every value gets a draw of its own
+static void draw(const instr* in, double* dst, size_t m) {
+    if ((int)in->num == RAND_NORMAL) rng_normal(dst, m);
+    else rng_uniform(dst, m);
+}
+
+static error_t scalar_run(const instr* code, size_t numcode, const double* x, numberstack* stack);
+
+// Runs the term of a sum for every k, the bounds are the top two values and the result replaces them
+static error_t scalar_series(const instr* in, const double* x, numberstack* numstack) {
+    series_s* series = in->series;
+    numstack->stacktop -= 2;
+    const double lo = numstack->stacktop[0], hi = numstack->stacktop[1];
+
+    double first, last;
+    if (ERROR_FAIL(series_terms(&lo, &hi, 1, &first, &last)))
+        return ERROR_CODE_FAIL;
+
+    double acc = series->product ? 1.0 : 0.0, comp = 0.0;
+    for (double k = first; k <= last; k++) {
+        series->k = k;
+        if (ERROR_FAIL(scalar_run(in+1, series->len, x, numstack)))
+            return ERROR_CODE_FAIL;
+
+        const double term = STACK_POP(*numstack);
+        if (series->product) acc *= term;
+        else acc = settings.kahan ? kahan_add(acc, term, &comp) : acc+term;
+    }
+
+    STACK_PUSH(*numstack, isnan(lo) || isnan(hi) ? NAN : acc);
+    return ERROR_CODE_OK;
+}
+
+// the operand counts are checked by the compiler, no need to do it again
+static error_t scalar_run(const instr* code, size_t numcode, const double* x, numberstack* stack) {
+    numberstack numstack = *stack;
+
+    for (const instr* in = code; in < code+numcode; in++) {
+        double right;
+
+        switch (in->op) {
+            case OC_NUM : STACK_PUSH(numstack, in->num); break;
+            case OC_X   : STACK_PUSH(numstack, *x); break;
+            case OC_I   : STACK_PUSH(numstack, NAN); break;
+            case OC_VAR : STACK_PUSH(numstack, *in->val); break;
+            case OC_RAND: draw(in, numstack.stacktop++, 1); break;
+            case OC_ARRAY :
+                error_throw("arrays are only computed element-wise");
+                return ERROR_CODE_FAIL;
+
+            case OC_ADD : right = STACK_POP(numstack); *STACK_PEEK(numstack) += right; break;
+            case OC_SUB : right = STACK_POP(numstack); *STACK_PEEK(numstack) -= right; break;
+            case OC_MULT: right = STACK_POP(numstack); *STACK_PEEK(numstack) *= right; break;
+            case OC_DIV : right = STACK_POP(numstack); *STACK_PEEK(numstack) /= right; break;
+            case OC_MOD : right = STACK_POP(numstack); *STACK_PEEK(numstack) = fmod(*STACK_PEEK(numstack), right); break;
+            case OC_POW : right = STACK_POP(numstack); *STACK_PEEK(numstack) = pow(*STACK_PEEK(numstack), right); break;
+            case OC_NEG : *STACK_PEEK(numstack) = -*STACK_PEEK(numstack); break; // negate the top of the stack 
+            case OC_POWI: *STACK_PEEK(numstack) = powi(*STACK_PEEK(numstack), (int)in->num); break;
+            case OC_POLY: *STACK_PEEK(numstack) = poly_eval(in->poly, *STACK_PEEK(numstack)); break;
+            case OC_CMP : right = STACK_POP(numstack); *STACK_PEEK(numstack) = compare((int)in->num, *STACK_PEEK(numstack), right); break;
+            case OC_SELECT : {
+                numstack.stacktop -= 2;
+                double* args = STACK_PEEK(numstack);
+                *args = choose(args[0], args[1], args[2]);
+            } break;
+
+            case OC_CFUNC : *STACK_PEEK(numstack) = in->call->func(*STACK_PEEK(numstack)); break;
+            case OC_CALL  :
+                // the arguments are next to each other on the stack already
+                numstack.stacktop -= in->call->arity-1;
+                *STACK_PEEK(numstack) = call_scalar(in->call, STACK_PEEK(numstack));
+            break;
+            case OC_ARG : break; // never emitted
+            case OC_FUNC  :
+                right = *STACK_PEEK(numstack);
+                if (ERROR_FAIL(compute(STACK_PEEK(numstack), in->func, &right)))
+                    return ERROR_CODE_FAIL;
+            break;
+            case OC_SERIES :
+                if (ERROR_FAIL(scalar_series(in, x, &numstack)))
+                    return ERROR_CODE_FAIL;
+                in += in->series->len;
+            break;
+        }
+    }
+
+    *stack = numstack;
+    return ERROR_CODE_OK;
+}
+
+// Computes the compiled reverse polish notation
+// https://en.wikipedia.org/wiki/Reverse_Polish_notation
+int compute(double* result, formula_s* formula, const double* x) {
+    if (ERROR_FAIL(formula_prepare(formula, x != NULL)))
+        return ERROR_CODE_FAIL;
+
+    if (formula->jit != NULL) {
+        double res;
+        ((jit_fn)formula->jit)(x, &res, 1);
+        if (result != NULL) *result = res;
+
+        return ERROR_CODE_OK;
+    }
+
+    arena_mark mark = scratch_save();
+
+    numberstack numstack;
+    STACK_SCRATCH(numstack, formula->depth, double);
+
+    if (ERROR_FAIL(scalar_run(formula->code, formula->numcode, x, &numstack))) {
+        scratch_restore(mark);
+        return ERROR_CODE_FAIL;
+    }
+
+    if (result != NULL) 
+        *result = STACK_POP(numstack);
+
+    scratch_restore(mark);
+
+    return ERROR_CODE_OK;
+}
+
+// ---------- BATCH EVALUATION -------------------
+// The bytecode is run one instruction at a time over a whole block of x values,
+// so the dispatch is paid once per block and the arithmetic gets vectorized
+
+// dst can be the same array as a or b
+#define BATCH_BINARY(name, simdop, op) \
+static void name(double* dst, const double* a, const double* b, size_t m) { \
+    size_t i = 0; \
+    for (; i+SIMD_LANES <= m; i += SIMD_LANES) \
+        SIMD_STORE(dst+i, simdop(SIMD_LOAD(a+i), SIMD_LOAD(b+i))); \
+    for (; i < m; i++) dst[i] = a[i] op b[i]; \
+}
+
+BATCH_BINARY(batch_add, SIMD_ADD, +)
+BATCH_BINARY(batch_sub, SIMD_SUB, -)
+BATCH_BINARY(batch_mult, SIMD_MUL, *)
+BATCH_BINARY(batch_div, SIMD_DIV, /)
+
+static void batch_neg(double* dst, const double* a, size_t m) {
+    size_t i = 0;
+    for (; i+SIMD_LANES <= m; i += SIMD_LANES)
+        SIMD_STORE(dst+i, SIMD_NEG(SIMD_LOAD(a+i)));
+    for (; i < m; i++) dst[i] = -a[i];
+}
+
+// Horner's scheme lane by lane, the lanes are independent so there is no need for Estrin's
+static void batch_poly(double* dst, const poly_s* poly, const double* a, size_t m) {
+    const double* c = poly->coeffs;
+    const unsigned n = poly->degree;
+
+    size_t i = 0;
+    for (; i+SIMD_LANES <= m; i += SIMD_LANES) {
+        const simd_d x = SIMD_LOAD(a+i);
+        simd_d res = SIMD_SET1(c[n]);
+
+        for (unsigned k = n; k-- > 0; )
+            res = SIMD_ADD(SIMD_MUL(res, x), SIMD_SET1(c[k]));
+
+        SIMD_STORE(dst+i, res);
+    }
+
+    for (; i < m; i++) {
+        double res = c[n];
+        for (unsigned k = n; k-- > 0; ) res = res*a[i] + c[k];
+        dst[i] = res;
+    }
+}
+
+// The comparisons are masks, 1.0 where they hold and NaN where an operand is NaN,
+// so no lane takes a branch of its own
+#define BATCH_COMPARE(name, kind, mask) \
+static void name(double* dst, const double* a, const double* b, size_t m) { \
+    const simd_d one = SIMD_SET1(1.0), nans = SIMD_SET1(NAN); \
+    size_t i = 0; \
+    for (; i+SIMD_LANES <= m; i += SIMD_LANES) { \
+        const simd_d x = SIMD_LOAD(a+i), y = SIMD_LOAD(b+i); \
+        SIMD_STORE(dst+i, SIMD_OR(SIMD_AND(mask, one), SIMD_AND(SIMD_UNORD(x, y), nans))); \
+    } \
+    for (; i < m; i++) dst[i] = compare(kind, a[i], b[i]); \
+}
+
+BATCH_COMPARE(batch_lt, CMP_LT, SIMD_LT(x, y))
+BATCH_COMPARE(batch_le, CMP_LE, SIMD_LE(x, y))
+BATCH_COMPARE(batch_gt, CMP_GT, SIMD_LT(y, x))
+BATCH_COMPARE(batch_ge, CMP_GE, SIMD_LE(y, x))
+BATCH_COMPARE(batch_eq, CMP_EQ, SIMD_EQ(x, y))
+BATCH_COMPARE(batch_ne, CMP_NE, SIMD_NEQ(x, y))
+
+// indexed by the CMP_ kinds
+static void (*const batch_cmp[])(double*, const double*, const double*, size_t) = {batch_lt, batch_le, batch_gt, batch_ge, batch_eq, batch_ne};
+
+void batch_select(double* dst, const double* c, const double* a, const double* b, size_t m) {
+    const simd_d zero = SIMD_SET1(0.0), nans = SIMD_SET1(NAN);
+
+    size_t i = 0;
+    for (; i+SIMD_LANES <= m; i += SIMD_LANES) {
+        const simd_d cond = SIMD_LOAD(c+i);
+        const simd_d res = SIMD_BLEND(SIMD_NEQ(cond, zero), SIMD_LOAD(a+i), SIMD_LOAD(b+i));
+        SIMD_STORE(dst+i, SIMD_OR(res, SIMD_AND(SIMD_UNORD(cond, cond), nans)));
+    }
+
+    for (; i < m; i++) dst[i] = choose(c[i], a[i], b[i]);
+}
+
+static void batch_fill(double* a, double val, size_t m) {
+    size_t i = 0;
+    const simd_d v = SIMD_SET1(val);
+    for (; i+SIMD_LANES <= m; i += SIMD_LANES)
+        SIMD_STORE(a+i, v);
+    for (; i < m; i++) a[i] = val;
+}
+
+error_t batch_instr(const instr* in, double* dst, const double* a, const double* b, const double* xs, size_t m) {
+    switch (in->op) {
+        case OC_NUM : batch_fill(dst, in->num, m); break;
+        case OC_X   : memmove(dst, xs, m*sizeof(double)); break;
+        case OC_VAR : batch_fill(dst, *in->val, m); break;
+        case OC_I   : batch_fill(dst, NAN, m); break;
+        case OC_RAND: draw(in, dst, m); break;
+
+        case OC_ADD : batch_add(dst, a, b, m); break;
+        case OC_SUB : batch_sub(dst, a, b, m); break;
+        case OC_MULT: batch_mult(dst, a, b, m); break;
+        case OC_DIV : batch_div(dst, a, b, m); break;
+        case OC_MOD : for (size_t i = 0; i < m; i++) dst[i] = fmod(a[i], b[i]); break;
+        case OC_POW : vm_pow(dst, a, b, m); break;
+        case OC_NEG : batch_neg(dst, b, m); break;
+        case OC_POWI: for (size_t i = 0; i < m; i++) dst[i] = powi(b[i], (int)in->num); break;
+        case OC_POLY: batch_poly(dst, in->poly, b, m); break;
+        case OC_CMP : batch_cmp[(int)in->num](dst, a, b, m); break;
+
+        case OC_CFUNC :
+            // only the built in functions have both entry points, their batch ones work in place
+            if (in->call->batch != NULL) in->call->batch(b, dst, m);
+            else for (size_t i = 0; i < m; i++) dst[i] = in->call->func(b[i]);
+        break;
+        case OC_FUNC  : return compute_batch(in->func, b, dst, m);
+        case OC_CALL  :
+            if (in->call->arity != 1) {
+                error_throw("multiple arguments need batch_block");
+                return ERROR_CODE_FAIL;
+            }
+
+            call_batch(in->call, b, dst, m);
+        break;
+        case OC_SELECT :
+            error_throw("the conditional needs batch_block");
+        return ERROR_CODE_FAIL;
+        case OC_SERIES :
+            error_throw("sums need batch_block");
+        return ERROR_CODE_FAIL;
+        case OC_ARRAY :
+            error_throw("arrays need batch_block");
+        return ERROR_CODE_FAIL;
+        case OC_ARG : break;
+    }
+
+    return ERROR_CODE_OK;
+}
+
+// acc (+)= term in the lanes whose bounds hold k, the others get the identity, so no lane branches,
+// comp carries the low bits the compensated sums would lose
+static void batch_accumulate(const series_s* series, double* acc, double* comp, const double* term,
+                             const double* lo, const double* hi, size_t m) {
+    const simd_d k = SIMD_SET1(series->k), id = SIMD_SET1(series->product ? 1.0 : 0.0);
+    const _Bool kahan = settings.kahan && !series->product;
+
+    size_t i = 0;
+    for (; i+SIMD_LANES <= m; i += SIMD_LANES) {
+        const simd_d in = SIMD_AND(SIMD_LE(SIMD_LOAD(lo+i), k), SIMD_LE(k, SIMD_LOAD(hi+i)));
+        const simd_d t = SIMD_BLEND(in, SIMD_LOAD(term+i), id), a = SIMD_LOAD(acc+i);
+
+        if (series->product) SIMD_STORE(acc+i, SIMD_MUL(a, t));
+        else if (!kahan) SIMD_STORE(acc+i, SIMD_ADD(a, t));
         else {
-            currtok->type = TT_UNKNOWN;
-            strcpy(currtok->name, currstr);
+            const simd_d y = SIMD_SUB(t, SIMD_LOAD(comp+i)), sum = SIMD_ADD(a, y);
+            SIMD_STORE(comp+i, SIMD_SUB(SIMD_SUB(sum, a), y));
+            SIMD_STORE(acc+i, sum);
         }
+    }
 
-        // This decides if a keyword is a function or a variable
-        // e.g. in "cos 2" "cos" is a function, that is not the case in "cos + 2"
-        if (prevtok != NULL && prevtok->type == TT_UNKNOWN) {
-            if (currtok->type == TT_OPERATOR && currtok->oper == OP_OBRACK)
-                prevtok->type = TT_FUNCTION;
-            else
-                prevtok->type = TT_VARIABLE;
+    for (; i < m; i++) {
+        const double t = lo[i] <= series->k && series->k <= hi[i] ? term[i] : series->product ? 1.0 : 0.0;
+
+        if (series->product) acc[i] *= t;
+        else acc[i] = kahan ? kahan_add(acc[i], t, &comp[i]) : acc[i]+t;
+    }
+}
+
+static error_t batch_block(const instr* code, size_t numcode, const double* xs, size_t offset, size_t m, double* stack);
+
+// The bounds are at top, the term is computed for all the lanes at once on top of the stack for every k
+// and the result replaces the bounds
+static error_t batch_series(const instr* in, const double* xs, size_t offset, size_t m, double* top) {
+    series_s* series = in->series;
+
+    arena_mark mark = scratch_save();
+    double* lo = scratch_alloc(4*m*sizeof(double));
+    double *hi = lo+m, *acc = lo+2*m, *comp = lo+3*m;
+    memcpy(lo, top, 2*m*sizeof(double));
+
+    double first, last;
+    if (ERROR_FAIL(series_terms(lo, hi, m, &first, &last))) {
+        scratch_restore(mark);
+        return ERROR_CODE_FAIL;
+    }
+
+    batch_fill(acc, series->product ? 1.0 : 0.0, m);
+    batch_fill(comp, 0.0, m);
+
+    for (double k = first; k <= last; k++) {
+        series->k = k;
+        if (ERROR_FAIL(batch_block(in+1, series->len, xs, offset, m, top))) {
+            scratch_restore(mark);
+            return ERROR_CODE_FAIL;
         }
 
-        // This allow sytactic sugar like 2x instead of 2*x (it just squeezes the * in between)
-        if (prevtok != NULL && prevtok->type == TT_NUMBER && (currtok->type == TT_UNKNOWN || (currtok->type == TT_OPERATOR && currtok->oper == OP_OBRACK))) {
-            tokens = realloc(tokens, (++numtoks)*sizeof(token));
-            tokens[numtoks-1] = tokens[numtoks-2];
-            token_set_operator(&tokens[numtoks-2], OP_MULT);
+        batch_accumulate(series, acc, comp, top, lo, hi, m);
+    }
+
+    // NaN bounds leave the sum undefined
+    const simd_d nans = SIMD_SET1(NAN);
+    size_t i = 0;
+    for (; i+SIMD_LANES <= m; i += SIMD_LANES)
+        SIMD_STORE(top+i, SIMD_OR(SIMD_LOAD(acc+i), SIMD_AND(SIMD_UNORD(SIMD_LOAD(lo+i), SIMD_LOAD(hi+i)), nans)));
+    for (; i < m; i++) top[i] = isnan(lo[i]) || isnan(hi[i]) ? NAN : acc[i];
+
+    scratch_restore(mark);
+    return ERROR_CODE_OK;
+}
+
+// Evaluates a single block of at most BATCH_LANES values, the result is left in stack[0 .. m-1],
+// the stack slot k occupies stack[k*m .. k*m+m-1], the arrays are read from the element offset on
+static error_t batch_block(const instr* code, size_t numcode, const double* xs, size_t offset, size_t m, double* stack) {
+    double* top = stack; // the first free slot
+
+    for (const instr* in = code; in < code+numcode; in++) {
+        double* a = top-2*m; // left operand
+        double* b = top-m; // right operand (or the only one)
+
+        switch (in->op) {
+            case OC_NUM : case OC_X : case OC_VAR : case OC_I : case OC_RAND :
+                if (ERROR_FAIL(batch_instr(in, top, NULL, NULL, xs, m)))
+                    return ERROR_CODE_FAIL;
+                top += m;
+            break;
+            case OC_ARRAY :
+                memcpy(top, (*in->array)->data+offset, m*sizeof(double));
+                top += m;
+            break;
+            case OC_NEG : case OC_POWI : case OC_CFUNC : case OC_FUNC : case OC_POLY :
+                if (ERROR_FAIL(batch_instr(in, b, NULL, b, xs, m)))
+                    return ERROR_CODE_FAIL;
+            break;
+            case OC_CALL : {
+                // the argument k of the lane i is at args[k*m+i], just what the plugins expect
+                double* args = top-in->call->arity*m;
+                call_batch(in->call, args, args, m);
+                top = args+m;
+            } break;
+            case OC_SELECT : {
+                double* args = top-3*m;
+                batch_select(args, args, args+m, args+2*m, m);
+                top = args+m;
+            } break;
+            case OC_SERIES :
+                if (ERROR_FAIL(batch_series(in, xs, offset, m, a)))
+                    return ERROR_CODE_FAIL;
+                in += in->series->len;
+                top -= m;
+            break;
+            default :
+                if (ERROR_FAIL(batch_instr(in, a, a, b, xs, m)))
+                    return ERROR_CODE_FAIL;
+                top -= m;
+            break;
         }
+    }
 
+    return ERROR_CODE_OK;
+}
+
+// The interpreter part of compute_batch, xs is NULL when x isn't bound,
+// the value i reads the element i of the arrays, the caller makes sure there are n of them
+static error_t batch_run(const formula_s* formula, const double* xs, double* ys, size_t n) {
+    arena_mark mark = scratch_save();
+    double* stack = scratch_alloc(formula->depth*BATCH_LANES*sizeof(double));
+
+    for (size_t done = 0; done < n; done += BATCH_LANES) {
+        size_t m = n-done < BATCH_LANES ? n-done : BATCH_LANES;
+
+        if (ERROR_FAIL(batch_block(formula->code, formula->numcode, xs != NULL ? xs+done : NULL, done, m, stack))) {
+            scratch_restore(mark);
+            return ERROR_CODE_FAIL;
         }
 
-    if (numtoks > 0 && tokens[numtoks-1].type == TT_UNKNOWN)
-        tokens[numtoks-1].type = TT_VARIABLE;
+        memcpy(ys+done, stack, m*sizeof(double));
+    }
 
-    if (depth != 0) {
-        error_throw("bracket error");
-        free(tokens);
-        return (formula_s){NULL, 0}; 
+    scratch_restore(mark);
+    return ERROR_CODE_OK;
+}
+
+// the arrays have their own lengths, only compute_array knows how many values there are
+static error_t check_arrays(const formula_s* formula) {
+    if (!formula->uses_arrays) return ERROR_CODE_OK;
+
+    error_throw("arrays are only computed element-wise");
+    return ERROR_CODE_FAIL;
+}
+
+error_t compute_batch(formula_s* formula, const double* xs, double* ys, size_t n) {
+    if (ERROR_FAIL(formula_prepare(formula, 1)) || ERROR_FAIL(check_arrays(formula)))
+        return ERROR_CODE_FAIL;
+
+    if (formula->native != NULL) {
+        aot_batch(formula, xs, ys, n);
+        return ERROR_CODE_OK;
     }
 
-    // Now, convert the infix notation to postifix (reverse polish) using the shunting yard algorithm
+    // the JIT calls libm one value at a time, the fast math would be lost
+    if (formula->jit != NULL && !(settings.fastmath && formula->vectormath)) {
+        ((jit_fn)formula->jit)(xs, ys, n);
+        return ERROR_CODE_OK;
+    }
 
-    // initialize the operator stack
-    tokenstack oper_stack;
-    STACK_ALLOC(oper_stack, numtoks, token);
+    return batch_run(formula, xs, ys, n);
+}
 
-    // this is the final array
-    tokenstack tokens_postfix;
-    STACK_ALLOC(tokens_postfix, numtoks, token);
+error_t compute_draws(formula_s* formula, double* ys, size_t n) {
+    if (ERROR_FAIL(formula_prepare(formula, 0)) || ERROR_FAIL(check_arrays(formula)))
+        return ERROR_CODE_FAIL;
 
-    for (size_t i = 0; i < numtoks; i++) {
-    if (tokens[i].type == TT_NUMBER || tokens[i].type == TT_VARIABLE)
-            STACK_PUSH(tokens_postfix, tokens[i]);
-    else if (tokens[i].type == TT_OPERATOR) {
+    return batch_run(formula, NULL, ys, n);
+}
 
-            if (tokens[i].oper == OP_CBRACK) {
+error_t compute_array(formula_s* formula, array_s** result) {
+    if (ERROR_FAIL(formula_prepare(formula, 0)))
+        return ERROR_CODE_FAIL;
 
-                while (STACK_HEIGHT(oper_stack) > 0 && (oper_stack.stacktop-1)->oper != OP_OBRACK)
-                    STACK_PUSH(tokens_postfix, STACK_POP(oper_stack));
+    const array_s* first = NULL;
+    for (const instr* in = formula->code; in < formula->code+formula->numcode; in++) {
+        if (in->op != OC_ARRAY) continue;
 
-                STACK_POP(oper_stack); // Get rid of the unwanted opening bracket that is just left over now
-            } else {
+        if (first != NULL && (*in->array)->length != first->length) {
+            error_throw("the arrays have different lengths");
+            return ERROR_CODE_FAIL;
+        }
+
+        first = *in->array;
+    }
+
+    // a call of a function which wasn't inlined doesn't know which elements the block is at
+    if (first == NULL) {
+        error_throw(formula->uses_arrays ? "the arrays have to be read directly, not in a function" : "there is no array in the formula");
+        return ERROR_CODE_FAIL;
+    }
+
+    // a plain array is just shared
+    if (formula->numcode == 1) {
+        *result = array_retain(*formula->code[0].array);
+        return ERROR_CODE_OK;
+    }
+
+    array_s* array = array_create(first->length);
+    if (array == NULL) return ERROR_CODE_FAIL;
+
+    if (ERROR_FAIL(batch_run(formula, NULL, array->data, array->length))) {
+        array_release(array);
+        return ERROR_CODE_FAIL;
+    }
+
+    *result = array;
+    return ERROR_CODE_OK;
+}
+
+// ---------- DUAL NUMBERS -------------------
+// Forward mode differentiation, every stack slot carries the value and the derivative by x,
+// the chain rule is applied instruction by instruction, so f and f' come out of one pass
+
+// df/dargs[k] of a function without a known derivative (old plugins)
+static double numeric_deriv(const cfunc_s* f, double* args, size_t k) {
+    const double a = args[k], h = 1e-6*(fabs(a) > 1.0 ? fabs(a) : 1.0);
 
-                if (tokens[i].oper != OP_OBRACK) // we dont want the opening bracket to pop ANYTHING
-                    while (STACK_HEIGHT(oper_stack) > 0 && precedence[tokens[i].oper] <= (STACK_PEEK(oper_stack)->type == TT_FUNCTION ? 3 : precedence[STACK_PEEK(oper_stack)->oper]))
-                        STACK_PUSH(tokens_postfix, STACK_POP(oper_stack));
+    args[k] = a+h;
+    double hi = call_scalar(f, args);
+    args[k] = a-h;
+    double lo = call_scalar(f, args);
+    args[k] = a;
 
-                STACK_PUSH(oper_stack, tokens[i]);
+    return (hi-lo)/(2*h);
+}
+
+static error_t dual_block(const instr* code, size_t numcode, const double* xs, size_t m, double* vals, double* ders);
+
+// The same as batch_series, the bounds are whole numbers, so only the terms have derivatives
+static error_t dual_series(const instr* in, const double* xs, size_t m, double* top, double* dtop) {
+    series_s* series = in->series;
+
+    arena_mark mark = scratch_save();
+    double* lo = scratch_alloc(4*m*sizeof(double));
+    double *hi = lo+m, *acc = lo+2*m, *dacc = lo+3*m;
+    memcpy(lo, top, 2*m*sizeof(double));
+
+    double first, last;
+    if (ERROR_FAIL(series_terms(lo, hi, m, &first, &last))) {
+        scratch_restore(mark);
+        return ERROR_CODE_FAIL;
+    }
+
+    batch_fill(acc, series->product ? 1.0 : 0.0, m);
+    batch_fill(dacc, 0.0, m);
+
+    for (double k = first; k <= last; k++) {
+        series->k = k;
+        if (ERROR_FAIL(dual_block(in+1, series->len, xs, m, top, dtop))) {
+            scratch_restore(mark);
+            return ERROR_CODE_FAIL;
+        }
+
+        for (size_t i = 0; i < m; i++) {
+            if (!(lo[i] <= k && k <= hi[i])) continue;
+
+            if (series->product) {
+                dacc[i] = dacc[i]*top[i] + acc[i]*dtop[i];
+                acc[i] *= top[i];
+            } else {
+                dacc[i] += dtop[i];
+                acc[i] += top[i];
             }
-        } else if (tokens[i].type == TT_FUNCTION) {
+        }
+    }
+
+    for (size_t i = 0; i < m; i++) {
+        const _Bool undefined = isnan(lo[i]) || isnan(hi[i]);
+        top[i] = undefined ? NAN : acc[i];
+        dtop[i] = undefined ? NAN : dacc[i];
+    }
+
+    scratch_restore(mark);
+    return ERROR_CODE_OK;
+}
+
+// The same as batch_block, ders mirrors vals with the derivatives
+static error_t dual_block(const instr* code, size_t numcode, const double* xs, size_t m, double* vals, double* ders) {
+    double* top = vals; // the first free slot
+
+    for (const instr* in = code; in < code+numcode; in++) {
+        double *a = top-2*m, *b = top-m;
+        double *da = ders+(a-vals), *db = ders+(b-vals);
+
+        switch (in->op) {
+            case OC_ARRAY :
+                error_throw("arrays are only computed element-wise");
+                return ERROR_CODE_FAIL;
+            case OC_NUM : case OC_VAR : case OC_I : case OC_RAND : // a draw doesn't follow x
+                batch_instr(in, top, NULL, NULL, xs, m);
+                batch_fill(ders+(top-vals), 0.0, m);
+                top += m;
+            break;
+            case OC_X :
+                memmove(top, xs, m*sizeof(double));
+                batch_fill(ders+(top-vals), 1.0, m);
+                top += m;
+            break;
+
+            case OC_ADD : batch_add(a, a, b, m); batch_add(da, da, db, m); top -= m; break;
+            case OC_CMP : batch_cmp[(int)in->num](a, a, b, m); batch_fill(da, 0.0, m); top -= m; break; // flat between the jumps
+            case OC_SUB : batch_sub(a, a, b, m); batch_sub(da, da, db, m); top -= m; break;
+            case OC_NEG : batch_neg(b, b, m); batch_neg(db, db, m); break;
+            case OC_MULT:
+                for (size_t i = 0; i < m; i++) {
+                    da[i] = da[i]*b[i] + a[i]*db[i];
+                    a[i] *= b[i];
+                }
+                top -= m;
+            break;
+            case OC_DIV :
+                for (size_t i = 0; i < m; i++) {
+                    a[i] /= b[i];
+                    da[i] = (da[i] - a[i]*db[i]) / b[i];
+                }
+                top -= m;
+            break;
+            case OC_MOD :
+                for (size_t i = 0; i < m; i++) {
+                    da[i] -= trunc(a[i]/b[i])*db[i];
+                    a[i] = fmod(a[i], b[i]);
+                }
+                top -= m;
+            break;
+            case OC_POW :
+                for (size_t i = 0; i < m; i++) {
+                    double val = pow(a[i], b[i]);
+
+                    // a constant exponent works for negative bases too, the general rule needs log(a)
+                    if (db[i] == 0.0) da[i] = da[i] == 0.0 ? 0.0 : b[i]*pow(a[i], b[i]-1)*da[i];
+                    else da[i] = val*(db[i]*log(a[i]) + (da[i] == 0.0 ? 0.0 : b[i]*da[i]/a[i]));
+
+                    a[i] = val;
+                }
+                top -= m;
+            break;
+            case OC_POWI : {
+                int n = (int)in->num;
+                for (size_t i = 0; i < m; i++) {
+                    db[i] = n == 0 ? 0.0 : n*powi(b[i], n-1)*db[i];
+                    b[i] = powi(b[i], n);
+                }
+            } break;
 
-            while (STACK_HEIGHT(oper_stack) > 0 && 3 <= (STACK_PEEK(oper_stack)->type == TT_FUNCTION ? 3 : precedence[STACK_PEEK(oper_stack)->oper]))
-                STACK_PUSH(tokens_postfix, STACK_POP(oper_stack));
+            case OC_POLY : {
+                // p and p' at once, p' picks up the partial sums of p
+                const double* c = in->poly->coeffs;
+                const unsigned n = in->poly->degree;
 
-            STACK_PUSH(oper_stack, tokens[i]);
+                for (size_t i = 0; i < m; i++) {
+                    double p = c[n], dp = 0.0;
+                    for (unsigned k = n; k-- > 0; ) {
+                        dp = dp*b[i] + p;
+                        p = p*b[i] + c[k];
+                    }
 
+                    db[i] = db[i] == 0.0 ? 0.0 : db[i]*dp;
+                    b[i] = p;
+                }
+            } break;
+            case OC_CFUNC :
+                for (size_t i = 0; i < m; i++) {
+                    if (db[i] != 0.0)
+                        db[i] *= in->call->deriv != NULL ? in->call->deriv(b[i]) : numeric_deriv(in->call, &b[i], 0);
+
+                    b[i] = in->call->func(b[i]);
+                }
+            break;
+            case OC_CALL : {
+                const size_t arity = in->call->arity;
+                double* args = top-arity*m;
+                double* dargs = ders+(args-vals);
+
+                for (size_t i = 0; i < m; i++) {
+                    double lane[JP_MAXARITY], grad[JP_MAXARITY];
+                    for (size_t k = 0; k < arity; k++) lane[k] = args[k*m+i];
+
+                    if (in->call->gradient != NULL) in->call->gradient(lane, grad);
+
+                    double d = 0.0;
+                    for (size_t k = 0; k < arity; k++)
+                        if (dargs[k*m+i] != 0.0)
+                            d += dargs[k*m+i] * (in->call->gradient != NULL ? grad[k] : numeric_deriv(in->call, lane, k));
+
+                    dargs[i] = d;
+                }
+
+                call_batch(in->call, args, args, m);
+                top = args+m;
+            } break;
+            case OC_SELECT : {
+                // the derivative of the branch taken, the condition still decides
+                double* args = top-3*m;
+                double* dargs = ders+(args-vals);
+
+                batch_select(dargs, args, dargs+m, dargs+2*m, m);
+                batch_select(args, args, args+m, args+2*m, m);
+                top = args+m;
+            } break;
+            case OC_FUNC : {
+                arena_mark mark = scratch_save();
+                double* dfunc = scratch_alloc(m*sizeof(double));
+
+                if (ERROR_FAIL(compute_batch_dual(in->func, b, b, dfunc, m))) {
+                    scratch_restore(mark);
+                    return ERROR_CODE_FAIL;
+                }
+
+                for (size_t i = 0; i < m; i++)
+                    db[i] = db[i] == 0.0 ? 0.0 : db[i]*dfunc[i];
+
+                scratch_restore(mark);
+            } break;
+            case OC_SERIES :
+                if (ERROR_FAIL(dual_series(in, xs, m, a, da)))
+                    return ERROR_CODE_FAIL;
+                in += in->series->len;
+                top -= m;
+            break;
+            case OC_ARG : break;
         }
+    }
+
+    return ERROR_CODE_OK;
+}
+
+error_t compute_batch_dual(formula_s* formula, const double* xs, double* ys, double* dys, size_t n) {
+    if (ERROR_FAIL(formula_prepare(formula, 1)))
+        return ERROR_CODE_FAIL;
+
+    arena_mark mark = scratch_save();
+    double* vals = scratch_alloc(2*formula->depth*BATCH_LANES*sizeof(double));
+    double* ders = vals+formula->depth*BATCH_LANES;
+
+    for (size_t done = 0; done < n; done += BATCH_LANES) {
+        size_t m = n-done < BATCH_LANES ? n-done : BATCH_LANES;
 
+        if (ERROR_FAIL(dual_block(formula->code, formula->numcode, xs+done, m, vals, ders))) {
+            scratch_restore(mark);
+            return ERROR_CODE_FAIL;
+        }
+
+        memcpy(ys+done, vals, m*sizeof(double));
+        memcpy(dys+done, ders, m*sizeof(double));
     }
 
-    // pop off the whole stack before finishing
-    while(STACK_HEIGHT(oper_stack) > 0) 
-        STACK_PUSH(tokens_postfix, STACK_POP(oper_stack));
+    scratch_restore(mark);
+    return ERROR_CODE_OK;
+}
 
-    free(tokens);
-    STACK_FREE(oper_stack);
+error_t compute_dual(double* result, double* deriv, formula_s* formula, double x) {
+    return compute_batch_dual(formula, &x, result, deriv, 1);
+}
 
-    // construct the result structure
-    formula_s result = {tokens_postfix.stackbot, STACK_HEIGHT(tokens_postfix)};
-    return result;
+// ---------- COMPLEX NUMBERS -------------------
+// Every stack slot has its real and imaginary parts in separate arrays (split, not interleaved),
+// so a vector holds the same part of several values and the arithmetic stays plain SIMD
+
+// a *= b
+static void cplx_mult(double* are, double* aim, const double* bre, const double* bim, size_t m) {
+    size_t i = 0;
+    for (; i+SIMD_LANES <= m; i += SIMD_LANES) {
+        const simd_d ar = SIMD_LOAD(are+i), ai = SIMD_LOAD(aim+i), br = SIMD_LOAD(bre+i), bi = SIMD_LOAD(bim+i);
+        SIMD_STORE(are+i, SIMD_SUB(SIMD_MUL(ar, br), SIMD_MUL(ai, bi)));
+        SIMD_STORE(aim+i, SIMD_ADD(SIMD_MUL(ar, bi), SIMD_MUL(ai, br)));
+    }
+
+    for (; i < m; i++) {
+        const double ar = are[i];
+        are[i] = ar*bre[i] - aim[i]*bim[i];
+        aim[i] = ar*bim[i] + aim[i]*bre[i];
+    }
 }
 
-// Computes reverse polish notation
-// https://en.wikipedia.org/wiki/Reverse_Polish_notation
-int compute(double* result, const formula_s formula, const double* x) {
-    if (formula.toks == NULL) {
-        error_throw("invalid formula");
-        return 0;
+// a /= b, the divisor is scaled first so its squared modulus can't over- or underflow
+static void cplx_div(double* are, double* aim, const double* bre, const double* bim, size_t m) {
+    for (size_t i = 0; i < m; i++) {
+        if (bim[i] == 0.0) {
+            are[i] /= bre[i];
+            aim[i] /= bre[i];
+            continue;
+        }
+
+        const double s = fabs(bre[i]) + fabs(bim[i]), c = bre[i]/s, d = bim[i]/s;
+        const double den = (c*c + d*d)*s, ar = are[i];
+
+        are[i] = (ar*c + aim[i]*d)/den;
+        aim[i] = (aim[i]*c - ar*d)/den;
     }
+}
 
-    numberstack numstack;
-    STACK_ALLOC(numstack, formula.numtoks, double);
-
-    for (size_t i = 0; i < formula.numtoks; i++) {
-        
-        if (formula.toks[i].type == TT_NUMBER) {
-            STACK_PUSH(numstack, formula.toks[i].num);
-        } else if (formula.toks[i].type == TT_OPERATOR){
-            if (STACK_HEIGHT(numstack) < (formula.toks[i].oper == OP_NEG ? 1 : 2)) {
-                error_throw("insufficent operand count");
-                return 0;
-            }
-            
-            double right = STACK_POP(numstack);
-            double left;
-
-            if (formula.toks[i].oper != OP_NEG)
-                left = STACK_POP(numstack);
-
-            switch (formula.toks[i].oper) {
-                case OP_ADD : STACK_PUSH(numstack, left + right); break;
-                case OP_SUB : STACK_PUSH(numstack, left - right); break;
-                case OP_MULT: STACK_PUSH(numstack, left * right); break;
-                case OP_DIV : STACK_PUSH(numstack, left / right); break;
-                case OP_MOD : STACK_PUSH(numstack, fmod(left, right)); break;
-                case OP_POW : STACK_PUSH(numstack, pow(left, right)); break;
-                case OP_NEG : STACK_PUSH(numstack, -right); break; // negate the top of the stack 
+// a^n by squaring, all the lanes at once
+static void cplx_powi(double* re, double* im, int n, size_t m) {
+    double rre[BATCH_LANES], rim[BATCH_LANES], sre[BATCH_LANES], sim[BATCH_LANES];
+    batch_fill(rre, 1.0, m);
+    batch_fill(rim, 0.0, m);
+    memcpy(sre, re, m*sizeof(double));
+    memcpy(sim, im, m*sizeof(double));
+
+    for (unsigned e = n < 0 ? -(unsigned)n : (unsigned)n; e != 0; e >>= 1) {
+        if (e & 1) cplx_mult(rre, rim, sre, sim, m);
+        if (e > 1) cplx_mult(sre, sim, sre, sim, m);
+    }
+
+    if (n < 0) {
+        batch_fill(re, 1.0, m);
+        batch_fill(im, 0.0, m);
+        cplx_div(re, im, rre, rim, m);
+    } else {
+        memcpy(re, rre, m*sizeof(double));
+        memcpy(im, rim, m*sizeof(double));
+    }
+}
+
+// a^b = e^(b*log(a)), 0^b is 0 for re(b) > 0
+static void cplx_pow(double* are, double* aim, const double* bre, const double* bim, size_t m) {
+    double zero[BATCH_LANES];
+    for (size_t i = 0; i < m; i++) zero[i] = are[i] == 0.0 && aim[i] == 0.0;
+
+    vm_clog(are, aim, m);
+    cplx_mult(are, aim, bre, bim, m);
+    vm_cexp(are, aim, m);
+
+    for (size_t i = 0; i < m; i++)
+        if (zero[i] != 0.0) {
+            are[i] = bre[i] > 0.0 ? 0.0 : bre[i] == 0.0 && bim[i] == 0.0 ? 1.0 : NAN;
+            aim[i] = are[i] == 1.0 ? 0.0 : are[i];
+        }
+}
+
+// the functions only known for real numbers give NaN for the rest
+static void cplx_real_only(const cfunc_s* f, double* re, double* im, size_t m) {
+    for (size_t i = 0; i < m; i++) {
+        re[i] = im[i] == 0.0 ? f->func(re[i]) : NAN;
+        im[i] = 0.0;
+    }
+}
+
+static error_t complex_block(const instr* code, size_t numcode, const double* xre, const double* xim, size_t m, double* re, double* im);
+
+// The same as batch_series, only real bounds count
+static error_t complex_series(const instr* in, const double* xre, const double* xim, size_t m, double* top, double* itop) {
+    series_s* series = in->series;
+
+    arena_mark mark = scratch_save();
+    double* lo = scratch_alloc(4*m*sizeof(double));
+    double *hi = lo+m, *acc = lo+2*m, *iacc = lo+3*m;
+    memcpy(lo, top, 2*m*sizeof(double));
+
+    for (size_t i = 0; i < m; i++)
+        if (itop[i] != 0.0 || itop[m+i] != 0.0) lo[i] = NAN;
+
+    double first, last;
+    if (ERROR_FAIL(series_terms(lo, hi, m, &first, &last))) {
+        scratch_restore(mark);
+        return ERROR_CODE_FAIL;
+    }
+
+    batch_fill(acc, series->product ? 1.0 : 0.0, m);
+    batch_fill(iacc, 0.0, m);
+
+    for (double k = first; k <= last; k++) {
+        series->k = k;
+        if (ERROR_FAIL(complex_block(in+1, series->len, xre, xim, m, top, itop))) {
+            scratch_restore(mark);
+            return ERROR_CODE_FAIL;
+        }
+
+        // the lanes outside of the bounds get the identity
+        for (size_t i = 0; i < m; i++)
+            if (!(lo[i] <= k && k <= hi[i])) {
+                top[i] = series->product ? 1.0 : 0.0;
+                itop[i] = 0.0;
             }
 
-        } else {
+        if (series->product) cplx_mult(acc, iacc, top, itop, m);
+        else {
+            batch_add(acc, acc, top, m);
+            batch_add(iacc, iacc, itop, m);
+        }
+    }
+
+    for (size_t i = 0; i < m; i++) {
+        const _Bool undefined = isnan(lo[i]) || isnan(hi[i]);
+        top[i] = undefined ? NAN : acc[i];
+        itop[i] = undefined ? NAN : iacc[i];
+    }
 
-            double pushval;
+    scratch_restore(mark);
+    return ERROR_CODE_OK;
+}
 
-            if (x != NULL && !strcmp(formula.toks[i].name, "x"))
-                pushval = *x;
-            else {
+// The same as batch_block, im mirrors re with the imaginary parts
+static error_t complex_block(const instr* code, size_t numcode, const double* xre, const double* xim, size_t m, double* re, double* im) {
+    double* top = re; // the first free slot
+
+    for (const instr* in = code; in < code+numcode; in++) {
+        double *a = top-2*m, *b = top-m;
+        double *ai = im+(a-re), *bi = im+(b-re);
+
+        switch (in->op) {
+            case OC_ARRAY :
+                error_throw("arrays are only computed element-wise");
+                return ERROR_CODE_FAIL;
+            case OC_NUM : case OC_VAR : case OC_RAND :
+                batch_instr(in, top, NULL, NULL, xre, m);
+                batch_fill(im+(top-re), 0.0, m);
+                top += m;
+            break;
+            case OC_X :
+                memmove(top, xre, m*sizeof(double));
+                memmove(im+(top-re), xim, m*sizeof(double));
+                top += m;
+            break;
+            case OC_I :
+                batch_fill(top, 0.0, m);
+                batch_fill(im+(top-re), 1.0, m);
+                top += m;
+            break;
+
+            case OC_ADD : batch_add(a, a, b, m); batch_add(ai, ai, bi, m); top -= m; break;
+            case OC_SUB : batch_sub(a, a, b, m); batch_sub(ai, ai, bi, m); top -= m; break;
+            case OC_NEG : batch_neg(b, b, m); batch_neg(bi, bi, m); break;
+            case OC_MULT: cplx_mult(a, ai, b, bi, m); top -= m; break;
+            case OC_DIV : cplx_div(a, ai, b, bi, m); top -= m; break;
+            case OC_POW : cplx_pow(a, ai, b, bi, m); top -= m; break;
+            case OC_POWI: cplx_powi(b, bi, (int)in->num, m); break;
+            case OC_MOD :
+                // only defined for real numbers
+                for (size_t i = 0; i < m; i++) {
+                    a[i] = ai[i] == 0.0 && bi[i] == 0.0 ? fmod(a[i], b[i]) : NAN;
+                    ai[i] = 0.0;
+                }
+                top -= m;
+            break;
 
-                object* obj;
-                if (ERROR_FAIL(object_get(formula.toks[i].name, &obj))) 
+            case OC_POLY : {
+                // Horner's scheme, the coefficients are real
+                const double* c = in->poly->coeffs;
+                double pre[BATCH_LANES], pim[BATCH_LANES];
+                batch_fill(pre, c[in->poly->degree], m);
+                batch_fill(pim, 0.0, m);
+
+                for (unsigned k = in->poly->degree; k-- > 0; ) {
+                    cplx_mult(pre, pim, b, bi, m);
+                    for (size_t i = 0; i < m; i++) pre[i] += c[k];
+                }
+
+                memcpy(b, pre, m*sizeof(double));
+                memcpy(bi, pim, m*sizeof(double));
+            } break;
+
+            case OC_CFUNC :
+                if (in->call->cbatch != NULL) in->call->cbatch(b, bi, m);
+                else cplx_real_only(in->call, b, bi, m);
+            break;
+            case OC_FUNC :
+                if (ERROR_FAIL(compute_batch_complex(in->func, b, bi, b, bi, m)))
                     return ERROR_CODE_FAIL;
+            break;
+            case OC_CALL : {
+                const size_t arity = in->call->arity;
+                double* args = top-arity*m;
+                double* iargs = im+(args-re);
 
-                switch(formula.toks[i].type) {
-                    case TT_VARIABLE :
-                        if (obj->type != OT_VARIABLE && obj->type != OT_CONSTANT) {
-                            error_throw_str("%s is not a variable", formula.toks[i].name);
-                            return ERROR_CODE_FAIL;
-                        }
-
-                        pushval = *obj->val;
-                    break;
-                    case TT_FUNCTION :
-                        if (STACK_HEIGHT(numstack) < 1) {
-                            error_throw("function argument missing");
-                            return ERROR_CODE_FAIL;
-                        }
-
-                        if (obj->type == OT_CFUNC)
-                            pushval = obj->cfunc(STACK_POP(numstack));
-                        else if (obj->type == OT_FUNCTION) {
-                            if (ERROR_FAIL(compute(&pushval, *obj->func, &STACK_POP(numstack)))) 
-                                return ERROR_CODE_FAIL;
-                        } else {
-                            error_throw_str("%s is not a function", formula.toks[i].name);
-                            return ERROR_CODE_FAIL;
-                        }
-
-                    break;
-                    default : 
-                        error_throw("unknown type token"); 
-                        return ERROR_CODE_FAIL;
-                    break;
+                for (size_t i = 0; i < m; i++) {
+                    double lane[JP_MAXARITY];
+                    _Bool real = 1;
+                    for (size_t k = 0; k < arity; k++) {
+                        lane[k] = args[k*m+i];
+                        real &= iargs[k*m+i] == 0.0;
+                    }
+
+                    args[i] = real ? call_scalar(in->call, lane) : NAN;
+                    iargs[i] = 0.0;
                 }
-            }
 
-            STACK_PUSH(numstack, pushval);
+                top = args+m;
+            } break;
+            case OC_CMP :
+                // complex numbers aren't ordered, only the real ones are compared
+                for (size_t i = 0; i < m; i++) {
+                    a[i] = ai[i] == 0.0 && bi[i] == 0.0 ? compare((int)in->num, a[i], b[i]) : NAN;
+                    ai[i] = 0.0;
+                }
+                top -= m;
+            break;
+            case OC_SELECT : {
+                double* args = top-3*m;
+                double* iargs = im+(args-re);
+
+                for (size_t i = 0; i < m; i++) {
+                    const double cond = iargs[i] == 0.0 ? args[i] : NAN;
+                    iargs[i] = choose(cond, iargs[m+i], iargs[2*m+i]);
+                    args[i] = choose(cond, args[m+i], args[2*m+i]);
+                }
 
+                top = args+m;
+            } break;
+            case OC_SERIES :
+                if (ERROR_FAIL(complex_series(in, xre, xim, m, a, ai)))
+                    return ERROR_CODE_FAIL;
+                in += in->series->len;
+                top -= m;
+            break;
+            case OC_ARG : break;
         }
+    }
+
+    return ERROR_CODE_OK;
+}
+
+// x is bound or not already (formula_prepare)
+static error_t complex_run(const formula_s* formula, const double* xre, const double* xim, double* yre, double* yim, size_t n) {
+    arena_mark mark = scratch_save();
+    double* re = scratch_alloc(2*formula->depth*BATCH_LANES*sizeof(double));
+    double* im = re+formula->depth*BATCH_LANES;
+
+    for (size_t done = 0; done < n; done += BATCH_LANES) {
+        size_t m = n-done < BATCH_LANES ? n-done : BATCH_LANES;
 
+        if (ERROR_FAIL(complex_block(formula->code, formula->numcode, xre+done, xim+done, m, re, im))) {
+            scratch_restore(mark);
+            return ERROR_CODE_FAIL;
+        }
+
+        memcpy(yre+done, re, m*sizeof(double));
+        memcpy(yim+done, im, m*sizeof(double));
     }
 
-    if (STACK_HEIGHT(numstack) > 1) {
-        error_throw("insufficent operator count");
+    scratch_restore(mark);
+    return ERROR_CODE_OK;
+}
+
+error_t compute_batch_complex(formula_s* formula, const double* xre, const double* xim, double* yre, double* yim, size_t n) {
+    if (ERROR_FAIL(formula_prepare(formula, 1)))
+        return ERROR_CODE_FAIL;
+
+    return complex_run(formula, xre, xim, yre, yim, n);
+}
+
+error_t compute_complex(double* re, double* im, formula_s* formula, const double* x) {
+    if (ERROR_FAIL(formula_prepare(formula, x != NULL)))
         return ERROR_CODE_FAIL;
+
+    return complex_run(formula, x != NULL ? x : &(double){0.0}, &(double){0.0}, re, im, 1);
+}
+
+// ---------- INTERVAL ARITHMETIC -------------------
+// Every stack slot holds a range the value is guaranteed to be in for any x of the input range,
+// the bounds are pushed out after every operation, so the rounding can't make them too narrow
+
+static const interval iv_whole = {-INFINITY, INFINITY, 1};
+static const interval iv_empty = {INFINITY, -INFINITY, 1};
+
+// pushes the bounds out by at least rel*|bound|, the rounding of the subtraction can't undo that
+// for rel >= 2^-51 (an ulp), this is a lot cheaper than nextafter,
+// the bounds near 0 move by DBL_MIN, a subnormal operand stalls the FMA the compiler contracts this into
+static interval iv_widen(double lo, double hi, _Bool gap, double rel) {
+    lo -= fabs(lo)*rel + DBL_MIN;
+    hi += fabs(hi)*rel + DBL_MIN;
+
+    if (isnan(lo) || isnan(hi)) return iv_whole;
+    return (interval){lo, hi, gap};
+}
+
+// the basic arithmetic is correctly rounded, pow, powi and the cfuncs get a few more ulps
+static interval iv_round(double lo, double hi, _Bool gap) { return iv_widen(lo, hi, gap, 0x1p-51); }
+static interval iv_loose(double lo, double hi, _Bool gap) { return iv_widen(lo, hi, gap, 0x1p-48); }
+
+// 0*inf is 0 here, a bound being infinite doesn't make the value infinite
+static double iv_prod(double a, double b) {
+    return a == 0.0 || b == 0.0 ? 0.0 : a*b;
+}
+
+static interval iv_mul(interval a, interval b) {
+    const double p[4] = {iv_prod(a.lo, b.lo), iv_prod(a.lo, b.hi), iv_prod(a.hi, b.lo), iv_prod(a.hi, b.hi)};
+    return iv_round(fmin(fmin(p[0], p[1]), fmin(p[2], p[3])), fmax(fmax(p[0], p[1]), fmax(p[2], p[3])), a.gap || b.gap);
+}
+
+static interval iv_div(interval a, interval b) {
+    interval inv;
+
+    // a divisor containing 0 is a pole (or a hole like x/x)
+    if (b.lo == 0.0 && b.hi == 0.0) return iv_empty;
+    else if (b.lo == 0.0) inv = iv_round(1/b.hi, INFINITY, 1);
+    else if (b.hi == 0.0) inv = iv_round(-INFINITY, 1/b.lo, 1);
+    else if (b.lo < 0.0 && b.hi > 0.0) inv = iv_whole;
+    else inv = iv_round(1/b.hi, 1/b.lo, b.gap);
+
+    return iv_mul(a, inv);
+}
+
+// x^n is monotonic for odd n, even n have the minimum at 0
+static interval iv_powi(interval a, int n) {
+    if (n == 0) return (interval){1.0, 1.0, a.gap};
+    if (n < 0) return iv_div((interval){1.0, 1.0, 0}, iv_powi(a, n == INT_MIN ? INT_MAX : -n));
+
+    const double plo = powi(a.lo, n), phi = powi(a.hi, n);
+    if (n % 2 == 1 || a.lo >= 0.0) return iv_loose(plo, phi, a.gap);
+    if (a.hi <= 0.0) return iv_loose(phi, plo, a.gap);
+    return iv_loose(0.0, fmax(plo, phi), a.gap);
+}
+
+static interval iv_pow(interval a, interval b) {
+    // an integer exponent works for negative bases too
+    if (b.lo == b.hi && b.lo == trunc(b.lo) && fabs(b.lo) <= INT_MAX) {
+        interval r = iv_powi(a, (int)b.lo);
+        r.gap |= b.gap;
+        return r;
     }
 
-    if (result != NULL) 
-        *result = STACK_POP(numstack);
+    // a negative base only has the powers of the integer exponents, (-m)^n is m^n or -m^n,
+    // m^n is monotonic in both m and n, so its corners bound it
+    interval neg = iv_empty;
+    const double nlo = ceil(b.lo), nhi = floor(b.hi);
+    if (a.lo < 0.0 && nlo <= nhi) {
+        const double mlo = a.hi < 0.0 ? -a.hi : 0.0, mhi = -a.lo;
+        const double p[4] = {pow(mlo, nlo), pow(mlo, nhi), pow(mhi, nlo), pow(mhi, nhi)};
+        const double m = fmax(fmax(p[0], p[1]), fmax(p[2], p[3]));
+        neg = iv_loose(-m, m, 1);
+    }
+
+    if (a.hi < 0.0) return neg;
+
+    // pow is monotonic in both arguments for the nonnegative bases
+    const _Bool gap = a.gap || b.gap || a.lo < 0.0 || (a.lo <= 0.0 && b.lo < 0.0);
+    if (a.lo < 0.0) a.lo = 0.0;
+
+    const double p[4] = {pow(a.lo, b.lo), pow(a.lo, b.hi), pow(a.hi, b.lo), pow(a.hi, b.hi)};
+    const interval pos = iv_loose(fmin(fmin(p[0], p[1]), fmin(p[2], p[3])), fmax(fmax(p[0], p[1]), fmax(p[2], p[3])), gap);
+
+    if (neg.lo > neg.hi) return pos;
+    return (interval){fmin(neg.lo, pos.lo), fmax(neg.hi, pos.hi), 1};
+}
+
+// fmod(a, b) has the sign of a and is smaller than |b|
+static interval iv_mod(interval a, interval b) {
+    const _Bool gap = a.gap || b.gap || (b.lo <= 0.0 && b.hi >= 0.0);
+    if (b.lo == 0.0 && b.hi == 0.0) return iv_empty;
+
+    // the whole range is within one period, fmod is monotonic there
+    if (b.lo == b.hi && isfinite(a.lo) && isfinite(a.hi) && (a.lo >= 0.0 || a.hi <= 0.0)
+        && trunc(a.lo/b.lo) == trunc(a.hi/b.lo))
+        return iv_round(fmod(a.lo, b.lo), fmod(a.hi, b.lo), gap);
+
+    const double m = fmax(fabs(b.lo), fabs(b.hi));
+    return iv_round(a.lo >= 0.0 ? 0.0 : fmax(-m, a.lo), a.hi <= 0.0 ? 0.0 : fmin(m, a.hi), gap);
+}
+
+// Both Horner's scheme and the sum of the terms are bounds, each of them is tighter for other ranges
+// (the even powers of the terms don't go below 0, Horner's scheme doesn't add up the overestimates of every term)
+static interval iv_poly(const poly_s* poly, interval x) {
+    const double* c = poly->coeffs;
+    interval horner = {c[poly->degree], c[poly->degree], x.gap}, terms = {c[0], c[0], x.gap};
+
+    for (unsigned k = poly->degree; k-- > 0; ) {
+        horner = iv_mul(horner, x);
+        horner = iv_round(horner.lo + c[k], horner.hi + c[k], horner.gap);
+    }
+
+    for (unsigned k = 1; k <= poly->degree; k++) {
+        if (c[k] == 0.0) continue;
+
+        interval term = iv_mul((interval){c[k], c[k], 0}, iv_powi(x, k));
+        terms = iv_round(terms.lo + term.lo, terms.hi + term.hi, terms.gap || term.gap);
+    }
+
+    return (interval){fmax(horner.lo, terms.lo), fmin(horner.hi, terms.hi), horner.gap || terms.gap};
+}
+
+// 0 if the comparison can't hold anywhere in the ranges, 1 if it can't fail, both are exact
+static interval iv_cmp(int kind, interval a, interval b) {
+    // GT and GE are LT and LE the other way around
+    if (kind == CMP_GT || kind == CMP_GE) {
+        const interval t = a;
+        a = b;
+        b = t;
+        kind = kind == CMP_GT ? CMP_LT : CMP_LE;
+    }
+
+    const _Bool single = a.lo == a.hi && b.lo == b.hi && a.lo == b.lo;
+    _Bool can_true, can_false;
+
+    switch (kind) {
+        case CMP_LT : can_true = a.lo < b.hi; can_false = a.hi >= b.lo; break;
+        case CMP_LE : can_true = a.lo <= b.hi; can_false = a.hi > b.lo; break;
+        case CMP_EQ : can_true = a.lo <= b.hi && b.lo <= a.hi; can_false = !single; break;
+        default : can_true = !single; can_false = a.lo <= b.hi && b.lo <= a.hi; break;
+    }
+
+    return (interval){can_false ? 0.0 : 1.0, can_true ? 1.0 : 0.0, a.gap || b.gap};
+}
+
+// the branches the condition can take, both of them joined if it isn't decided in the whole range
+static interval iv_select(interval c, interval a, interval b) {
+    if (c.lo > c.hi) return iv_empty;
+
+    const _Bool can_true = c.lo != 0.0 || c.hi != 0.0, can_false = c.lo <= 0.0 && c.hi >= 0.0;
+    if (!can_false) a.gap |= c.gap;
+    if (!can_true) b.gap |= c.gap;
+    if (!can_false) return a;
+    if (!can_true) return b;
+
+    // an undefined branch leaves the other one with a gap
+    if (a.lo > a.hi) return b.lo > b.hi ? iv_empty : (interval){b.lo, b.hi, 1};
+    if (b.lo > b.hi) return (interval){a.lo, a.hi, 1};
+    return (interval){fmin(a.lo, b.lo), fmax(a.hi, b.hi), a.gap || b.gap || c.gap};
+}
+
+static error_t interval_run(const instr* code, size_t numcode, interval x, interval* stack);
+
+// The bounds are ranges too, the k only some of their values reach might be in the sum or not,
+// so its term is joined with the identity
+static error_t iv_series(const instr* in, interval x, interval* top) {
+    series_s* series = in->series;
+    const interval lo = top[0], hi = top[1];
+    const double id = series->product ? 1.0 : 0.0;
 
-    STACK_FREE(numstack);
+    if (lo.lo > lo.hi || hi.lo > hi.hi || isnan(lo.lo) || isnan(hi.hi)) {
+        *top = iv_empty;
+        return ERROR_CODE_OK;
+    }
+
+    double first, last;
+    if (ERROR_FAIL(series_terms(&lo.lo, &hi.hi, 1, &first, &last)))
+        return ERROR_CODE_FAIL;
+
+    interval acc = {id, id, lo.gap || hi.gap};
+    for (double k = first; k <= last; k++) {
+        series->k = k;
+        if (ERROR_FAIL(interval_run(in+1, series->len, x, top)))
+            return ERROR_CODE_FAIL;
+
+        interval term = *top;
+        if (term.lo > term.hi) {
+            acc = iv_empty;
+            break;
+        }
+
+        if (k < lo.hi || k > hi.lo) {
+            term.lo = fmin(term.lo, id);
+            term.hi = fmax(term.hi, id);
+        }
 
+        acc = series->product ? iv_mul(acc, term) : iv_round(acc.lo + term.lo, acc.hi + term.hi, acc.gap || term.gap);
+    }
+
+    *top = acc;
     return ERROR_CODE_OK;
 }
 
-error_t validate(const formula_s tokens) {
-    return compute(NULL, tokens, &(double){0});
+// The result is left in stack[0]
+static error_t interval_run(const instr* code, size_t numcode, interval x, interval* stack) {
+    interval* top = stack;
+
+    for (const instr* in = code; in < code+numcode; in++) {
+        interval *a = top-2, *b = top-1;
+
+        // nothing comes out of an undefined operand
+        switch (in->op) {
+            case OC_ADD : case OC_SUB : case OC_MULT : case OC_DIV : case OC_MOD : case OC_POW : case OC_CMP :
+                if (a->lo > a->hi || b->lo > b->hi) {
+                    *a = iv_empty;
+                    top--;
+                    continue;
+                }
+            break;
+            case OC_NEG : case OC_POWI : case OC_CFUNC : case OC_FUNC : case OC_POLY :
+                if (b->lo > b->hi) continue;
+            break;
+            default : break;
+        }
+
+        switch (in->op) {
+            case OC_NUM : *top++ = (interval){in->num, in->num, isnan(in->num)}; break;
+            case OC_VAR : *top++ = (interval){*in->val, *in->val, isnan(*in->val)}; break;
+            case OC_X   : *top++ = x; break;
+            case OC_I   : *top++ = iv_empty; break; // no real value anywhere
+            case OC_RAND: *top++ = (int)in->num == RAND_NORMAL ? iv_whole : (interval){0.0, 1.0, 1}; break; // any draw, anywhere
+            case OC_ARRAY :
+                error_throw("arrays are only computed element-wise");
+                return ERROR_CODE_FAIL;
+
+            case OC_ADD : *a = iv_round(a->lo + b->lo, a->hi + b->hi, a->gap || b->gap); top--; break;
+            case OC_SUB : *a = iv_round(a->lo - b->hi, a->hi - b->lo, a->gap || b->gap); top--; break;
+            case OC_MULT: *a = iv_mul(*a, *b); top--; break;
+            case OC_DIV : *a = iv_div(*a, *b); top--; break;
+            case OC_MOD : *a = iv_mod(*a, *b); top--; break;
+            case OC_POW : *a = iv_pow(*a, *b); top--; break;
+            case OC_NEG : *b = (interval){-b->hi, -b->lo, b->gap}; break;
+            case OC_POWI: *b = iv_powi(*b, (int)in->num); break;
+            case OC_POLY: *b = iv_poly(in->poly, *b); break;
+
+            case OC_CFUNC :
+                if (in->call->range != NULL) {
+                    interval r = in->call->range(*b);
+                    *b = r.lo > r.hi ? iv_empty : iv_loose(r.lo, r.hi, r.gap);
+                } else
+                    *b = iv_whole;
+            break;
+            case OC_CALL :
+                top -= in->call->arity-1;
+                top[-1] = iv_whole;
+            break;
+            case OC_CMP : *a = iv_cmp((int)in->num, *a, *b); top--; break;
+            case OC_SELECT :
+                top -= 2;
+                top[-1] = iv_select(top[-1], top[0], top[1]);
+            break;
+            case OC_FUNC :
+                if (ERROR_FAIL(compute_interval(b, in->func, *b)))
+                    return ERROR_CODE_FAIL;
+            break;
+            case OC_SERIES :
+                if (ERROR_FAIL(iv_series(in, x, a)))
+                    return ERROR_CODE_FAIL;
+                in += in->series->len;
+                top--;
+            break;
+            case OC_ARG : break;
+        }
+    }
+
+    return ERROR_CODE_OK;
+}
+
+error_t compute_interval(interval* result, formula_s* formula, interval x) {
+    if (ERROR_FAIL(formula_prepare(formula, 1)))
+        return ERROR_CODE_FAIL;
+
+    arena_mark mark = scratch_save();
+    interval* stack = scratch_alloc(formula->depth*sizeof(interval));
+
+    error_t retval = interval_run(formula->code, formula->numcode, x, stack);
+    if (!ERROR_FAIL(retval)) *result = stack[0];
+
+    scratch_restore(mark);
+    return retval;
+}
+
+error_t validate(formula_s* formula) {
+    return compute_batch(formula, &(double){0}, &(double){0}, 1);
 }
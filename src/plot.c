@@ -3,12 +3,177 @@
 #include "renderer.h" // camera macros
 #include "console.h" // settings
 #include "error.h"
+#include "dag.h" // shared graphing
+#include "compiler.h" // instr
+#include "stepper.h" // incremental sampling
+#include "ddouble.h" // deep zoom
+#include "array.h" // data sets
 #include <math.h> // isnormal
 
 int pointf_compare(const pointf* p1, const pointf* p2) {
     return (p1->x < p2->x ? -1 : p1->x > p2->x ? 1 : 1);
 }
 
+#define ADAPTIVE_COARSE 128 // the samples of the first adaptive pass
+#define ADAPTIVE_TURN 32.0 // how many pixels of arc length turning by a radian is worth
+#define ADAPTIVE_JUMP 4.0 // pixels, rising this much within a single pixel column is a jump
+
+// Marks the steps of the coarse pass the graph jumps in (between the pieces of an if, at a rounding ...),
+// the slopes at the ends don't explain the rise there. Such a step is halved until it is a pixel wide,
+// a jump keeps all of its rise in one of the halves, a steep curve spreads it out
+static void find_jumps(formula_s* formula, const double* cx, const double* cy, const double* cd, double cstep, double sx, double sy, _Bool* jump) {
+    double lo[ADAPTIVE_COARSE-1], hi[ADAPTIVE_COARSE-1], flo[ADAPTIVE_COARSE-1], fhi[ADAPTIVE_COARSE-1];
+    double mid[ADAPTIVE_COARSE-1], fmid[ADAPTIVE_COARSE-1];
+    size_t idx[ADAPTIVE_COARSE-1], n = 0;
+
+    for (size_t j = 0; j < ADAPTIVE_COARSE-1; j++) {
+        const double rise = fabs(cy[j+1]-cy[j]);
+        jump[j] = 0;
+
+        if (rise*sy > ADAPTIVE_JUMP && rise > cstep*(fabs(cd[j]) + fabs(cd[j+1]))) {
+            lo[n] = cx[j]; hi[n] = cx[j+1];
+            flo[n] = cy[j]; fhi[n] = cy[j+1];
+            idx[n++] = j;
+        }
+    }
+
+    if (n == 0) return;
+
+    for (double w = cstep*sx; w > 1.0; w /= 2) {
+        for (size_t k = 0; k < n; k++) mid[k] = (lo[k]+hi[k])/2;
+        if (ERROR_FAIL(compute_batch(formula, mid, fmid, n)))
+            return;
+
+        // the half which rises more, a hole in the middle interrupts the graph anyway
+        for (size_t k = 0; k < n; k++) {
+            if (isnan(fmid[k])) flo[k] = fhi[k] = INFINITY;
+            else if (fabs(fmid[k]-flo[k]) > fabs(fhi[k]-fmid[k])) { hi[k] = mid[k]; fhi[k] = fmid[k]; }
+            else { lo[k] = mid[k]; flo[k] = fmid[k]; }
+        }
+    }
+
+    for (size_t k = 0; k < n; k++)
+        jump[idx[k]] = !(fabs(fhi[k]-flo[k])*sy <= ADAPTIVE_JUMP);
+}
+
+// Spreads the samples by how long and how curved the graph is on the screen,
+// both are measured from the derivatives of a coarse first pass
+static void sample_adaptive(double start, double end, unsigned numsteps, formula_s* formula, double* xs) {
+    double cx[ADAPTIVE_COARSE], cy[ADAPTIVE_COARSE], cd[ADAPTIVE_COARSE];
+    double weight[ADAPTIVE_COARSE-1];
+    _Bool jump[ADAPTIVE_COARSE-1] = {0};
+
+    const double cstep = (end-start)/(ADAPTIVE_COARSE-1);
+    for (size_t j = 0; j < ADAPTIVE_COARSE; j++)
+        cx[j] = start + j*cstep;
+
+    const double sx = settings.WIDTH/cam.w, sy = settings.HEIGHT/cam.h; // pixels per unit
+    const double ylo = -cam.y-cam.h, yhi = -cam.y; // the visible range (see WORLD2CAMCART)
+    const _Bool known = !ERROR_FAIL(compute_batch_dual(formula, cx, cy, cd, ADAPTIVE_COARSE));
+    if (known) find_jumps(formula, cx, cy, cd, cstep, sx, sy, jump);
+
+    double total = 0.0;
+    for (size_t j = 0; j < ADAPTIVE_COARSE-1; j++) {
+        const double s0 = cd[j]*sy/sx, s1 = cd[j+1]*sy/sx; // the slopes on the screen
+
+        const _Bool vis0 = cy[j] >= ylo && cy[j] <= yhi, vis1 = cy[j+1] >= ylo && cy[j+1] <= yhi;
+        const double rise = cy[j+1]-cy[j];
+
+        // the values go against the slope at both ends, that is a jump (like a pole), not a curve,
+        // no samples are spent on the height of a jump, the graph isn't drawn across it
+        if (jump[j] || (rise*cd[j] < 0.0 && rise*cd[j+1] < 0.0))
+            weight[j] = cstep*sx;
+        // the length of the curve on the screen plus how much it turns
+        else if (vis0 && vis1)
+            weight[j] = cstep*sx*(sqrt(1+s0*s0) + sqrt(1+s1*s1))/2 + ADAPTIVE_TURN*fabs(atan(s1) - atan(s0));
+        // only the visible part counts
+        else {
+            const double y0 = fmin(fmax(cy[j], ylo), yhi), y1 = fmin(fmax(cy[j+1], ylo), yhi);
+            weight[j] = hypot(cstep*sx, (y1-y0)*sy);
+        }
+
+        // domain gaps just get the uniform share
+        if (!known || !isfinite(weight[j])) weight[j] = cstep*sx;
+        total += weight[j];
+    }
+
+    // the inverse of the cumulative weight, so the density of the samples follows the weight
+    size_t j = 0;
+    double cum = 0.0;
+    for (size_t i = 0; i < numsteps; i++) {
+        const double t = total*i/(numsteps-1);
+        while (j < ADAPTIVE_COARSE-2 && cum+weight[j] < t) cum += weight[j++];
+
+        double frac = weight[j] > 0.0 ? (t-cum)/weight[j] : 0.0;
+        xs[i] = cx[j] + (frac < 0.0 ? 0.0 : frac > 1.0 ? 1.0 : frac)*cstep;
+    }
+}
+
+#define CULL_MINSAMPLES 32 // pieces this small aren't split anymore, bounding a piece costs about as much as 10-20 samples
+#define CULL_MARGIN 8 // pixels, the thickest line still shows a bit outside of the screen
+
+static size_t samples_computed = 0, samples_culled = 0, samples_stepped = 0, samples_deep = 0, sets_reused = 0;
+
+// Marks the samples which can't end up on the screen with NaN (the rest with 0),
+// the interval bounds of a piece decide, it is only split if they cross the edge of the screen
+static error_t cull(formula_s* formula, const double* xs, double* ys, size_t n, double ylo, double yhi) {
+    interval y;
+    if (ERROR_FAIL(compute_interval(&y, formula, (interval){xs[0], xs[n-1], 0})))
+        return ERROR_CODE_FAIL;
+
+    // completely off the screen, or undefined everywhere
+    const _Bool hidden = y.lo > y.hi || y.hi < ylo || y.lo > yhi;
+
+    if (!hidden && (y.lo < ylo || y.hi > yhi) && n > CULL_MINSAMPLES) {
+        const size_t half = n/2;
+        if (ERROR_FAIL(cull(formula, xs, ys, half, ylo, yhi)))
+            return ERROR_CODE_FAIL;
+
+        return cull(formula, xs+half, ys+half, n-half, ylo, yhi);
+    }
+
+    for (size_t i = 0; i < n; i++) ys[i] = hidden ? NAN : 0.0;
+    return ERROR_CODE_OK;
+}
+
+// Computes the samples cull left, each run of them at once,
+// stepped means the stepper has a plan for the formula on this (uniform) grid
+static error_t graph_visible(formula_s* formula, _Bool stepped, const double* xs, double* ys, size_t n, double ylo, double yhi) {
+    if (ERROR_FAIL(cull(formula, xs, ys, n, ylo, yhi)))
+        return ERROR_CODE_FAIL;
+
+    for (size_t i = 0; i < n; ) {
+        size_t run = i;
+        while (run < n && !isnan(ys[run])) run++;
+
+        if (run > i) {
+            error_t retval = stepped ? stepper_batch(xs+i, ys+i, i, run-i) : compute_batch(formula, xs+i, ys+i, run-i);
+            if (ERROR_FAIL(retval))
+                return ERROR_CODE_FAIL;
+        }
+
+        samples_computed += run-i;
+        if (stepped) samples_stepped += run-i;
+        for (i = run; i < n && isnan(ys[i]); i++) samples_culled++;
+    }
+
+    return ERROR_CODE_OK;
+}
+
+// The part of the complex values on the real axis "set complex" picks, without culling and stepping
+// (the intervals and the stepper only know real numbers)
+static error_t graph_complex(formula_s* formula, const double* xs, double* ys, size_t n) {
+    double zero[SET_MAXLENGTH] = {0}, im[SET_MAXLENGTH];
+    if (ERROR_FAIL(compute_batch_complex(formula, xs, zero, ys, im, n)))
+        return ERROR_CODE_FAIL;
+
+    for (size_t i = 0; i < n; i++)
+        ys[i] = settings.complex_part == CP_IM ? im[i] : settings.complex_part == CP_ABS ? hypot(ys[i], im[i]) : ys[i];
+
+    samples_computed += n;
+    return ERROR_CODE_OK;
+}
+
 void graph(double start, double end, unsigned numsteps, set_s* dst) {
     if (dst == NULL || numsteps < 2) return;
 
@@ -16,28 +181,310 @@ void graph(double start, double end, unsigned numsteps, set_s* dst) {
 
     dst->length = numsteps;
 
-    double step = (end-start)/(numsteps-1);
+    double xs[SET_MAXLENGTH], ys[SET_MAXLENGTH];
     size_t i = 0;
-    for (double x = start; i < numsteps; x += step, i++) {
-        dst->coords[i].x = x;
-        compute(&dst->coords[i].y, dst->formula, &x);
+    _Bool stepped = 0;
+
+    if (settings.adaptive)
+        sample_adaptive(start, end, numsteps, &dst->formula, xs);
+    else {
+        // not accumulated, the x values have to agree with the stepped samples
+        double step = (end-start)/(numsteps-1);
+        for (; i < numsteps; i++)
+            xs[i] = start + i*step;
+
+        stepped = settings.stepping && !dst->derivative && settings.complex_part == CP_OFF && !ERROR_FAIL(stepper_plan(&dst->formula, start, step));
+    }
+
+    error_t retval;
+    if (dst->derivative) {
+        double fs[SET_MAXLENGTH]; // the function itself is computed along, but not needed
+        retval = compute_batch_dual(&dst->formula, xs, fs, ys, numsteps);
+    } else if (settings.complex_part != CP_OFF) {
+        retval = graph_complex(&dst->formula, xs, ys, numsteps);
+    } else {
+        const double margin = CULL_MARGIN*cam.h/settings.HEIGHT;
+        retval = graph_visible(&dst->formula, stepped, xs, ys, numsteps, -cam.y-cam.h-margin, -cam.y+margin); // see WORLD2CAMCART
+    }
+
+    // a broken formula (e.g. a hidden variable) just doesn't get drawn
+    if (ERROR_FAIL(retval))
+        for (i = 0; i < numsteps; i++) ys[i] = NAN;
+
+    for (i = 0; i < numsteps; i++)
+        dst->coords[i] = (pointf){xs[i], ys[i]};
+
+    dst->deep = 0;
+}
+
+#define DEEP_ZOOM 1e-10 // the camera this small relative to its position leaves doubles only a few bits per pixel
+
+static _Bool zoom_deep() {
+    return cam.w < DEEP_ZOOM*fabs(cam.x) || cam.h < DEEP_ZOOM*fabs(cam.y);
+}
+
+// Graphs the set over the camera in double-double, the coordinates are stored relative
+// to the camera (see WORLD2CAMCART_DEEP), as plain world coordinates they would be rounded right back.
+// The x values don't come from the start and end of graph, cam.x+cam.w has already lost the width
+static void graph_deep(unsigned numsteps, set_s* dst) {
+    if (dst == NULL || numsteps < 2) return;
+
+    if (numsteps > SET_MAXLENGTH) numsteps = SET_MAXLENGTH;
+
+    dst->length = numsteps;
+
+    const ddouble left = {cam.x, cam_lo.x}, top = {cam.y, cam_lo.y};
+    const double step = cam.w/(numsteps-1);
+
+    ddouble xs[SET_MAXLENGTH], ys[SET_MAXLENGTH];
+    size_t i;
+    for (i = 0; i < numsteps; i++)
+        xs[i] = dd_add_d(left, i*step);
+
+    error_t retval;
+    if (dst->derivative) {
+        // the slopes are computed in double, the dual numbers have no double-double version
+        double hs[SET_MAXLENGTH], fs[SET_MAXLENGTH], ds[SET_MAXLENGTH];
+        for (i = 0; i < numsteps; i++) hs[i] = xs[i].hi;
+
+        retval = compute_batch_dual(&dst->formula, hs, fs, ds, numsteps);
+        for (i = 0; i < numsteps; i++) ys[i] = (ddouble){ds[i], 0.0};
+    } else {
+        retval = compute_batch_dd(&dst->formula, xs, ys, numsteps);
+        samples_computed += numsteps;
+        samples_deep += numsteps;
+    }
+
+    if (ERROR_FAIL(retval))
+        for (i = 0; i < numsteps; i++) ys[i] = (ddouble){NAN, 0.0};
+
+    // y upwards from the top edge, which is at -cam.y
+    for (i = 0; i < numsteps; i++)
+        dst->coords[i] = (pointf){i*step, dd_add(ys[i], top).hi};
+
+    dst->deep = 1;
+}
+
+#define DOMAIN_PIXEL 2 // screen pixels per side of a domain coloring sample, the image is scaled up by the GPU
+
+// The domain coloring of the set, only one set has it at a time (see csfn_domain)
+static unsigned char* domain_pixels; // RGBA
+static double* domain_row; // the arguments and values of a row of pixels
+static unsigned domain_w, domain_h;
+static _Bool domain_fresh; // the pixels changed since they were uploaded
+static GPU_Image* domain_image;
+
+// The argument of re+im in turns (0 .. 1), the arctangent in the first octant is approximated by
+// pi/4*t + 0.273*t*(1-t) (within 0.004 radians), atan2 would cost more than most formulas
+static double turns(double re, double im) {
+    const double ax = fabs(re), ay = fabs(im);
+    double t = ax > ay ? ay/ax : ax/ay;
+    if (isnan(t)) t = ax == ay && ax != 0.0 ? 1.0 : 0.0; // 0/0 and inf/inf
+
+    double a = t*(0.125 + 0.0434496*(1.0-t));
+    if (ay > ax) a = 0.25 - a;
+    if (re < 0.0) a = 0.5 - a;
+    if (im < 0.0) a = 1.0 - a;
+    return a;
+}
+
+// The color of a complex value, the hue is its argument (red on the positive real axis) and the lightness
+// grows with its modulus (black at the zeros, white at the poles), undefined values are transparent
+static void domain_color(unsigned char* px, double re, double im) {
+    if (isnan(re) || isnan(im)) {
+        px[0] = px[1] = px[2] = px[3] = 0;
+        return;
+    }
+
+    const double mod = sqrt(re*re + im*im);
+    const double l = isinf(mod) ? 1.0 : mod/(mod+1.0);
+
+    // HSL with full saturation, the hue is split into six sectors
+    const double h = turns(re, im)*6.0;
+    const int sector = (int)h % 6;
+    const double f = h - (int)h;
+    const double c = 1.0 - fabs(2.0*l - 1.0), m = l - c/2.0;
+    const double x = c*(sector & 1 ? 1.0-f : f);
+
+    double rgb[3];
+    switch (sector) {
+        case 0 : rgb[0] = c; rgb[1] = x; rgb[2] = 0; break;
+        case 1 : rgb[0] = x; rgb[1] = c; rgb[2] = 0; break;
+        case 2 : rgb[0] = 0; rgb[1] = c; rgb[2] = x; break;
+        case 3 : rgb[0] = 0; rgb[1] = x; rgb[2] = c; break;
+        case 4 : rgb[0] = x; rgb[1] = 0; rgb[2] = c; break;
+        default: rgb[0] = c; rgb[1] = 0; rgb[2] = x; break;
+    }
+
+    for (int k = 0; k < 3; k++) px[k] = (unsigned char)((rgb[k]+m)*255.0 + 0.5);
+    px[3] = 255;
+}
+
+// Computes the formula of complex numbers over the camera, a row of the image at a time
+static void domain_graph(set_s* s) {
+    const unsigned w = (settings.WIDTH+DOMAIN_PIXEL-1)/DOMAIN_PIXEL, h = (settings.HEIGHT+DOMAIN_PIXEL-1)/DOMAIN_PIXEL;
+    if (w != domain_w || h != domain_h) {
+        free(domain_pixels);
+        free(domain_row);
+        domain_pixels = malloc(4*w*h);
+        domain_row = malloc(4*w*sizeof(double));
+        domain_w = w;
+        domain_h = h;
+    }
+
+    const double pw = cam.w*DOMAIN_PIXEL/settings.WIDTH, ph = cam.h*DOMAIN_PIXEL/settings.HEIGHT;
+    double *xre = domain_row, *xim = xre+w, *yre = xre+2*w, *yim = xre+3*w;
+
+    for (unsigned i = 0; i < w; i++) xre[i] = cam.x + (i+0.5)*pw;
+
+    for (unsigned j = 0; j < h; j++) {
+        const double y = -(cam.y + (j+0.5)*ph); // see WORLD2CAMCART
+        for (unsigned i = 0; i < w; i++) xim[i] = y;
+
+        if (ERROR_FAIL(compute_batch_complex(&s->formula, xre, xim, yre, yim, w)))
+            for (unsigned i = 0; i < w; i++) yre[i] = NAN;
+
+        for (unsigned i = 0; i < w; i++)
+            domain_color(domain_pixels + 4*(j*w+i), yre[i], yim[i]);
+    }
+
+    samples_computed += w*h;
+    domain_fresh = 1;
+}
+
+static void plot_domain(GPU_Target* target) {
+    if (domain_pixels == NULL) return;
+
+    if (domain_fresh) {
+        if (domain_image == NULL || domain_image->w != domain_w || domain_image->h != domain_h) {
+            if (domain_image != NULL) GPU_FreeImage(domain_image);
+            domain_image = GPU_CreateImage(domain_w, domain_h, GPU_FORMAT_RGBA);
+            if (domain_image == NULL) return;
+        }
+
+        GPU_UpdateImageBytes(domain_image, NULL, domain_pixels, 4*domain_w);
+        domain_fresh = 0;
     }
 
+    GPU_Rect screen = {0, 0, (float)domain_w*DOMAIN_PIXEL, (float)domain_h*DOMAIN_PIXEL};
+    GPU_BlitRect(domain_image, NULL, target, &screen);
+}
+
+// Everything the coordinates of a set depend on besides its formula
+typedef struct view_s {
+    double start, end, top, height; // the camera, because of the culling
+    double start_lo, top_lo; // the double-double camera position, see zoom_deep
+    unsigned numsteps, screen, width;
+    unsigned generation;
+    _Bool adaptive, stepping, fastmath, kahan;
+    int complex_part;
+} view_s;
+
+static view_s last_view;
+
+static _Bool view_equal(const view_s* a, const view_s* b) {
+    return a->start == b->start && a->end == b->end && a->top == b->top && a->height == b->height && a->start_lo == b->start_lo && a->top_lo == b->top_lo &&
+        a->numsteps == b->numsteps && a->screen == b->screen && a->width == b->width && a->generation == b->generation &&
+        a->adaptive == b->adaptive && a->stepping == b->stepping && a->fastmath == b->fastmath && a->kahan == b->kahan &&
+        a->complex_part == b->complex_part;
+}
+
+// Calls a function which can give something else every time (or the formula is broken right now),
+// such a set is computed every frame
+static _Bool formula_volatile(const formula_s* formula, unsigned depth) {
+    if (formula->code == NULL || depth > 16) return 1;
+
+    for (const instr* in = formula->code; in < formula->code+formula->numcode; in++)
+        switch (in->op) {
+            case OC_CFUNC : case OC_CALL :
+                if (!(in->flags & IF_PURE)) return 1;
+            break;
+            case OC_FUNC :
+                if (formula_volatile(in->func, depth+1)) return 1;
+            break;
+            case OC_RAND : return 1;
+            default : break;
+        }
+
+    return 0;
+}
+
+void graph_all(double start, double end, unsigned numsteps) {
+    samples_computed = samples_culled = samples_stepped = samples_deep = sets_reused = 0;
+
+    view_s view = {start, end, cam.y, cam.h, cam_lo.x, cam_lo.y, numsteps, settings.HEIGHT, settings.WIDTH, object_generation,
+        settings.adaptive, settings.stepping, settings.fastmath, settings.kahan, settings.complex_part};
+    const _Bool moved = !view_equal(&view, &last_view);
+    last_view = view;
+
+    // only the sets whose variables were modified (or which are volatile) are computed again
+    _Bool any = 0;
+    for (set_s* s = set_first; s != NULL; s = s->next) {
+        if (s->plot_type != PT_FUNCTION) continue;
+
+        s->dirty |= moved || formula_volatile(&s->formula, 0);
+        any |= s->dirty;
+        if (!s->dirty) sets_reused++;
+    }
+
+    if (!any) return;
+
+    // the domain coloring covers the whole screen, the DAG and the rest of graph_all only know curves
+    for (set_s* s = set_first; s != NULL; s = s->next)
+        if (s->plot_type == PT_FUNCTION && s->domain && s->dirty) {
+            domain_graph(s);
+            s->dirty = 0;
+        }
+
+    // zoomed in this deep the graphs are uniform and computed one by one, the DAG and the culling work in double,
+    // the complex graphs are only computed in double
+    const _Bool complex_graphs = settings.complex_part != CP_OFF;
+    const _Bool deep = !complex_graphs && zoom_deep();
+
+    // the DAG needs the same x for every set
+    if (!deep && !complex_graphs && !settings.adaptive && dag_worth()) {
+        dag_graph(start, end, numsteps);
+        sets_reused = 0;
+
+        for (set_s* s = set_first; s != NULL; s = s->next)
+            s->dirty = 0;
+        return;
+    }
+
+    for (set_s* s = set_first; s != NULL; s = s->next)
+        if (s->plot_type == PT_FUNCTION && s->dirty) {
+            if (deep) graph_deep(numsteps, s);
+            else graph(start, end, numsteps, s);
+            s->dirty = 0;
+        }
+}
+
+// the data sets are drawn straight from their columns, nothing gets copied
+static inline pointf set_point(const set_s* s, size_t i) {
+    return s->xs != NULL ? (pointf){s->xs->data[i], s->ys->data[i]} : s->coords[i];
 }
 
 void plot(GPU_Target* target, set_s* s) {
-    if (s == NULL || !s->shown || s->length < 2) return;
+    if (s == NULL || !s->shown) return;
+
+    if (s->plot_type == PT_FUNCTION && s->domain) {
+        plot_domain(target);
+        return;
+    }
+
+    if (s->length < 2) return;
 
     GPU_SetLineThickness((float)s->linewidth);
 
     pointi curr, last; // save the last point so we dont have to calculate the same point again
-    last = WORLD2CAMCART(s->coords[0]);
+    last = s->deep ? WORLD2CAMCART_DEEP(set_point(s, 0)) : WORLD2CAMCART(set_point(s, 0));
     for (size_t i = 1; i < s->length; i++) {
+        const pointf p = set_point(s, i);
         
-        if (isnan(s->coords[i].y))
+        if (isnan(p.y))
             continue;
 
-        curr = WORLD2CAMCART(s->coords[i]);
+        curr = s->deep ? WORLD2CAMCART_DEEP(p) : WORLD2CAMCART(p);
 
         // Draw the point
         if (s->linewidth == 1)
@@ -51,3 +498,11 @@ void plot(GPU_Target* target, set_s* s) {
         last = curr;
     }
 }
+
+void graph_stats(size_t* computed, size_t* culled, size_t* stepped, size_t* deep, size_t* reused) {
+    *computed = samples_computed;
+    *stepped = samples_stepped;
+    *deep = samples_deep;
+    *culled = samples_culled;
+    *reused = sets_reused;
+}
@@ -7,11 +7,14 @@
 #include "error.h"
 
 #include "plot.h" // plotting
+#include "parser.h" // eval_allocations
 #include "console.h" // settings
+#include "ddouble.h" // the camera position
 
 #include <ctype.h> // isdigit
 #include <pthread.h> // mutex
 #include <math.h> // fmod
+#include <float.h> // DBL_EPSILON
 #include <string.h> // memmove
 
 static GPU_Target *target;
@@ -20,7 +23,16 @@ static SDL_Window *win;
 static font_s font;
 
 rectf cam;
+rectf cam_lo;
 pthread_mutex_t renderer_mutex;
+unsigned long frame_allocations;
+
+void cam_move(double dx, double dy) {
+    const ddouble x = dd_add_d((ddouble){cam.x, cam_lo.x}, dx), y = dd_add_d((ddouble){cam.y, cam_lo.y}, dy);
+
+    cam.x = x.hi; cam_lo.x = x.lo;
+    cam.y = y.hi; cam_lo.y = y.lo;
+}
 
 static uint8_t *key_state, *key_state_last;
 static unsigned num_keys;
@@ -121,10 +133,10 @@ int window_update() {
     pthread_mutex_lock(&renderer_mutex);
 
     if (!KEY_HOLD(SDL_SCANCODE_LCTRL)) {
-        if (KEY_HOLD(SDL_SCANCODE_LEFT))  cam.x -= settings.cam_movespeed*cam.w/5.0;
-        if (KEY_HOLD(SDL_SCANCODE_RIGHT)) cam.x += settings.cam_movespeed*cam.w/5.0;
-        if (KEY_HOLD(SDL_SCANCODE_UP))    cam.y -= settings.cam_movespeed*cam.h/5.0;
-        if (KEY_HOLD(SDL_SCANCODE_DOWN))  cam.y += settings.cam_movespeed*cam.h/5.0;
+        if (KEY_HOLD(SDL_SCANCODE_LEFT))  cam_move(-settings.cam_movespeed*cam.w/5.0, 0.0);
+        if (KEY_HOLD(SDL_SCANCODE_RIGHT)) cam_move(settings.cam_movespeed*cam.w/5.0, 0.0);
+        if (KEY_HOLD(SDL_SCANCODE_UP))    cam_move(0.0, -settings.cam_movespeed*cam.h/5.0);
+        if (KEY_HOLD(SDL_SCANCODE_DOWN))  cam_move(0.0, settings.cam_movespeed*cam.h/5.0);
     } else {
         rectf prevcam = cam;
 
@@ -144,8 +156,7 @@ int window_update() {
             cam.h*=settings.cam_scalespeed;
         }
 
-        cam.x+=(prevcam.w-cam.w)/2;
-        cam.y+=(prevcam.h-cam.h)/2;
+        cam_move((prevcam.w-cam.w)/2, (prevcam.h-cam.h)/2);
     }
 
     pthread_mutex_unlock(&renderer_mutex);
@@ -175,7 +186,11 @@ int window_draw() {
         pointf p = (pointf){cam.x-fmod(cam.x, step.x), 
                             cam.y-fmod(cam.y, step.y)};
         pointi pcam = {0};
-        while (p.x <= cam.x+cam.w || p.y <= cam.y+cam.h) {
+
+        // zoomed in deeper than doubles go, p wouldn't move anymore (only the graphs are double-double)
+        const _Bool griddable = step.x > 4*DBL_EPSILON*(fabs(cam.x)+cam.w) && step.y > 4*DBL_EPSILON*(fabs(cam.y)+cam.h);
+
+        while (griddable && (p.x <= cam.x+cam.w || p.y <= cam.y+cam.h)) {
             pcam = WORLD2CAM(p);
 
             SDL_Color coldarker = COLDARKER1(settings.col_grid);
@@ -207,12 +222,12 @@ int window_draw() {
         const float char_scale = 0.25;
         const pointi char_size = {font.char_w*char_scale, font.char_h*char_scale};
 
-        while (p.x <= cam.x+cam.w || p.y <= cam.y+cam.h) {
+        while (griddable && (p.x <= cam.x+cam.w || p.y <= cam.y+cam.h)) {
             pcam = WORLD2CAM(p);
 
             // Draw numbers
             if ((long)abs(round(p.x/step.x)) % numstep.x == 0) {
-                sprintf(nums, "%.*f", wlog > 0.0 ? 0 : abs((int)floor(wlog)), p.x);
+                snprintf(nums, sizeof(nums), "%.*f", wlog > 0.0 ? 0 : abs((int)floor(wlog)), p.x);
                 if (atof(nums) == 0.0 && nums[0] == '-') { // this sometimes "bugs out" producing -0.0
                     memmove(nums, nums+1, 19);
                 }
@@ -227,7 +242,8 @@ int window_draw() {
 
             if ((long)abs(round(p.y/step.y)) % numstep.y == 0) {
                 // sprintf returns the number of characters
-                int chars = sprintf(nums, "%.*f", hlog > 0.0 ? 0 : abs((int)floor(hlog)), -p.y);
+                int chars = snprintf(nums, sizeof(nums), "%.*f", hlog > 0.0 ? 0 : abs((int)floor(hlog)), -p.y);
+                if (chars >= (int)sizeof(nums)) chars = sizeof(nums)-1;
 
                 if (atof(nums) != 0.0) { // we dont want 0's to overlap
 
@@ -253,14 +269,15 @@ int window_draw() {
 
     //Graph and plot all sets
     pthread_mutex_lock(&renderer_mutex);
-    for (set_s* s = set_first; s != NULL; s = s->next) {
+    unsigned long allocations = eval_allocations;
 
-        if (s->plot_type == PT_FUNCTION)
-            //graph(cam.x, cam.x+cam.w, settings.WIDTH/4, s);
-            graph(cam.x, cam.x+cam.w, SET_MAXLENGTH, s);
+    //graph_all(cam.x, cam.x+cam.w, settings.WIDTH/4);
+    graph_all(cam.x, cam.x+cam.w, SET_MAXLENGTH);
 
+    for (set_s* s = set_first; s != NULL; s = s->next)
         plot(target, s);
-    }
+
+    frame_allocations = eval_allocations-allocations;
     pthread_mutex_unlock(&renderer_mutex);
 
     GPU_Flip(target);
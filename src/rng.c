@@ -0,0 +1,141 @@
+#include "rng.h"
+#include "vmath.h"
+
+#include <string.h> // memcpy
+
+#define RNG_BLOCK 256 // the bits are generated this many at a time, a multiple of RNG_LANES
+#define RNG_PAIRS 128 // Box-Muller turns this many pairs of uniform draws into normal ones at a time
+#define RNG_DEFAULT_SEED 0x5EEDULL
+
+#define TWO_PI 6.283185307179586
+
+typedef struct rng_state {
+    unsigned long long s[4][RNG_LANES]; // the four words of xoshiro, every lane on its own
+    unsigned generation; // of the seed the state comes from
+    unsigned long long stream;
+    _Bool started;
+} rng_state;
+
+static _Thread_local rng_state state;
+
+static _Atomic unsigned long long global_seed = RNG_DEFAULT_SEED;
+static _Atomic unsigned generation = 0;
+static _Atomic unsigned long long streams = 0; // the threads that have drawn something so far
+
+// splitmix64, it only spreads the seeds over the whole state
+static unsigned long long splitmix(unsigned long long* x) {
+    unsigned long long z = (*x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+void rng_seed(unsigned long long seed, unsigned long long stream) {
+    unsigned long long x = stream;
+    x = seed ^ splitmix(&x);
+
+    for (int w = 0; w < 4; w++)
+        for (int j = 0; j < RNG_LANES; j++)
+            state.s[w][j] = splitmix(&x);
+
+    state.generation = generation;
+    state.started = 1;
+}
+
+void rng_reseed(unsigned long long seed) {
+    global_seed = seed;
+    generation++;
+}
+
+// a thread gets its stream with the first draw and keeps it, "set seed" only restarts it
+static rng_state* current() {
+    if (!state.started) state.stream = streams++;
+    if (!state.started || state.generation != generation)
+        rng_seed(global_seed, state.stream);
+
+    return &state;
+}
+
+static inline unsigned long long rotl(unsigned long long x, int k) {
+    return (x << k) | (x >> (64-k));
+}
+
+// n is a multiple of RNG_LANES, out[i] comes from the lane i % RNG_LANES
+static void fill_bits(unsigned long long* out, size_t n) {
+    rng_state* st = current();
+
+    // the lanes are independent, one step of all of them is a handful of vector instructions
+    unsigned long long s0[RNG_LANES], s1[RNG_LANES], s2[RNG_LANES], s3[RNG_LANES];
+    memcpy(s0, st->s[0], sizeof(s0));
+    memcpy(s1, st->s[1], sizeof(s1));
+    memcpy(s2, st->s[2], sizeof(s2));
+    memcpy(s3, st->s[3], sizeof(s3));
+
+    for (size_t i = 0; i < n; i += RNG_LANES)
+        for (int j = 0; j < RNG_LANES; j++) {
+            out[i+j] = s0[j] + s3[j];
+
+            const unsigned long long t = s1[j] << 17;
+            s2[j] ^= s0[j];
+            s3[j] ^= s1[j];
+            s1[j] ^= s2[j];
+            s0[j] ^= s3[j];
+            s2[j] ^= t;
+            s3[j] = rotl(s3[j], 45);
+        }
+
+    memcpy(st->s[0], s0, sizeof(s0));
+    memcpy(st->s[1], s1, sizeof(s1));
+    memcpy(st->s[2], s2, sizeof(s2));
+    memcpy(st->s[3], s3, sizeof(s3));
+}
+
+void rng_uniform(double* out, size_t n) {
+    unsigned long long bits[RNG_BLOCK];
+
+    for (size_t done = 0; done < n; done += RNG_BLOCK) {
+        const size_t m = n-done < RNG_BLOCK ? n-done : RNG_BLOCK;
+        fill_bits(bits, (m+RNG_LANES-1)/RNG_LANES*RNG_LANES); // the lanes left over are dropped
+
+        // the top 52 bits as the mantissa of a number from [1, 2), no integer conversion needed
+        for (size_t i = 0; i < m; i++) {
+            const unsigned long long one = (bits[i] >> 12) | 0x3FF0000000000000ULL;
+            double d;
+            memcpy(&d, &one, sizeof(d));
+            out[done+i] = d - 1.0;
+        }
+    }
+}
+
+void rng_normal(double* out, size_t n) {
+    double r[RNG_PAIRS], t[RNG_PAIRS], c[RNG_PAIRS];
+
+    for (size_t done = 0; done < n; done += 2*RNG_PAIRS) {
+        const size_t m = n-done < 2*RNG_PAIRS ? n-done : 2*RNG_PAIRS, pairs = (m+1)/2;
+        rng_uniform(r, pairs);
+        rng_uniform(t, pairs);
+
+        // the radius sqrt(-2 log u) (1-u is never 0) and the angle 2 PI u
+        for (size_t i = 0; i < pairs; i++) {
+            r[i] = 1.0 - r[i];
+            t[i] *= TWO_PI;
+        }
+
+        vm_log(r, r, pairs);
+        for (size_t i = 0; i < pairs; i++) r[i] *= -2.0;
+        vm_sqrt(r, r, pairs);
+
+        vm_cos(t, c, pairs);
+        vm_sin(t, t, pairs);
+
+        // both coordinates of every pair are used, the last sine is dropped when m is odd
+        for (size_t i = 0; i < pairs; i++) out[done+i] = r[i]*c[i];
+        for (size_t i = 0; i < m-pairs; i++) out[done+pairs+i] = r[i]*t[i];
+    }
+}
+
+unsigned long long rng_bits() {
+    unsigned long long bits[RNG_LANES];
+    fill_bits(bits, RNG_LANES);
+    return bits[0];
+}
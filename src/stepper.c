@@ -0,0 +1,347 @@
+#include "stepper.h"
+#include "compiler.h"
+#include "parser.h" // batch_instr, call_batch
+#include "simd.h"
+#include "eval.h" // the plan of the context
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define STEP_MAXSTREAMS 16
+#define STEP_MAXDEGREE 4 // the forward differences of higher degrees lose too many digits between the anchors
+
+// A subexpression computed by a recurrence instead of its instructions
+typedef struct stream_s {
+    enum { SK_SIN, SK_COS, SK_EXP, SK_POLY } kind;
+    double a, b; // the argument is a + b*x
+    double base; // SK_EXP
+    poly_s poly; // SK_POLY
+
+    // cos(j*d) and sin(j*d) (base^(j*d) in rot[0] for SK_EXP), d is the step of the argument
+    double rot[2][STEP_ANCHOR];
+} stream_s;
+
+typedef struct step_s {
+    instr in;
+    int stream; // the value comes from this stream, -1 for the instructions
+} step_s;
+
+// What the bytecode computes up to an instruction, tracked while planning
+typedef struct shape_s {
+    enum { SH_CONST, SH_AFFINE, SH_OTHER } kind;
+    double a, b; // the value is a + b*x (b is 0 for the constants)
+    size_t first; // where the code of the subexpression starts in the program
+} shape_s;
+
+// The plan only lives for one graph, the arrays are kept for the next one,
+// every evaluation context plans its own graphs
+typedef struct stepper_s {
+    stream_s streams[STEP_MAXSTREAMS];
+    size_t numstreams;
+
+    step_s* prog;
+    size_t numprog, capprog;
+
+    shape_s* shapes;
+    double* stack;
+    size_t capdepth;
+
+    double grid_start, grid_step;
+} stepper_s;
+
+// the plan of the current context, made by the first graph it steps
+static stepper_s* current() {
+    eval_ctx* ctx = eval_current();
+    if (ctx->stepper == NULL) {
+        ctx->stepper = calloc(1, sizeof(stepper_s));
+        eval_allocations++;
+    }
+
+    return ctx->stepper;
+}
+
+void stepper_free(stepper_s* plan) {
+    if (plan == NULL) return;
+
+    free(plan->prog);
+    free(plan->shapes);
+    free(plan->stack);
+    free(plan);
+}
+
+// ------- PLANNING ---------
+
+// The formula ends up with the same stack depth, it just doesn't use all of it
+static void reserve(stepper_s* plan, size_t numcode, size_t depth) {
+    if (plan->capprog < numcode) {
+        free(plan->prog);
+        plan->capprog = numcode;
+        plan->prog = malloc(plan->capprog*sizeof(step_s));
+        eval_allocations++;
+    }
+
+    if (plan->capdepth < depth) {
+        free(plan->shapes);
+        free(plan->stack);
+        plan->capdepth = depth;
+        plan->shapes = malloc(plan->capdepth*sizeof(shape_s));
+        plan->stack = malloc(plan->capdepth*BATCH_LANES*sizeof(double));
+        eval_allocations += 2;
+    }
+}
+
+// Replaces the code of the subexpression (everything from its first instruction) by a new stream
+static void stream_add(stepper_s* plan, stream_s stream, shape_s* sh) {
+    sh->kind = SH_OTHER;
+    if (plan->numstreams == STEP_MAXSTREAMS) return;
+
+    const double d = stream.b*plan->grid_step;
+    for (size_t j = 0; j < STEP_ANCHOR; j++) {
+        if (stream.kind == SK_EXP)
+            stream.rot[0][j] = pow(stream.base, j*d);
+        else {
+            stream.rot[0][j] = cos(j*d);
+            stream.rot[1][j] = sin(j*d);
+        }
+    }
+
+    plan->numprog = sh->first;
+    plan->prog[plan->numprog++] = (step_s){.stream = plan->numstreams};
+    plan->streams[plan->numstreams++] = stream;
+}
+
+// The rotations and the scaling cost two operations per sample, the differences
+// about as much as Horner's scheme of half the degree (they can't be vectorized, but they are independent)
+static unsigned step_cost(const stepper_s* plan, const step_s* st) {
+    if (st->stream < 0) return instr_cost(&st->in);
+
+    const stream_s* s = &plan->streams[st->stream];
+    return s->kind == SK_POLY ? (s->poly.degree+1)/2 : 2;
+}
+
+error_t stepper_plan(formula_s* formula, double start, double step) {
+    stepper_s* plan = current();
+
+    if (ERROR_FAIL(formula_prepare(formula, 1)) || formula->numcode == 0)
+        return ERROR_CODE_FAIL;
+
+    // the compiled kernel is what the user asked for
+    if (formula->native != NULL || !isfinite(start) || !isfinite(step))
+        return ERROR_CODE_FAIL;
+
+    // the terms of a sum are computed once for every index and the draws have nothing to step,
+    // the plan can't follow either
+    for (size_t i = 0; i < formula->numcode; i++)
+        if (formula->code[i].op == OC_SERIES || formula->code[i].op == OC_RAND || formula->code[i].op == OC_ARRAY) return ERROR_CODE_FAIL;
+
+    reserve(plan, formula->numcode, formula->depth);
+    plan->grid_start = start;
+    plan->grid_step = step;
+    plan->numprog = plan->numstreams = 0;
+
+    shape_s* top = plan->shapes;
+
+    for (const instr* in = formula->code; in < formula->code+formula->numcode; in++) {
+        shape_s* a = top-2; // left operand
+        shape_s* b = top-1; // right operand (or the only one)
+        const size_t first = plan->numprog;
+        plan->prog[plan->numprog++] = (step_s){*in, -1};
+
+        switch (in->op) {
+            case OC_NUM : *top++ = (shape_s){SH_CONST, in->num, 0.0, first}; break;
+            case OC_VAR : *top++ = (shape_s){SH_CONST, *in->val, 0.0, first}; break; // can't change while graphing
+            case OC_X   : *top++ = (shape_s){SH_AFFINE, 0.0, 1.0, first}; break;
+            case OC_I   : *top++ = (shape_s){SH_OTHER, 0.0, 0.0, first}; break;
+
+            case OC_ADD : case OC_SUB : case OC_MULT : case OC_DIV : case OC_MOD : case OC_POW : case OC_CMP : {
+                const _Bool linear = a->kind != SH_OTHER && b->kind != SH_OTHER;
+                shape_s res = {SH_OTHER, 0.0, 0.0, a->first};
+
+                if (linear && in->op == OC_ADD) res = (shape_s){SH_AFFINE, a->a + b->a, a->b + b->b, a->first};
+                else if (linear && in->op == OC_SUB) res = (shape_s){SH_AFFINE, a->a - b->a, a->b - b->b, a->first};
+                else if (linear && in->op == OC_MULT && a->kind == SH_CONST) res = (shape_s){SH_AFFINE, a->a*b->a, a->a*b->b, a->first};
+                else if (linear && in->op == OC_MULT && b->kind == SH_CONST) res = (shape_s){SH_AFFINE, a->a*b->a, a->b*b->a, a->first};
+                else if (linear && in->op == OC_DIV && b->kind == SH_CONST && b->a != 0.0) res = (shape_s){SH_AFFINE, a->a/b->a, a->b/b->a, a->first};
+                else if (linear && in->op == OC_POW && a->kind == SH_CONST && a->a > 0.0 && b->kind == SH_AFFINE)
+                    stream_add(plan, (stream_s){.kind = SK_EXP, .a = b->a, .b = b->b, .base = a->a}, &res);
+
+                // constants stay constants, affine only means a + b*x could have any b
+                if (res.kind == SH_AFFINE && a->kind == SH_CONST && b->kind == SH_CONST) res.kind = SH_CONST;
+
+                top--;
+                top[-1] = res;
+            } break;
+
+            case OC_NEG :
+                if (b->kind != SH_OTHER) { b->a = -b->a; b->b = -b->b; }
+            break;
+
+            case OC_CFUNC :
+                if (b->kind == SH_AFFINE && (in->call->func == sin || in->call->func == cos))
+                    stream_add(plan, (stream_s){.kind = in->call->func == sin ? SK_SIN : SK_COS, .a = b->a, .b = b->b}, b);
+                else
+                    b->kind = SH_OTHER;
+            break;
+
+            case OC_POWI : case OC_POLY : {
+                // negative powers aren't polynomials
+                const _Bool fits = in->op == OC_POLY || in->num >= 2.0;
+                const unsigned degree = in->op == OC_POLY ? in->poly->degree : fits ? (unsigned)in->num : 0;
+
+                if (b->kind == SH_AFFINE && fits && degree <= STEP_MAXDEGREE) {
+                    stream_s stream = {.kind = SK_POLY, .a = b->a, .b = b->b};
+                    if (in->op == OC_POLY) stream.poly = *in->poly;
+                    else stream.poly.coeffs[stream.poly.degree = degree] = 1.0;
+
+                    stream_add(plan, stream, b);
+                } else
+                    b->kind = SH_OTHER;
+            } break;
+
+            case OC_CALL : case OC_SELECT :
+                top -= (in->op == OC_CALL ? in->call->arity : 3)-1;
+                top[-1] = (shape_s){SH_OTHER, 0.0, 0.0, top[-1].first};
+            break;
+
+            default : b->kind = SH_OTHER; break;
+        }
+    }
+
+    if (plan->numstreams == 0) return ERROR_CODE_FAIL;
+
+    unsigned full = 0, stepped = 0;
+    for (size_t i = 0; i < formula->numcode; i++) full += instr_cost(&formula->code[i]);
+    for (size_t i = 0; i < plan->numprog; i++) stepped += step_cost(plan, &plan->prog[i]);
+
+    // the program is interpreted, so it has to save more when the formula runs natively
+    return (formula->jit != NULL ? stepped*2 < full : stepped < full) ? ERROR_CODE_OK : ERROR_CODE_FAIL;
+}
+
+// ------- EVALUATION ---------
+
+// dst = p*c + q*s
+static void rotate(double* dst, double p, const double* c, double q, const double* s, size_t m) {
+    size_t i = 0;
+    const simd_d vp = SIMD_SET1(p), vq = SIMD_SET1(q);
+    for (; i+SIMD_LANES <= m; i += SIMD_LANES)
+        SIMD_STORE(dst+i, SIMD_ADD(SIMD_MUL(vp, SIMD_LOAD(c+i)), SIMD_MUL(vq, SIMD_LOAD(s+i))));
+    for (; i < m; i++) dst[i] = p*c[i] + q*s[i];
+}
+
+// The forward differences of the polynomial from its values at u, u+h ... u+degree*h,
+// then every sample is just degree additions
+static void differences(double* dst, const poly_s* poly, double u, double h, size_t skip, size_t m) {
+    const unsigned n = poly->degree;
+    double diff[STEP_MAXDEGREE+1];
+
+    _Bool finite = 1;
+    for (unsigned k = 0; k <= n; k++)
+        finite &= isfinite(diff[k] = poly_eval(poly, u + k*h));
+
+    // the differences of infinities are NaN, these are left to the full evaluation
+    if (!finite) {
+        for (size_t i = 0; i < m; i++) dst[i] = poly_eval(poly, u + (skip+i)*h);
+        return;
+    }
+
+    for (unsigned lvl = 1; lvl <= n; lvl++)
+        for (unsigned k = n; k >= lvl; k--)
+            diff[k] -= diff[k-1];
+
+    // the missing degrees have zero differences, so the loop doesn't depend on the degree
+    double d0 = diff[0], d1 = diff[1], d2 = n >= 2 ? diff[2] : 0.0, d3 = n >= 3 ? diff[3] : 0.0, d4 = n >= 4 ? diff[4] : 0.0;
+    for (size_t i = 0; i < skip; i++) {
+        d0 += d1; d1 += d2; d2 += d3; d3 += d4;
+    }
+
+    for (size_t i = 0; i < m; i++) {
+        dst[i] = d0;
+        d0 += d1; d1 += d2; d2 += d3; d3 += d4;
+    }
+}
+
+// Computes the stream for the samples first ... first+m-1, anchored at every multiple of STEP_ANCHOR,
+// so a sample doesn't depend on where the run it is computed in starts
+static void stream_fill(const stepper_s* plan, const stream_s* s, double* dst, size_t first, size_t m) {
+    for (size_t i = 0; i < m; ) {
+        const size_t skip = (first+i) % STEP_ANCHOR, anchor = first+i-skip;
+        const size_t count = STEP_ANCHOR-skip < m-i ? STEP_ANCHOR-skip : m-i;
+        const double u = s->a + s->b*(plan->grid_start + anchor*plan->grid_step);
+
+        switch (s->kind) {
+            case SK_SIN : rotate(dst+i, sin(u), s->rot[0]+skip, cos(u), s->rot[1]+skip, count); break;
+            case SK_COS : rotate(dst+i, cos(u), s->rot[0]+skip, -sin(u), s->rot[1]+skip, count); break;
+            case SK_EXP : {
+                const double scale = pow(s->base, u);
+
+                // an underflow or overflow at the anchor doesn't have to happen at the rest of the samples
+                if (isnormal(scale)) for (size_t j = 0; j < count; j++) dst[i+j] = scale*s->rot[0][skip+j];
+                else for (size_t j = 0; j < count; j++) dst[i+j] = pow(s->base, s->a + s->b*(plan->grid_start + (first+i+j)*plan->grid_step));
+            } break;
+            case SK_POLY : differences(dst+i, &s->poly, u, s->b*plan->grid_step, skip, count); break;
+        }
+
+        i += count;
+    }
+}
+
+// batch_block with the streams in place of the code they replaced
+static error_t step_block(const stepper_s* plan, const double* xs, double* ys, size_t first, size_t m) {
+    double* top = plan->stack; // the first free slot
+
+    for (const step_s* st = plan->prog; st < plan->prog+plan->numprog; st++) {
+        const instr* in = &st->in;
+        double* a = top-2*m; // left operand
+        double* b = top-m; // right operand (or the only one)
+
+        if (st->stream >= 0) {
+            stream_fill(plan, &plan->streams[st->stream], top, first, m);
+            top += m;
+            continue;
+        }
+
+        switch (in->op) {
+            case OC_NUM : case OC_X : case OC_VAR : case OC_I :
+                if (ERROR_FAIL(batch_instr(in, top, NULL, NULL, xs, m)))
+                    return ERROR_CODE_FAIL;
+                top += m;
+            break;
+            case OC_NEG : case OC_POWI : case OC_CFUNC : case OC_FUNC : case OC_POLY :
+                if (ERROR_FAIL(batch_instr(in, b, NULL, b, xs, m)))
+                    return ERROR_CODE_FAIL;
+            break;
+            case OC_CALL : {
+                double* args = top-in->call->arity*m;
+                call_batch(in->call, args, args, m);
+                top = args+m;
+            } break;
+            case OC_SELECT : {
+                double* args = top-3*m;
+                batch_select(args, args, args+m, args+2*m, m);
+                top = args+m;
+            } break;
+            default :
+                if (ERROR_FAIL(batch_instr(in, a, a, b, xs, m)))
+                    return ERROR_CODE_FAIL;
+                top -= m;
+            break;
+        }
+    }
+
+    memcpy(ys, plan->stack, m*sizeof(double));
+    return ERROR_CODE_OK;
+}
+
+error_t stepper_batch(const double* xs, double* ys, size_t first, size_t n) {
+    const stepper_s* plan = current();
+
+    for (size_t done = 0; done < n; done += BATCH_LANES) {
+        size_t m = n-done < BATCH_LANES ? n-done : BATCH_LANES;
+
+        if (ERROR_FAIL(step_block(plan, xs+done, ys+done, first+done, m)))
+            return ERROR_CODE_FAIL;
+    }
+
+    return ERROR_CODE_OK;
+}
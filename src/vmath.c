@@ -0,0 +1,419 @@
+#include "vmath.h"
+#include "simd.h"
+#include "console.h" // settings
+
+#include <string.h>
+#include <math.h>
+
+// The coefficients are the ones of fdlibm (Sun Microsystems), which the libm of most systems comes from
+// https://www.netlib.org/fdlibm/
+
+#define VM_TRIG_MAX 1e5 // below that, q*pi/2 is subtracted exactly
+#define VM_EXP_MAX 708.0 // the results (and 2^k) stay normal
+#define VM_LOG_MIN 0x1p-1000
+#define VM_LOG_MAX 0x1p1000
+
+static simd_d from_bits(unsigned long long bits) {
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return SIMD_SET1(d);
+}
+
+// to the nearest integer (ties to even), only for |x| < 2^51
+static inline simd_d vm_round(simd_d x) {
+    const simd_d magic = SIMD_SET1(0x1.8p52);
+    return SIMD_SUB(SIMD_ADD(x, magic), magic);
+}
+
+// 2^n for the integers -1022 <= n <= 1023, n+1023 ends up in the lowest bits of the sum, the shift makes it the exponent
+static inline simd_d vm_pow2(simd_d n) {
+    return SIMD_SHL52(SIMD_ADD(n, SIMD_SET1(0x1p52 + 1023)));
+}
+
+// the biased exponent of positive x, the reverse of vm_pow2
+static inline simd_d vm_exponent(simd_d x) {
+    return SIMD_SUB(SIMD_OR(SIMD_SHR52(x), from_bits(0x4330000000000000ULL)), SIMD_SET1(0x1p52));
+}
+
+// floor(q/2) for the integers q, q/2-0.25 is never a tie
+static inline simd_d vm_half(simd_d q) {
+    return vm_round(SIMD_SUB(SIMD_MUL(q, SIMD_SET1(0.5)), SIMD_SET1(0.25)));
+}
+
+// ------- SINE, COSINE, TANGENT ---------
+
+// x = r + q*pi/2, |r| <= pi/4 (Cody and Waite, in three parts for exact)
+static inline simd_d trig_reduce(simd_d x, simd_d* q, _Bool fast) {
+    *q = vm_round(SIMD_MUL(x, SIMD_SET1(6.36619772367581382433e-01))); // 2/pi
+
+    simd_d r = SIMD_SUB(x, SIMD_MUL(*q, SIMD_SET1(1.57079632673412561417e+00)));
+    if (fast) return SIMD_SUB(r, SIMD_MUL(*q, SIMD_SET1(6.07710050650619224932e-11)));
+
+    r = SIMD_SUB(r, SIMD_MUL(*q, SIMD_SET1(6.07710050630396597660e-11)));
+    return SIMD_SUB(r, SIMD_MUL(*q, SIMD_SET1(2.02226624879595063154e-21)));
+}
+
+// sin and cos of |r| <= pi/4
+static inline simd_d kernel_sin(simd_d r, _Bool fast) {
+    const simd_d z = SIMD_MUL(r, r);
+    simd_d p;
+
+    if (fast) {
+        // Taylor up to r^9
+        p = SIMD_ADD(SIMD_SET1(-1.0/5040), SIMD_MUL(z, SIMD_SET1(1.0/362880)));
+        p = SIMD_ADD(SIMD_SET1(1.0/120), SIMD_MUL(z, p));
+        p = SIMD_ADD(SIMD_SET1(-1.0/6), SIMD_MUL(z, p));
+        return SIMD_ADD(r, SIMD_MUL(SIMD_MUL(z, r), p));
+    }
+
+    p = SIMD_ADD(SIMD_SET1(-2.50507602534068634195e-08), SIMD_MUL(z, SIMD_SET1(1.58969099521155010221e-10)));
+    p = SIMD_ADD(SIMD_SET1(2.75573137070700676789e-06), SIMD_MUL(z, p));
+    p = SIMD_ADD(SIMD_SET1(-1.98412698298579493134e-04), SIMD_MUL(z, p));
+    p = SIMD_ADD(SIMD_SET1(8.33333333332248946124e-03), SIMD_MUL(z, p));
+    p = SIMD_ADD(SIMD_SET1(-1.66666666666666324348e-01), SIMD_MUL(z, p));
+    return SIMD_ADD(r, SIMD_MUL(SIMD_MUL(z, r), p));
+}
+
+static inline simd_d kernel_cos(simd_d r, _Bool fast) {
+    const simd_d z = SIMD_MUL(r, r), one = SIMD_SET1(1.0);
+    const simd_d hz = SIMD_MUL(z, SIMD_SET1(0.5));
+    simd_d p;
+
+    if (fast) {
+        // Taylor up to r^8
+        p = SIMD_ADD(SIMD_SET1(-1.0/720), SIMD_MUL(z, SIMD_SET1(1.0/40320)));
+        p = SIMD_ADD(SIMD_SET1(1.0/24), SIMD_MUL(z, p));
+        return SIMD_ADD(SIMD_SUB(one, hz), SIMD_MUL(SIMD_MUL(z, z), p));
+    }
+
+    p = SIMD_ADD(SIMD_SET1(2.08757232129817482790e-09), SIMD_MUL(z, SIMD_SET1(-1.13596475577881948265e-11)));
+    p = SIMD_ADD(SIMD_SET1(-2.75573143513906633035e-07), SIMD_MUL(z, p));
+    p = SIMD_ADD(SIMD_SET1(2.48015872894767294178e-05), SIMD_MUL(z, p));
+    p = SIMD_ADD(SIMD_SET1(-1.38888888888741095749e-03), SIMD_MUL(z, p));
+    p = SIMD_ADD(SIMD_SET1(4.16666666666666019037e-02), SIMD_MUL(z, p));
+    p = SIMD_MUL(z, p);
+
+    // 1-hz rounded, the error of that is added back
+    const simd_d w = SIMD_SUB(one, hz);
+    return SIMD_ADD(w, SIMD_ADD(SIMD_SUB(SIMD_SUB(one, w), hz), SIMD_MUL(z, p)));
+}
+
+// sin(x + shift*pi/2), the quadrant picks sin or cos of r and the sign,
+// the selections are products with 0 and 1, so there are no branches
+static inline simd_d vm_sin_shifted(simd_d x, double shift, _Bool fast) {
+    simd_d q;
+    const simd_d r = trig_reduce(x, &q, fast), one = SIMD_SET1(1.0), two = SIMD_SET1(2.0);
+    q = SIMD_ADD(q, SIMD_SET1(shift));
+
+    const simd_d half = vm_half(q);
+    const simd_d odd = SIMD_SUB(q, SIMD_MUL(two, half)); // q mod 2
+    const simd_d neg = SIMD_SUB(half, SIMD_MUL(two, vm_half(half))); // q mod 4 >= 2
+
+    const simd_d res = SIMD_ADD(SIMD_MUL(kernel_sin(r, fast), SIMD_SUB(one, odd)), SIMD_MUL(kernel_cos(r, fast), odd));
+    return SIMD_MUL(res, SIMD_SUB(one, SIMD_MUL(two, neg)));
+}
+
+static inline simd_d kernel_vsin(simd_d x, _Bool fast) { return vm_sin_shifted(x, 0.0, fast); }
+static inline simd_d kernel_vcos(simd_d x, _Bool fast) { return vm_sin_shifted(x, 1.0, fast); }
+
+// tan(r + q*pi/2) is tan(r) for even q and -cot(r) for odd q
+static inline simd_d kernel_vtan(simd_d x, _Bool fast) {
+    simd_d q;
+    const simd_d r = trig_reduce(x, &q, fast), one = SIMD_SET1(1.0);
+    const simd_d odd = SIMD_SUB(q, SIMD_MUL(SIMD_SET1(2.0), vm_half(q))), even = SIMD_SUB(one, odd);
+    const simd_d s = kernel_sin(r, fast), c = kernel_cos(r, fast);
+
+    return SIMD_DIV(SIMD_SUB(SIMD_MUL(s, even), SIMD_MUL(c, odd)), SIMD_ADD(SIMD_MUL(c, even), SIMD_MUL(s, odd)));
+}
+
+// ------- EXPONENTIAL, LOGARITHM ---------
+
+#define LN2_HI 6.93147180369123816490e-01 // the first 32 bits, k*LN2_HI is exact
+#define LN2_LO 1.90821492927058770002e-10
+
+// e^x = 2^k * e^r, |r| <= ln(2)/2
+static inline simd_d kernel_vexp(simd_d x, _Bool fast) {
+    const simd_d k = vm_round(SIMD_MUL(x, SIMD_SET1(1.44269504088896338700e+00))), one = SIMD_SET1(1.0);
+
+    if (fast) {
+        const simd_d r = SIMD_SUB(x, SIMD_MUL(k, SIMD_SET1(M_LN2)));
+
+        // Taylor up to r^7
+        simd_d p = SIMD_SET1(1.0/5040);
+        const double coeffs[] = {1.0/720, 1.0/120, 1.0/24, 1.0/6, 0.5, 1.0, 1.0};
+        for (size_t i = 0; i < sizeof(coeffs)/sizeof(*coeffs); i++)
+            p = SIMD_ADD(SIMD_SET1(coeffs[i]), SIMD_MUL(r, p));
+
+        return SIMD_MUL(p, vm_pow2(k));
+    }
+
+    const simd_d hi = SIMD_SUB(x, SIMD_MUL(k, SIMD_SET1(LN2_HI))), lo = SIMD_MUL(k, SIMD_SET1(LN2_LO));
+    const simd_d r = SIMD_SUB(hi, lo), t = SIMD_MUL(r, r);
+
+    // a rational approximation, e^r = 1 + 2r/(R(r*r) - r)
+    simd_d p = SIMD_ADD(SIMD_SET1(-1.65339022054652515390e-06), SIMD_MUL(t, SIMD_SET1(4.13813679705723846039e-08)));
+    p = SIMD_ADD(SIMD_SET1(6.61375632143793436117e-05), SIMD_MUL(t, p));
+    p = SIMD_ADD(SIMD_SET1(-2.77777777770155933842e-03), SIMD_MUL(t, p));
+    p = SIMD_ADD(SIMD_SET1(1.66666666666666019037e-01), SIMD_MUL(t, p));
+    const simd_d c = SIMD_SUB(r, SIMD_MUL(t, p));
+
+    const simd_d y = SIMD_SUB(one, SIMD_SUB(SIMD_SUB(lo, SIMD_DIV(SIMD_MUL(r, c), SIMD_SUB(SIMD_SET1(2.0), c))), hi));
+    return SIMD_MUL(y, vm_pow2(k));
+}
+
+// log(x) = k*ln(2) + log(m), sqrt(2)/2 <= m < sqrt(2), the exponent of x*sqrt(2) is k
+static inline simd_d kernel_vlog(simd_d x, _Bool fast) {
+    const simd_d k = SIMD_SUB(vm_exponent(SIMD_MUL(x, SIMD_SET1(M_SQRT2))), SIMD_SET1(1023.0));
+    const simd_d f = SIMD_SUB(SIMD_MUL(x, vm_pow2(SIMD_NEG(k))), SIMD_SET1(1.0)); // exact
+    const simd_d s = SIMD_DIV(f, SIMD_ADD(SIMD_SET1(2.0), f)), z = SIMD_MUL(s, s);
+
+    if (fast) {
+        // log(m) = 2*atanh(s), the series up to s^7
+        simd_d p = SIMD_ADD(SIMD_SET1(2.0/5), SIMD_MUL(z, SIMD_SET1(2.0/7)));
+        p = SIMD_ADD(SIMD_SET1(2.0/3), SIMD_MUL(z, p));
+        p = SIMD_ADD(SIMD_SET1(2.0), SIMD_MUL(z, p));
+        return SIMD_ADD(SIMD_MUL(k, SIMD_SET1(M_LN2)), SIMD_MUL(s, p));
+    }
+
+    const simd_d w = SIMD_MUL(z, z);
+    simd_d t1 = SIMD_ADD(SIMD_SET1(2.222219843214978396e-01), SIMD_MUL(w, SIMD_SET1(1.531383769920937332e-01)));
+    t1 = SIMD_MUL(w, SIMD_ADD(SIMD_SET1(3.999999999940941908e-01), SIMD_MUL(w, t1)));
+    simd_d t2 = SIMD_ADD(SIMD_SET1(1.818357216161805012e-01), SIMD_MUL(w, SIMD_SET1(1.479819860511658591e-01)));
+    t2 = SIMD_ADD(SIMD_SET1(2.857142874366239149e-01), SIMD_MUL(w, t2));
+    t2 = SIMD_MUL(z, SIMD_ADD(SIMD_SET1(6.666666666666735130e-01), SIMD_MUL(w, t2)));
+    const simd_d R = SIMD_ADD(t1, t2), hfsq = SIMD_MUL(SIMD_SET1(0.5), SIMD_MUL(f, f));
+
+    // k*LN2_HI + f - hfsq + s*(hfsq+R), the small terms first
+    const simd_d small = SIMD_ADD(SIMD_MUL(s, SIMD_ADD(hfsq, R)), SIMD_MUL(k, SIMD_SET1(LN2_LO)));
+    return SIMD_SUB(SIMD_MUL(k, SIMD_SET1(LN2_HI)), SIMD_SUB(SIMD_SUB(hfsq, small), f));
+}
+
+static inline simd_d kernel_vsqrt(simd_d x, _Bool fast) {
+    (void)fast;
+    return SIMD_SQRT(x); // correctly rounded in hardware
+}
+
+static inline simd_d kernel_vabs(simd_d x, _Bool fast) {
+    (void)fast;
+    return SIMD_AND(x, from_bits(0x7FFFFFFFFFFFFFFFULL)); // clears the sign
+}
+
+// ------- ARRAYS ---------
+
+// Whole vectors go through the kernel, the lanes out of [lo, hi] (NaN included) and the tail to libm
+#define VM_UNARY(name, kernel, lo, hi, libm) \
+void name(const double* in, double* out, size_t n) { \
+    const _Bool fast = settings.fastmath; \
+    size_t i = 0; \
+    for (; i+SIMD_LANES <= n; i += SIMD_LANES) { \
+        double x[SIMD_LANES]; /* in and out can be the same */ \
+        memcpy(x, in+i, sizeof(x)); \
+        SIMD_STORE(out+i, kernel(SIMD_LOAD(x), fast)); \
+        for (size_t j = 0; j < SIMD_LANES; j++) \
+            if (!(x[j] >= lo && x[j] <= hi)) out[i+j] = libm(x[j]); \
+    } \
+    for (; i < n; i++) out[i] = libm(in[i]); \
+}
+
+VM_UNARY(vm_sin, kernel_vsin, -VM_TRIG_MAX, VM_TRIG_MAX, sin)
+VM_UNARY(vm_cos, kernel_vcos, -VM_TRIG_MAX, VM_TRIG_MAX, cos)
+VM_UNARY(vm_tan, kernel_vtan, -VM_TRIG_MAX, VM_TRIG_MAX, tan)
+VM_UNARY(vm_exp, kernel_vexp, -VM_EXP_MAX, VM_EXP_MAX, exp)
+VM_UNARY(vm_log, kernel_vlog, VM_LOG_MIN, VM_LOG_MAX, log)
+VM_UNARY(vm_sqrt, kernel_vsqrt, 0.0, INFINITY, sqrt)
+VM_UNARY(vm_abs, kernel_vabs, -INFINITY, INFINITY, fabs)
+
+// exp(b*log(a)) loses about |b*log(a)| ulps, so only the fast mode takes it
+void vm_pow(double* dst, const double* a, const double* b, size_t n) {
+    size_t i = 0;
+
+    if (settings.fastmath)
+        for (; i+SIMD_LANES <= n; i += SIMD_LANES) {
+            double x[SIMD_LANES], y[SIMD_LANES];
+            memcpy(x, a+i, sizeof(x));
+            memcpy(y, b+i, sizeof(y));
+
+            const simd_d e = SIMD_MUL(SIMD_LOAD(y), kernel_vlog(SIMD_LOAD(x), 1));
+            double ex[SIMD_LANES];
+            SIMD_STORE(ex, e);
+            SIMD_STORE(dst+i, kernel_vexp(e, 1));
+
+            for (size_t j = 0; j < SIMD_LANES; j++)
+                if (!(x[j] >= VM_LOG_MIN && x[j] <= VM_LOG_MAX && ex[j] >= -VM_EXP_MAX && ex[j] <= VM_EXP_MAX))
+                    dst[i+j] = pow(x[j], y[j]);
+        }
+
+    for (; i < n; i++) dst[i] = pow(a[i], b[i]);
+}
+
+// ------- COMPLEX ---------
+// The scalar versions handle every argument (libm), the vector kernels only the ones their
+// checks let through, the rest of the lanes is computed again by the scalar versions
+
+#define VM_SINH_MIN 0.5 // e^b - e^-b cancels below that, sinh goes to libm
+
+static void c_exp(double* re, double* im, double a, double b) {
+    const double e = exp(a);
+    *re = b == 0.0 ? e : e*cos(b);
+    *im = b == 0.0 ? b : e*sin(b);
+}
+
+static void c_sin(double* re, double* im, double a, double b) {
+    *re = sin(a)*cosh(b);
+    *im = cos(a)*sinh(b);
+}
+
+static void c_cos(double* re, double* im, double a, double b) {
+    *re = cos(a)*cosh(b);
+    *im = -sin(a)*sinh(b);
+}
+
+// (sin 2a + i sinh 2b) / (cos 2a + cosh 2b), far from the real axis it is just i*sgn(b)
+static void c_tan(double* re, double* im, double a, double b) {
+    if (b == 0.0) {
+        *re = tan(a);
+        *im = b;
+        return;
+    }
+
+    const double den = cos(2*a) + cosh(2*b);
+    *re = isinf(den) ? 0.0 : sin(2*a)/den;
+    *im = isinf(den) ? copysign(1.0, b) : sinh(2*b)/den;
+}
+
+static void c_log(double* re, double* im, double a, double b) {
+    *re = log(hypot(a, b));
+    *im = atan2(b, a);
+}
+
+static inline void kernel_cexp(simd_d a, simd_d b, simd_d* re, simd_d* im, _Bool fast) {
+    const simd_d e = kernel_vexp(a, fast);
+    *re = SIMD_MUL(e, kernel_vcos(b, fast));
+    *im = SIMD_MUL(e, kernel_vsin(b, fast));
+}
+
+static inline void kernel_cosh_sinh(simd_d b, simd_d* ch, simd_d* sh, _Bool fast) {
+    const simd_d e = kernel_vexp(b, fast), ei = SIMD_DIV(SIMD_SET1(1.0), e), half = SIMD_SET1(0.5);
+    *ch = SIMD_MUL(SIMD_ADD(e, ei), half);
+    *sh = SIMD_MUL(SIMD_SUB(e, ei), half);
+}
+
+static inline void kernel_csin(simd_d a, simd_d b, simd_d* re, simd_d* im, _Bool fast) {
+    simd_d ch, sh;
+    kernel_cosh_sinh(b, &ch, &sh, fast);
+    *re = SIMD_MUL(kernel_vsin(a, fast), ch);
+    *im = SIMD_MUL(kernel_vcos(a, fast), sh);
+}
+
+static inline void kernel_ccos(simd_d a, simd_d b, simd_d* re, simd_d* im, _Bool fast) {
+    simd_d ch, sh;
+    kernel_cosh_sinh(b, &ch, &sh, fast);
+    *re = SIMD_MUL(kernel_vcos(a, fast), ch);
+    *im = SIMD_NEG(SIMD_MUL(kernel_vsin(a, fast), sh));
+}
+
+static inline void kernel_ctan(simd_d a, simd_d b, simd_d* re, simd_d* im, _Bool fast) {
+    const simd_d two = SIMD_SET1(2.0), a2 = SIMD_MUL(a, two);
+    simd_d ch, sh;
+    kernel_cosh_sinh(SIMD_MUL(b, two), &ch, &sh, fast);
+
+    const simd_d den = SIMD_ADD(kernel_vcos(a2, fast), ch);
+    *re = SIMD_DIV(kernel_vsin(a2, fast), den);
+    *im = SIMD_DIV(sh, den);
+}
+
+// the modulus only, the argument needs atan2
+static inline void kernel_clog(simd_d a, simd_d b, simd_d* re, simd_d* im, _Bool fast) {
+    *re = SIMD_MUL(SIMD_SET1(0.5), kernel_vlog(SIMD_ADD(SIMD_MUL(a, a), SIMD_MUL(b, b)), fast));
+    *im = b;
+}
+
+// the real axis goes to libm for sin and cos as well, cosh(0) and sinh(0) are exact there, so it's the same
+#define VALID_CEXP(a, b) (fabs(a) <= VM_EXP_MAX && fabs(b) <= VM_TRIG_MAX)
+#define VALID_CSIN(a, b) (fabs(a) <= VM_TRIG_MAX && ((b) == 0.0 || (fabs(b) >= VM_SINH_MIN && fabs(b) <= VM_EXP_MAX)))
+#define VALID_CTAN(a, b) (fabs(a) <= VM_TRIG_MAX/2 && fabs(b) >= VM_SINH_MIN/2 && fabs(b) <= VM_EXP_MAX/2)
+#define VALID_CLOG(a, b) ((a)*(a)+(b)*(b) >= VM_LOG_MIN && (a)*(a)+(b)*(b) <= VM_LOG_MAX)
+
+#define VM_COMPLEX(name, kernel, valid, scalar) \
+void name(double* re, double* im, size_t n) { \
+    const _Bool fast = settings.fastmath; \
+    size_t i = 0; \
+    for (; i+SIMD_LANES <= n; i += SIMD_LANES) { \
+        double a[SIMD_LANES], b[SIMD_LANES]; \
+        memcpy(a, re+i, sizeof(a)); \
+        memcpy(b, im+i, sizeof(b)); \
+        simd_d r, m; \
+        kernel(SIMD_LOAD(a), SIMD_LOAD(b), &r, &m, fast); \
+        SIMD_STORE(re+i, r); \
+        SIMD_STORE(im+i, m); \
+        for (size_t j = 0; j < SIMD_LANES; j++) \
+            if (!(valid(a[j], b[j]))) scalar(re+i+j, im+i+j, a[j], b[j]); \
+    } \
+    for (; i < n; i++) scalar(re+i, im+i, re[i], im[i]); \
+}
+
+VM_COMPLEX(vm_cexp, kernel_cexp, VALID_CEXP, c_exp)
+VM_COMPLEX(vm_csin, kernel_csin, VALID_CSIN, c_sin)
+VM_COMPLEX(vm_ccos, kernel_ccos, VALID_CSIN, c_cos)
+VM_COMPLEX(vm_ctan, kernel_ctan, VALID_CTAN, c_tan)
+
+void vm_clog(double* re, double* im, size_t n) {
+    const _Bool fast = settings.fastmath;
+    size_t i = 0;
+    for (; i+SIMD_LANES <= n; i += SIMD_LANES) {
+        double a[SIMD_LANES], b[SIMD_LANES];
+        memcpy(a, re+i, sizeof(a));
+        memcpy(b, im+i, sizeof(b));
+        simd_d r, m;
+        kernel_clog(SIMD_LOAD(a), SIMD_LOAD(b), &r, &m, fast);
+        SIMD_STORE(re+i, r);
+
+        for (size_t j = 0; j < SIMD_LANES; j++)
+            if (!VALID_CLOG(a[j], b[j])) c_log(re+i+j, im+i+j, a[j], b[j]);
+            else im[i+j] = atan2(b[j], a[j]);
+    }
+    for (; i < n; i++) c_log(re+i, im+i, re[i], im[i]);
+}
+
+// the principal root, the cut is along the negative real axis like in C99 csqrt
+void vm_csqrt(double* re, double* im, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        const double a = re[i], b = im[i];
+        const double t = sqrt((fabs(a) + hypot(a, b))/2);
+
+        if (t == 0.0) re[i] = im[i] = 0.0;
+        else if (a >= 0.0) { re[i] = t; im[i] = b/(2*t); }
+        else { re[i] = fabs(b)/(2*t); im[i] = copysign(t, b); }
+    }
+}
+
+void vm_cabs(double* re, double* im, size_t n) {
+    size_t i = 0;
+    for (; i+SIMD_LANES <= n; i += SIMD_LANES) {
+        double a[SIMD_LANES], b[SIMD_LANES];
+        memcpy(a, re+i, sizeof(a));
+        memcpy(b, im+i, sizeof(b));
+        const simd_d va = SIMD_LOAD(a), vb = SIMD_LOAD(b);
+        SIMD_STORE(re+i, SIMD_SQRT(SIMD_ADD(SIMD_MUL(va, va), SIMD_MUL(vb, vb))));
+        SIMD_STORE(im+i, SIMD_SET1(0.0));
+
+        // the squares over- or underflow, hypot scales them
+        for (size_t j = 0; j < SIMD_LANES; j++)
+            if (!VALID_CLOG(a[j], b[j])) re[i+j] = hypot(a[j], b[j]);
+    }
+    for (; i < n; i++) {
+        re[i] = hypot(re[i], im[i]);
+        im[i] = 0.0;
+    }
+}
+
+// z/|z|, 0 for 0
+void vm_csgn(double* re, double* im, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        const double r = hypot(re[i], im[i]);
+        if (r == 0.0) continue;
+
+        re[i] /= r;
+        im[i] /= r;
+    }
+}
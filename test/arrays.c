@@ -0,0 +1,101 @@
+// The array objects : their references, and the formulas computed over them element by element
+
+#include "test.h"
+#include "array.h"
+#include "parser.h"
+#include "compiler.h" // formula_free
+#include "objects.h"
+
+#include <math.h>
+
+#define ARRAYS_LENGTH 1000LU // a few blocks of the batch evaluator and a tail
+
+// computes the formula over the arrays, NULL if it failed
+static array_s* computed(const char* str) {
+    formula_s formula = lex(str);
+    array_s* result = NULL;
+    if (ERROR_FAIL(compute_array(&formula, &result))) result = NULL;
+    formula_free(&formula);
+    return result;
+}
+
+static void check_refs() {
+    array_s* xs = array_linspace(0, 1, 5);
+    CHECK(xs != NULL && xs->length == 5 && xs->refs == 1, "linspace(0,1,5) isn't a new array of 5");
+    if (xs == NULL) return;
+
+    for (size_t i = 0; i < 5; i++)
+        CHECK(xs->data[i] == i*0.25, "linspace(0,1,5)[%lu] is %g", i, xs->data[i]);
+
+    // the object takes the reference over
+    CHECK(!ERROR_FAIL(object_add("xs", OT_ARRAY, &xs)), "the array object can't be added");
+    CHECK(xs->refs == 1, "adding the object made %u references", xs->refs);
+
+    // a plain array is shared, not copied
+    array_s* shared = computed("xs");
+    CHECK(shared == xs, "computing a plain array copied it");
+    CHECK(xs->refs == 2, "sharing the array made %u references instead of 2", xs->refs);
+
+    array_s* result = computed("xs*2+1");
+    CHECK(result != NULL && result != xs && result->length == 5 && result->refs == 1, "xs*2+1 isn't a new array of 5");
+    CHECK(xs->refs == 2, "computing over the array left %u references instead of 2", xs->refs);
+    if (result != NULL)
+        for (size_t i = 0; i < 5; i++)
+            CHECK(result->data[i] == xs->data[i]*2+1, "(xs*2+1)[%lu] is %g", i, result->data[i]);
+    array_release(result);
+
+    // the array outlives the object while it's shared
+    CHECK(!ERROR_FAIL(object_remove("xs")), "the array object can't be removed");
+    CHECK(shared->refs == 1, "removing the object left %u references instead of 1", shared->refs);
+    CHECK(shared->data[4] == 1.0, "the shared array changed after the object was removed");
+    array_release(shared);
+}
+
+static void check_elementwise() {
+    array_s* as = array_linspace(-5, 5, ARRAYS_LENGTH);
+    array_s* bs = array_linspace(1, 2, ARRAYS_LENGTH);
+    array_s* cs = array_linspace(0, 1, ARRAYS_LENGTH+1);
+    CHECK(!ERROR_FAIL(object_add("as", OT_ARRAY, &as)) && !ERROR_FAIL(object_add("bs", OT_ARRAY, &bs))
+        && !ERROR_FAIL(object_add("cs", OT_ARRAY, &cs)), "the array objects can't be added");
+
+    array_s* result = computed("sin(as)*bs^2+exp(-as^2)/bs");
+    CHECK(result != NULL && result->length == ARRAYS_LENGTH, "sin(as)*bs^2+exp(-as^2)/bs isn't an array of %lu", ARRAYS_LENGTH);
+    if (result != NULL)
+        for (size_t i = 0; i < ARRAYS_LENGTH; i++) {
+            const double a = as->data[i], b = bs->data[i];
+            const double expected = sin(a)*b*b + exp(-a*a)/b;
+            if (!(fabs(result->data[i]-expected) <= 1e-14*fmax(fabs(expected), 1))) {
+                CHECK(0, "element %lu is %.17g instead of %.17g", i, result->data[i], expected);
+                break;
+            }
+        }
+    array_release(result);
+
+    result = computed("sum(k,1,3,as*k)");
+    CHECK(result != NULL && result->data[0] == -30 && result->data[ARRAYS_LENGTH-1] == 30, "sum(k,1,3,as*k) isn't 6*as");
+    array_release(result);
+
+    CHECK(computed("as+cs") == NULL, "arrays of different lengths were added");
+    CHECK(computed("sin(1)") == NULL, "a formula without arrays gave an array");
+
+    // a single value can't be read out of an array
+    double y;
+    formula_s formula = lex("as+1");
+    CHECK(ERROR_FAIL(compute(&y, &formula, NULL)), "an array formula was computed as a single value");
+    formula_free(&formula);
+
+    CHECK(as->refs == 1 && bs->refs == 1 && cs->refs == 1, "computing left references behind (%u, %u, %u)", as->refs, bs->refs, cs->refs);
+    object_remove("as");
+    object_remove("bs");
+    object_remove("cs");
+}
+
+int main() {
+    objects_init();
+
+    check_refs();
+    check_elementwise();
+
+    objects_destroy();
+    return TEST_RESULT();
+}
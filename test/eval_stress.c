@@ -0,0 +1,120 @@
+// Several threads compiling and computing formulas at once, each in a context of its own,
+// against one object table (make test-tsan runs it under the thread sanitizer)
+
+#include "test.h"
+#include "eval.h"
+#include "parser.h"
+#include "compiler.h" // formula_free
+#include "objects.h"
+#include "array.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#define STRESS_THREADS 8
+#define STRESS_ROUNDS 200
+#define STRESS_SAMPLES 300LU
+
+typedef struct worker {
+    pthread_t thread;
+    unsigned index;
+    const snapshot_s* objects;
+} worker;
+
+// the checks of the workers, CHECK itself isn't meant for several threads
+static atomic_uint failures;
+#define WORKER_CHECK(cond, ...) do { if (!(cond)) { failures++; printf(__VA_ARGS__); printf("\n"); } } while (0)
+
+static double f(double x) { return 2*x*x + sin(x); } // the function object, a = 2
+
+static void* work(void* arg) {
+    worker* w = arg;
+    eval_ctx ctx;
+    eval_init(&ctx, NULL, w->objects);
+    eval_bind(&ctx);
+
+    double xs[STRESS_SAMPLES], ys[STRESS_SAMPLES];
+    for (size_t i = 0; i < STRESS_SAMPLES; i++) xs[i] = i/(double)STRESS_SAMPLES*4-2;
+
+    // a name only this thread binds, the others bind their own index to it
+    WORKER_CHECK(!ERROR_FAIL(frame_bind("t", w->index, NULL)), "thread %u can't bind t", w->index);
+
+    char unknown[NAME_MAXLEN];
+    snprintf(unknown, sizeof(unknown), "unknown%c", 'a'+w->index);
+
+    for (unsigned round = 0; round < STRESS_ROUNDS; round++) {
+        // compiled here, inlining f and reading a and t
+        formula_s formula = lex("f(x)*t+a");
+        WORKER_CHECK(!ERROR_FAIL(compute_batch(&formula, xs, ys, STRESS_SAMPLES)), "thread %u : %s", w->index, ctx.error);
+        for (size_t i = 0; i < STRESS_SAMPLES; i++)
+            if (!(fabs(ys[i] - (f(xs[i])*w->index+2)) <= 1e-12)) {
+                WORKER_CHECK(0, "thread %u computed %g at %g", w->index, ys[i], xs[i]);
+                break;
+            }
+        formula_free(&formula);
+
+        formula = lex("sum(k,1,10,f(k/10)*t)");
+        double y = NAN;
+        WORKER_CHECK(!ERROR_FAIL(compute(&y, &formula, NULL)), "thread %u : %s", w->index, ctx.error);
+        double expected = 0;
+        for (int k = 1; k <= 10; k++) expected += f(k/10.0)*w->index;
+        WORKER_CHECK(fabs(y-expected) <= 1e-12, "thread %u summed %g instead of %g", w->index, y, expected);
+        formula_free(&formula);
+
+        array_s* array = NULL;
+        formula = lex("xs*a+t");
+        WORKER_CHECK(!ERROR_FAIL(compute_array(&formula, &array)), "thread %u : %s", w->index, ctx.error);
+        if (array != NULL)
+            WORKER_CHECK(array->data[0] == w->index && array->data[array->length-1] == 2+w->index,
+                "thread %u computed the array wrong", w->index);
+        array_release(array);
+        formula_free(&formula);
+
+        // the error stays in the context of the thread which threw it
+        char str[NAME_MAXLEN+4];
+        snprintf(str, sizeof(str), "%s+1", unknown);
+        formula = lex(str);
+        WORKER_CHECK(ERROR_FAIL(compute(&y, &formula, NULL)), "thread %u found %s", w->index, unknown);
+        WORKER_CHECK(strstr(ctx.error, unknown) != NULL, "thread %u has the error '%s'", w->index, ctx.error);
+        formula_free(&formula);
+    }
+
+    frame_clear();
+    eval_bind(NULL);
+    eval_destroy(&ctx);
+    return NULL;
+}
+
+int main() {
+    objects_init();
+
+    formula_s body = lex("a*x^2+sin(x)");
+    array_s* xs = array_linspace(0, 1, 1000);
+    CHECK(!ERROR_FAIL(object_add("a", OT_VARIABLE, &(double){2.0})) && !ERROR_FAIL(object_add("f", OT_FUNCTION, &body))
+        && !ERROR_FAIL(object_add("xs", OT_ARRAY, &xs)), "the objects can't be added");
+
+    // the shared function is compiled before the threads start, like the Monte Carlo workers do
+    double y;
+    formula_s formula = lex("f(1)");
+    CHECK(!ERROR_FAIL(compute(&y, &formula, NULL)) && y == f(1), "f(1) is %g", y);
+    formula_free(&formula);
+
+    snapshot_s* snapshot = objects_snapshot();
+    worker workers[STRESS_THREADS];
+    for (unsigned k = 0; k < STRESS_THREADS; k++) {
+        workers[k] = (worker){.index = k, .objects = snapshot};
+        CHECK(pthread_create(&workers[k].thread, NULL, work, &workers[k]) == 0, "thread %u can't be started", k);
+    }
+    for (unsigned k = 0; k < STRESS_THREADS; k++)
+        pthread_join(workers[k].thread, NULL);
+    snapshot_free(snapshot);
+
+    CHECK(failures == 0, "%u checks failed in the threads", (unsigned)failures);
+    CHECK(xs->refs == 1, "the threads left %u references to the array", xs->refs);
+    CHECK(eval_current()->error[0] == '\0', "an error of the threads showed up in the main thread : %s", eval_current()->error);
+
+    objects_destroy();
+    return TEST_RESULT();
+}
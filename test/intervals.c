@@ -0,0 +1,66 @@
+// The interval bounds hold every value compute gives in the range, the ranges and the values cover a grid over [-3, 3]
+
+#include "test.h"
+#include "parser.h"
+#include "compiler.h" // formula_free
+#include "objects.h"
+
+#include <math.h>
+
+#define GRID_STEP (1.0/64) // the integers and the halves are on the grid, negative bases have powers there
+
+static const char* const formulas[] = {
+    "x^x", "x^(x/2)", "(x-1)^(1/3)", "x^-2", "2^x", "(-2)^x", "x^2.5",
+    "x^2-3x+1", "(x-1)^3", "sin(x)*x^3", "exp(x)/(1+x^2)", "1/(x-0.5)", "sqrt(x)", "log(x^2)",
+    "x mod 1.5", "abs(x)-x", "tan(x)", "sum(k,1,5,x^k/k)", "x<1",
+};
+
+static const double widths[] = {0, GRID_STEP, 0.5, 1, 6};
+
+static void check_formula(const char* str) {
+    formula_s formula = lex(str);
+    unsigned failures = 0;
+
+    for (size_t w = 0; w < sizeof(widths)/sizeof(*widths); w++)
+        for (double from = -3; from+widths[w] <= 3; from += widths[w] > 0 ? widths[w]/2 : GRID_STEP) {
+            const interval range = {from, from+widths[w], 0};
+
+            interval bounds;
+            if (ERROR_FAIL(compute_interval(&bounds, &formula, range))) {
+                CHECK(0, "%s can't be bounded over [%g, %g]", str, range.lo, range.hi);
+                continue;
+            }
+
+            for (double x = range.lo; x <= range.hi && failures < 4; x += GRID_STEP) {
+                double y;
+                if (ERROR_FAIL(compute(&y, &formula, &x))) continue;
+
+                if (isfinite(y) && !(y >= bounds.lo && y <= bounds.hi)) {
+                    CHECK(0, "%s is %g at %g, outside of [%g, %g] over [%g, %g]", str, y, x, bounds.lo, bounds.hi, range.lo, range.hi);
+                    failures++;
+                } else if (!isfinite(y) && !bounds.gap) {
+                    CHECK(0, "%s is %g at %g, [%g, %g] over [%g, %g] has no gap", str, y, x, bounds.lo, bounds.hi, range.lo, range.hi);
+                    failures++;
+                }
+            }
+        }
+
+    formula_free(&formula);
+}
+
+int main() {
+    objects_init();
+
+    for (size_t i = 0; i < sizeof(formulas)/sizeof(*formulas); i++)
+        check_formula(formulas[i]);
+
+    // (-3)^-3 is defined, the range isn't undefined everywhere
+    interval bounds;
+    formula_s formula = lex("x^x");
+    CHECK(!ERROR_FAIL(compute_interval(&bounds, &formula, (interval){-4, -1, 0})) && bounds.lo <= bounds.hi,
+        "x^x over [-4, -1] is empty");
+    formula_free(&formula);
+
+    objects_destroy();
+    return TEST_RESULT();
+}
@@ -0,0 +1,102 @@
+// Monte Carlo results are reproducible for a seed : the generator itself, and calc mc run through the console
+
+#include "test.h"
+#include "rng.h"
+#include "console.h"
+#include "objects.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h> // dup, dup2
+
+#define MC_DRAWS 1000
+
+static const char script[] =
+    "set seed 7\n"
+    "calc mc 10^5 randn()+rand()\n"
+    "set seed 7\n"
+    "calc mc 10^5 randn()+rand()\n"
+    "set seed 8\n"
+    "calc mc 10^5 randn()+rand()\n"
+    "exit\n";
+
+// the console reads the script from stdin, everything it prints goes to the returned file
+static FILE* run_console() {
+    FILE* in = tmpfile(), *out = tmpfile();
+    fputs(script, in);
+    rewind(in);
+
+    fflush(stdout);
+    const int saved_in = dup(STDIN_FILENO), saved_out = dup(STDOUT_FILENO);
+    dup2(fileno(in), STDIN_FILENO);
+    dup2(fileno(out), STDOUT_FILENO);
+
+    volatile _Atomic _Bool quit = 0;
+    console_start((void*)&quit);
+    console_cleanup();
+
+    fflush(stdout);
+    dup2(saved_in, STDIN_FILENO);
+    dup2(saved_out, STDOUT_FILENO);
+    close(saved_in);
+    close(saved_out);
+    fclose(in);
+
+    rewind(out);
+    return out;
+}
+
+static void check_generator() {
+    static double first[MC_DRAWS], second[MC_DRAWS], other[MC_DRAWS];
+
+    rng_seed(7, 0);
+    rng_normal(first, MC_DRAWS);
+    rng_seed(7, 0);
+    rng_normal(second, MC_DRAWS);
+    rng_seed(7, 1);
+    rng_normal(other, MC_DRAWS);
+
+    CHECK(memcmp(first, second, sizeof(first)) == 0, "seed 7 gave different normal draws the second time");
+    CHECK(memcmp(first, other, sizeof(first)) != 0, "the streams 0 and 1 of seed 7 gave the same draws");
+
+    rng_seed(7, 0);
+    rng_uniform(first, MC_DRAWS);
+    rng_seed(7, 0);
+    rng_uniform(second, MC_DRAWS);
+    CHECK(memcmp(first, second, sizeof(first)) == 0, "seed 7 gave different uniform draws the second time");
+
+    for (size_t i = 0; i < MC_DRAWS; i++)
+        if (!(first[i] >= 0 && first[i] < 1)) {
+            CHECK(0, "the uniform draw %g is out of [0, 1)", first[i]);
+            break;
+        }
+}
+
+static void check_console() {
+    FILE* out = run_console();
+
+    char results[3][COMMAND_MAXLEN*2];
+    size_t numresults = 0;
+
+    char line[COMMAND_MAXLEN*2];
+    while (fgets(line, sizeof(line), out) != NULL)
+        if (strstr(line, " +- ") != NULL && numresults < 3)
+            strcpy(results[numresults++], line);
+    fclose(out);
+
+    CHECK(numresults == 3, "calc mc printed %lu results instead of 3", numresults);
+    if (numresults != 3) return;
+
+    CHECK(strcmp(results[0], results[1]) == 0, "seed 7 gave %s and then %s", results[0], results[1]);
+    CHECK(strcmp(results[0], results[2]) != 0, "seeds 7 and 8 both gave %s", results[0]);
+}
+
+int main() {
+    objects_init();
+
+    check_generator();
+    check_console();
+
+    objects_destroy();
+    return TEST_RESULT();
+}
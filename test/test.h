@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdio.h>
+
+// The tests are programs of their own linked with everything but main.c (make test),
+// a test prints every check that failed and exits with 1 if there was any
+
+static unsigned test_failures = 0;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        test_failures++; \
+        printf("%s:%d: ", __FILE__, __LINE__); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+    } \
+} while (0)
+
+// the exit code of main
+#define TEST_RESULT() (printf("%s : %s\n", __FILE__, test_failures ? "FAILED" : "passed"), test_failures ? 1 : 0)
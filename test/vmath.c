@@ -0,0 +1,137 @@
+// The maximum error of the vectorized functions against libm over dense grids, in both math modes,
+// exact is measured in ulps and fast as the relative error (see vmath.h)
+
+#include "test.h"
+#include "vmath.h"
+#include "console.h" // settings
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GRID_SIZE ((1 << 20) + 3) // the 3 go through the tail after the last full vector
+
+typedef struct bound {
+    const char* name;
+    void (*vector)(const double* in, double* out, size_t n);
+    double (*libm)(double);
+    double from, to;
+    _Bool geometric; // the points are spaced evenly on a log scale
+
+    double exact_ulps, fast_relative;
+} bound;
+
+static const bound bounds[] = {
+    {"sin",  vm_sin,  sin,  -8*M_PI, 8*M_PI,   0, 2, 4e-8},
+    {"sin",  vm_sin,  sin,  -1e5, 1e5,         0, 2, 4e-8},
+    {"cos",  vm_cos,  cos,  -8*M_PI, 8*M_PI,   0, 2, 4e-8},
+    {"cos",  vm_cos,  cos,  -1e5, 1e5,         0, 2, 4e-8},
+    {"tan",  vm_tan,  tan,  -8*M_PI, 8*M_PI,   0, 4, 4e-8},
+    {"tan",  vm_tan,  tan,  -1e5, 1e5,         0, 4, 4e-8},
+    {"exp",  vm_exp,  exp,  -708, 708,         0, 1, 1e-8},
+    {"exp",  vm_exp,  exp,  -1, 1,             0, 1, 1e-8},
+    {"log",  vm_log,  log,  0.5, 2,            0, 1, 1e-7},
+    {"log",  vm_log,  log,  1e-300, 1e300,     1, 1, 1e-7},
+    {"sqrt", vm_sqrt, sqrt, 0, 1e6,            0, 0, 0},
+    {"sqrt", vm_sqrt, sqrt, 1e-300, 1e300,     1, 0, 0},
+    {"abs",  vm_abs,  fabs, -1e6, 1e6,         0, 0, 0},
+};
+
+// outside the range of every kernel, libm handles them in both modes and the results have to be the same
+static const double specials[] = {1e305, -1e305, INFINITY, -INFINITY, NAN};
+
+static double ulps(double got, double expected) {
+    if (got == expected) return 0;
+    return fabs(got-expected) / (nextafter(fabs(expected), INFINITY) - fabs(expected));
+}
+
+static double relative(double got, double expected) {
+    if (got == expected) return 0;
+    return fabs((got-expected)/expected);
+}
+
+static _Bool same(double a, double b) {
+    return (isnan(a) && isnan(b)) || a == b;
+}
+
+static void check_function(const bound* b, double* xs, double* ys) {
+    for (size_t i = 0; i < GRID_SIZE; i++) {
+        const double t = (double)i/(GRID_SIZE-1);
+        xs[i] = b->geometric ? b->from*pow(b->to/b->from, t) : b->from + (b->to-b->from)*t;
+    }
+
+    for (int fast = 0; fast <= 1; fast++) {
+        settings.fastmath = fast;
+        b->vector(xs, ys, GRID_SIZE);
+
+        double worst = 0, worst_x = 0;
+        for (size_t i = 0; i < GRID_SIZE; i++) {
+            const double expected = b->libm(xs[i]);
+            const double error = fast ? relative(ys[i], expected) : ulps(ys[i], expected);
+            if (!(error <= worst)) worst = error, worst_x = xs[i];
+        }
+
+        const double limit = fast ? b->fast_relative : b->exact_ulps;
+        printf("%-4s [%g, %g] %s : %g%s\n", b->name, b->from, b->to, fast ? "fast" : "exact", worst, fast ? "" : " ulp");
+        CHECK(worst <= limit, "%s(%.17g) is off by %g in %s mode, more than %g", b->name, worst_x, worst, fast ? "fast" : "exact", limit);
+
+        // in place
+        memcpy(ys, xs, GRID_SIZE*sizeof(double));
+        b->vector(ys, ys, GRID_SIZE);
+        for (size_t i = 0; i < GRID_SIZE; i++) {
+            const double expected = b->libm(xs[i]);
+            const double error = fast ? relative(ys[i], expected) : ulps(ys[i], expected);
+            if (!(error <= limit)) {
+                CHECK(0, "%s(%.17g) in place is off by %g in %s mode", b->name, xs[i], error, fast ? "fast" : "exact");
+                break;
+            }
+        }
+
+        double special[sizeof(specials)/sizeof(*specials)];
+        b->vector(specials, special, sizeof(specials)/sizeof(*specials));
+        for (size_t i = 0; i < sizeof(specials)/sizeof(*specials); i++)
+            CHECK(same(special[i], b->libm(specials[i])), "%s(%g) is %g, libm says %g", b->name, specials[i], special[i], b->libm(specials[i]));
+    }
+}
+
+// a^b over a grid of both, libm in exact mode,
+// exp(b*log(a)) in fast mode, where the error of the log grows with |b*log(a)|
+static void check_pow(double* as, double* bs, double* ys) {
+    const size_t side = 1024;
+    for (size_t i = 0; i < side*side; i++) {
+        as[i] = 1e-3*pow(1e5, (double)(i/side)/(side-1)); // 1e-3 to 100
+        bs[i] = -20 + 40*(double)(i%side)/(side-1);
+    }
+
+    for (int fast = 0; fast <= 1; fast++) {
+        settings.fastmath = fast;
+        vm_pow(ys, as, bs, side*side);
+
+        double worst = 0, worst_a = 0, worst_b = 0;
+        for (size_t i = 0; i < side*side; i++) {
+            const double expected = pow(as[i], bs[i]);
+            const double error = fast ? relative(ys[i], expected)/(1 + fabs(bs[i]*log(as[i]))) : ulps(ys[i], expected);
+            if (!(error <= worst)) worst = error, worst_a = as[i], worst_b = bs[i];
+        }
+
+        const double limit = fast ? 1e-7 : 0;
+        printf("pow  [1e-3, 100]^[-20, 20] %s : %g%s\n", fast ? "fast" : "exact", worst, fast ? " per 1+|b*log(a)|" : " ulp");
+        CHECK(worst <= limit, "pow(%.17g, %.17g) is off by %g in %s mode, more than %g", worst_a, worst_b, worst, fast ? "fast" : "exact", limit);
+    }
+}
+
+int main() {
+    double* xs = malloc(GRID_SIZE*sizeof(double));
+    double* ys = malloc(GRID_SIZE*sizeof(double));
+    double* zs = malloc(GRID_SIZE*sizeof(double));
+
+    for (size_t i = 0; i < sizeof(bounds)/sizeof(*bounds); i++)
+        check_function(&bounds[i], xs, ys);
+    check_pow(xs, ys, zs);
+
+    settings.fastmath = 0;
+    free(xs);
+    free(ys);
+    free(zs);
+    return TEST_RESULT();
+}